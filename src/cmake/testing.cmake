@@ -110,6 +110,7 @@ macro ( TESTSUITE )
     set (test_all_optix $ENV{TESTSUITE_OPTIX})
     set (test_all_batched $ENV{TESTSUITE_BATCHED})
     set (test_all_rs_bitcode $ENV{TESTSUITE_RS_BITCODE})
+    set (test_all_fuse_layers $ENV{TESTSUITE_FUSE_LAYERS})
     # Add the tests if all is well.
     set (ALL_TEST_LIST "")
     set (_testsuite "${CMAKE_SOURCE_DIR}/testsuite")
@@ -166,6 +167,18 @@ macro ( TESTSUITE )
             add_one_testsuite ("${_testname}.opt.rs_bitcode" "${_testsrcdir}"
                                ENV TESTSHADE_OPT=2 TESTSHADE_RS_BITCODE=1)
         endif ()
+        # Run the same test again, optimized, with all of the group's layers
+        # fused into one function (llvm_fuse_layers), if there is a
+        # FUSELAYERS marker file in the directory. If an environment variable
+        # $TESTSUITE_FUSE_LAYERS is nonzero, then run all tests that way.
+        if ((EXISTS "${_testsrcdir}/FUSELAYERS" OR test_all_fuse_layers)
+            AND NOT _testname MATCHES "optix"
+            AND NOT EXISTS "${_testsrcdir}/NOSCALAR"
+            AND NOT EXISTS "${_testsrcdir}/BATCHED_REGRESSION"
+            AND NOT EXISTS "${_testsrcdir}/NOOPTIMIZE")
+            add_one_testsuite ("${_testname}.fuselayers" "${_testsrcdir}"
+                               ENV TESTSHADE_OPT=2 TESTSHADE_FUSE_LAYERS=1 )
+        endif ()
         # When building for OptiX support, also run it in OptiX mode
         # if there is an OPTIX marker file in the directory.
         # If an environment variable $TESTSUITE_OPTIX is nonzero, then
@@ -211,6 +224,15 @@ macro ( TESTSUITE )
                 AND NOT EXISTS "${_testsrcdir}/NOOPTIMIZE")
                 add_one_testsuite ("${_testname}.batched.opt" "${_testsrcdir}"
                                    ENV TESTSHADE_OPT=2 TESTSHADE_BATCHED=1 )
+                # When the 4-wide target is built alongside wider ones, the
+                # widest is always picked, so also force batches of 4.
+                list (LENGTH BATCHED_TARGET_LIST _num_batched_targets)
+                if ("b4_SSE4_2" IN_LIST BATCHED_TARGET_LIST
+                    AND _num_batched_targets GREATER 1)
+                    add_one_testsuite ("${_testname}.batched4.opt" "${_testsrcdir}"
+                                       ENV TESTSHADE_OPT=2 TESTSHADE_BATCHED=1
+                                           TESTSHADE_BATCH_SIZE=4 )
+                endif ()
             endif ()
 
             # When building for Batched support, optionally run a regression test
@@ -296,11 +318,11 @@ macro (osl_add_all_tests)
                 ieee_fp ieee_fp-reg if if-reg incdec initlist
                 initops initops-instance-clash
                 intbits isconnected
-                isconstant
+                isconstant jit-cache
                 layers layers-Ciassign layers-entry layers-lazy layers-lazyerror
                 layers-nonlazycopy layers-repeatedoutputs
                 lazytrace
-                length-reg linearstep
+                length-reg linearstep load-shaders
                 logic loop luminance-reg
                 matrix matrix-reg matrix-arithmetic-reg
                 matrix-compref-reg max-reg message message-no-closure message-reg
@@ -319,7 +341,7 @@ macro (osl_add_all_tests)
                 normalize-reg
                 pnoise pnoise-cell pnoise-gabor
                 pnoise-generic pnoise-perlin
-                pnoise-reg
+                pnoise-reg pointcloud-native
                 operator-overloading
                 opt-warnings
                 oslc-comma oslc-D oslc-M
@@ -347,9 +369,11 @@ macro (osl_add_all_tests)
                 pragma-nowarn
                 printf-reg
                 printf-whole-array
+                profile-layers
                 raytype raytype-reg raytype-specialized regex-reg
                 reparam reparam-arrays testoptix-reparam
-                render-background render-bumptest
+                render-background render-binary-oso render-bumptest
+                render-bumptest-deferred
                 render-cornell render-furnace-diffuse
                 render-mx-furnace-burley-diffuse
                 render-mx-furnace-oren-nayar
@@ -360,15 +384,15 @@ macro (osl_add_all_tests)
                 render-mx-generalized-schlick render-mx-generalized-schlick-glass
                 render-mx-layer
                 render-mx-sheen
-                render-microfacet render-oren-nayar
-                render-uv render-veachmis render-ward
+                render-mesh render-microfacet render-oren-nayar
+                render-uv render-veachmis render-veachmis-lights render-ward
                 render-raytypes
                 select select-reg shaderglobals shortcircuit
                 smoothstep-reg
                 spline spline-reg splineinverse splineinverse-ident
                 splineinverse-knots-ascend-reg splineinverse-knots-descend-reg
                 spline-boundarybug spline-derivbug
-                split-reg
+                split-reg stats-json
                 string string-reg
                 struct struct-array struct-array-mixture
                 struct-err struct-init-copy
@@ -421,7 +445,8 @@ macro (osl_add_all_tests)
         TESTSUITE ( texture3d texture3d-opts-reg )
     endif()
 
-    # Only run pointcloud tests if Partio is found
+    # Only run the pointcloud tests that read or write Partio formats if
+    # Partio is found (pointcloud-native, above, needs no Partio)
     if (partio_FOUND)
         TESTSUITE ( pointcloud pointcloud-fold )
     endif ()
@@ -6,6 +6,9 @@
 
 #include <OSL/oslconfig.h>
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -76,26 +79,53 @@ enum class TargetISA {
 /// tied to OSL internals at all.
 class OSLEXECPUBLIC LLVM_Util {
 public:
+    class ContextPool;
+
+    /// The LLVM state (context and parsed function libraries) used by one
+    /// thread at a time. If given a ContextPool, the state is borrowed
+    /// from the pool and given back to it when the PerThreadInfo is
+    /// destroyed, rather than being made anew and thrown away.
     struct OSLEXECPUBLIC PerThreadInfo {
         PerThreadInfo() {}
+        explicit PerThreadInfo(ContextPool* pool) : m_pool(pool) {}
         ~PerThreadInfo();
 
     private:
         friend class LLVM_Util;
+        friend class ContextPool;
         struct Impl;
         mutable Impl* m_thread_info = nullptr;
+        ContextPool* m_pool         = nullptr;
         Impl* get() const;
     };
 
+    /// A set of per-thread LLVM states for PerThreadInfo to borrow. Each
+    /// function library is then parsed once per LLVM context the pool ever
+    /// needed, not once per PerThreadInfo. The pool must outlive every
+    /// PerThreadInfo made with it.
+    class OSLEXECPUBLIC ContextPool {
+    public:
+        ContextPool() {}
+        ContextPool(const ContextPool&) = delete;
+        ContextPool& operator=(const ContextPool&) = delete;
+        ~ContextPool();
+
+    private:
+        friend struct PerThreadInfo;
+        PerThreadInfo::Impl* acquire();
+        void release(PerThreadInfo::Impl* impl);
+        std::mutex m_mutex;
+        std::vector<PerThreadInfo::Impl*> m_free;
+    };
+
     LLVM_Util(const PerThreadInfo& per_thread_info, int debuglevel = 0,
               int vector_width = 4);
     ~LLVM_Util();
 
-    // JIT'd code needs to exist with a longer lifetime than the LLVM_Util object.
-    // To enable better cleanup at shutdown, the lifetime of all JIT'd code is
-    // controlled by the the existence of ScopedJitMemoryUser objects.
-    // When the last ScopedJitMemoryUser goes out of scope or is deleted,
-    // then the underlying memory managers will be deleted
+    // JIT'd code needs to exist with a longer lifetime than the LLVM_Util
+    // object, so its memory is held by reference (see jit_memory()).
+    // ScopedJitMemoryUser no longer controls the lifetime of any code, and
+    // is only kept for compatibility.
     struct OSLEXECPUBLIC ScopedJitMemoryUser {
         ScopedJitMemoryUser();
         ~ScopedJitMemoryUser();
@@ -147,6 +177,23 @@ public:
                                       const std::string& name = std::string(),
                                       std::string* err        = NULL);
 
+    /// Create a new module that declares (but doesn't define) everything
+    /// in the library of functions in bitcode[0..size-1]. The library is
+    /// parsed only once per LLVM context, so the bitcode must stay the
+    /// same for as long as the PerThreadInfo (or its ContextPool) lives.
+    /// Call link_library_functions() once the module's own code is
+    /// generated.
+    llvm::Module* module_from_library(const char* bitcode, size_t size,
+                                      const std::string& name = std::string(),
+                                      std::string* err        = NULL);
+
+    /// Add to the current module, made by module_from_library(), the
+    /// definitions of the library functions and variables it uses,
+    /// directly or not. Only those are ever materialized from the
+    /// bitcode, once per LLVM context. Return false on failure, with the
+    /// message in err if it is not NULL.
+    bool link_library_functions(std::string* err = NULL);
+
     bool debug_is_enabled() const;
     void debug_setup_compilation_unit(const char* compile_unit_name);
     void debug_push_function(const std::string& function_name,
@@ -269,6 +316,27 @@ public:
     /// current one).
     void execengine(llvm::ExecutionEngine* exec);
 
+    /// Keep a copy of the object file that the JIT produces for the
+    /// current module, for jit_object() to return. The object can then be
+    /// saved, and loaded with add_jit_object() by a later LLVM_Util (in
+    /// this process or another) instead of compiling the IR again.
+    void capture_jit_object(bool capture);
+
+    /// The object file captured from the last module compiled by the JIT
+    /// (empty if capture_jit_object() was not on).
+    const std::string& jit_object() const;
+
+    /// Load an object file that was returned by jit_object() into the
+    /// current ExecutionEngine, in place of compiling a module. Its
+    /// functions are then retrieved by name with getPointerToFunction().
+    /// Return false, and set *err, if the object is not valid.
+    bool add_jit_object(string_view object, std::string* err = nullptr);
+
+    /// Resolve references from JITed code to the external symbol `name`
+    /// to the address `addr`. This only affects the engines of this
+    /// LLVM_Util.
+    void add_jit_symbol(string_view name, void* addr);
+
     /// Return a pointer to the TargetMachine for NVPTX.  Create the TargetMachine
     /// if it has not yet been created.
     llvm::TargetMachine* nvptx_target_machine();
@@ -297,7 +365,10 @@ public:
 
     /// Setup LLVM optimization passes.
     /// if targetHost is true, passes to target the host will be added
-    void setup_optimization_passes(int optlevel, bool target_host = true);
+    /// if batched is true, the module holds batched code at the vector
+    /// width, and passes to lower its bit masks for the host are added
+    void setup_optimization_passes(int optlevel, bool target_host = true,
+                                   bool batched = false);
 
     /// Run the optimization passes.
     void do_optimize(std::string* err = NULL);
@@ -307,6 +378,10 @@ public:
     /// you have already called do_optimize() if you want optimization.
     void* getPointerToFunction(llvm::Function* func);
 
+    /// Retrieve a callable pointer to a JITed function by its name, or
+    /// NULL if there is no such function.
+    void* getPointerToFunction(const std::string& name);
+
     /// Wrap ExecutionEngine::InstallLazyFunctionCreator.
     void InstallLazyFunctionCreator(void* (*P)(const std::string&));
 
@@ -715,6 +790,12 @@ public:
     /// If the type specified is NULL, it will make a 'void *'.
     llvm::Value* constant_ptr(void* p, llvm::PointerType* type = NULL);
 
+    /// Return a pointer to the external symbol `name`, whose address is
+    /// set by add_jit_symbol(). Unlike constant_ptr(), the generated code
+    /// does not contain the address itself, so it can be used by another
+    /// process. If the type specified is NULL, it will make a 'void *'.
+    llvm::Value* symbol_ptr(string_view name, llvm::PointerType* type = NULL);
+
     /// Return an llvm::Value holding the given string constant (as
     /// determined by the ustring_rep).
     llvm::Value* constant(ustring s);
@@ -891,6 +972,10 @@ public:
     void op_branch(llvm::Value* cond, llvm::BasicBlock* trueblock,
                    llvm::BasicBlock* falseblock);
 
+    /// Read the CPU's cycle counter (like rdtsc on x86), as a 64 bit int.
+    /// It's 0 on targets that don't have one.
+    llvm::Value* op_read_cycle_counter();
+
     /// Generate code for a memset.
     void op_memset(llvm::Value* ptr, int val, int len, int align = 1);
 
@@ -1047,10 +1132,17 @@ public:
 
     std::string func_name(llvm::Function* f);
 
+    /// Reference to the memory holding the code JITed by this LLVM_Util.
+    /// The code stays valid, even after the LLVM_Util is destroyed, until
+    /// the last copy of the reference is gone, and then it is freed.
+    std::shared_ptr<void> jit_memory() const { return m_llvm_jitmm; }
+
+    /// Bytes of memory currently mapped for JITed code.
     static size_t total_jit_memory_held();
 
 private:
     class MemoryManager;
+    class ObjectCache;
     class IRBuilder;
     struct NewPassManager;
 
@@ -1065,13 +1157,16 @@ private:
     PerThreadInfo::Impl* m_thread;
     llvm::LLVMContext* m_llvm_context;
     llvm::Module* m_llvm_module;
+    llvm::Module* m_library = nullptr;  // Library m_llvm_module declares
     IRBuilder* m_builder;
-    llvm::SectionMemoryManager* m_llvm_jitmm;
+    std::shared_ptr<llvm::SectionMemoryManager> m_llvm_jitmm;
     llvm::Function* m_current_function;
     llvm::legacy::PassManager* m_llvm_module_passes;
     llvm::legacy::FunctionPassManager* m_llvm_func_passes;
     NewPassManager* m_new_pass_manager;
     llvm::ExecutionEngine* m_llvm_exec;
+    ObjectCache* m_object_cache = nullptr;
+    std::unordered_map<std::string, void*> m_jit_symbols;
     TargetISA m_target_isa = TargetISA::UNKNOWN;
     llvm::TargetMachine* m_nvptx_target_machine;
 
@@ -1229,6 +1324,7 @@ private:
 
     llvm::Value* op_linearize_16x_indices(llvm::Value* wide_index);
     llvm::Value* op_linearize_8x_indices(llvm::Value* wide_index);
+    llvm::Value* op_linearize_4x_indices(llvm::Value* wide_index);
     std::array<llvm::Value*, 2> op_split_16x(llvm::Value* vector_val);
     std::array<llvm::Value*, 2> op_split_8x(llvm::Value* vector_val);
     std::array<llvm::Value*, 4> op_quarter_16x(llvm::Value* vector_val);
@@ -1237,8 +1333,10 @@ private:
     llvm::Value* op_combine_4x_vectors(llvm::Value* half_vec_1,
                                        llvm::Value* half_vec_2);
 
-    void setup_legacy_optimization_passes(int optlevel, bool target_host);
-    void setup_new_optimization_passes(int optlevel, bool target_host);
+    void setup_legacy_optimization_passes(int optlevel, bool target_host,
+                                          bool batched);
+    void setup_new_optimization_passes(int optlevel, bool target_host,
+                                       bool batched);
 };
 
 
@@ -9,6 +9,7 @@
 #include <OSL/oslconfig.h>
 #include <OSL/shaderglobals.h>
 
+#include <OpenImageIO/paramlist.h>
 #include <OpenImageIO/refcnt.h>
 
 
@@ -196,6 +197,13 @@ public:
     ///                              output atomically, to prevent threads
     ///                              from interleaving lines. (1)
     ///    int profile            Perform some rudimentary profiling (0)
+    ///    int profile_layers     JIT groups so that they count the cycles
+    ///                              spent in each layer and in expensive
+    ///                              ops (texture, noise, getattribute,
+    ///                              trace, pointcloud, spline), reported
+    ///                              by getstats and "profile_report".
+    ///                              Not done for OptiX or batched
+    ///                              execution. (0)
     ///    int no_noise           Replace noise with constant value. (0)
     ///    int no_pointcloud      Skip pointcloud lookups. (0)
     ///    int exec_repeat        How many times to run each group (1).
@@ -236,6 +244,14 @@ public:
     ///                              isconnected()? (0)
     ///    int greedyjit          Optimize and compile all shaders up front,
     ///                              versus only as needed (0).
+    ///    int async_jit          Optimize and compile a group on the OIIO
+    ///                              thread pool when it is first executed,
+    ///                              rather than on the executing thread.
+    ///                              Until it's ready, execute() runs the
+    ///                              code of the group's "async_fallback"
+    ///                              group instead (once that is compiled,
+    ///                              also in the background), or returns
+    ///                              false having run nothing. (0)
     ///    int llvm_target_host   Target the specific host architecture for
     ///                              LLVM IR generation. (1)
     ///    int llvm_jit_fma       Allow fused mul/add (0). This can increase
@@ -248,6 +264,26 @@ public:
     ///                              "AVX512_noFMA", or "host" means to
     ///                              figure out what the host can do. ("")
     ///    int llvm_jit_aggressive  Use LLVM "aggressive" JIT mode. (0)
+    ///    int llvm_fuse_layers   On the CPU, JIT groups without explicit
+    ///                              entry layers as one function with every
+    ///                              layer inlined, and drop the layer run
+    ///                              flag checks that can't matter. This
+    ///                              trims call overhead in deep networks at
+    ///                              the cost of longer JIT. Running the
+    ///                              last layer then runs init as well, and
+    ///                              the init step does nothing. (0)
+    ///    string llvm_jit_cache_dir  If nonempty, the directory of an
+    ///                              on-disk cache of JITed machine code,
+    ///                              shareable between runs and processes.
+    ///                              A group whose code is found there skips
+    ///                              runtime optimization and all LLVM
+    ///                              work. The cache assumes the renderer
+    ///                              answers the same queries (such as
+    ///                              constant getattribute) the same way.
+    ///                              It is not used for groups with
+    ///                              interactive parameters, or with
+    ///                              batched execution, debugging or
+    ///                              profiling events enabled. ("")
     ///    int vector_width       Vector width to allow for SIMD ops (4).
     ///    int llvm_debugging_symbols  When JITing, generate debug symbols
     ///                             that associate machine code with shader
@@ -282,7 +318,9 @@ public:
     ///         opt_peephole, opt_coalesce_temps, opt_assign, opt_mix
     ///         opt_merge_instances, opt_merge_instance_with_userdata,
     ///         opt_fold_getattribute, opt_middleman, opt_texture_handle
-    ///         opt_seed_bblock_aliases, opt_groupdata
+    ///         opt_seed_bblock_aliases, opt_groupdata, opt_merge_groups
+    ///         (the last shares the optimized layers and compiled code of
+    ///         groups that are identical to one already optimized)
     ///    int opt_passes         Number of optimization passes per layer (10)
     ///    int llvm_optimize      Which of several LLVM optimize strategies (1)
     ///    int llvm_debug         Set LLVM extra debug level (0)
@@ -344,6 +382,18 @@ public:
     ///                                 be elided, but nor will they be
     ///                                 called unconditionally.
     ///    int exec_repeat            How many times to run the group (1).
+    ///    ptr async_fallback         The ShaderGroup* to execute in place
+    ///                                 of this group while it is being
+    ///                                 compiled in the background (only
+    ///                                 with "async_jit"). It should be
+    ///                                 cheap to compile, and must produce
+    ///                                 the same outputs. Only its code is
+    ///                                 run: the context still refers to
+    ///                                 this group, execute_layer() only
+    ///                                 runs its last layer, and its symbols
+    ///                                 can't be retrieved until it's
+    ///                                 compiled. Set it before the group is
+    ///                                 first executed.
     ///
     bool attribute(ShaderGroup* group, string_view name, TypeDesc type,
                    const void* val);
@@ -394,6 +444,16 @@ public:
     ///   library build dependencies and their versions (for example,
     ///   "OIIO-2.3.0,LLVM-10.0.0,OpenEXR-2.5.0").
     ///
+    /// - `int stat:layers_executed`, `float stat:shading_time`,
+    ///   `int64 stat:llvm_jit_memory` : The number of layers executed (if
+    ///   counted with `countlayerexecs`), the total shading time of all
+    ///   threads (if timed with `profile`), and the memory held by JITed
+    ///   code. See getstats() for the other `stat:` attributes.
+    ///
+    /// - `string profile_report` : A JSON report of the cycles counted in
+    ///   each layer and op class of every live group that was JITed with
+    ///   the `profile_layers` attribute set.
+    ///
     bool getattribute(string_view name, TypeDesc type, void* val);
 
     /// Shortcut getattribute() for retrieving a single integer.
@@ -510,6 +570,14 @@ public:
     ///   string pickle              Retrieves a serialized representation
     ///                                 of the shader group declaration.
     ///   int llvm_groupdata_size    Size of the GroupData struct.
+    ///   int jitted                 Nonzero if the group is compiled and
+    ///                                 ready for execute().
+    ///   int batch_jitted           Nonzero if the group is compiled and
+    ///                                 ready for batched execute().
+    ///   string profile_report      JSON report of the cycles counted in
+    ///                                 each layer and op class of the group
+    ///                                 (if JITed with profile_layers).
+    ///   ptr async_fallback         The group's fallback (see attribute()).
     ///   ptr interactive_params     Pointer to the memory block containing
     ///                                 host-side interactive parameter values
     ///                                 for this shader group.
@@ -559,9 +627,21 @@ public:
 
 
     /// Load compiled shader (oso) from a memory buffer, overriding
-    /// shader lookups in the shader search path
+    /// shader lookups in the shader search path. The buffer may hold
+    /// either a text or a binary (oslc -binary) oso.
     bool LoadMemoryCompiledShader(string_view shadername, string_view buffer);
 
+    /// Find and parse the named shaders (.oso) ahead of time, in parallel
+    /// on the OIIO thread pool, so that declaring groups later doesn't
+    /// stop to read them. Shaders that are already loaded are not read
+    /// again. Return the number of shaders that are loaded and usable.
+    ///
+    /// Shaders are loaded on first use anyway, and threads asking for
+    /// different shaders read them in parallel, while threads asking for
+    /// one that is being read wait for it, so this is only an aid to
+    /// spread the reading over more threads.
+    int load_shaders(cspan<ustring> names);
+
     // The basic sequence for declaring a shader group looks like this:
     // ShadingSystem *ss = ...;
     // ShaderGroupRef group = ss->ShaderGroupBegin (groupname);
@@ -820,7 +900,10 @@ public:
     /// execute any part of the shader, so do all the usual binding
     /// preparation, but don't actually run the shader.  Return true if the
     /// shader executed, false if it did not (including if the shader itself
-    /// was empty).
+    /// was empty). When llvm_fuse_layers applies to the group, its
+    /// initialization is done by executing its last layer instead, so
+    /// execute_init followed by execute_layer of the last layer still runs
+    /// the group once, whatever 'run' was.
     bool execute_init(ShadingContext& ctx, ShaderGroup& group, int threadindex,
                       int shadeindex, ShaderGlobals& globals,
                       void* userdata_base_ptr, void* output_base_ptr,
@@ -931,6 +1014,8 @@ public:
     /// batched execution at the specified width.  If no specific
     /// target was requested, sets llvm_jit_target and llvm_jit_fma
     /// to the supported configuration for the requested width.
+    /// Width 4 runs on SSE4.2 (the "b4_SSE4_2" USE_BATCHED target), for
+    /// machines without AVX or workloads that can't keep more lanes busy.
     /// Returns true if supported, false otherwise
     bool configure_batch_execution_at(int width);
 
@@ -993,6 +1078,38 @@ public:
     ///
     std::string getstats(int level = 1) const;
 
+    /// Fill `stats` with a snapshot of the statistics as typed name/value
+    /// pairs, named like the `stat:` attributes that getattribute()
+    /// retrieves (e.g., "stat:optimization_time"). If `groups` is true,
+    /// it also gets these stats of each live shader group, with ID `N`:
+    ///
+    ///   string group:N:name          The group's name.
+    ///   int group:N:layers           Number of layers.
+    ///   int group:N:optimized        Nonzero once optimized.
+    ///   int group:N:jitted           Nonzero once JITed.
+    ///   int group:N:shared_code      Nonzero if it reuses the compiled
+    ///                                   code of an identical group.
+    ///   int64 group:N:executions     Times executed.
+    ///   float group:N:optimization_time  Runtime optimization time.
+    ///   float group:N:llvm_irgen_time    LLVM IR generation time.
+    ///   float group:N:llvm_opt_time      LLVM optimization time.
+    ///   float group:N:llvm_jit_time      LLVM JIT time.
+    ///   int group:N:preopt_ops, group:N:postopt_ops
+    ///                                Instructions before and after
+    ///                                   runtime optimization.
+    ///   int group:N:preopt_syms, group:N:postopt_syms
+    ///                                Symbols before and after runtime
+    ///                                   optimization.
+    ///   int64 group:N:groupdata_size Size of the GroupData struct.
+    ///
+    /// Times are in seconds. Entries of `stats` are replaced.
+    void getstats(OIIO::ParamValueList& stats, bool groups = true) const;
+
+    /// Return the snapshot of getstats(stats, groups) as a JSON object,
+    /// with the `stat:` values (without the prefix) in "stats", and one
+    /// object per group in the "groups" array.
+    std::string getstats_json(bool groups = true) const;
+
     void register_closure(string_view name, int id, const ClosureParam* params,
                           PrepareClosureFunc prepare, SetupClosureFunc setup);
 
@@ -1057,6 +1174,11 @@ public:
     /// If option "greedyjit" was set, this call will trigger all
     /// shader groups that have not yet been compiled to do so with the
     /// specified number of threads (0 means use all available HW cores).
+    /// The most expensive groups are started first, and the work is spread
+    /// over the calling thread and tasks on the OIIO thread pool. If a pass
+    /// is already in progress on another thread, this call (and any thread
+    /// waiting to compile a group that the pass is working on) helps with
+    /// it instead.
     void optimize_all_groups(int nthreads = 0, bool do_jit = true);
 
     /// Return a pointer to the TextureSystem being used.
@@ -1153,6 +1275,12 @@ enum ShadeImageLocations {
 /// themselves will either be at "pixel centers" (position (i+0.5)/res), or
 /// as if it were a grid that is shaded at exact endpoints (position
 /// i/(res+1)). In either case, derivatives will be set appropriately.
+///
+/// If the renderer provides BatchedRendererServices, the ShadingSystem was
+/// set up for batched execution ("opt_batched_analysis"), the buffer holds
+/// its pixels in memory, and configure_batch_execution_at() succeeds for a
+/// width of 16, 8 or 4, pixels are shaded a whole batch at a time using the
+/// batched executor. Otherwise each pixel is shaded on its own.
 OSLEXECPUBLIC
 bool
 shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
@@ -0,0 +1,94 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <OSL/oslexec.h>
+
+OSL_NAMESPACE_ENTER
+
+/// Queue of shading points for shading them sorted by shader group.
+///
+/// A renderer that shades points as its rays happen to hit them keeps
+/// switching between the code of different groups, which thrashes the
+/// instruction cache. Instead, it may push() every point it needs shaded,
+/// along with its group, and then execute() the queue: the points are
+/// shaded one group at a time (and one ray type at a time), in the order
+/// their groups were first pushed and, within a group, in the order they
+/// were pushed.
+///
+/// When the queue is made with a batch width of 16, 8 or 4, and the
+/// renderer has BatchedRendererServices of that width, each group's points
+/// are shaded in batches with the batched executor (the caller must already
+/// have called ShadingSystem::configure_batch_execution_at for that width).
+/// The uniform renderstate of each batch is then an array of the
+/// `ShaderGlobals*` of its lanes, so that the renderer's batched services
+/// can get at the renderstate of every lane (the uniform tracedata and
+/// objdata are null). Otherwise, points are shaded one at a time.
+///
+/// Closures only live until the next execution on the context, so the
+/// callback given to execute() is called for each point as soon as it has
+/// been shaded, with its ShaderGlobals (Ci and any other globals the group
+/// wrote, such as N or P, included). For reading the group's outputs with
+/// ShadingSystem::symbol_address, it is also given the lane of the batch
+/// the point was shaded in, or -1 if it was shaded on its own.
+///
+/// A queue is meant to be used by one thread at a time, and may be reused
+/// after clear() without giving back its memory.
+class OSLEXECPUBLIC ShadingQueue {
+public:
+    typedef std::function<void(size_t index, ShaderGlobals& sg, int lane)>
+        Callback;
+
+    explicit ShadingQueue(ShadingSystem& shadingsys, int batch_width = 0);
+
+    /// Width of the batches the points are shaded in, or 0 if they are
+    /// shaded one at a time.
+    int batch_width() const { return m_batch_width; }
+
+    /// Queue a point to be shaded with `group`, and return its index.
+    size_t push(ShaderGroup* group, const ShaderGlobals& sg);
+
+    size_t size() const { return m_points.size(); }
+    bool empty() const { return m_points.empty(); }
+
+    /// The ShaderGlobals of the point with this index. References are only
+    /// valid until the next push.
+    ShaderGlobals& globals(size_t index) { return m_points[index].sg; }
+
+    /// Shade all the queued points with the context, calling
+    /// done(index, sg, lane) after each one is shaded. The queue is left
+    /// as it is; call clear() to empty it.
+    void execute(ShadingContext& ctx, const Callback& done);
+
+    /// Remove all the points.
+    void clear()
+    {
+        m_points.clear();
+        m_group_rank.clear();
+    }
+
+private:
+    struct Point {
+        ShaderGroup* group;
+        int rank;  ///< Order in which the group was first pushed
+        ShaderGlobals sg;
+    };
+
+    void sort();
+    template<int WidthT>
+    void execute_batched(ShadingContext& ctx, const Callback& done);
+
+    ShadingSystem& m_shadingsys;
+    int m_batch_width;
+    std::vector<Point> m_points;
+    std::vector<size_t> m_order;  ///< Indices of the points, sorted
+    std::unordered_map<ShaderGroup*, int> m_group_rank;
+};
+
+OSL_NAMESPACE_EXIT
@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 
+#include "../liboslexec/osobinary.h"
 #include "oslcomp_pvt.h"
 
 #include <OpenImageIO/filesystem.h>
@@ -289,6 +290,8 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
         } else if (options[i] == "-embed-source"
                    || options[i] == "--embed-source") {
             m_embed_source = true;
+        } else if (options[i] == "-binary" || options[i] == "--binary") {
+            m_binary_oso = true;
         } else if (options[i] == "-MD"
                    || options[i] == "--write-dependencies") {
             // write depfile w/ user and system headers
@@ -475,19 +478,34 @@ OSLCompilerImpl::compile(string_view filename,
                 m_output_filename = default_output_filename();
 
             OIIO::ofstream oso_output;
-            OIIO::Filesystem::open(oso_output, m_output_filename);
+            OIIO::Filesystem::open(oso_output, m_output_filename,
+                                   m_binary_oso ? std::ios_base::out
+                                                      | std::ios_base::binary
+                                                : std::ios_base::out);
             if (!oso_output.good()) {
                 errorfmt(ustring(), 0, "Could not open \"{}\"",
                          m_output_filename);
                 return false;
             }
+            // A binary oso is made from the text, so write that to memory
+            std::ostringstream oso_text;
+            oso_text.imbue(std::locale::classic());  // force C locale
             OSL_DASSERT(m_osofile == nullptr);
-            m_osofile = &oso_output;
+            if (m_binary_oso)
+                m_osofile = &oso_text;
+            else
+                m_osofile = &oso_output;
 
             write_oso_file(OIIO::Strutil::join(options, " "),
                            preprocess_result);
             OSL_DASSERT(m_osofile == nullptr);
 
+            if (m_binary_oso) {
+                std::string oso = oso_text.str();
+                if (!binary_oso(oso))
+                    return false;
+                oso_output.write(oso.data(), oso.size());
+            }
             oso_output.close();
             if (!oso_output.good()) {
                 errorfmt(ustring(), 0, "Failed to write to \"{}\"",
@@ -572,6 +590,8 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
                            preprocess_result);
             osobuffer = oso_output.str();
             OSL_DASSERT(m_osofile == nullptr);
+            if (m_binary_oso && !binary_oso(osobuffer))
+                return false;
         }
     }
 
@@ -580,6 +600,22 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
 
 
 
+bool
+OSLCompilerImpl::binary_oso(std::string& oso)
+{
+    // Read the oso text back, recording what it holds in binary
+    OSOBinaryWriter writer(m_errhandler);
+    if (!writer.parse_memory(oso)) {
+        errorfmt(ustring(), 0, "Could not make a binary oso for \"{}\"",
+                 m_output_filename);
+        return false;
+    }
+    oso = writer.data();
+    return true;
+}
+
+
+
 void
 OSLCompilerImpl::write_dependency_file(string_view filename)
 {
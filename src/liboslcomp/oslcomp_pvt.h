@@ -389,6 +389,7 @@ private:
     void write_oso_symbol(const Symbol* sym);
     void write_oso_metadata(const ASTNode* metanode) const;
     void write_dependency_file(string_view filename);
+    bool binary_oso(std::string& oso);
 
     // Output text to the osofile, using std::format formatting conventions.
     template<typename... Args>
@@ -473,6 +474,7 @@ private:
     bool m_generate_deps = false;  ///< Generate dependencies? -MD or -MMD?
     bool m_generate_system_deps = false;  ///< Generate system header deps? -MD
     bool m_embed_source         = false;  ///< Embed preprocessed source in oso?
+    bool m_binary_oso           = false;  ///< Write a binary oso?
     bool m_err_on_warning;                ///< Treat warnings as errors?
     int m_optimizelevel;                  ///< Optimization level
     OpcodeVec m_ircode;                   ///< Generated IR code
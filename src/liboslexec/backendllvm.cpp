@@ -21,6 +21,7 @@ BackendLLVM::BackendLLVM(ShadingSystemImpl& shadingsys, ShaderGroup& group,
                          ShadingContext* ctx)
     : OSOProcessorBase(shadingsys, group, ctx)
     , ll(ctx->llvm_thread_info(), llvm_debug(), shadingsys.m_vector_width)
+    , m_run_flags_clear_ptr(nullptr)
     , m_stat_total_llvm_time(0)
     , m_stat_llvm_setup_time(0)
     , m_stat_llvm_irgen_time(0)
@@ -30,6 +31,8 @@ BackendLLVM::BackendLLVM(ShadingSystemImpl& shadingsys, ShaderGroup& group,
     m_use_optix      = shadingsys.use_optix();
     m_use_rs_bitcode = !shadingsys.m_rs_bitcode.empty();
     m_name_llvm_syms = shadingsys.m_llvm_output_bitcode;
+    m_profile_layers = shadingsys.m_profile_layers && !m_use_optix;
+    m_jit_cache      = !group.m_llvm_jit_cache_key.empty() && !m_use_optix;
 
     // Select the appropriate ustring representation
     ll.ustring_rep(LLVM_Util::UstringRep::hash);
@@ -70,6 +73,26 @@ BackendLLVM::set_inst(int layer)
 
 
 
+llvm::Value*
+BackendLLVM::llvm_process_ptr(void* p, string_view kind, ustring name,
+                              llvm::PointerType* type)
+{
+    if (!m_jit_cache || !p)
+        return ll.constant_ptr(p, type);
+    std::string symbol;
+    for (auto&& ptr : m_jit_cache_ptrs)
+        if (ptr.kind == kind && ptr.name == name)
+            symbol = ptr.symbol;
+    if (symbol.empty()) {
+        symbol = fmtformat("osl_process_ptr_{}", m_jit_cache_ptrs.size());
+        m_jit_cache_ptrs.push_back({ symbol, kind, name });
+        ll.add_jit_symbol(symbol, p);
+    }
+    return ll.symbol_ptr(symbol, type);
+}
+
+
+
 llvm::Type*
 BackendLLVM::llvm_pass_type(const TypeSpec& typespec)
 {
@@ -41,6 +41,13 @@ public:
     /// and store the llvm::Function* handle to it with the ShaderGroup.
     virtual void run();
 
+    /// In place of runtime optimization and run(), set up the group from
+    /// its entry in the on-disk JIT cache (see llvm_jit_cache_dir): the
+    /// JITed code and everything the optimizer and run() would have
+    /// recorded in the group. Return false, leaving the group untouched,
+    /// if there is no usable entry.
+    bool load_from_jit_cache();
+
     /// Set additional Module/Function options for the CUDA/OptiX target.
     void prepare_module_for_cuda_jit();
 
@@ -66,6 +73,13 @@ public:
     std::vector<llvm::Function*> build_llvm_optix_callables();
     llvm::Function* build_llvm_fused_callable();
 
+    /// After all the layers have been generated, take out the checks and
+    /// stores of the layer run flags that can't make a difference: the
+    /// check at the only call site of a layer, when that site is reached
+    /// at most once, and the stores to flags that are never checked.
+    /// Only valid for groups without explicit entry layers.
+    void remove_redundant_run_flags();
+
     /// Build up LLVM IR code for the given range [begin,end) or
     /// opcodes, putting them (initially) into basic block bb (or the
     /// current basic block if bb==NULL).
@@ -142,9 +156,21 @@ public:
 
     llvm::Value* llvm_const_hash(ustring str)
     {
+        // A cached group only has the hashes of its strings, so the strings
+        // must be recorded to exist when it is loaded.
+        if (m_jit_cache)
+            m_jit_cache_strings.insert(str);
         return ll.constant64((uint64_t)str.hash());
     }
 
+    /// Return a pointer constant for the address p, which is only valid in
+    /// this process: the renderer, a texture handle, or a closure
+    /// callback. When the group is saved to the JIT cache, the code refers
+    /// to it through a symbol instead, which is resolved again from `kind`
+    /// and `name` when the group is loaded (see load_from_jit_cache).
+    llvm::Value* llvm_process_ptr(void* p, string_view kind, ustring name,
+                                  llvm::PointerType* type = nullptr);
+
     /// Legacy version
     ///
     llvm::Value* loadLLVMValue(const Symbol& sym, int component = 0,
@@ -379,10 +405,18 @@ public:
     /// Generate an error message at shader execution time.
     void llvm_gen_error(string_view message);
 
+    /// With profile_layers, generate code to start timing the given
+    /// GroupProfile op class of the current layer, or to stop timing the
+    /// innermost one.
+    void llvm_profile_enter(int opclass);
+    void llvm_profile_exit();
+
     /// Generate code to call the given layer.  If 'unconditional' is
     /// true, call it without even testing if the layer has already been
-    /// called.
-    void llvm_call_layer(int layer, bool unconditional = false);
+    /// called. If 'once' is true, the call site is reached at most once
+    /// per execution of the current layer.
+    void llvm_call_layer(int layer, bool unconditional = false,
+                         bool once = false);
 
     /// Execute the upstream connection (if any, and if not yet run) that
     /// establishes the value of symbol sym, which has index 'symindex'
@@ -533,6 +567,15 @@ private:
     std::set<int> m_layers_already_run;  ///< List of layers run
     int m_num_used_layers;               ///< Number of layers actually used
 
+    // Run flag checks, kept for remove_redundant_run_flags()
+    struct RunFlagCheck {
+        llvm::Instruction* load;  ///< Load of the run flag of the layer
+        bool once;                ///< Site reached at most once per layer run
+    };
+    std::vector<std::vector<RunFlagCheck>> m_run_flag_checks;  ///< Per layer
+    std::vector<llvm::Value*> m_run_flag_refs;  ///< Flag ref in each layer
+    llvm::Value* m_run_flags_clear_ptr;  ///< Run flags pointer in init
+
     double m_stat_total_llvm_time;  ///<   total time spent on LLVM
     double m_stat_llvm_setup_time;  ///<     llvm setup time
     double m_stat_llvm_irgen_time;  ///<     llvm IR generation time
@@ -556,6 +599,7 @@ private:
     llvm::PointerType* m_llvm_type_setup_closure_func;
     int m_llvm_local_mem;   // Amount of memory we use for locals
     bool m_name_llvm_syms;  // Whether to name LLVM symbols
+    bool m_profile_layers;  // Whether to time layers and expensive ops
 
     // A mapping from symbol names to llvm::GlobalVariables
     std::map<std::string, llvm::GlobalVariable*> m_const_map;
@@ -566,6 +610,20 @@ private:
     bool m_use_optix;  ///< Compile for OptiX?
     bool m_use_rs_bitcode;  /// To use free function versions of Renderer Service functions.
 
+    // On-disk JIT cache (see load_from_jit_cache)
+    std::string jit_cache_path();
+    void save_to_jit_cache(const std::string& init_name,
+                           const std::vector<std::string>& layer_names);
+
+    struct JitCachePtr {
+        std::string symbol;  ///< Symbol the code uses for the pointer
+        std::string kind;    ///< "renderer", "texture", "prepare", "setup"
+        ustring name;        ///< Texture or closure name
+    };
+    bool m_jit_cache = false;  ///< Will the group be saved in the JIT cache?
+    std::vector<JitCachePtr> m_jit_cache_ptrs;
+    std::set<ustring> m_jit_cache_strings;
+
     friend class ShadingSystemImpl;
 };
 
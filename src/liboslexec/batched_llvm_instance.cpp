@@ -537,6 +537,33 @@ const char*
     = "b8_AVX_";
 #endif
 
+#ifdef __OSL_SUPPORTS_b4_SSE4_2
+template<>
+const NameAndSignature
+    ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>::library_functions[]
+    = {
+#    define DECL_INDIRECT(name, signature) \
+        NameAndSignature { #name, signature },
+#    define DECL(name, signature) DECL_INDIRECT(name, signature)
+#    define __OSL_WIDTH           4
+#    define __OSL_TARGET_ISA      SSE4_2
+// Don't allow order of xmacro includes be rearranged
+// clang-format off
+#    include "wide/define_opname_macros.h"
+#    include "builtindecl_wide_xmacro.h"
+#    include "wide/undef_opname_macros.h"
+// clang-format on
+#    undef __OSL_TARGET_ISA
+#    undef __OSL_WIDTH
+#    undef DECL
+#    undef DECL_INDIRECT
+      };
+template<>
+const char*
+    ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>::library_selector_string
+    = "b4_SSE4_2_";
+#endif
+
 
 
 std::unique_ptr<BatchedBackendLLVM::TargetLibraryHelper>
@@ -588,6 +615,16 @@ BatchedBackendLLVM::TargetLibraryHelper::build(ShadingContext* context,
         case TargetISA::AVX:
             return RetType(
                 new ConcreteTargetLibraryHelper<8, TargetISA::AVX>());
+#endif
+        default: break;
+        }
+        break;
+    case 4:
+        switch (target_isa) {
+#ifdef __OSL_SUPPORTS_b4_SSE4_2
+        case TargetISA::SSE4_2:
+            return RetType(
+                new ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>());
 #endif
         default: break;
         }
@@ -610,6 +647,11 @@ helper_function_lookup(const std::string& name)
                            << std::endl);
     HelperFuncMap::const_iterator i = llvm_helper_function_map.find(
         name.c_str());
+#ifdef __APPLE__
+    // The JIT asks for the mangled name, which has a global prefix
+    if (i == llvm_helper_function_map.end() && name.size() && name[0] == '_')
+        i = llvm_helper_function_map.find(name.c_str() + 1);
+#endif
     if (i == llvm_helper_function_map.end()) {
         // built-in functions like memset wouldn't be in this lookup
         //std::cout << "DIDN'T FIND helper_function_lookup (" << name << ")" << std::endl;
@@ -735,6 +777,9 @@ BatchedBackendLLVM::llvm_type_batched_texture_options()
     {
         std::vector<unsigned int> offset_by_index;
         switch (m_width) {
+        case 4:
+            build_offsets_of_BatchedTextureOptions<4>(offset_by_index);
+            break;
         case 8:
             build_offsets_of_BatchedTextureOptions<8>(offset_by_index);
             break;
@@ -2380,7 +2425,7 @@ BatchedBackendLLVM::initialize_llvm_group()
     }
 
     ll.setup_optimization_passes(shadingsys().llvm_optimize(),
-                                 true /*targetHost*/);
+                                 true /*targetHost*/, true /*batched*/);
 
     // Clear the shaderglobals and groupdata types -- they will be
     // created on demand.
@@ -2440,15 +2485,13 @@ BatchedBackendLLVM::initialize_llvm_group()
             }
             types += advance;
         }
-        llvm::Function* f = nullptr;
+        // The address is found by helper_function_lookup at JIT time
         if (ret_is_uniform) {
-            f = ll.make_function(funcname, false, llvm_type(rettype), params,
-                                 varargs);
+            ll.make_function(funcname, false, llvm_type(rettype), params,
+                             varargs);
         } else {
-            f = ll.make_function(funcname, false, ll.type_void(), params,
-                                 varargs);
+            ll.make_function(funcname, false, ll.type_void(), params, varargs);
         }
-        ll.add_function_mapping(f, (void*)i->second.function);
     }
 
     // Needed for closure setup
@@ -2698,6 +2741,9 @@ BatchedBackendLLVM::run()
     {
         std::vector<unsigned int> offset_by_index;
         switch (m_width) {
+        case 4:
+            build_offsets_of_BatchedShaderGlobals<4>(offset_by_index);
+            break;
         case 8:
             build_offsets_of_BatchedShaderGlobals<8>(offset_by_index);
             break;
@@ -2707,7 +2753,7 @@ BatchedBackendLLVM::run()
         default:
             OSL_ASSERT(
                 0
-                && "Unsupported width of batch.  Only widths 8 and 16 are allowed");
+                && "Unsupported width of batch.  Only widths 4, 8, and 16 are allowed");
             break;
         };
         ll.validate_struct_data_layout(m_llvm_type_sg, offset_by_index);
@@ -2836,6 +2882,8 @@ BatchedBackendLLVM::run()
     else
         group().llvm_compiled_wide_version(
             group().llvm_compiled_wide_layer(nlayers - 1));
+    // The group keeps the code alive after ll is gone
+    group().m_llvm_jit_memory.push_back(ll.jit_memory());
 
     // We are destroying the entire module below, no reason to bother
     // destroying individual functions
@@ -142,6 +142,8 @@ DECL(osl_gen_warningfmt, "xXhiXiX")
 DECL(osl_formatfmt, "hXhiXiX")
 DECL(osl_split, "ihXhii")
 DECL(osl_incr_layers_executed, "xX")
+DECL(osl_profile_enter, "xXiL")
+DECL(osl_profile_exit, "xXL")
 
 // For legacy printf support
 DECL(osl_printf, "xXh*")
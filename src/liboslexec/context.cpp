@@ -80,22 +80,52 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
         execute_cleanup();
     batch_size_executed = 0;
     m_group             = &sgroup;
+    m_code_group        = nullptr;
     m_ticks             = 0;
 
     // Optimize if we haven't already
+    ShaderGroup* code = &sgroup;  // the group whose code we run
     if (sgroup.nlayers()) {
         sgroup.start_running();
         if (!sgroup.jitted()) {
-            auto ctx = shadingsys().get_context(thread_info());
-            shadingsys().optimize_group(sgroup, ctx, true /*do_jit*/);
-            if (shadingsys().m_greedyjit
-                && shadingsys().m_groups_to_compile_count) {
-                // If we are greedily JITing, optimize/JIT everything now
-                shadingsys().optimize_all_groups();
+            auto compile = [](ShaderGroup& group, ShadingContext* ctx) {
+                ShadingSystemImpl& ss(ctx->shadingsys());
+                ss.optimize_group(group, ctx, true /*do_jit*/);
+                if (ss.m_greedyjit && ss.m_groups_to_compile_count) {
+                    // If we are greedily JITing, optimize/JIT everything now
+                    ss.optimize_all_groups();
+                }
+            };
+            if (shadingsys().m_async_jit) {
+                // Don't stall on the JIT: do it in the background, and
+                // until it's done run the fallback group's code in this
+                // one's place (still as this group, so that symbol and
+                // layer lookups don't refer to the wrong one), or report
+                // that nothing ran. The fallback is compiled in the
+                // background, too.
+                shadingsys().compile_group_async(sgroup,
+                                                 ShaderGroup::AsyncScalar,
+                                                 compile);
+                if (!sgroup.jitted()) {
+                    ShaderGroup* fallback = sgroup.m_async_fallback.get();
+                    if (!fallback || !fallback->nlayers())
+                        return false;
+                    if (!fallback->jitted()) {
+                        shadingsys().compile_group_async(
+                            *fallback, ShaderGroup::AsyncScalar, compile);
+                        if (!fallback->jitted())
+                            return false;
+                    }
+                    code         = fallback;
+                    m_code_group = fallback;
+                }
+            } else {
+                auto ctx = shadingsys().get_context(thread_info());
+                compile(sgroup, ctx);
+                shadingsys().release_context(ctx);
             }
-            shadingsys().release_context(ctx);
         }
-        if (sgroup.does_nothing())
+        if (code->does_nothing())
             return false;
     } else {
         // empty shader - nothing to do!
@@ -107,7 +137,7 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
                               : OIIO::Timer::DontStartNow);
 
     // Allocate enough space on the heap
-    size_t heap_size_needed = sgroup.llvm_groupdata_size();
+    size_t heap_size_needed = code->llvm_groupdata_size();
     reserve_heap(heap_size_needed);
     // Zero out the heap memory we will be using
     if (shadingsys().m_clearmemory)
@@ -125,8 +155,17 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
     // Zero out stats for this execution
     clear_runtime_stats();
 
+    // Make room for the counters of a group JITed with profile_layers
+    if (code->m_profile) {
+        size_t nslots = code->m_profile->cycles.size();
+        if (m_prof_cycles.size() < nslots) {
+            m_prof_cycles.resize(nslots, 0);
+            m_prof_calls.resize(nslots, 0);
+        }
+    }
+
     if (run) {
-        RunLLVMGroupFunc run_func = sgroup.llvm_compiled_init();
+        RunLLVMGroupFunc run_func = code->llvm_compiled_init();
         if (!run_func)
             return false;
         ssg.context             = this;
@@ -137,7 +176,7 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
         ssg.shade_index         = shadeindex;
         //TODO: Possible remove shadeindex from run_func
         run_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr,
-                 shadeindex, sgroup.interactive_arena_ptr());
+                 shadeindex, code->interactive_arena_ptr());
     }
 
     if (profile)
@@ -152,20 +191,28 @@ ShadingContext::execute_layer(int threadindex, int shadeindex,
                               ShaderGlobals& ssg, void* userdata_base_ptr,
                               void* output_base_ptr, int layernumber)
 {
-    if (!group() || group()->nlayers() == 0 || group()->does_nothing())
+    ShaderGroup* code = code_group();
+    if (!code || code->nlayers() == 0 || code->does_nothing())
         return false;
     OSL_DASSERT(ssg.context == this && ssg.renderer == renderer());
+    if (code != group()) {
+        // The fallback's layers aren't the group's: only the group's last
+        // layer, which runs the whole group, has an equivalent.
+        if (layernumber != group()->nlayers() - 1)
+            return false;
+        layernumber = code->nlayers() - 1;
+    }
 
     int profile = shadingsys().m_profile;
     OIIO::Timer timer(profile ? OIIO::Timer::StartNow
                               : OIIO::Timer::DontStartNow);
 
-    RunLLVMGroupFunc run_func = group()->llvm_compiled_layer(layernumber);
+    RunLLVMGroupFunc run_func = code->llvm_compiled_layer(layernumber);
     if (!run_func)
         return false;
 
     run_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr, shadeindex,
-             group()->interactive_arena_ptr());
+             code->interactive_arena_ptr());
 
     if (profile)
         m_ticks += timer.ticks();
@@ -194,12 +241,32 @@ ShadingContext::execute_cleanup()
         shadingsys().m_stat_total_shading_time_ticks += m_ticks;
         group()->m_stat_total_shading_time_ticks += m_ticks;
     }
+    if (m_prof_touched.size())
+        record_profile();
 
     return true;
 }
 
 
 
+void
+ShadingContext::record_profile()
+{
+    GroupProfile* prof = code_group()->m_profile.get();
+    for (int slot : m_prof_touched) {
+        if (prof) {
+            prof->cycles[slot] += m_prof_cycles[slot];
+            prof->calls[slot] += m_prof_calls[slot];
+        }
+        m_prof_cycles[slot] = 0;
+        m_prof_calls[slot]  = 0;
+    }
+    m_prof_touched.clear();
+    m_prof_stack.clear();
+}
+
+
+
 bool
 ShadingContext::execute(ShaderGroup& sgroup, int threadindex, int shadeindex,
                         ShaderGlobals& ssg, void* userdata_base_ptr,
@@ -254,25 +321,49 @@ ShadingContext::Batched<WidthT>::execute_init(
 
     context().batch_size_executed = batch_size;
     context().m_group             = &sgroup;
+    context().m_code_group        = nullptr;
     context().m_ticks             = 0;
 
     // Optimize if we haven't already
+    ShaderGroup* code = &sgroup;  // the group whose code we run
     if (sgroup.nlayers()) {
         sgroup.start_running();
         if (!sgroup.batch_jitted()) {
-            // Matching ShadingContext::execute_init behavior
-            // of grabbing another context.
-            // TODO:  Is this necessary, why can't we just use the
-            // the existing context()?
-            //shadingsys().template batched<WidthT>().jit_group(sgroup, &context());
-            auto ctx = shadingsys().get_context(context().thread_info());
-            shadingsys().template batched<WidthT>().jit_group(sgroup, ctx);
-            if (shadingsys().m_greedyjit
-                && shadingsys().m_groups_to_compile_count) {
-                // If we are greedily JITing, optimize/JIT everything now
-                shadingsys().template batched<WidthT>().jit_all_groups();
+            auto compile = [](ShaderGroup& group, ShadingContext* ctx) {
+                ShadingSystemImpl& ss(ctx->shadingsys());
+                ss.template batched<WidthT>().jit_group(group, ctx);
+                if (ss.m_greedyjit && ss.m_groups_to_compile_count) {
+                    // If we are greedily JITing, optimize/JIT everything now
+                    ss.template batched<WidthT>().jit_all_groups();
+                }
+            };
+            if (shadingsys().m_async_jit) {
+                // See ShadingContext::execute_init
+                shadingsys().compile_group_async(sgroup,
+                                                 ShaderGroup::AsyncBatched,
+                                                 compile);
+                if (!sgroup.batch_jitted()) {
+                    ShaderGroup* fallback = sgroup.m_async_fallback.get();
+                    if (!fallback || !fallback->nlayers())
+                        return false;
+                    if (!fallback->batch_jitted()) {
+                        shadingsys().compile_group_async(
+                            *fallback, ShaderGroup::AsyncBatched, compile);
+                        if (!fallback->batch_jitted())
+                            return false;
+                    }
+                    code                   = fallback;
+                    context().m_code_group = fallback;
+                }
+            } else {
+                // Matching ShadingContext::execute_init behavior
+                // of grabbing another context.
+                // TODO:  Is this necessary, why can't we just use the
+                // the existing context()?
+                auto ctx = shadingsys().get_context(context().thread_info());
+                compile(sgroup, ctx);
+                shadingsys().release_context(ctx);
             }
-            shadingsys().release_context(ctx);
         }
         // To handle layers that were not used but still possibly had
         // render outputs, we always generate a run function even for
@@ -293,7 +384,7 @@ ShadingContext::Batched<WidthT>::execute_init(
                               : OIIO::Timer::DontStartNow);
 
     // Allocate enough space on the heap
-    size_t heap_size_needed = sgroup.llvm_groupdata_wide_size();
+    size_t heap_size_needed = code->llvm_groupdata_wide_size();
     context().reserve_heap(heap_size_needed);
     // Zero out the heap memory we will be using
     if (shadingsys().m_clearmemory)
@@ -316,9 +407,9 @@ ShadingContext::Batched<WidthT>::execute_init(
         bsg.uniform.context  = &context();
         bsg.uniform.renderer = context().renderer();
         assign_all(bsg.varying.Ci, (ClosureColor*)nullptr);
-        RunLLVMGroupFuncWide run_func = sgroup.llvm_compiled_wide_init();
+        RunLLVMGroupFuncWide run_func = code->llvm_compiled_wide_init();
         OSL_DASSERT(run_func);
-        OSL_DASSERT(sgroup.llvm_groupdata_wide_size() <= context().m_heapsize);
+        OSL_DASSERT(code->llvm_groupdata_wide_size() <= context().m_heapsize);
 
         if (batch_size > 0) {
             Mask<WidthT> run_mask(false);
@@ -326,7 +417,7 @@ ShadingContext::Batched<WidthT>::execute_init(
 
             run_func(&bsg, context().m_heap.get(), &wide_shadeindex.data(),
                      userdata_base_ptr, output_base_ptr, run_mask.value(),
-                     sgroup.interactive_arena_ptr());
+                     code->interactive_arena_ptr());
         }
     }
 
@@ -342,17 +433,24 @@ ShadingContext::Batched<WidthT>::execute_layer(
     BatchedShaderGlobals<WidthT>& bsg, void* userdata_base_ptr,
     void* output_base_ptr, int layernumber)
 {
-    if (!group() || group()->nlayers() == 0 || group()->does_nothing()
+    ShaderGroup* code = code_group();
+    if (!code || code->nlayers() == 0 || code->does_nothing()
         || (context().batch_size_executed != batch_size))
         return false;
     OSL_DASSERT(bsg.uniform.context == &context()
                 && bsg.uniform.renderer == context().renderer());
+    if (code != group()) {
+        // See ShadingContext::execute_layer
+        if (layernumber != group()->nlayers() - 1)
+            return false;
+        layernumber = code->nlayers() - 1;
+    }
 
     int profile = shadingsys().m_profile;
     OIIO::Timer timer(profile ? OIIO::Timer::StartNow
                               : OIIO::Timer::DontStartNow);
 
-    RunLLVMGroupFuncWide run_func = group()->llvm_compiled_wide_layer(
+    RunLLVMGroupFuncWide run_func = code->llvm_compiled_wide_layer(
         layernumber);
     if (!run_func)
         return false;
@@ -366,7 +464,7 @@ ShadingContext::Batched<WidthT>::execute_layer(
 
         run_func(&bsg, context().m_heap.get(), &wide_shadeindex.data(),
                  userdata_base_ptr, output_base_ptr, run_mask.value(),
-                 group()->interactive_arena_ptr());
+                 code->interactive_arena_ptr());
     }
 
     if (profile)
@@ -670,10 +768,29 @@ osl_incr_layers_executed(ShaderGlobals* sg)
     ctx->incr_layers_executed();
 }
 
+
+
+OSL_SHADEOP void
+osl_profile_enter(ShaderGlobals* sg, int slot, long long cycles)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    ctx->profile_enter(slot, cycles);
+}
+
+
+
+OSL_SHADEOP void
+osl_profile_exit(ShaderGlobals* sg, long long cycles)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    ctx->profile_exit(cycles);
+}
+
 #if OSL_USE_BATCHED
 // Explicit template instantiation for supported batch sizes
 template class ShadingContext::Batched<16>;
 template class ShadingContext::Batched<8>;
+template class ShadingContext::Batched<4>;
 #endif
 
 
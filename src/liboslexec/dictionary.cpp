@@ -5,11 +5,13 @@
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include <OpenImageIO/strutil.h>
+#include <OpenImageIO/thread.h>
 
 #include <pugixml.hpp>
 
@@ -26,7 +28,7 @@ OSL_NAMESPACE_ENTER
 namespace pvt {  // OSL::pvt
 
 
-// Helper class to manage the dictionaries.
+// Dictionaries are cached at two levels.
 //
 // Shaders are written as if they parse arbitrary things from whole
 // cloth on every call: from potentially loading XML from disk, parsing
@@ -35,37 +37,30 @@ namespace pvt {  // OSL::pvt
 // But that is expensive, so we really cache all this stuff at several
 // levels.
 //
-// We have parsed xml (as pugi::xml_document *'s) cached in a hash table,
-// looked up by the xml and/or dictionary name.  Either will do, if it
-// looks like a filename, it will read the XML from the file, otherwise it
-// will interpret it as xml directly.
-//
-// Also, individual queries are cached in a hash table.  The key is a
-// tuple of (nodeID, query_string, type_requested), so that asking for a
+// The SharedDictionary, one per ShadingSystem, holds the parsed xml (as
+// pugi::xml_document's), looked up by the xml and/or dictionary name.
+// Either will do, if it looks like a filename, it will read the XML from
+// the file, otherwise it will interpret it as xml directly. Each document
+// is parsed only once no matter how many threads use it. It also holds
+// the nodes found by queries, whose indices are the node IDs shaders see,
+// and caches the results of individual queries. The key is a tuple of
+// (nodeID, query_string, type_requested), so that asking for a
 // particular query to return a string is a totally different cache
 // entry than asking for it to be converted to a matrix, say.
 //
-class Dictionary {
+// Nodes are only ever appended, and their IDs never change, so reading
+// them takes no lock. The query cache is split into shards with their own
+// reader/writer lock so threads rarely contend for it.
+//
+// Each ShadingContext then has a Dictionary, which keeps its own cache of
+// the queries that context has made, so that repeated queries take no
+// lock at all.
+//
+class SharedDictionary {
 public:
-    Dictionary(ShadingContext* ctx) : m_context(ctx)
-    {
-        // Create placeholder element 0 == 'not found'
-        m_nodes.emplace_back(0, pugi::xml_node());
-    }
-    ~Dictionary()
-    {
-        // Free all the documents.
-        for (auto& doc : m_documents)
-            delete doc;
-    }
+    SharedDictionary();
+    ~SharedDictionary();
 
-    int dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query);
-    int dict_find(ExecContextPtr ec, int nodeID, ustring query);
-    int dict_next(int nodeID);
-    int dict_value(int nodeID, ustring attribname, TypeDesc type, void* data,
-                   bool treat_ustrings_as_hash);
-
-private:
     // We cache individual queries with a key that is a tuple of the
     // (nodeID, query_string, type_requested).
     struct Query {
@@ -93,6 +88,321 @@ private:
         }
     };
 
+    // Nodes we've looked up.  The matches of one query are consecutive,
+    // and 'next' is the index of the one after this (or 0 for the last).
+    struct Node {
+        int document = -1;    // which document the node belongs to
+        pugi::xml_node node;  // which node within the dictionary
+        int next = 0;         // next node for the same query
+    };
+
+    // The decoded (and type converted) value of an attribute query.
+    struct Value {
+        bool found = false;
+        std::vector<float> floatdata;
+        std::vector<int> intdata;
+        ustring stringdata;
+    };
+
+    // Return the index of the named document, reading and parsing it if
+    // this is the first time it's asked for, or -1 if it could not be
+    // parsed. Only the call that parsed a bad document sets `err`.
+    int document(ustring dictionaryname, std::string& err);
+
+    // Return the ID of the first node matching `query`, starting the search
+    // at node `nodeID` of the given document (or its root if nodeID is 0),
+    // or 0 if nothing matched. Set `err` if the query is malformed.
+    int find(int document, int nodeID, ustring query, std::string& err);
+
+    // Return the node with the given ID, or nullptr if it's not valid.
+    const Node* node(int nodeID) const
+    {
+        if (nodeID <= 0 || nodeID >= m_nnodes.load(std::memory_order_acquire))
+            return nullptr;
+        return &m_node_chunks[nodeID >> ChunkBits].load(
+            std::memory_order_relaxed)[nodeID & (ChunkSize - 1)];
+    }
+
+    // Look up the named attribute of a node (or its value if attribname is
+    // empty) converted to the given type.
+    void value(int nodeID, ustring attribname, TypeDesc type, Value& result);
+
+private:
+    enum { ChunkBits = 10, ChunkSize = 1 << ChunkBits, MaxChunks = 1 << 16 };
+    enum { NumShards = 16 };
+
+    // The cached query result is the ID of the first matching node for a
+    // node query, or the decoded value for an attribute query.
+    struct QueryResult {
+        int node = 0;
+        Value value;
+    };
+    typedef std::unordered_map<Query, QueryResult, QueryHash> QueryMap;
+
+    struct Shard {
+        OIIO::spin_rw_mutex mutex;
+        QueryMap cache;
+    };
+
+    // Append the matches of a query as new consecutive nodes, and return
+    // the ID of the first one (or 0 if there's no room left).
+    int append_nodes(int document, const pugi::xpath_node_set& matches);
+
+    static void decode(const pugi::xml_node& node, ustring attribname,
+                       TypeDesc type, Value& result);
+
+    Shard& shard(const Query& q)
+    {
+        return m_shards[QueryHash()(q) % NumShards];
+    }
+
+    // List of XML documents we've read in, and the map from xml strings
+    // and/or filenames to indices in m_documents.
+    std::vector<std::unique_ptr<pugi::xml_document>> m_documents;
+    std::unordered_map<ustring, int> m_document_map;
+    OIIO::spin_rw_mutex m_documents_mutex;
+    mutex m_load_mutex;  // Serializes reading and parsing documents
+
+    // All the nodes found by queries, in fixed size chunks so that they
+    // never move once they've been handed out.
+    std::unique_ptr<std::atomic<Node*>[]> m_node_chunks;
+    std::atomic<int> m_nnodes;
+    mutex m_nodes_mutex;  // Serializes appending nodes
+
+    Shard m_shards[NumShards];  // Cache of fully resolved queries
+};
+
+
+
+SharedDictionary::SharedDictionary()
+    : m_node_chunks(new std::atomic<Node*>[MaxChunks])
+{
+    for (int i = 0; i < MaxChunks; ++i)
+        m_node_chunks[i].store(nullptr, std::memory_order_relaxed);
+    // Create placeholder element 0 == 'not found'
+    m_node_chunks[0].store(new Node[ChunkSize], std::memory_order_relaxed);
+    m_nnodes.store(1, std::memory_order_release);
+}
+
+
+
+SharedDictionary::~SharedDictionary()
+{
+    for (int i = 0; i < MaxChunks; ++i)
+        delete[] m_node_chunks[i].load(std::memory_order_relaxed);
+}
+
+
+
+int
+SharedDictionary::document(ustring dictionaryname, std::string& err)
+{
+    {
+        OIIO::spin_rw_read_lock lock(m_documents_mutex);
+        auto dm = m_document_map.find(dictionaryname);
+        if (dm != m_document_map.end())
+            return dm->second;
+    }
+
+    // Parse outside of the map lock so that other threads can keep using
+    // the documents that are already loaded.
+    lock_guard load_lock(m_load_mutex);
+    auto dm = m_document_map.find(dictionaryname);
+    if (dm != m_document_map.end())
+        return dm->second;  // another thread loaded it meanwhile
+
+    std::unique_ptr<pugi::xml_document> doc(new pugi::xml_document);
+    pugi::xml_parse_result parse_result;
+    if (Strutil::ends_with(dictionaryname, ".xml")) {
+        // xml file -- read it
+        parse_result = doc->load_file(dictionaryname.c_str());
+    } else {
+        // load xml directly from the string
+        parse_result = doc->load_string(dictionaryname.c_str());
+    }
+    int dindex = -1;
+    if (parse_result) {
+        dindex = (int)m_documents.size();
+    } else {
+        err = fmtformat("XML parsed with errors: {}, at offset {}",
+                        parse_result.description(), parse_result.offset);
+        doc.reset();
+    }
+
+    OIIO::spin_rw_write_lock lock(m_documents_mutex);
+    if (doc)
+        m_documents.push_back(std::move(doc));
+    m_document_map[dictionaryname] = dindex;
+    return dindex;
+}
+
+
+
+int
+SharedDictionary::find(int document, int nodeID, ustring query,
+                       std::string& err)
+{
+    Query q(document, nodeID, query);
+    Shard& sh(shard(q));
+    {
+        OIIO::spin_rw_read_lock lock(sh.mutex);
+        auto qfound = sh.cache.find(q);
+        if (qfound != sh.cache.end())
+            return qfound->second.node;
+    }
+
+    // Query was not found.  Do the expensive lookup and cache it
+    pugi::xml_node root;
+    if (nodeID == 0) {
+        OIIO::spin_rw_read_lock lock(m_documents_mutex);
+        OSL_DASSERT(document >= 0 && document < (int)m_documents.size());
+        root = *m_documents[document];
+    } else {
+        root = node(nodeID)->node;
+    }
+    pugi::xpath_node_set matches;
+    try {
+        matches = root.select_nodes(query.c_str());
+    } catch (const pugi::xpath_exception& e) {
+        err = fmtformat("Invalid dict_find query '{}': {}", query, e.what());
+        return 0;
+    }
+
+    OIIO::spin_rw_write_lock lock(sh.mutex);
+    auto inserted = sh.cache.emplace(q, QueryResult());
+    if (inserted.second && !matches.empty())
+        inserted.first->second.node = append_nodes(document, matches);
+    // If another thread cached the same query meanwhile, use its nodes
+    return inserted.first->second.node;
+}
+
+
+
+int
+SharedDictionary::append_nodes(int document,
+                               const pugi::xpath_node_set& matches)
+{
+    lock_guard lock(m_nodes_mutex);
+    int first = m_nnodes.load(std::memory_order_relaxed);
+    int n     = (int)matches.size();
+    if (n > MaxChunks * ChunkSize - first)
+        return 0;  // Out of node IDs
+    int id = first;
+    for (auto&& m : matches) {
+        std::atomic<Node*>& chunk(m_node_chunks[id >> ChunkBits]);
+        Node* nodes = chunk.load(std::memory_order_relaxed);
+        if (!nodes) {
+            nodes = new Node[ChunkSize];
+            chunk.store(nodes, std::memory_order_relaxed);
+        }
+        Node& node(nodes[id & (ChunkSize - 1)]);
+        node.document = document;
+        node.node     = m.node();
+        node.next     = (id + 1 < first + n) ? id + 1 : 0;
+        ++id;
+    }
+    // Publish the new nodes (and any new chunk) to readers
+    m_nnodes.store(id, std::memory_order_release);
+    return first;
+}
+
+
+
+void
+SharedDictionary::value(int nodeID, ustring attribname, TypeDesc type,
+                        Value& result)
+{
+    const Node* n = node(nodeID);
+    if (!n) {
+        result = Value();
+        return;
+    }
+    Query q(n->document, nodeID, attribname, type);
+    Shard& sh(shard(q));
+    {
+        OIIO::spin_rw_read_lock lock(sh.mutex);
+        auto qfound = sh.cache.find(q);
+        if (qfound != sh.cache.end()) {
+            result = qfound->second.value;
+            return;
+        }
+    }
+
+    // OK, the entry wasn't in the cache, we need to decode it and cache it.
+    QueryResult r;
+    decode(n->node, attribname, type, r.value);
+    result = r.value;
+    OIIO::spin_rw_write_lock lock(sh.mutex);
+    sh.cache.emplace(q, std::move(r));
+}
+
+
+
+void
+SharedDictionary::decode(const pugi::xml_node& node, ustring attribname,
+                         TypeDesc type, Value& result)
+{
+    const char* val = NULL;
+    if (attribname.empty()) {
+        val = node.value();
+    } else {
+        for (pugi::xml_attribute_iterator ait = node.attributes_begin();
+             ait != node.attributes_end(); ++ait) {
+            if (ait->name() == attribname) {
+                val = ait->value();
+                break;
+            }
+        }
+    }
+    if (val == NULL)
+        return;  // not found
+
+    int n = type.numelements() * type.aggregate;
+    if (type.basetype == TypeDesc::STRING && n == 1) {
+        result.stringdata = ustring(val);
+        result.found      = true;
+    } else if (type.basetype == TypeDesc::INT) {
+        string_view valstr(val);
+        for (int i = 0; i < n; ++i) {
+            int v;
+            OIIO::Strutil::parse_int(valstr, v);
+            OIIO::Strutil::parse_char(valstr, ',');
+            result.intdata.push_back(v);
+        }
+        result.found = true;
+    } else if (type.basetype == TypeDesc::FLOAT) {
+        string_view valstr(val);
+        for (int i = 0; i < n; ++i) {
+            float v;
+            OIIO::Strutil::parse_float(valstr, v);
+            OIIO::Strutil::parse_char(valstr, ',');
+            result.floatdata.push_back(v);
+        }
+        result.found = true;
+    }
+    // Anything that's left is an unsupported type
+}
+
+
+
+// Per-context front end to the SharedDictionary, caching the results of
+// the queries made through this context so they need no locking.
+class Dictionary {
+public:
+    Dictionary(ShadingContext* ctx)
+        : m_context(ctx), m_shared(ctx->shadingsys().shared_dictionary())
+    {
+    }
+
+    int dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query);
+    int dict_find(ExecContextPtr ec, int nodeID, ustring query);
+    int dict_next(int nodeID);
+    int dict_value(int nodeID, ustring attribname, TypeDesc type, void* data,
+                   bool treat_ustrings_as_hash);
+
+private:
+    typedef SharedDictionary::Query Query;
+
     // The cached query result is mostly just a 'valueoffset', which is
     // the index into floatdata/intdata/stringdata (depending on the type
     // being asked for) at which the decoded data live, or a node ID
@@ -107,32 +417,19 @@ private:
         }
     };
 
-    // Nodes we've looked up.  Includes a 'next' index of the matching node
-    // for the query that generated this one.
-    struct Node {
-        int document;         // which document the node belongs to
-        pugi::xml_node node;  // which node within the dictionary
-        int next;             // next node for the same query
-        Node(int d, const pugi::xml_node& n) : document(d), node(n), next(0) {}
-    };
-
-    typedef std::unordered_map<Query, QueryResult, QueryHash> QueryMap;
+    typedef std::unordered_map<Query, QueryResult, SharedDictionary::QueryHash>
+        QueryMap;
     typedef std::unordered_map<ustring, int> DocMap;
 
     ShadingContext* m_context;  // back-pointer to shading context
+    std::shared_ptr<SharedDictionary> m_shared;
 
-    // List of XML documents we've read in.
-    std::vector<pugi::xml_document*> m_documents;
-
-    // Map xml strings and/or filename to indices in m_documents.
+    // Map xml strings and/or filename to shared document indices.
     DocMap m_document_map;
 
     // Cache of fully resolved queries.
     Dictionary::QueryMap m_cache;  // query cache
 
-    // List of all the nodes we've found by queries.
-    std::vector<Dictionary::Node> m_nodes;
-
     // m_floatdata, m_intdata, and m_stringdata hold the decoded data
     // results (including type conversion) of cached queries.
     std::vector<float> m_floatdata;
@@ -141,6 +438,19 @@ private:
 
     // Helper function: return the document index given dictionary name.
     int get_document_index(ExecContextPtr ec, ustring dictionaryname);
+
+    // Shared lookup of a node query, caching the result locally.
+    int find(ExecContextPtr ec, const Query& q);
+
+    void error(ExecContextPtr ec, const std::string& msg)
+    {
+        // Batched case doesn't support error customization yet,
+        // so continue to report through the context when ec is null
+        if (ec == nullptr)
+            m_context->errorfmt("{}", msg);
+        else
+            OSL::errorfmt(ec, "{}", msg);
+    }
 };
 
 
@@ -149,149 +459,58 @@ int
 Dictionary::get_document_index(ExecContextPtr ec, ustring dictionaryname)
 {
     DocMap::iterator dm = m_document_map.find(dictionaryname);
-    int dindex;
-    if (dm == m_document_map.end()) {
-        dindex                         = m_documents.size();
-        m_document_map[dictionaryname] = dindex;
-        pugi::xml_document* doc        = new pugi::xml_document;
-        m_documents.push_back(doc);
-        pugi::xml_parse_result parse_result;
-        if (Strutil::ends_with(dictionaryname, ".xml")) {
-            // xml file -- read it
-            parse_result = doc->load_file(dictionaryname.c_str());
-        } else {
-            // load xml directly from the string
-            parse_result = doc->load_string(dictionaryname.c_str());
-        }
-        if (!parse_result) {
-            // Batched case doesn't support error customization yet,
-            // so continue to report through the context when ec is null
-            if (ec == nullptr) {
-                m_context->errorfmt("XML parsed with errors: {}, at offset {}",
-                                    parse_result.description(),
-                                    parse_result.offset);
-            } else {
-                OSL::errorfmt(ec, "XML parsed with errors: {}, at offset {}",
-                              parse_result.description(), parse_result.offset);
-            }
-            m_document_map[dictionaryname] = -1;
-            return -1;
-        }
-    } else {
-        dindex = dm->second;
-    }
-
-    OSL_DASSERT(dindex < (int)m_documents.size());
+    if (dm != m_document_map.end())
+        return dm->second;
+    std::string err;
+    int dindex = m_shared->document(dictionaryname, err);
+    if (!err.empty())
+        error(ec, err);
+    m_document_map[dictionaryname] = dindex;
     return dindex;
 }
 
 
 
 int
-Dictionary::dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query)
+Dictionary::find(ExecContextPtr ec, const Query& q)
 {
-    int dindex = get_document_index(ec, dictionaryname);
-    if (dindex < 0)
-        return dindex;
-
-    Query q(dindex, 0, query);
     QueryMap::iterator qfound = m_cache.find(q);
     if (qfound != m_cache.end()) {
         return qfound->second.valueoffset;
     }
 
-    pugi::xml_document* doc = m_documents[dindex];
-
-    // Query was not found.  Do the expensive lookup and cache it
-    pugi::xpath_node_set matches;
-
-    try {
-        matches = doc->select_nodes(query.c_str());
-    } catch (const pugi::xpath_exception& e) {
-        // Batched case doesn't support error customization yet,
-        // so continue to report through the context when ec is null
-        if (ec == nullptr) {
-            m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                                e.what());
-        } else {
-            OSL::errorfmt(ec, "Invalid dict_find query '{}': {}", query,
-                          e.what());
-        }
+    // Query was not found locally.  Ask the shared dictionary and cache it
+    std::string err;
+    int firstmatch = m_shared->find(q.document, q.node, q.name, err);
+    if (!err.empty()) {
+        error(ec, err);
         return 0;
     }
-
-    if (matches.empty()) {
-        m_cache[q] = QueryResult(false);  // mark invalid
-        return 0;                         // Not found
-    }
-    int firstmatch = (int)m_nodes.size();
-    int last       = -1;
-    for (auto&& m : matches) {
-        m_nodes.emplace_back(dindex, m.node());
-        int nodeid = (int)m_nodes.size() - 1;
-        if (last < 0) {
-            // If this is the first match, add a cache entry for it
-            m_cache[q] = QueryResult(true /* it's a node */, nodeid);
-        } else {
-            // If this is a subsequent match, set the last match's 'next'
-            m_nodes[last].next = nodeid;
-        }
-        last = nodeid;
-    }
+    m_cache[q] = firstmatch ? QueryResult(true /* it's a node */, firstmatch)
+                            : QueryResult(false);  // mark invalid
     return firstmatch;
 }
 
 
 
 int
-Dictionary::dict_find(ExecContextPtr ec, int nodeID, ustring query)
+Dictionary::dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
-        return 0;  // invalid node ID
+    int dindex = get_document_index(ec, dictionaryname);
+    if (dindex < 0)
+        return dindex;
+    return find(ec, Query(dindex, 0, query));
+}
 
-    int document = m_nodes[nodeID].document;
-    Query q(document, nodeID, query);
-    QueryMap::iterator qfound = m_cache.find(q);
-    if (qfound != m_cache.end()) {
-        return qfound->second.valueoffset;
-    }
 
-    // Query was not found.  Do the expensive lookup and cache it
-    pugi::xpath_node_set matches;
-    try {
-        matches = m_nodes[nodeID].node.select_nodes(query.c_str());
-    } catch (const pugi::xpath_exception& e) {
-        // Batched case doesn't support error customization yet,
-        // so continue to report through the context when ec is null
-        if (ec == nullptr) {
-            m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                                e.what());
-        } else {
-            OSL::errorfmt(ec, "Invalid dict_find query '{}': {}", query,
-                          e.what());
-        }
-        return 0;
-    }
 
-    if (matches.empty()) {
-        m_cache[q] = QueryResult(false);  // mark invalid
-        return 0;                         // Not found
-    }
-    int firstmatch = (int)m_nodes.size();
-    int last       = -1;
-    for (auto&& m : matches) {
-        m_nodes.emplace_back(document, m.node());
-        int nodeid = (int)m_nodes.size() - 1;
-        if (last < 0) {
-            // If this is the first match, add a cache entry for it
-            m_cache[q] = QueryResult(true /* it's a node */, nodeid);
-        } else {
-            // If this is a subsequent match, set the last match's 'next'
-            m_nodes[last].next = nodeid;
-        }
-        last = nodeid;
-    }
-    return firstmatch;
+int
+Dictionary::dict_find(ExecContextPtr ec, int nodeID, ustring query)
+{
+    const SharedDictionary::Node* node = m_shared->node(nodeID);
+    if (!node)
+        return 0;  // invalid node ID
+    return find(ec, Query(node->document, nodeID, query));
 }
 
 
@@ -299,9 +518,10 @@ Dictionary::dict_find(ExecContextPtr ec, int nodeID, ustring query)
 int
 Dictionary::dict_next(int nodeID)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
+    const SharedDictionary::Node* node = m_shared->node(nodeID);
+    if (!node)
         return 0;  // invalid node ID
-    return m_nodes[nodeID].next;
+    return node->next;
 }
 
 
@@ -310,98 +530,70 @@ int
 Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
                        void* data, bool treat_ustrings_as_hash)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
+    const SharedDictionary::Node* node = m_shared->node(nodeID);
+    if (!node)
         return 0;  // invalid node ID
 
-    const Dictionary::Node& node(m_nodes[nodeID]);
-    Dictionary::Query q(node.document, nodeID, attribname, type);
+    Dictionary::Query q(node->document, nodeID, attribname, type);
     Dictionary::QueryMap::iterator qfound = m_cache.find(q);
-    if (qfound != m_cache.end()) {
-        // previously found
-        int offset = qfound->second.valueoffset;
-        int n      = type.numelements() * type.aggregate;
-        if (type.basetype == TypeDesc::STRING) {
-            OSL_DASSERT(n == 1 && "no string arrays in XML");
-            if (treat_ustrings_as_hash == true) {
-                ((ustringhash_pod*)data)[0] = m_stringdata[offset].hash();
+    if (qfound == m_cache.end()) {
+        // The entry wasn't in the local cache, get it from the shared
+        // dictionary and cache it.
+        SharedDictionary::Value v;
+        m_shared->value(nodeID, attribname, type, v);
+        Dictionary::QueryResult r(v.found);
+        if (v.found) {
+            if (type.basetype == TypeDesc::STRING) {
+                r.valueoffset = (int)m_stringdata.size();
+                m_stringdata.push_back(v.stringdata);
+            } else if (type.basetype == TypeDesc::INT) {
+                r.valueoffset = (int)m_intdata.size();
+                m_intdata.insert(m_intdata.end(), v.intdata.begin(),
+                                 v.intdata.end());
             } else {
-                ((ustring*)data)[0] = m_stringdata[offset];
-            }
-            return 1;
-        }
-        if (type.basetype == TypeDesc::INT) {
-            for (int i = 0; i < n; ++i)
-                ((int*)data)[i] = m_intdata[offset++];
-            return 1;
-        }
-        if (type.basetype == TypeDesc::FLOAT) {
-            for (int i = 0; i < n; ++i)
-                ((float*)data)[i] = m_floatdata[offset++];
-            return 1;
-        }
-        return 0;  // Unknown type
-    }
-
-    // OK, the entry wasn't in the cache, we need to decode it and cache it.
-
-    const char* val = NULL;
-    if (attribname.empty()) {
-        val = node.node.value();
-    } else {
-        for (pugi::xml_attribute_iterator ait = node.node.attributes_begin();
-             ait != node.node.attributes_end(); ++ait) {
-            if (ait->name() == attribname) {
-                val = ait->value();
-                break;
+                r.valueoffset = (int)m_floatdata.size();
+                m_floatdata.insert(m_floatdata.end(), v.floatdata.begin(),
+                                   v.floatdata.end());
             }
         }
+        qfound = m_cache.emplace(q, r).first;
     }
-    if (val == NULL)
-        return 0;  // not found
+    if (!qfound->second.is_valid)
+        return 0;  // not found, or an unsupported type
 
-    Dictionary::QueryResult r(false, 0);
-    int n = type.numelements() * type.aggregate;
-    if (type.basetype == TypeDesc::STRING && n == 1) {
-        r.valueoffset = (int)m_stringdata.size();
-        ustring s(val);
-        m_stringdata.push_back(s);
+    int offset = qfound->second.valueoffset;
+    int n      = type.numelements() * type.aggregate;
+    if (type.basetype == TypeDesc::STRING) {
+        OSL_DASSERT(n == 1 && "no string arrays in XML");
         if (treat_ustrings_as_hash == true) {
-            ((ustringhash_pod*)data)[0] = s.hash();
+            ((ustringhash_pod*)data)[0] = m_stringdata[offset].hash();
         } else {
-            ((ustring*)data)[0] = s;
+            ((ustring*)data)[0] = m_stringdata[offset];
         }
-        m_cache[q] = r;
         return 1;
     }
     if (type.basetype == TypeDesc::INT) {
-        r.valueoffset = (int)m_intdata.size();
-        string_view valstr(val);
-        for (int i = 0; i < n; ++i) {
-            int v;
-            OIIO::Strutil::parse_int(valstr, v);
-            OIIO::Strutil::parse_char(valstr, ',');
-            m_intdata.push_back(v);
-            ((int*)data)[i] = v;
-        }
-        m_cache[q] = r;
+        for (int i = 0; i < n; ++i)
+            ((int*)data)[i] = m_intdata[offset++];
         return 1;
     }
     if (type.basetype == TypeDesc::FLOAT) {
-        r.valueoffset = (int)m_floatdata.size();
-        string_view valstr(val);
-        for (int i = 0; i < n; ++i) {
-            float v;
-            OIIO::Strutil::parse_float(valstr, v);
-            OIIO::Strutil::parse_char(valstr, ',');
-            m_floatdata.push_back(v);
-            ((float*)data)[i] = v;
-        }
-        m_cache[q] = r;
+        for (int i = 0; i < n; ++i)
+            ((float*)data)[i] = m_floatdata[offset++];
         return 1;
     }
+    return 0;  // Unknown type
+}
 
-    // Anything that's left is an unsupported type
-    return 0;
+
+
+std::shared_ptr<SharedDictionary>
+ShadingSystemImpl::shared_dictionary()
+{
+    lock_guard lock(m_mutex);
+    if (!m_shared_dictionary)
+        m_shared_dictionary.reset(new SharedDictionary);
+    return m_shared_dictionary;
 }
 
 
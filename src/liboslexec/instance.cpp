@@ -731,6 +731,48 @@ ShaderInstance::mergeable(const ShaderInstance& b,
 }
 
 
+
+int
+GroupProfile::opclass(ustring opname)
+{
+    static const std::pair<ustring, int> timed_ops[] = {
+        { ustring("texture"), Texture },
+        { ustring("texture3d"), Texture },
+        { ustring("environment"), Texture },
+        { ustring("gettextureinfo"), Texture },
+        { ustring("noise"), Noise },
+        { ustring("snoise"), Noise },
+        { ustring("pnoise"), Noise },
+        { ustring("psnoise"), Noise },
+        { ustring("cellnoise"), Noise },
+        { ustring("hashnoise"), Noise },
+        { ustring("getattribute"), Getattribute },
+        { ustring("trace"), Trace },
+        { ustring("pointcloud_search"), Pointcloud },
+        { ustring("pointcloud_get"), Pointcloud },
+        { ustring("pointcloud_write"), Pointcloud },
+        { ustring("spline"), Spline },
+        { ustring("splineinverse"), Spline },
+    };
+    for (auto& op : timed_ops)
+        if (op.first == opname)
+            return op.second;
+    return -1;
+}
+
+
+
+const char*
+GroupProfile::opclass_name(int opclass)
+{
+    static const char* names[NumOpClasses] = { "layer", "texture",
+                                               "noise", "getattribute",
+                                               "trace", "pointcloud",
+                                               "spline" };
+    return opclass >= 0 && opclass < NumOpClasses ? names[opclass] : "";
+}
+
+
 };  // namespace pvt
 
 
@@ -10,6 +10,8 @@
 #include <OSL/genclosure.h>
 #include "backendllvm.h"
 
+#include <llvm/IR/Instructions.h>
+
 using namespace OSL;
 using namespace OSL::pvt;
 
@@ -130,7 +132,7 @@ BackendLLVM::llvm_gen_error(string_view message)
 
 
 void
-BackendLLVM::llvm_call_layer(int layer, bool unconditional)
+BackendLLVM::llvm_call_layer(int layer, bool unconditional, bool once)
 {
     // Make code that looks like:
     //     if (! groupdata->run[parentlayer])
@@ -152,9 +154,12 @@ BackendLLVM::llvm_call_layer(int layer, bool unconditional)
     llvm::BasicBlock *then_block = NULL, *after_block = NULL;
     if (!unconditional) {
         llvm::Value* executed = ll.op_load(ll.type_bool(), layerfield);
-        executed              = ll.op_ne(executed, trueval);
-        then_block            = ll.new_basic_block("");
-        after_block           = ll.new_basic_block("");
+        if (layer < (int)m_run_flag_checks.size())
+            m_run_flag_checks[layer].push_back(
+                { llvm::cast<llvm::Instruction>(executed), once });
+        executed    = ll.op_ne(executed, trueval);
+        then_block  = ll.new_basic_block("");
+        after_block = ll.new_basic_block("");
         ll.op_branch(executed, then_block, after_block);
         // insert point is now then_block
     }
@@ -232,8 +237,10 @@ BackendLLVM::llvm_run_connected_layers(Symbol& sym, int symindex, int opnum,
             }
 
             // If the earlier layer it comes from has not yet been
-            // executed, do so now.
-            llvm_call_layer(con.srclayer);
+            // executed, do so now. Output copies (opnum < 0) and main code
+            // outside of loops run at most once each time this layer does.
+            bool once = opnum < 0 || (inmain && !m_in_loop[opnum]);
+            llvm_call_layer(con.srclayer, false, once);
         }
     }
 }
@@ -2815,7 +2822,8 @@ LLVMGEN(llvm_gen_texture)
     llvm::Value* args[] = {
         rop.sg_void_ptr(),
         rop.llvm_load_value(Filename),
-        rop.ll.constant_ptr(texture_handle),
+        rop.llvm_process_ptr(texture_handle, "texture",
+                             texture_handle ? Filename.get_string() : ustring()),
         opt,
         rop.llvm_load_value(S),
         rop.llvm_load_value(T),
@@ -2882,7 +2890,8 @@ LLVMGEN(llvm_gen_texture3d)
     llvm::Value* args[] = {
         rop.sg_void_ptr(),
         rop.llvm_load_value(Filename),
-        rop.ll.constant_ptr(texture_handle),
+        rop.llvm_process_ptr(texture_handle, "texture",
+                             texture_handle ? Filename.get_string() : ustring()),
         opt,
         rop.llvm_void_ptr(P),
         // Auto derivs of P if !user_derivs
@@ -2947,7 +2956,8 @@ LLVMGEN(llvm_gen_environment)
     llvm::Value* args[] = {
         rop.sg_void_ptr(),
         rop.llvm_load_value(Filename),
-        rop.ll.constant_ptr(texture_handle),
+        rop.llvm_process_ptr(texture_handle, "texture",
+                             texture_handle ? Filename.get_string() : ustring()),
         opt,
         rop.llvm_void_ptr(R),
         user_derivs ? rop.llvm_void_ptr(*rop.opargsym(op, 3))
@@ -3476,7 +3486,9 @@ LLVMGEN(llvm_gen_gettextureinfo)
     std::vector<llvm::Value*> args;
     args.push_back(rop.sg_void_ptr());
     args.push_back(rop.llvm_load_value(Filename));
-    args.push_back(rop.ll.constant_ptr(texture_handle));
+    args.push_back(rop.llvm_process_ptr(
+        texture_handle, "texture",
+        texture_handle ? Filename.get_string() : ustring()));
     if (use_coords) {
         args.push_back(rop.llvm_load_value(*S));
         args.push_back(rop.llvm_load_value(*T));
@@ -3799,8 +3811,9 @@ LLVMGEN(llvm_gen_closure)
 
     // Call osl_allocate_closure_component(closure, id, size).  It returns
     // the memory for the closure parameter data.
-    llvm::Value* render_ptr = rop.ll.constant_ptr(rop.shadingsys().renderer(),
-                                                  rop.ll.type_void_ptr());
+    llvm::Value* render_ptr = rop.llvm_process_ptr(rop.shadingsys().renderer(),
+                                                   "renderer", ustring(),
+                                                   rop.ll.type_void_ptr());
     llvm::Value* sg_ptr     = rop.sg_void_ptr();
     llvm::Value* id_int     = rop.ll.constant(clentry->id);
     llvm::Value* size_int   = rop.ll.constant(clentry->struct_size);
@@ -3840,8 +3853,9 @@ LLVMGEN(llvm_gen_closure)
     if (clentry->prepare) {
         // Call clentry->prepare(renderservices *, int id, void *mem)
         llvm::Value* funct_ptr
-            = rop.ll.constant_ptr((void*)clentry->prepare,
-                                  rop.llvm_type_prepare_closure_func());
+            = rop.llvm_process_ptr((void*)clentry->prepare, "prepare",
+                                   clentry->name,
+                                   rop.llvm_type_prepare_closure_func());
         llvm::Value* args[] = { render_ptr, id_int, mem_void_ptr };
         rop.ll.call_function(funct_ptr, args);
     } else {
@@ -3876,8 +3890,9 @@ LLVMGEN(llvm_gen_closure)
     if (clentry->setup) {
         // Call clentry->setup(renderservices *, int id, void *mem)
         llvm::Value* funct_ptr
-            = rop.ll.constant_ptr((void*)clentry->setup,
-                                  rop.llvm_type_setup_closure_func());
+            = rop.llvm_process_ptr((void*)clentry->setup, "setup",
+                                   clentry->name,
+                                   rop.llvm_type_setup_closure_func());
         llvm::Value* args[] = { render_ptr, id_int, mem_void_ptr };
         rop.ll.call_function(funct_ptr, args);
     }
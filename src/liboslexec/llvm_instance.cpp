@@ -5,6 +5,7 @@
 #include <bitset>
 #include <cmath>
 #include <iostream>
+#include <sstream>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -22,6 +23,7 @@
 #include "oslexec_pvt.h"
 #include "backendllvm.h"
 
+#include <llvm/IR/Instructions.h>
 #if OSL_USE_OPTIX
 #    include <llvm/Linker/Linker.h>
 #endif
@@ -150,9 +152,28 @@ static ustring unknown_shader_group_name("<Unknown Shader Group Name>");
 struct HelperFuncRecord {
     const char* argtypes;
     void (*function)();
+    // The argtypes, parsed once rather than for every group
+    TypeSpec rettype;
+    std::vector<TypeSpec> params;
+    bool varargs = false;
     HelperFuncRecord(const char* argtypes = NULL, void (*function)() = NULL)
         : argtypes(argtypes), function(function)
     {
+        const char* types = argtypes;
+        if (!types)
+            return;
+        int advance;
+        rettype = OSLCompilerImpl::type_from_code(types, &advance);
+        for (types += advance; *types; types += advance) {
+            TypeSpec t = OSLCompilerImpl::type_from_code(types, &advance);
+            if (t.simpletype().basetype == TypeDesc::UNKNOWN) {
+                OSL_DASSERT(*types == '*');
+                if (*types == '*')
+                    varargs = true;
+            } else {
+                params.push_back(t);
+            }
+        }
     }
 };
 
@@ -184,10 +205,18 @@ initialize_llvm_helper_function_map()
 
 
 
+// The JIT resolves the helper functions called by every group through this
+// one table, rather than by being given the address of each of them for
+// every module.
 static void*
 helper_function_lookup(const std::string& name)
 {
     HelperFuncMap::const_iterator i = llvm_helper_function_map.find(name);
+#ifdef __APPLE__
+    // The JIT asks for the mangled name, which has a global prefix
+    if (i == llvm_helper_function_map.end() && name.size() && name[0] == '_')
+        i = llvm_helper_function_map.find(name.substr(1));
+#endif
     if (i == llvm_helper_function_map.end())
         return NULL;
     return (void*)i->second.function;
@@ -513,12 +542,13 @@ BackendLLVM::llvm_create_constant(const Symbol& sym)
                 const_element = ll.constant(sym.get_int(linear_index));
             }
             if (sym.typespec().is_string_based()) {
+                ustring str = sym.get_string(linear_index);
+                if (m_jit_cache)
+                    m_jit_cache_strings.insert(str);
                 // TODO:  right now stored as char *, but change to int64 when we can
                 const_element = reinterpret_cast<llvm::Constant*>(
-                    ll.constant_ptr(
-                        OSL::bitcast<char*>(
-                            ustring(sym.get_string(linear_index)).hash()),
-                        ll.type_char_ptr()));
+                    ll.constant_ptr(OSL::bitcast<char*>(str.hash()),
+                                    ll.type_char_ptr()));
             }
             OSL_ASSERT(const_element && "unhandled type");
             elements.push_back(const_element);
@@ -1029,6 +1059,26 @@ BackendLLVM::llvm_generate_debug_op_printf(const Opcode& op)
 
 
 
+void
+BackendLLVM::llvm_profile_enter(int opclass)
+{
+    llvm::Value* args[] = { sg_void_ptr(),
+                            ll.constant(GroupProfile::slot(layer(), opclass)),
+                            ll.op_read_cycle_counter() };
+    ll.call_function("osl_profile_enter", args);
+}
+
+
+
+void
+BackendLLVM::llvm_profile_exit()
+{
+    llvm::Value* args[] = { sg_void_ptr(), ll.op_read_cycle_counter() };
+    ll.call_function("osl_profile_exit", args);
+}
+
+
+
 bool
 BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
 {
@@ -1046,9 +1096,16 @@ BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
             if (ll.debug_is_enabled())
                 ll.debug_set_location(op.sourcefile(),
                                       std::max(op.sourceline(), 1));
+            int opclass = m_profile_layers
+                              ? GroupProfile::opclass(op.opname())
+                              : -1;
+            if (opclass > 0)
+                llvm_profile_enter(opclass);
             bool ok = (*opd->llvmgen)(*this, opnum);
             if (!ok)
                 return false;
+            if (opclass > 0)
+                llvm_profile_exit();
             if (shadingsys().debug_nan() /* debug NaN/Inf */
                 && op.farthest_jump() < 0 /* Jumping ops don't need it */) {
                 llvm_generate_debugnan(op);
@@ -1122,9 +1179,12 @@ BackendLLVM::build_llvm_init()
 #endif
 
     // Group init clears all the "layer_run" and "userdata_initialized" flags.
-    if (m_num_used_layers > 1) {
+    m_run_flags_clear_ptr = m_num_used_layers > 1
+                                ? ll.void_ptr(layer_run_ref(0))
+                                : nullptr;
+    if (m_run_flags_clear_ptr) {
         int sz = (m_num_used_layers + 3) & (~3);  // round up to 32 bits
-        ll.op_memset(ll.void_ptr(layer_run_ref(0)), 0, sz, 4 /*align*/);
+        ll.op_memset(m_run_flags_clear_ptr, 0, sz, 4 /*align*/);
     }
     int num_userdata = (int)group().m_userdata_names.size();
     if (num_userdata) {
@@ -1264,6 +1324,55 @@ BackendLLVM::build_llvm_optix_callables()
     return funcs;
 }
 
+// Erase the instructions of type InstT that use val, which must be an
+// instruction itself (so that it can't be shared with anything else).
+template<typename InstT>
+static void
+erase_users(llvm::Value* val)
+{
+    if (!val || !llvm::isa<llvm::Instruction>(val))
+        return;
+    std::vector<llvm::Instruction*> dead;
+    for (llvm::User* user : val->users())
+        if (auto inst = llvm::dyn_cast<InstT>(user))
+            dead.push_back(inst);
+    for (llvm::Instruction* inst : dead)
+        inst->eraseFromParent();
+}
+
+
+
+void
+BackendLLVM::remove_redundant_run_flags()
+{
+    OSL_DASSERT(!group().num_entry_layers());
+    // Without explicit entry layers, the flags are only checked where lazy
+    // layers are called, and every layer runs at most once per shade: the
+    // group entry runs once, non-lazy layers are run once by it, and lazy
+    // ones are guarded by these checks. So a lazy layer that is called from
+    // a single site, reached at most once each time its layer runs, can't
+    // have run yet when it gets there. And once nothing checks a layer's
+    // flag, setting it is wasted (as is clearing the flags if none are
+    // checked at all).
+    bool any_checked = false;
+    for (int layer = 0, n = group().nlayers(); layer < n; ++layer) {
+        std::vector<RunFlagCheck>& checks(m_run_flag_checks[layer]);
+        if (checks.size() == 1 && checks[0].once) {
+            checks[0].load->replaceAllUsesWith(ll.constant_bool(false));
+            checks[0].load->eraseFromParent();
+            checks.clear();
+        }
+        if (checks.size())
+            any_checked = true;
+        else
+            erase_users<llvm::StoreInst>(m_run_flag_refs[layer]);
+    }
+    if (!any_checked)
+        erase_users<llvm::CallInst>(m_run_flags_clear_ptr);
+}
+
+
+
 //
 // Fused callable:
 //  Alternative OptiX API to the init + entry callables.
@@ -1271,6 +1380,9 @@ BackendLLVM::build_llvm_optix_callables()
 //  Calls init and the entry layer functions itself, so that OSL can own
 //  the groupdata params buffer.
 //
+//  With llvm_fuse_layers, it is also the CPU entry point of groups that
+//  have no explicit entry layers, with init and the layers inlined into it.
+//
 //  With max_optix_groupdata_alloc > 0, the callable will try to allocate
 //  a buffer for groupdata params on the stack. If the buffer requirement
 //  exceeds max_optix_groupdata_alloc, it will skip allocation and instead
@@ -1300,8 +1412,9 @@ BackendLLVM::build_llvm_fused_callable(void)
     // renderer-supplied pointer
     llvm::Value* llvm_groupdata_ptr = ll.current_function_arg(1);
 
-    if ((int)group().llvm_groupdata_size()
-        <= shadingsys().m_max_optix_groupdata_alloc)
+    if (use_optix()
+        && (int)group().llvm_groupdata_size()
+               <= shadingsys().m_max_optix_groupdata_alloc)
         llvm_groupdata_ptr = ll.op_alloca(m_llvm_type_groupdata, 1,
                                           "groupdata_buffer", 8);
 
@@ -1374,7 +1487,8 @@ BackendLLVM::build_llvm_instance(bool groupentry)
     // Set up a new IR builder
     ll.new_builder(entry_bb);
 
-    llvm::Value* layerfield = layer_run_ref(layer_remap(layer()));
+    llvm::Value* layerfield  = layer_run_ref(layer_remap(layer()));
+    m_run_flag_refs[layer()] = layerfield;
     if (is_entry_layer && !group().is_last_layer(layer())) {
         // For entry layers, we need an extra check to see if it already
         // ran. If it has, do an early return. Otherwise, set the 'ran' flag
@@ -1409,6 +1523,8 @@ BackendLLVM::build_llvm_instance(bool groupentry)
         if (shadingsys().countlayerexecs())
             ll.call_function("osl_incr_layers_executed", sg_void_ptr());
     }
+    if (m_profile_layers)
+        llvm_profile_enter(GroupProfile::Layer);
 
     // Setup the symbols
     m_named_values.clear();
@@ -1632,6 +1748,8 @@ BackendLLVM::build_llvm_instance(bool groupentry)
     }
 
     // All done
+    if (m_profile_layers)
+        llvm_profile_exit();
     if (shadingsys().llvm_debug_layers())
         llvm_gen_debug_printf(fmtformat("exit layer {} {} {}", this->layer(),
                                         inst()->layername(),
@@ -1683,44 +1801,27 @@ BackendLLVM::initialize_llvm_group()
     if (!use_optix())
         ll.InstallLazyFunctionCreator(helper_function_lookup);
 
-    for (HelperFuncMap::iterator i = llvm_helper_function_map.begin(),
-                                 e = llvm_helper_function_map.end();
-         i != e; ++i) {
-        const std::string& funcname(i->first);
-        bool varargs      = false;
-        const char* types = i->second.argtypes;
-        int advance;
-        TypeSpec rettype = OSLCompilerImpl::type_from_code(types, &advance);
-        types += advance;
-        std::vector<llvm::Type*> params;
-        while (*types) {
-            TypeSpec t = OSLCompilerImpl::type_from_code(types, &advance);
-            if (t.simpletype().basetype == TypeDesc::UNKNOWN) {
-                OSL_DASSERT(*types == '*');
-                if (*types == '*')
-                    varargs = true;
-            } else {
-                params.push_back(llvm_pass_type(t));
-            }
-            types += advance;
-        }
+    // Declare the helpers. Their addresses are found by
+    // helper_function_lookup when the module is JITed.
+    std::vector<llvm::Type*> params;
+    for (auto&& helper : llvm_helper_function_map) {
+        const HelperFuncRecord& rec(helper.second);
+        bool varargs = rec.varargs;
+        params.clear();
+        for (const TypeSpec& t : rec.params)
+            params.push_back(llvm_pass_type(t));
 #if OSL_USE_OPTIX
         if (varargs && use_optix()) {
             varargs = false;
             params.push_back(ll.type_void_ptr());
         }
 #endif
-        llvm::Function* f = ll.make_function(funcname, false,
-                                             llvm_pass_type(rettype), params,
-                                             varargs);
-
-        // Skipping this in the non-JIT OptiX case suppresses an LLVM warning
-        if (!use_optix())
-            ll.add_function_mapping(f, (void*)i->second.function);
+        ll.make_function(helper.first, false, llvm_pass_type(rec.rettype),
+                         params, varargs);
     }
 
     // Needed for closure setup
-    std::vector<llvm::Type*> params(3);
+    params.resize(3);
     params[0]                        = (llvm::Type*)ll.type_char_ptr();
     params[1]                        = ll.type_int();
     params[2]                        = (llvm::Type*)ll.type_char_ptr();
@@ -1866,6 +1967,8 @@ BackendLLVM::run()
     if (group().does_nothing()) {
         group().llvm_compiled_init((RunLLVMGroupFunc)empty_group_func);
         group().llvm_compiled_version((RunLLVMGroupFunc)empty_group_func);
+        if (m_jit_cache)
+            save_to_jit_cache(std::string(), {});
         return;
     }
 
@@ -1939,8 +2042,11 @@ BackendLLVM::run()
                     shadingcontext()->errorfmt(
                         "LLVM_Util::absorb_module failed'\n");
             } else {
+                // The shadeops are parsed once per LLVM context, and only
+                // those the group uses are added to its module after
+                // codegen.
                 ll.module(
-                    ll.module_from_bitcode((char*)osl_llvm_compiled_ops_block,
+                    ll.module_from_library((char*)osl_llvm_compiled_ops_block,
                                            osl_llvm_compiled_ops_size,
                                            "llvm_ops", &err));
                 if (err.length())
@@ -2082,6 +2188,8 @@ BackendLLVM::run()
     shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
 
     initialize_llvm_group();
+    m_run_flag_checks.assign(nlayers, {});
+    m_run_flag_refs.assign(nlayers, nullptr);
 
     // Generate the LLVM IR for each layer.  Skip unused layers.
     m_llvm_local_mem          = 0;
@@ -2102,6 +2210,24 @@ BackendLLVM::run()
     if (use_optix())
         optix_externals = build_llvm_optix_callables();
 
+    // Fusing: the CPU entry point becomes a single function that runs init
+    // and the group entry, with the layers inlined into it, so that deep
+    // networks don't pay for a call (and a run flag check) per layer. Every
+    // layer called from a single place is always inlined; a lazy layer
+    // called from several is left to the inliner, lest a network with many
+    // shared upstream layers blow up in size. With explicit entry layers,
+    // the renderer calls the layers itself, so there is nothing to fuse.
+    llvm::Function* fused_func = nullptr;
+    if (shadingsys().llvm_fuse_layers() && !use_optix()
+        && !group().num_entry_layers()) {
+        init_func->addFnAttr(llvm::Attribute::AlwaysInline);
+        for (int layer = 0; layer < nlayers; ++layer)
+            if (funcs[layer] && m_run_flag_checks[layer].size() <= 1)
+                funcs[layer]->addFnAttr(llvm::Attribute::AlwaysInline);
+        remove_redundant_run_flags();
+        fused_func = build_llvm_fused_callable();
+    }
+
     // llvm::Function* entry_func = group().num_entry_layers() ? NULL : funcs[m_num_used_layers-1];
     m_stat_llvm_irgen_time += timer.lap();
 
@@ -2112,6 +2238,14 @@ BackendLLVM::run()
             group().name(), m_llvm_local_mem / 1024);
     }
 
+    // Bring in the shadeops the group calls, if the module only declares
+    // them (see LLVM_Util::module_from_library).
+    if (!ll.link_library_functions(&err)) {
+        shadingcontext()->errorfmt("Failed to link the shadeops: {}\n", err);
+        OSL_ASSERT(0);
+        return;
+    }
+
     // The module contains tons of "library" functions that our generated IR
     // might call. But probably not. We don't want to incur the overhead of
     // fully compiling those, so we want to get rid of all functions not
@@ -2134,6 +2268,8 @@ BackendLLVM::run()
         if (use_optix()) {
             for (llvm::Function* func : optix_externals)
                 external_functions.insert(func);
+        } else if (fused_func) {
+            external_functions.insert(fused_func);
         } else {
             external_functions.insert(init_func);
 
@@ -2193,6 +2329,10 @@ BackendLLVM::run()
     }
 #endif
 
+    // Keep the machine code if the group goes into the JIT cache
+    if (m_jit_cache)
+        ll.capture_jit_object(true);
+
     // Optimize the LLVM IR unless it's a do-nothing group.
     if (!group().does_nothing()) {
         ll.do_optimize();
@@ -2264,21 +2404,55 @@ BackendLLVM::run()
     } else
 #endif
     {
+        // The instrumented code adds up its cycles in the group's profile
+        if (m_profile_layers)
+            group().m_profile.reset(new GroupProfile(nlayers));
+
         // Force the JIT to happen now and retrieve the JITed function pointers
         // for the initialization and all public entry points.
-        group().llvm_compiled_init(
-            (RunLLVMGroupFunc)ll.getPointerToFunction(init_func));
-        for (int layer = 0; layer < nlayers; ++layer) {
-            llvm::Function* f = funcs[layer];
-            if (f && group().is_entry_layer(layer))
-                group().llvm_compiled_layer(
-                    layer, (RunLLVMGroupFunc)ll.getPointerToFunction(f));
+        if (fused_func) {
+            // The fused function is the entry layer, and runs init itself,
+            // leaving nothing for the init step to do. That way the group
+            // still runs exactly once, and only when the entry layer is
+            // executed, even if execute_init was called with run=false.
+            group().llvm_compiled_init((RunLLVMGroupFunc)empty_group_func);
+            group().llvm_compiled_layer(
+                nlayers - 1,
+                (RunLLVMGroupFunc)ll.getPointerToFunction(fused_func));
+        } else {
+            group().llvm_compiled_init(
+                (RunLLVMGroupFunc)ll.getPointerToFunction(init_func));
+            for (int layer = 0; layer < nlayers; ++layer) {
+                llvm::Function* f = funcs[layer];
+                if (f && group().is_entry_layer(layer))
+                    group().llvm_compiled_layer(
+                        layer, (RunLLVMGroupFunc)ll.getPointerToFunction(f));
+            }
         }
         if (group().num_entry_layers())
             group().llvm_compiled_version(NULL);
         else
             group().llvm_compiled_version(
                 group().llvm_compiled_layer(nlayers - 1));
+        // The group keeps the code alive after ll is gone
+        group().m_llvm_jit_memory.push_back(ll.jit_memory());
+
+        if (m_jit_cache) {
+            // Record the names of the functions the group calls, which are
+            // all that's needed of the module to load the object again. A
+            // fused group has no init of its own.
+            std::vector<std::string> layer_names(nlayers);
+            if (fused_func) {
+                layer_names[nlayers - 1] = ll.func_name(fused_func);
+            } else {
+                for (int layer = 0; layer < nlayers; ++layer)
+                    if (funcs[layer] && group().is_entry_layer(layer))
+                        layer_names[layer] = ll.func_name(funcs[layer]);
+            }
+            save_to_jit_cache(fused_func ? std::string()
+                                         : ll.func_name(init_func),
+                              layer_names);
+        }
     }
 
     // We are destroying the entire module below,
@@ -2318,5 +2492,400 @@ BackendLLVM::run()
 
 
 
+
+// An entry of the on-disk JIT cache is a header of one record per line,
+// each a keyword followed by its fields, and then the object file. Strings
+// are written as their length, a colon and their characters, so that they
+// may hold anything.
+namespace {
+
+struct JitCacheWriter {
+    std::string out;
+
+    JitCacheWriter& rec(string_view keyword)
+    {
+        if (out.size())
+            out += '\n';
+        out += keyword;
+        return *this;
+    }
+    JitCacheWriter& operator()(long long i)
+    {
+        out += fmtformat(" {}", i);
+        return *this;
+    }
+    JitCacheWriter& operator()(string_view s)
+    {
+        out += fmtformat(" {}:{}", s.size(), s);
+        return *this;
+    }
+};
+
+struct JitCacheReader {
+    string_view in;
+    bool ok = true;
+
+    string_view rec()
+    {
+        Strutil::skip_whitespace(in);
+        return Strutil::parse_identifier(in);
+    }
+    JitCacheReader& operator()(int& i)
+    {
+        ok &= Strutil::parse_int(in, i);
+        return *this;
+    }
+    JitCacheReader& operator()(std::string& s)
+    {
+        int len = 0;
+        ok &= Strutil::parse_int(in, len)
+              && Strutil::parse_char(in, ':', false) && len >= 0
+              && size_t(len) <= in.size();
+        if (ok) {
+            s = in.substr(0, len);
+            in.remove_prefix(len);
+        }
+        return *this;
+    }
+    JitCacheReader& operator()(ustring& s)
+    {
+        std::string str;
+        (*this)(str);
+        s = ustring(str);
+        return *this;
+    }
+    JitCacheReader& operator()(TypeDesc& t)
+    {
+        std::string str;
+        (*this)(str);
+        t = TypeDesc(str);
+        return *this;
+    }
+};
+
+}  // namespace
+
+
+
+std::string
+BackendLLVM::jit_cache_path()
+{
+    // The machine code depends on the ISA it is compiled for, which is
+    // chosen the same way as by make_jit_execengine.
+    if (ll.target_isa() == TargetISA::UNKNOWN)
+        ll.detect_cpu_features(ll.lookup_isa_by_name(
+                                   shadingsys().m_llvm_jit_target),
+                               !ll.jit_fma());
+    return fmtformat("{}/{}_{}.osljit", shadingsys().llvm_jit_cache_dir(),
+                     group().m_llvm_jit_cache_key,
+                     ll.target_isa_name(ll.target_isa()));
+}
+
+
+
+void
+BackendLLVM::save_to_jit_cache(const std::string& init_name,
+                               const std::vector<std::string>& layer_names)
+{
+    const ShaderGroup& g(group());
+    string_view object = ll.jit_object();
+    if (!g.does_nothing() && object.empty())
+        return;
+
+    JitCacheWriter w;
+    w.rec("osljit")(1);
+    w.rec("does_nothing")(g.does_nothing());
+    w.rec("groupdata")((long long)g.llvm_groupdata_size());
+    w.rec("init")(init_name);
+    for (int layer = 0, n = int(layer_names.size()); layer < n; ++layer)
+        if (layer_names[layer].size())
+            w.rec("layer")(layer)(layer_names[layer]);
+    for (int layer = 0, n = g.nlayers(); layer < n; ++layer) {
+        if (g[layer]->unused())
+            continue;
+        FOREACH_PARAM(const Symbol& sym, g[layer])
+        {
+            w.rec("param")(layer)(sym.name())(sym.dataoffset());
+        }
+    }
+    for (size_t i = 0, n = g.m_userdata_names.size(); i < n; ++i)
+        w.rec("userdata")(g.m_userdata_names[i])(
+            g.m_userdata_types[i].c_str())(g.m_userdata_derivs[i])(
+            g.m_userdata_layers[i])(g.m_userdata_offsets[i]);
+    for (size_t i = 0, n = g.m_attributes_needed.size(); i < n; ++i)
+        w.rec("attribute")(g.m_attributes_needed[i])(g.m_attribute_scopes[i])(
+            g.m_attribute_types[i].c_str());
+    for (auto&& name : g.m_textures_needed)
+        w.rec("texture")(name);
+    for (auto&& name : g.m_closures_needed)
+        w.rec("closure")(name);
+    for (auto&& name : g.m_globals_needed)
+        w.rec("global")(name);
+    w.rec("unknown")(g.m_unknown_textures_needed)(g.m_unknown_closures_needed)(
+        g.m_unknown_attributes_needed);
+    w.rec("globals_rw")(g.m_globals_read)(g.m_globals_write);
+    for (auto&& str : m_jit_cache_strings)
+        w.rec("string")(str);
+    for (auto&& ptr : m_jit_cache_ptrs)
+        w.rec("ptr")(ptr.symbol)(ptr.kind)(ptr.name);
+    w.rec("object")((long long)object.size());
+    w.out += '\n';
+    w.out += object;
+
+    // Write to a uniquely named temp file in the same directory and then
+    // rename it into place, so that other threads or processes sharing
+    // the cache never see a partially written entry.
+    std::string path = jit_cache_path();
+    std::string err;
+    OIIO::Filesystem::create_directories(shadingsys().llvm_jit_cache_dir(),
+                                         err);
+    std::string tmppath = OIIO::Filesystem::unique_path(path
+                                                        + ".%%%%-%%%%.tmp");
+    OIIO::ofstream out;
+    OIIO::Filesystem::open(out, tmppath, std::ios::out | std::ios::binary);
+    if (out) {
+        out.write(w.out.data(), w.out.size());
+        out.close();
+    }
+    if (!out || !OIIO::Filesystem::rename(tmppath, path, err))
+        OIIO::Filesystem::remove(tmppath, err);
+}
+
+
+
+bool
+BackendLLVM::load_from_jit_cache()
+{
+    OIIO::Timer timer;
+    ShaderGroup& g(group());
+    int nlayers = g.nlayers();
+
+    std::string path = jit_cache_path();
+    std::string entry;
+    {
+        OIIO::ifstream in;
+        OIIO::Filesystem::open(in, path, std::ios::in | std::ios::binary);
+        if (!in)
+            return false;
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        entry = contents.str();
+    }
+
+    // Read everything before changing anything in the group, so that an
+    // entry that's unreadable (or truncated, or for another version)
+    // leaves it to be compiled as usual.
+    JitCacheReader r { entry };
+    int version = 0, does_nothing = 0, groupdata_size = 0, object_size = -1;
+    int unknown_textures = 0, unknown_closures = 0, unknown_attributes = 0;
+    int globals_read = 0, globals_write = 0;
+    std::string init_name;
+    std::vector<std::string> layer_names(nlayers);
+    struct ParamOffset {
+        int layer, index, offset;
+    };
+    std::vector<ParamOffset> params;
+    std::vector<int> userdata_params;
+    std::vector<UserDataNeeded> userdata;
+    std::vector<int> userdata_offsets;
+    std::vector<ustring> attributes, attribute_scopes, textures, closures,
+        globals;
+    std::vector<TypeDesc> attribute_types;
+    std::vector<std::string> strings;
+    std::vector<JitCachePtr> ptrs;
+    if (r.rec() != "osljit" || !r(version).ok || version != 1)
+        return false;
+    while (r.ok && object_size < 0) {
+        string_view rec = r.rec();
+        if (rec == "does_nothing") {
+            r(does_nothing);
+        } else if (rec == "groupdata") {
+            r(groupdata_size);
+        } else if (rec == "init") {
+            r(init_name);
+        } else if (rec == "layer") {
+            int layer = -1;
+            std::string name;
+            r(layer)(name);
+            r.ok &= layer >= 0 && layer < nlayers;
+            if (r.ok)
+                layer_names[layer] = name;
+        } else if (rec == "param") {
+            int layer = -1, offset = -1;
+            ustring name;
+            r(layer)(name)(offset);
+            r.ok &= layer >= 0 && layer < nlayers;
+            int index = r.ok ? g[layer]->findparam(name) : -1;
+            r.ok &= index >= 0;
+            params.push_back({ layer, index, offset });
+        } else if (rec == "userdata") {
+            ustring name;
+            TypeDesc type;
+            int derivs = 0, layer = -1, offset = 0;
+            r(name)(type)(derivs)(layer)(offset);
+            r.ok &= layer >= 0 && layer < nlayers;
+            int index = r.ok ? g[layer]->findparam(name) : -1;
+            r.ok &= index >= 0;
+            userdata.emplace_back(name, layer, type, nullptr, derivs);
+            userdata_params.push_back(index);
+            userdata_offsets.push_back(offset);
+        } else if (rec == "attribute") {
+            ustring name, scope;
+            TypeDesc type;
+            r(name)(scope)(type);
+            attributes.push_back(name);
+            attribute_scopes.push_back(scope);
+            attribute_types.push_back(type);
+        } else if (rec == "texture") {
+            textures.emplace_back();
+            r(textures.back());
+        } else if (rec == "closure") {
+            closures.emplace_back();
+            r(closures.back());
+        } else if (rec == "global") {
+            globals.emplace_back();
+            r(globals.back());
+        } else if (rec == "unknown") {
+            r(unknown_textures)(unknown_closures)(unknown_attributes);
+        } else if (rec == "globals_rw") {
+            r(globals_read)(globals_write);
+        } else if (rec == "string") {
+            strings.emplace_back();
+            r(strings.back());
+        } else if (rec == "ptr") {
+            JitCachePtr ptr;
+            r(ptr.symbol)(ptr.kind)(ptr.name);
+            ptrs.push_back(ptr);
+        } else if (rec == "object") {
+            r(object_size);
+            r.ok &= object_size >= 0 && Strutil::parse_char(r.in, '\n', false)
+                    && size_t(object_size) == r.in.size();
+        } else {
+            r.ok = false;
+        }
+    }
+    if (!r.ok)
+        return false;
+
+    // The code refers to strings only by their hashes, which the shadeops
+    // turn back into strings, so make sure they all exist.
+    for (auto&& str : strings)
+        ustring s(str);
+
+    RunLLVMGroupFunc init_func = (RunLLVMGroupFunc)empty_group_func;
+    std::vector<RunLLVMGroupFunc> layer_funcs(nlayers, nullptr);
+    if (!does_nothing) {
+        // Find this process's addresses for the pointers in the code
+        for (auto&& ptr : ptrs) {
+            void* p = nullptr;
+            if (ptr.kind == "renderer") {
+                p = shadingsys().renderer();
+            } else if (ptr.kind == "texture") {
+                p = renderer()->get_texture_handle(ptr.name, shadingcontext(),
+                                                   nullptr);
+            } else if (ptr.kind == "prepare" || ptr.kind == "setup") {
+                const ClosureRegistry::ClosureEntry* clentry
+                    = shadingsys().find_closure(ptr.name);
+                if (clentry)
+                    p = ptr.kind == "prepare" ? (void*)clentry->prepare
+                                              : (void*)clentry->setup;
+            }
+            if (!p)
+                return false;
+            ll.add_jit_symbol(ptr.symbol, p);
+        }
+
+        std::string err;
+        ll.module(ll.new_module("jit_cache"));
+        if (!ll.make_jit_execengine(&err,
+                                    ll.lookup_isa_by_name(
+                                        shadingsys().m_llvm_jit_target),
+                                    false /*debugging_symbols*/,
+                                    false /*profiling_events*/)) {
+            ll.module(NULL);
+            return false;
+        }
+        initialize_llvm_helper_function_map();
+        ll.InstallLazyFunctionCreator(helper_function_lookup);
+        bool ok = ll.add_jit_object(r.in, &err);
+        if (ok && init_name.size()) {  // a fused group has no init
+            init_func = (RunLLVMGroupFunc)ll.getPointerToFunction(init_name);
+            ok        = init_func != nullptr;
+        }
+        for (int layer = 0; layer < nlayers && ok; ++layer) {
+            if (layer_names[layer].size()) {
+                layer_funcs[layer] = (RunLLVMGroupFunc)ll.getPointerToFunction(
+                    layer_names[layer]);
+                ok = layer_funcs[layer] != nullptr;
+            }
+        }
+        if (!ok) {
+            ll.execengine(NULL);
+            ll.module(NULL);
+            return false;
+        }
+    }
+
+    // Everything checks out, so now set up the group as the optimizer and
+    // run() would have.
+    for (int layer = 0; layer < nlayers; ++layer) {
+        ShaderInstance* inst = g[layer];
+        inst->copy_code_from_master(g);
+        for (auto&& sym : inst->symbols())
+            sym.layer(layer);
+    }
+    for (auto&& p : params)
+        g[p.layer]->symbol(p.index)->dataoffset(p.offset);
+    g.does_nothing(does_nothing);
+    g.llvm_groupdata_size(groupdata_size);
+    g.m_textures_needed           = textures;
+    g.m_closures_needed           = closures;
+    g.m_globals_needed            = globals;
+    g.m_unknown_textures_needed   = unknown_textures;
+    g.m_unknown_closures_needed   = unknown_closures;
+    g.m_unknown_attributes_needed = unknown_attributes;
+    g.m_globals_read              = globals_read;
+    g.m_globals_write             = globals_write;
+    for (size_t i = 0, n = userdata.size(); i < n; ++i) {
+        // The initial value is the parameter's own
+        UserDataNeeded& u(userdata[i]);
+        u.data = g[u.layer_num]->symbol(userdata_params[i])->data();
+        g.m_userdata_names.push_back(u.name);
+        g.m_userdata_types.push_back(u.type);
+        g.m_userdata_derivs.push_back(u.derivs);
+        g.m_userdata_layers.push_back(u.layer_num);
+        g.m_userdata_init_vals.push_back(u.data);
+    }
+    g.m_userdata_offsets  = userdata_offsets;
+    g.m_attributes_needed = attributes;
+    g.m_attribute_scopes  = attribute_scopes;
+    g.m_attribute_types   = attribute_types;
+
+    g.llvm_compiled_init(init_func);
+    if (does_nothing) {
+        g.llvm_compiled_version(init_func);
+    } else {
+        for (int layer = 0; layer < nlayers; ++layer)
+            if (layer_funcs[layer])
+                g.llvm_compiled_layer(layer, layer_funcs[layer]);
+        g.llvm_compiled_version(g.num_entry_layers()
+                                    ? nullptr
+                                    : g.llvm_compiled_layer(nlayers - 1));
+        if (m_profile_layers)
+            g.m_profile.reset(new GroupProfile(nlayers));
+        g.m_llvm_jit_memory.push_back(ll.jit_memory());
+        ll.execengine(NULL);
+        ll.module(NULL);
+    }
+
+    m_stat_llvm_jit_time   = timer();
+    m_stat_total_llvm_time = m_stat_llvm_jit_time;
+    if (shadingsys().m_compile_report)
+        shadingcontext()->infofmt("Loaded shader group {} from the JIT cache",
+                                  g.name());
+    return true;
+}
+
+
 };  // namespace pvt
 OSL_NAMESPACE_EXIT
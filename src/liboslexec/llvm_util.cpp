@@ -3,10 +3,13 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <atomic>
 #include <cinttypes>
 #include <memory>
+#include <unordered_map>
 
 #include <OpenImageIO/fmath.h>
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/thread.h>
 
 #include <OSL/llvm_util.h>
@@ -63,9 +66,11 @@
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Object/ObjectFile.h>
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/PrettyStackTrace.h>
@@ -158,19 +163,35 @@ typedef llvm::Error LLVMErr;
 
 namespace {
 
-// NOTE: This is a COPY of something internal to LLVM, but since we destroy
-// our LLVMMemoryManager via global variables we can't rely on the LLVM copy
-// sticking around. Because of this, the variable must be declared _before_
-// jitmm_hold so that the object stays valid until after we have destroyed
-// all our memory managers.
+// Bytes of JIT memory currently mapped by all our memory managers
+static std::atomic<size_t> jit_memory_mapped(0);
+
+inline size_t
+block_size(const llvm::sys::MemoryBlock& block)
+{
+#if OSL_LLVM_VERSION >= 100
+    return block.allocatedSize();
+#else
+    return block.size();
+#endif
+}
+
+// NOTE: This is a COPY of something internal to LLVM, but since the memory
+// managers may be destroyed late (by whoever holds the last reference to
+// the code) we can't rely on the LLVM copy sticking around. It also counts
+// the memory mapped for JITed code.
 struct DefaultMMapper final : public llvm::SectionMemoryManager::MemoryMapper {
     llvm::sys::MemoryBlock allocateMappedMemory(
         llvm::SectionMemoryManager::AllocationPurpose /*Purpose*/,
         size_t NumBytes, const llvm::sys::MemoryBlock* const NearBlock,
         unsigned Flags, std::error_code& EC) override
     {
-        return llvm::sys::Memory::allocateMappedMemory(NumBytes, NearBlock,
-                                                       Flags, EC);
+        llvm::sys::MemoryBlock block
+            = llvm::sys::Memory::allocateMappedMemory(NumBytes, NearBlock,
+                                                      Flags, EC);
+        if (!EC)
+            jit_memory_mapped += block_size(block);
+        return block;
     }
 
     std::error_code protectMappedMemory(const llvm::sys::MemoryBlock& Block,
@@ -181,15 +202,17 @@ struct DefaultMMapper final : public llvm::SectionMemoryManager::MemoryMapper {
 
     std::error_code releaseMappedMemory(llvm::sys::MemoryBlock& M) override
     {
-        return llvm::sys::Memory::releaseMappedMemory(M);
+        size_t size        = block_size(M);
+        std::error_code EC = llvm::sys::Memory::releaseMappedMemory(M);
+        if (!EC)
+            jit_memory_mapped -= size;
+        return EC;
     }
 };
 static DefaultMMapper llvm_default_mapper;
 
 static OIIO::spin_mutex llvm_global_mutex;
 static bool setup_done = false;
-static std::unique_ptr<std::vector<std::shared_ptr<LLVMMemoryManager>>>
-    jitmm_hold;
 static int jit_mem_hold_users = 0;
 
 
@@ -201,15 +224,11 @@ llvm::raw_os_ostream raw_cout(std::cout);
 
 
 
-// ScopedJitMemoryUser will keep jitmm_hold alive until the last instance
-// is gone then the it will be freed.
+// JITed code is now owned by the holders of jit_memory(), so the
+// ScopedJitMemoryUser only counts the users.
 LLVM_Util::ScopedJitMemoryUser::ScopedJitMemoryUser()
 {
     OIIO::spin_lock lock(llvm_global_mutex);
-    if (jit_mem_hold_users == 0) {
-        OSL_ASSERT(!jitmm_hold);
-        jitmm_hold.reset(new std::vector<std::shared_ptr<LLVMMemoryManager>>());
-    }
     ++jit_mem_hold_users;
 }
 
@@ -219,26 +238,25 @@ LLVM_Util::ScopedJitMemoryUser::~ScopedJitMemoryUser()
     OIIO::spin_lock lock(llvm_global_mutex);
     OSL_ASSERT(jit_mem_hold_users > 0);
     --jit_mem_hold_users;
-    if (jit_mem_hold_users == 0) {
-        jitmm_hold.reset();
-    }
 }
 
 
 
-// We hold certain things (LLVM context and custom JIT memory manager)
-// per thread and retained across LLVM_Util invocations.
+// We hold certain things (the LLVM context) per thread and retained
+// across LLVM_Util invocations.
 struct LLVM_Util::PerThreadInfo::Impl {
     Impl() {}
     ~Impl()
     {
+        libraries.clear();  // before the context they belong to
         delete llvm_context;
-        // N.B. Do NOT delete the jitmm -- another thread may need the
-        // code! Don't worry, we stashed a pointer in jitmm_hold.
     }
 
     llvm::LLVMContext* llvm_context = nullptr;
-    LLVMMemoryManager* llvm_jitmm   = nullptr;
+    // Function libraries, by the address of their bitcode, which are
+    // materialized on demand (see module_from_library). They live as long
+    // as the context, which may outlive a PerThreadInfo (see ContextPool).
+    std::unordered_map<const char*, std::unique_ptr<llvm::Module>> libraries;
 };
 
 
@@ -247,7 +265,10 @@ LLVM_Util::PerThreadInfo::~PerThreadInfo()
 {
     // Make sure destructor to PerThreadInfoImpl is only called here
     // where we know the definition of the owned PerThreadInfoImpl;
-    delete m_thread_info;
+    if (m_pool && m_thread_info)
+        m_pool->release(m_thread_info);
+    else
+        delete m_thread_info;
 }
 
 
@@ -256,20 +277,46 @@ LLVM_Util::PerThreadInfo::Impl*
 LLVM_Util::PerThreadInfo::get() const
 {
     if (!m_thread_info)
-        m_thread_info = new Impl();
+        m_thread_info = m_pool ? m_pool->acquire() : new Impl();
     return m_thread_info;
 }
 
 
 
+LLVM_Util::ContextPool::~ContextPool()
+{
+    for (PerThreadInfo::Impl* impl : m_free)
+        delete impl;
+}
+
+
+
+LLVM_Util::PerThreadInfo::Impl*
+LLVM_Util::ContextPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_free.empty())
+        return new PerThreadInfo::Impl();
+    PerThreadInfo::Impl* impl = m_free.back();
+    m_free.pop_back();
+    return impl;
+}
+
+
+
+void
+LLVM_Util::ContextPool::release(PerThreadInfo::Impl* impl)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free.push_back(impl);
+}
+
+
+
 size_t
 LLVM_Util::total_jit_memory_held()
 {
-    // FIXME: This can't possibly be correct. It will always return 0,
-    // since jitmem is a local variable.
-    size_t jitmem = 0;
-    OIIO::spin_lock lock(llvm_global_mutex);
-    return jitmem;
+    return jit_memory_mapped;
 }
 
 
@@ -280,8 +327,26 @@ LLVM_Util::total_jit_memory_held()
 class LLVM_Util::MemoryManager final : public LLVMMemoryManager {
 protected:
     LLVMMemoryManager* mm;  // the real one
+    // Symbols added with add_jit_symbol
+    const std::unordered_map<std::string, void*>& m_symbols;
+
+    void* jit_symbol(const std::string& Name) const
+    {
+        auto found = m_symbols.find(Name);
+#ifdef __APPLE__
+        // The JIT asks for the mangled name, which has a global prefix
+        if (found == m_symbols.end() && Name.size() && Name[0] == '_')
+            found = m_symbols.find(Name.substr(1));
+#endif
+        return found != m_symbols.end() ? found->second : nullptr;
+    }
+
 public:
-    MemoryManager(LLVMMemoryManager* realmm) : mm(realmm) {}
+    MemoryManager(LLVMMemoryManager* realmm,
+                  const std::unordered_map<std::string, void*>& symbols)
+        : mm(realmm), m_symbols(symbols)
+    {
+    }
 
     void notifyObjectLoaded(llvm::ExecutionEngine* EE,
                             const llvm::object::ObjectFile& oi) override
@@ -321,6 +386,9 @@ public:
 
     llvm::JITSymbol findSymbol(const std::string& Name) override
     {
+        if (void* addr = jit_symbol(Name))
+            return llvm::JITSymbol(llvm::JITTargetAddress(addr),
+                                   llvm::JITSymbolFlags::Exported);
         return mm->findSymbol(Name);
     }
 
@@ -365,6 +433,8 @@ public:
 
     uint64_t getSymbolAddress(const std::string& Name) override
     {
+        if (void* addr = jit_symbol(Name))
+            return uint64_t(addr);
         return mm->getSymbolAddress(Name);
     }
 
@@ -376,6 +446,33 @@ public:
 
 
 
+/// ObjectCache - An llvm::ObjectCache that keeps a copy of the object
+/// file MCJIT compiles, so that it can be saved and loaded again later (see
+/// jit_object() and add_jit_object()). It never supplies objects itself:
+/// a saved object is loaded with ExecutionEngine::addObjectFile, without
+/// going through a module.
+class LLVM_Util::ObjectCache final : public llvm::ObjectCache {
+public:
+    void notifyObjectCompiled(const llvm::Module* /*M*/,
+                              llvm::MemoryBufferRef obj) override
+    {
+        m_object = obj.getBuffer().str();
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer>
+    getObject(const llvm::Module* /*M*/) override
+    {
+        return nullptr;
+    }
+
+    const std::string& object() const { return m_object; }
+
+private:
+    std::string m_object;
+};
+
+
+
 class LLVM_Util::IRBuilder final
     : public llvm::IRBuilder<llvm::ConstantFolder,
                              llvm::IRBuilderDefaultInserter> {
@@ -424,7 +521,6 @@ LLVM_Util::LLVM_Util(const PerThreadInfo& per_thread_info, int debuglevel,
     , m_llvm_context(NULL)
     , m_llvm_module(NULL)
     , m_builder(NULL)
-    , m_llvm_jitmm(NULL)
     , m_current_function(NULL)
     , m_llvm_module_passes(NULL)
     , m_llvm_func_passes(NULL)
@@ -459,19 +555,12 @@ LLVM_Util::LLVM_Util(const PerThreadInfo& per_thread_info, int debuglevel,
 #endif
             //static SetCommandLineOptionsForLLVM sSetCommandLineOptionsForLLVM;
         }
-
-        if (!m_thread->llvm_jitmm) {
-            m_thread->llvm_jitmm = new LLVMMemoryManager(&llvm_default_mapper);
-            OSL_DASSERT(m_thread->llvm_jitmm);
-            OSL_ASSERT(
-                jitmm_hold
-                && "An instance of OSL::pvt::LLVM_Util::ScopedJitMemoryUser must exist with a longer lifetime than this LLVM_Util object");
-            jitmm_hold->emplace_back(m_thread->llvm_jitmm);
-        }
-        // Hold the REAL manager and use it as an argument later
-        m_llvm_jitmm = m_thread->llvm_jitmm;
     }
 
+    // Each LLVM_Util JITs into its own memory, which is freed when the
+    // last reference to it (see jit_memory()) is gone.
+    m_llvm_jitmm = std::make_shared<LLVMMemoryManager>(&llvm_default_mapper);
+
     OSL_ASSERT(m_thread->llvm_context);
     m_llvm_context = m_thread->llvm_context;
 
@@ -583,8 +672,9 @@ LLVM_Util::~LLVM_Util()
     delete m_builder;
     delete m_llvm_debug_builder;
     delete m_nvptx_target_machine;
+    delete m_object_cache;
     module(NULL);
-    // DO NOT delete m_llvm_jitmm;  // just the dummy wrapper around the real MM
+    // m_llvm_jitmm lives on as long as someone holds jit_memory()
 }
 
 
@@ -631,6 +721,12 @@ LLVM_Util::SetupLLVM()
             "PreventBitMasksFromBeingLiveinsToBasicBlocks<16>",
             "Prevent Bit Masks <16xi1> From Being Liveins To Basic Blocks Pass",
             false /* Only looks at CFG */, false /* Analysis Pass */);
+    static llvm::RegisterPass<
+        LegacyPreventBitMasksFromBeingLiveinsToBasicBlocks<4>>
+        sRegCustomPass2(
+            "PreventBitMasksFromBeingLiveinsToBasicBlocks<4>",
+            "Prevent Bit Masks <4xi1> From Being Liveins To Basic Blocks Pass",
+            false /* Only looks at CFG */, false /* Analysis Pass */);
 #endif
 
     if (debug()) {
@@ -1010,6 +1106,153 @@ LLVM_Util::module_from_bitcode(const char* bitcode, size_t size,
 }
 
 
+llvm::Module*
+LLVM_Util::module_from_library(const char* bitcode, size_t size,
+                               const std::string& name, std::string* err)
+{
+    if (err)
+        err->clear();
+    std::unique_ptr<llvm::Module>& library = m_thread->libraries[bitcode];
+    if (!library) {
+        library.reset(module_from_bitcode(bitcode, size, name, err));
+        if (!library)
+            return nullptr;
+    }
+    m_library = library.get();
+    llvm::ValueToValueMapTy vmap;
+    return llvm::CloneModule(*m_library, vmap,
+                             [](const llvm::GlobalValue*) { return false; })
+        .release();
+}
+
+
+
+bool
+LLVM_Util::link_library_functions(std::string* err)
+{
+    if (err)
+        err->clear();
+    if (!m_library)
+        return true;
+
+    // Find everything in the library that the module uses, directly or
+    // through other library code, materializing the functions as we go.
+    std::unordered_set<const llvm::GlobalValue*> needed;
+    std::vector<llvm::GlobalValue*> worklist;
+    auto need = [&](llvm::GlobalValue* gv) {
+        if (needed.insert(gv).second)
+            worklist.push_back(gv);
+    };
+    for (llvm::GlobalValue& gv : m_llvm_module->global_values()) {
+        if (gv.isDeclaration() && !gv.use_empty())
+            if (llvm::GlobalValue* libgv = m_library->getNamedValue(
+                    gv.getName()))
+                need(libgv);
+    }
+    std::unordered_set<const llvm::User*> scanned;
+    std::vector<const llvm::User*> users;
+    while (!worklist.empty()) {
+        llvm::GlobalValue* gv = worklist.back();
+        worklist.pop_back();
+        if (gv->isMaterializable()) {
+            LLVMErr e = gv->materialize();
+            if (error_string(std::move(e), err))
+                return false;
+        }
+        // The value's own operands (initializer, aliasee, personality)
+        // and, for a function, those of its instructions.
+        users.push_back(gv);
+        if (auto func = llvm::dyn_cast<llvm::Function>(gv))
+            for (llvm::BasicBlock& bb : *func)
+                for (llvm::Instruction& inst : bb)
+                    users.push_back(&inst);
+        while (!users.empty()) {
+            const llvm::User* user = users.back();
+            users.pop_back();
+            for (const llvm::Use& op : user->operands()) {
+                const llvm::Value* v = op.get();
+                if (auto opgv = llvm::dyn_cast<llvm::GlobalValue>(v))
+                    need(const_cast<llvm::GlobalValue*>(opgv));
+                else if (auto c = llvm::dyn_cast<llvm::Constant>(v))
+                    if (scanned.insert(c).second)
+                        users.push_back(c);
+            }
+        }
+    }
+    if (needed.empty())
+        return true;
+
+    // The module already declares everything in the library, so copy the
+    // needed definitions straight into those declarations rather than
+    // cloning the library again and linking it in.
+    llvm::ValueToValueMapTy vmap;
+    for (llvm::GlobalValue& libgv : m_library->global_values())
+        if (llvm::GlobalValue* gv = m_llvm_module->getNamedValue(
+                libgv.getName()))
+            vmap[&libgv] = gv;
+    auto copy_comdat = [&](llvm::GlobalObject* dst,
+                           const llvm::GlobalObject* src) {
+        if (const llvm::Comdat* sc = src->getComdat()) {
+            llvm::Comdat* dc = m_llvm_module->getOrInsertComdat(sc->getName());
+            dc->setSelectionKind(sc->getSelectionKind());
+            dst->setComdat(dc);
+        }
+    };
+    for (const llvm::GlobalValue* libgv : needed) {
+        auto dst = llvm::dyn_cast_or_null<llvm::GlobalValue>(
+            (llvm::Value*)vmap.lookup(libgv));
+        if (!dst) {
+            if (err)
+                *err = fmtformat("'{}' is not declared in the module",
+                                 libgv->getName().str());
+            return false;
+        }
+        if (!dst->isDeclaration())
+            continue;  // The module defines its own
+        if (auto src = llvm::dyn_cast<llvm::Function>(libgv)) {
+            auto f = llvm::cast<llvm::Function>(dst);
+            auto arg = f->arg_begin();
+            for (const llvm::Argument& a : src->args()) {
+                arg->setName(a.getName());
+                vmap[&a] = &*arg++;
+            }
+            llvm::SmallVector<llvm::ReturnInst*, 8> returns;
+#if OSL_LLVM_VERSION >= 130
+            llvm::CloneFunctionInto(
+                f, src, vmap, llvm::CloneFunctionChangeType::DifferentModule,
+                returns);
+#else
+            llvm::CloneFunctionInto(f, src, vmap, /*ModuleLevelChanges=*/true,
+                                    returns);
+#endif
+            if (src->hasPersonalityFn())
+                f->setPersonalityFn(
+                    llvm::MapValue(src->getPersonalityFn(), vmap));
+            copy_comdat(f, src);
+        } else if (auto src = llvm::dyn_cast<llvm::GlobalVariable>(libgv)) {
+            auto var = llvm::cast<llvm::GlobalVariable>(dst);
+            if (src->hasInitializer())
+                var->setInitializer(
+                    llvm::MapValue(src->getInitializer(), vmap));
+            copy_comdat(var, src);
+        } else if (auto src = llvm::dyn_cast<llvm::GlobalAlias>(libgv)) {
+            // Declared as a function or variable, so make the real alias
+            auto alias = llvm::GlobalAlias::create(
+                src->getValueType(), src->getAddressSpace(), src->getLinkage(),
+                "", llvm::MapValue(src->getAliasee(), vmap), m_llvm_module);
+            alias->copyAttributesFrom(src);
+            alias->takeName(dst);
+            dst->replaceAllUsesWith(alias);
+            dst->eraseFromParent();
+            continue;
+        }
+        dst->setLinkage(libgv->getLinkage());
+    }
+    return true;
+}
+
+
+
 void
 LLVM_Util::push_function_mask(llvm::Value* startMaskValue)
 {
@@ -1507,7 +1750,7 @@ LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
     // We are actually holding a LLVMMemoryManager
     engine_builder.setMCJITMemoryManager(
         std::unique_ptr<llvm::RTDyldMemoryManager>(
-            new MemoryManager(m_llvm_jitmm)));
+            new MemoryManager(m_llvm_jitmm.get(), m_jit_symbols)));
 
 #if OSL_LLVM_VERSION >= 180
     engine_builder.setOptLevel(jit_aggressive()
@@ -1584,6 +1827,9 @@ LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
     if (!m_llvm_exec)
         return NULL;
 
+    if (m_object_cache)
+        m_llvm_exec->setObjectCache(m_object_cache);
+
     //const llvm::DataLayout & data_layout = m_llvm_exec->getDataLayout();
     //OSL_DEV_ONLY(std::cout << "data_layout.getStringRepresentation()=" << data_layout.getStringRepresentation() << std::endl);
 
@@ -1785,6 +2031,62 @@ LLVM_Util::execengine(llvm::ExecutionEngine* exec)
 
 
 
+void
+LLVM_Util::capture_jit_object(bool capture)
+{
+    if (capture && !m_object_cache)
+        m_object_cache = new ObjectCache;
+    if (m_llvm_exec)
+        m_llvm_exec->setObjectCache(capture ? m_object_cache : nullptr);
+    if (!capture) {
+        delete m_object_cache;
+        m_object_cache = nullptr;
+    }
+}
+
+
+
+const std::string&
+LLVM_Util::jit_object() const
+{
+    static const std::string none;
+    return m_object_cache ? m_object_cache->object() : none;
+}
+
+
+
+bool
+LLVM_Util::add_jit_object(string_view object, std::string* err)
+{
+    // Check that it really is an object file before handing it to the JIT,
+    // which treats a malformed object as a fatal error.
+    auto buf = llvm::MemoryBuffer::getMemBufferCopy(
+        llvm::StringRef(object.data(), object.size()), "jit_object");
+    auto obj = llvm::object::ObjectFile::createObjectFile(
+        buf->getMemBufferRef());
+    if (!obj) {
+        std::string msg = llvm::toString(obj.takeError());
+        if (err)
+            *err = msg;
+        return false;
+    }
+    execengine()->addObjectFile(
+        llvm::object::OwningBinary<llvm::object::ObjectFile>(std::move(*obj),
+                                                             std::move(buf)));
+    m_ModuleIsFinalized = false;
+    return true;
+}
+
+
+
+void
+LLVM_Util::add_jit_symbol(string_view name, void* addr)
+{
+    m_jit_symbols[std::string(name)] = addr;
+}
+
+
+
 llvm::TargetMachine*
 LLVM_Util::nvptx_target_machine()
 {
@@ -1858,6 +2160,19 @@ LLVM_Util::getPointerToFunction(llvm::Function* func)
 }
 
 
+void*
+LLVM_Util::getPointerToFunction(const std::string& name)
+{
+    llvm::ExecutionEngine* exec = execengine();
+    if (!m_ModuleIsFinalized) {
+        exec->finalizeObject();
+        m_ModuleIsFinalized = true;
+    }
+    return (void*)exec->getFunctionAddress(name);
+}
+
+
+
 void
 LLVM_Util::add_global_mapping(const char* global_var_name,
                               void* global_var_addr)
@@ -1875,17 +2190,19 @@ LLVM_Util::InstallLazyFunctionCreator(void* (*P)(const std::string&))
 
 
 void
-LLVM_Util::setup_optimization_passes(int optlevel, bool target_host)
+LLVM_Util::setup_optimization_passes(int optlevel, bool target_host,
+                                     bool batched)
 {
 #ifdef OSL_LLVM_NEW_PASS_MANAGER
-    setup_new_optimization_passes(optlevel, target_host);
+    setup_new_optimization_passes(optlevel, target_host, batched);
 #else
-    setup_legacy_optimization_passes(optlevel, target_host);
+    setup_legacy_optimization_passes(optlevel, target_host, batched);
 #endif
 }
 
 void
-LLVM_Util::setup_new_optimization_passes(int optlevel, bool target_host)
+LLVM_Util::setup_new_optimization_passes(int optlevel, bool target_host,
+                                         bool batched)
 {
 #ifdef OSL_LLVM_NEW_PASS_MANAGER
 #    if OSL_LLVM_VERSION <= 110
@@ -2284,8 +2601,10 @@ LLVM_Util::setup_new_optimization_passes(int optlevel, bool target_host)
     }
     }
 
-    // Add some extra passes if they are needed
-    if (target_host) {
+    // Add some extra passes if they are needed. Only batched code has
+    // wide bit masks; scalar code keeps the default vector width of 4,
+    // which must not pull in the 4-wide mask pass.
+    if (target_host && batched) {
         if (!m_supports_llvm_bit_masks_natively) {
             switch (m_vector_width) {
             case 16: {
@@ -2304,9 +2623,14 @@ LLVM_Util::setup_new_optimization_passes(int optlevel, bool target_host)
                             context())));
                 break;
             }
-            case 4:
-                // We don't use masking or SIMD shading for 4-wide
+            case 4: {
+                // MUST BE THE FINAL PASS!
+                m_new_pass_manager->module_pass_manager.addPass(
+                    createModuleToFunctionPassAdaptor(
+                        NewPreventBitMasksFromBeingLiveinsToBasicBlocks<4>(
+                            context())));
                 break;
+            }
             default:
                 std::cout << "m_vector_width = " << m_vector_width << "\n";
                 OSL_ASSERT(0 && "unsupported bit mask width");
@@ -2317,7 +2641,8 @@ LLVM_Util::setup_new_optimization_passes(int optlevel, bool target_host)
 }
 
 void
-LLVM_Util::setup_legacy_optimization_passes(int optlevel, bool target_host)
+LLVM_Util::setup_legacy_optimization_passes(int optlevel, bool target_host,
+                                            bool batched)
 {
 #ifndef OSL_LLVM_NEW_PASS_MANAGER
 #    if OSL_LLVM_VERSION >= 160
@@ -2603,8 +2928,10 @@ LLVM_Util::setup_legacy_optimization_passes(int optlevel, bool target_host)
     }
     };  // switch(optlevel)
 
-    // Add some extra passes if they are needed
-    if (target_host) {
+    // Add some extra passes if they are needed. Only batched code has
+    // wide bit masks; scalar code keeps the default vector width of 4,
+    // which must not pull in the 4-wide mask pass.
+    if (target_host && batched) {
         if (!m_supports_llvm_bit_masks_natively) {
             switch (m_vector_width) {
             case 16:
@@ -2618,7 +2945,9 @@ LLVM_Util::setup_legacy_optimization_passes(int optlevel, bool target_host)
                     new LegacyPreventBitMasksFromBeingLiveinsToBasicBlocks<8>());
                 break;
             case 4:
-                // We don't use masking or SIMD shading for 4-wide
+                // MUST BE THE FINAL PASS!
+                mpm.add(
+                    new LegacyPreventBitMasksFromBeingLiveinsToBasicBlocks<4>());
                 break;
             default:
                 std::cout << "m_vector_width = " << m_vector_width << "\n";
@@ -3003,7 +3332,8 @@ LLVM_Util::validate_global_mappings(
     std::vector<std::string>& names_of_unmapped_globals)
 {
     for (llvm::GlobalVariable& global : m_llvm_module->globals()) {
-        if (global.hasExternalLinkage()) {
+        if (global.hasExternalLinkage()
+            && !m_jit_symbols.count(global.getName().str())) {
             void* global_addr
                 = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(
                     global.getName().data());
@@ -3517,6 +3847,23 @@ LLVM_Util::constant_ptr(void* p, llvm::PointerType* type)
 
 
 
+llvm::Value*
+LLVM_Util::symbol_ptr(string_view name, llvm::PointerType* type)
+{
+    if (!type)
+        type = type_void_ptr();
+    llvm::StringRef llname(name.data(), name.size());
+    llvm::GlobalVariable* global = module()->getNamedGlobal(llname);
+    if (!global)
+        global = new llvm::GlobalVariable(*module(), type_char(),
+                                          false /*isConstant*/,
+                                          llvm::GlobalValue::ExternalLinkage,
+                                          nullptr, llname);
+    return ptr_cast(global, type);
+}
+
+
+
 llvm::Value*
 LLVM_Util::constant(ustring s)
 {
@@ -3597,7 +3944,8 @@ LLVM_Util::mask_as_int(llvm::Value* mask)
 
         llvm::Value* result = builder().CreateBitCast(mask, intMaskType);
         return builder().CreateZExt(result, type_int());
-    } else if (m_supports_avx) {
+    } else if (m_supports_avx && m_vector_width > 4) {
+        // (4 lanes fit in a 128 bit register, handled below as for SSE4.2)
         switch (m_vector_width) {
         case 16: {
             // We need to do more than a simple cast to an int. Since we
@@ -3950,23 +4298,11 @@ LLVM_Util::op_1st_active_lane_of(llvm::Value* mask)
         // and all types are happy
         intMaskType = type_int8();
         break;
-#if 0  // WIP
-        case 4:
-        {
-            // We can just reinterpret cast a 8 bit mask to a 8 bit integer
-            // and all types are happy
-            intMaskType = type_int8();
-
-//            extended_int_vector_type = (llvm::Type *) llvm::VectorType::get(llvm::Type::getInt32Ty (*m_llvm_context), m_vector_width);
-//            llvm::Value * wide_int_mask = builder().CreateSExt(mask, extended_int_vector_type);
-//
-//            int_reinterpret_cast_vector_type = (llvm::Type *) llvm::Type::getInt128Ty (*m_llvm_context);
-//            zeroConstant = constant128(0);
-//
-//            llvm::Value * mask_as_int =  builder().CreateBitCast (wide_int_mask, int_reinterpret_cast_vector_type);
-            break;
-        }
-#endif
+    case 4:
+        // A 4 bit mask reinterprets as a 4 bit integer, which llvm
+        // legalizes for cttz
+        intMaskType = llvm::Type::getIntNTy(context(), 4);
+        break;
     default: OSL_ASSERT(0 && "unsupported native bit mask width");
     };
 
@@ -4358,6 +4694,16 @@ LLVM_Util::op_return(llvm::Value* retval)
 
 
 
+llvm::Value*
+LLVM_Util::op_read_cycle_counter()
+{
+    llvm::Function* func = llvm::Intrinsic::getDeclaration(
+        module(), llvm::Intrinsic::readcyclecounter);
+    return builder().CreateCall(func);
+}
+
+
+
 void
 LLVM_Util::op_memset(llvm::Value* ptr, int val, int len, int align)
 {
@@ -4455,6 +4801,19 @@ LLVM_Util::op_linearize_8x_indices(llvm::Value* wide_index)
 }
 
 
+llvm::Value*
+LLVM_Util::op_linearize_4x_indices(llvm::Value* wide_index)
+{
+    llvm::Value* strided_indices = op_mul(wide_index, wide_constant(4, 4));
+    llvm::Constant* offsets_to_lane[4]
+        = { constant(0), constant(1), constant(2), constant(3) };
+    llvm::Value* const_vec_offsets = llvm::ConstantVector::get(
+        llvm::ArrayRef<llvm::Constant*>(&offsets_to_lane[0], 4));
+
+    return op_add(strided_indices, const_vec_offsets);
+}
+
+
 std::array<llvm::Value*, 2>
 LLVM_Util::op_split_16x(llvm::Value* vector_val)
 {
@@ -5093,6 +5452,7 @@ LLVM_Util::op_scatter(llvm::Value* wide_val, llvm::Type* src_type,
                 linear_indices = op_linearize_16x_indices(wide_index);
                 break;
             case 8: linear_indices = op_linearize_8x_indices(wide_index); break;
+            case 4: linear_indices = op_linearize_4x_indices(wide_index); break;
             default: OSL_ASSERT(0 && "unsupported vector width for scatter");
             };
         } else {
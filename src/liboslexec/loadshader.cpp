@@ -4,14 +4,17 @@
 
 #include <cmath>  // FIXME: used by timer.h - should be included there
 #include <cstdio>
+#include <future>
 #include <string>
 #include <vector>
 
+#include "mappedfile.h"
 #include "oslexec_pvt.h"
 #include "osoreader.h"
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/hash.h>
+#include <OpenImageIO/parallel.h>
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/thread.h>
 #include <OpenImageIO/timer.h>
@@ -37,7 +40,7 @@ public:
     }
     virtual ~OSOReaderToMaster() {}
     virtual bool parse_file(const std::string& filename);
-    virtual bool parse_memory(const std::string& oso);
+    virtual bool parse_memory(string_view oso);
     virtual void version(const char* specid, int major, int minor);
     virtual void shader(const char* shadertype, const char* name);
     virtual void symbol(SymType symtype, TypeSpec typespec, const char* name);
@@ -86,15 +89,24 @@ OSOReaderToMaster::parse_file(const std::string& filename)
     m_master->m_maincodeend   = 0;
     m_codesection.clear();
     m_codesym = -1;
-    return OSOReader::parse_file(filename) && !m_errors;
+    // Map the file once, both to hash it and to parse it from.
+    MappedFile mapped;
+    if (!mapped.open(filename))
+        return OSOReader::parse_file(filename) && !m_errors;
+    string_view oso(mapped.data(), mapped.size());
+    m_master->m_oso_hash = Strutil::strhash(oso);
+    bool ok = is_binary(oso) ? parse_binary(oso, filename)
+                             : parse_text(oso, filename);
+    return ok && !m_errors;
 }
 
 
 
 bool
-OSOReaderToMaster::parse_memory(const std::string& oso)
+OSOReaderToMaster::parse_memory(string_view oso)
 {
     m_master->m_osofilename   = "<none>";
+    m_master->m_oso_hash      = Strutil::strhash(oso);
     m_master->m_maincodebegin = 0;
     m_master->m_maincodeend   = 0;
     m_codesection.clear();
@@ -558,55 +570,102 @@ ShadingSystemImpl::loadshader(string_view cname)
     }
     ++m_stat_shaders_requested;
     ustring name(cname);
-    lock_guard guard(m_mutex);  // Thread safety
-    ShaderNameMap::const_iterator found = m_shader_masters.find(name);
-    if (found != m_shader_masters.end()) {
+
+    // The first request for a name reads the shader, without holding any
+    // lock, so that different shaders load in parallel. Requests for the
+    // same name that come in meanwhile wait for that load to finish.
+    std::promise<ShaderMaster::ref> loaded;
+    std::shared_future<ShaderMaster::ref> pending;
+    uint64_t load_id = 0;
+    {
+        spin_lock lock(m_shader_masters_mutex);
+        ShaderNameMap::const_iterator found = m_shader_masters.find(name);
+        if (found != m_shader_masters.end()) {
+            pending = found->second.master;
+        } else {
+            load_id                = ++m_shader_load_ids;
+            m_shader_masters[name] = { loaded.get_future().share(), load_id };
+        }
+    }
+    if (pending.valid()) {
         // if (debug())
         //     infofmt("Found {} in shader_masters", name);
-        // Already loaded this shader, return its reference
-        return (*found).second;
+        // Already loaded (or loading) this shader, return its reference
+        return pending.get();
     }
 
     // Not found in the map
+    std::vector<std::string> searchpath;
+    {
+        lock_guard guard(m_mutex);  // Thread safety
+        searchpath = m_searchpath_dirs;
+    }
     OSOReaderToMaster oso(*this);
-    bool testcwd
-        = m_searchpath_dirs.empty();  // test "." if there's no searchpath
+    bool testcwd = searchpath.empty();  // test "." if there's no searchpath
     std::string filename
         = OIIO::Filesystem::searchpath_find(name.string() + ".oso",
-                                            m_searchpath_dirs, testcwd);
+                                            searchpath, testcwd);
     if (filename.empty()) {
         errorfmt("No .oso file could be found for shader \"{}\"", name);
+        // Don't remember the failure, the searchpath may change
+        forget_shader_master(name, load_id);
+        loaded.set_value(nullptr);
         return NULL;
     }
-    OIIO::Timer timer;
-    bool ok                = oso.parse_file(filename);
-    ShaderMaster::ref r    = ok ? oso.master() : nullptr;
-    m_shader_masters[name] = r;
-    double loadtime        = timer();
-    {
-        spin_lock lock(m_stat_mutex);
-        m_stat_master_load_time += loadtime;
-    }
-    if (ok) {
-        ++m_stat_shaders_loaded;
-        infofmt("Loaded \"{}\" (took {})", filename,
-                Strutil::timeintervalformat(loadtime, 2));
-        OSL_DASSERT(r);
-        r->resolve_syms();
-        // if (debug()) {
-        //     std::string s = r->print ();
-        //     if (s.length())
-        //         infofmt("{}", s);
-        // }
-    } else {
-        errorfmt("Unable to read \"{}\"", filename);
+    ShaderMaster::ref r;
+    try {
+        OIIO::Timer timer;
+        bool ok         = oso.parse_file(filename);
+        r               = ok ? oso.master() : nullptr;
+        double loadtime = timer();
+        {
+            spin_lock lock(m_stat_mutex);
+            m_stat_master_load_time += loadtime;
+        }
+        if (ok) {
+            ++m_stat_shaders_loaded;
+            infofmt("Loaded \"{}\" (took {})", filename,
+                    Strutil::timeintervalformat(loadtime, 2));
+            OSL_DASSERT(r);
+            r->resolve_syms();
+            // if (debug()) {
+            //     std::string s = r->print ();
+            //     if (s.length())
+            //         infofmt("{}", s);
+            // }
+        } else {
+            errorfmt("Unable to read \"{}\"", filename);
+        }
+    } catch (...) {
+        // Pass the exception on to the requests waiting for this load,
+        // and let a later request try again.
+        forget_shader_master(name, load_id);
+        loaded.set_exception(std::current_exception());
+        throw;
     }
 
+    // Don't remember a failure, so a later request will try again
+    if (!r)
+        forget_shader_master(name, load_id);
+    loaded.set_value(r);
     return r;
 }
 
 
 
+int
+ShadingSystemImpl::load_shaders(cspan<ustring> names)
+{
+    std::atomic<int> nloaded(0);
+    OIIO::parallel_for(int64_t(0), int64_t(names.size()), [&](int64_t i) {
+        if (loadshader(names[i]))
+            ++nloaded;
+    });
+    return nloaded;
+}
+
+
+
 bool
 ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
                                             string_view buffer)
@@ -622,9 +681,20 @@ ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
     }
 
     ustring name(shadername);
-    lock_guard guard(m_mutex);  // Thread safety
-    ShaderNameMap::const_iterator found = m_shader_masters.find(name);
-    if (found != m_shader_masters.end() && !allow_shader_replacement()) {
+    std::promise<ShaderMaster::ref> loaded;
+    bool exists      = false;
+    uint64_t load_id = 0;
+    {
+        spin_lock lock(m_shader_masters_mutex);
+        ShaderNameMap::const_iterator found = m_shader_masters.find(name);
+        exists = (found != m_shader_masters.end()
+                  && !allow_shader_replacement());
+        if (!exists) {
+            load_id                = ++m_shader_load_ids;
+            m_shader_masters[name] = { loaded.get_future().share(), load_id };
+        }
+    }
+    if (exists) {
         if (debug())
             infofmt("Preload shader {} already exists in shader_masters", name);
         return false;
@@ -632,31 +702,51 @@ ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
 
     // Not found in the map
     OSOReaderToMaster reader(*this);
-    OIIO::Timer timer;
-    bool ok                = reader.parse_memory(buffer);
-    ShaderMaster::ref r    = ok ? reader.master() : nullptr;
-    m_shader_masters[name] = r;
-    double loadtime        = timer();
-    {
-        spin_lock lock(m_stat_mutex);
-        m_stat_master_load_time += loadtime;
-    }
-    if (ok) {
-        ++m_stat_shaders_loaded;
-        infofmt("Loaded \"{}\" (took {})", shadername,
-                Strutil::timeintervalformat(loadtime, 2));
-        OSL_DASSERT(r);
-        r->resolve_syms();
-        // if (debug()) {
-        //     std::string s = r->print ();
-        //     if (s.length())
-        //         infof ("%s", s);
-        // }
-    } else {
-        errorfmt("Unable to parse preloaded shader \"{}\"", shadername);
+    ShaderMaster::ref r;
+    try {
+        OIIO::Timer timer;
+        bool ok         = reader.parse_memory(buffer);
+        r               = ok ? reader.master() : nullptr;
+        double loadtime = timer();
+        {
+            spin_lock lock(m_stat_mutex);
+            m_stat_master_load_time += loadtime;
+        }
+        if (ok) {
+            ++m_stat_shaders_loaded;
+            infofmt("Loaded \"{}\" (took {})", shadername,
+                    Strutil::timeintervalformat(loadtime, 2));
+            OSL_DASSERT(r);
+            r->resolve_syms();
+            // if (debug()) {
+            //     std::string s = r->print ();
+            //     if (s.length())
+            //         infof ("%s", s);
+            // }
+        } else {
+            errorfmt("Unable to parse preloaded shader \"{}\"", shadername);
+        }
+    } catch (...) {
+        forget_shader_master(name, load_id);
+        loaded.set_exception(std::current_exception());
+        throw;
     }
 
-    return ok;
+    if (!r)
+        forget_shader_master(name, load_id);
+    loaded.set_value(r);
+    return r != nullptr;
+}
+
+
+
+void
+ShadingSystemImpl::forget_shader_master(ustring name, uint64_t load_id)
+{
+    spin_lock lock(m_shader_masters_mutex);
+    ShaderNameMap::iterator found = m_shader_masters.find(name);
+    if (found != m_shader_masters.end() && found->second.load_id == load_id)
+        m_shader_masters.erase(found);
 }
 
 
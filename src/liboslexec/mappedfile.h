@@ -0,0 +1,93 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <string>
+
+#ifdef _WIN32
+#    include <OpenImageIO/platform.h>
+#    include <OpenImageIO/strutil.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+// A read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+#else
+        if (m_data)
+            munmap((void*)m_data, m_size);
+#endif
+    }
+
+    bool open(const std::string& filename)
+    {
+#ifdef _WIN32
+        // The filename is UTF-8, which the ANSI API would misread
+        std::wstring wfilename = OIIO::Strutil::utf8_to_utf16wstring(
+            filename);
+        HANDLE file = CreateFileW(wfilename.c_str(), GENERIC_READ,
+                                  FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            m_mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0,
+                                           NULL);
+        CloseHandle(file);
+        if (!m_mapping)
+            return false;
+        m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        m_size = size_t(size.QuadPart);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_PRIVATE,
+                           fd, 0);
+            if (p != MAP_FAILED) {
+                m_data = (const char*)p;
+                m_size = size_t(st.st_size);
+            }
+        }
+        ::close(fd);
+#endif
+        return m_data != nullptr;
+    }
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size      = 0;
+#ifdef _WIN32
+    HANDLE m_mapping = NULL;
+#endif
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
@@ -10,8 +10,8 @@
 /////////////////////////////////////////////////////////////////////////
 // Notes on how messages work:
 //
-// The messages are stored in a ParamValueList in the ShadingContext.
-// For simple types, just slurp them up into the PVL.
+// The messages are stored in a MessageList in the ShadingContext, which
+// finds them by name with a small hash table (MessageIndex).
 //
 // FIXME -- setmessage only stores message values, not derivs, so
 // getmessage only retrieves the values and has zero derivs.
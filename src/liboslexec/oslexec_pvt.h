@@ -4,9 +4,14 @@
 
 #pragma once
 
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <regex>
 #include <set>
 #include <stack>
@@ -66,7 +71,7 @@ OSL_NAMESPACE_ENTER
 
 
 struct PerThreadInfo {
-    PerThreadInfo();
+    PerThreadInfo(LLVM_Util::ContextPool* llvm_pool = nullptr);
     ~PerThreadInfo();
     ShadingContext* pop_context();  ///< Get the pool top and then pop
 
@@ -83,6 +88,7 @@ class ShadingSystemImpl;
 class ShaderInstance;
 typedef std::shared_ptr<ShaderInstance> ShaderInstanceRef;
 class Dictionary;
+class SharedDictionary;
 class RuntimeOptimizer;
 class BackendLLVM;
 #if OSL_USE_BATCHED
@@ -423,7 +429,14 @@ public:
 
     const std::string& osofilename() const { return m_osofilename; }
 
+    /// Hash of the .oso text this master was loaded from.
+    uint64_t oso_hash() const { return m_oso_hash; }
+
     ShaderType shadertype() const { return m_shadertype; }
+
+    /// Number of instructions in the master's code.
+    int num_ops() const { return (int)m_ops.size(); }
+
     string_view shadertypename() const
     {
         return OSL::pvt::shadertypename(m_shadertype);
@@ -445,6 +458,7 @@ private:
     ShaderType m_shadertype;          ///< Type of shader
     std::string m_shadername;         ///< Shader name
     std::string m_osofilename;        ///< Full path of oso file
+    uint64_t m_oso_hash = 0;          ///< Hash of the oso text
     OpcodeVec m_ops;                  ///< Actual code instructions
     std::vector<int> m_args;          ///< Arguments for all the ops
     // Need the code offsets for each code block
@@ -499,6 +513,7 @@ public:
     }
 
     bool empty() const { return m_closure_table.empty(); }
+    int size() const { return int(m_closure_table.size()); }
 
 private:
     // A mapping from name to ID for the compiler
@@ -590,11 +605,20 @@ public:
     void message(const std::string& message) const;
 
     std::string getstats(int level = 1) const;
+    void getstats(ParamValueList& stats, bool groups) const;
+    std::string getstats_json(bool groups) const;
+
+    /// JSON report of the layer profile of a group, or of all the live
+    /// groups that have one if group is null.
+    std::string profile_report(ShaderGroup* group = nullptr) const;
 
     ErrorHandler& errhandler() const { return *m_err; }
 
     ShaderMaster::ref loadshader(string_view name);
 
+    /// Load the named shaders in parallel, returning how many succeeded.
+    int load_shaders(cspan<ustring> names);
+
     PerThreadInfo* create_thread_info();
 
     void destroy_thread_info(PerThreadInfo* threadinfo);
@@ -647,6 +671,7 @@ public:
     int llvm_debugging_symbols() const { return m_llvm_debugging_symbols; }
     int llvm_profiling_events() const { return m_llvm_profiling_events; }
     int llvm_output_bitcode() const { return m_llvm_output_bitcode; }
+    bool llvm_fuse_layers() const { return m_llvm_fuse_layers; }
     bool dump_forced_llvm_bool_symbols() const
     {
         return m_dump_forced_llvm_bool_symbols;
@@ -666,6 +691,7 @@ public:
     bool lazy_trace() const { return m_lazy_trace; }
     bool userdata_isconnected() const { return m_userdata_isconnected; }
     int profile() const { return m_profile; }
+    int profile_layers() const { return m_profile_layers; }
     bool no_noise() const { return m_no_noise; }
     bool no_pointcloud() const { return m_no_pointcloud; }
     bool force_derivs() const { return m_force_derivs; }
@@ -677,6 +703,7 @@ public:
 
     bool llvm_jit_fma() const { return m_llvm_jit_fma; }
     ustring llvm_jit_target() const { return m_llvm_jit_target; }
+    ustring llvm_jit_cache_dir() const { return m_llvm_jit_cache_dir; }
 
     ustring debug_groupname() const { return m_debug_groupname; }
     ustring debug_layername() const { return m_debug_layername; }
@@ -702,6 +729,54 @@ public:
     /// symbol tables down to just parameters.
     void group_post_jit_cleanup(ShaderGroup& group);
 
+    /// Describe everything about the group that determines its optimized
+    /// code: its serialization plus the properties set outside of it.
+    /// Identical descriptions mean identical code.
+    std::string group_code_key(const ShaderGroup& group) const;
+
+    /// Compute the on-disk JIT cache key of the group from its code key,
+    /// the .oso it was built from and the options that affect its code
+    /// generation, or return "" if the group can't be cached. The target
+    /// ISA is added to the key by BackendLLVM.
+    std::string llvm_jit_cache_key(const ShaderGroup& group) const;
+
+    /// Look up the group in the system-wide table of groups, keyed on
+    /// their serialization. If an identical group is already there,
+    /// return it; otherwise record this group as the one that later
+    /// identical groups will share, and return an empty ref. Groups that
+    /// aren't eligible for sharing are never recorded.
+    ShaderGroupRef intern_group(ShaderGroup& group);
+
+    /// Run a pass over all complete groups for which needs_compile()
+    /// is true, calling compile() for each of them. The groups are
+    /// ordered most expensive first and taken one at a time from a shared
+    /// queue by the calling thread and up to nthreads-1 tasks on the OIIO
+    /// thread pool, so that the load balances itself. `kind` names what
+    /// compile() does (e.g., "jit" or "batched8"): if a pass of the same
+    /// kind is already in progress, just help with it. Passes of
+    /// different kinds run side by side.
+    void compile_all_groups(
+        string_view kind, int nthreads,
+        std::function<bool(const ShaderGroup&)> needs_compile,
+        std::function<void(ShaderGroup&, ShadingContext*)> compile);
+
+    /// If compile_all_groups passes are in progress, help with them until
+    /// their queues are empty or done() returns true.
+    void help_compile_all_groups(const std::function<bool()>& done);
+
+    /// Queue a task on the OIIO thread pool that calls compile() for the
+    /// group, unless one was already queued for it with the same `which`
+    /// bit (ShaderGroup::AsyncScalar or AsyncBatched) and is still
+    /// running. The task holds a reference to the group, so the group
+    /// outlives it.
+    void compile_group_async(
+        ShaderGroup& group, int which,
+        std::function<void(ShaderGroup&, ShadingContext*)> compile);
+
+    /// Make `group` share the layers and the optimized and compiled state
+    /// of the identical group `src`.
+    void share_group_code(ShaderGroup& group, const ShaderGroupRef& src);
+
     int* alloc_int_constants(size_t n) { return m_int_pool.alloc(n); }
     float* alloc_float_constants(size_t n) { return m_float_pool.alloc(n); }
     ustring* alloc_string_constants(size_t n) { return m_string_pool.alloc(n); }
@@ -735,8 +810,10 @@ public:
 
     OSLEXECPUBLIC int raytype_bit(ustring name);
 
-    void optimize_all_groups(int nthreads = 0, int mythread = 0,
-                             int totalthreads = 1, bool do_jit = true);
+    /// Optimize (and optionally JIT) all complete groups that haven't
+    /// been already, using up to nthreads threads (<= 0 means use all the
+    /// hardware threads available).
+    void optimize_all_groups(int nthreads = 0, bool do_jit = true);
 
     typedef std::unordered_map<ustring, OpDescriptor> OpDescriptorMap;
 
@@ -767,6 +844,10 @@ public:
 
     std::shared_ptr<OIIO::ColorConfig> colorconfig();
 
+    /// The dictionary documents and query cache shared by all the
+    /// ShadingContexts of this ShadingSystem.
+    std::shared_ptr<SharedDictionary> shared_dictionary();
+
 #if OSL_USE_BATCHED
     // Group all batched methods behind a templated interface
     // so we can support multiple widths
@@ -780,8 +861,7 @@ public:
         /// Ensure that the group has been JITed.
         void jit_group(ShaderGroup& group, ShadingContext* ctx);
 
-        void jit_all_groups(int nthreads = 0, int mythread = 0,
-                            int totalthreads = 1);
+        void jit_all_groups(int nthreads = 0);
     };
 
     template<int WidthT> OSL_FORCEINLINE Batched<WidthT> batched()
@@ -849,8 +929,19 @@ private:
     static const int m_errseenmax = 32;
     mutable mutex m_errmutex;
 
-    typedef std::map<ustring, ShaderMaster::ref> ShaderNameMap;
+    // name -> shader master, which another thread may still be loading.
+    // Each load has its own id, so that a failed load removes only its
+    // own entry, never one that has replaced it since.
+    struct PendingMaster {
+        std::shared_future<ShaderMaster::ref> master;
+        uint64_t load_id = 0;
+    };
+    typedef std::map<ustring, PendingMaster> ShaderNameMap;
     ShaderNameMap m_shader_masters;  ///< name -> shader masters map
+    uint64_t m_shader_load_ids = 0;  ///< Last load id handed out
+    mutable spin_mutex m_shader_masters_mutex;
+    // Remove a failed load from m_shader_masters, so it is tried again
+    void forget_shader_master(ustring name, uint64_t load_id);
 
     ConstantPool<int> m_int_pool;
     ConstantPool<Float> m_float_pool;
@@ -883,9 +974,11 @@ private:
     bool m_range_checking;        ///< Range check arrays & components?
     bool m_connection_error;      ///< Error for ConnectShaders to fail?
     bool m_greedyjit;             ///< JIT as much as we can?
+    bool m_async_jit;             ///< JIT in the background on first use?
     bool m_countlayerexecs;       ///< Count number of layer execs?
     bool m_relaxed_param_typecheck;  ///< Allow parameters to be set from isomorphic types (same data layout)
     int m_profile;                 ///< Level of profiling of shader execution
+    int m_profile_layers;          ///< Time layers and ops in the JIT
     int m_optimize;                ///< Runtime optimization level
     bool m_opt_simplify_param;     ///< Turn instance params into const?
     bool m_opt_constant_fold;      ///< Allow constant folding?
@@ -905,10 +998,13 @@ private:
     bool m_opt_useparam;  ///< Perform extra useparam analysis for culling run layer calls
     bool m_opt_groupdata;  ///< Move eligible parameters out of groupdata into locals
     bool m_opt_batched_analysis;  ///< Perform extra analysis required for batched execution?
+    bool m_opt_merge_groups;  ///< Share code among identical groups?
     bool m_llvm_jit_fma;         ///< Allow fused multiply/add in JIT
     bool m_llvm_jit_aggressive;  ///< Turn on llvm "aggressive" JIT
+    bool m_llvm_fuse_layers;     ///< Inline all layers into one function
     bool m_optimize_nondebug;    ///< Fully optimize non-debug!
     ustring m_llvm_jit_target;   ///< ISA target for JIT
+    ustring m_llvm_jit_cache_dir;  ///< Directory for on-disk JIT cache
     int m_vector_width;          ///< SIMD width maximum (8)
     int m_opt_passes;            ///< Opt passes per layer
     int m_llvm_optimize;         ///< OSL optimization strategy
@@ -968,9 +1064,19 @@ private:
     std::shared_ptr<OIIO::ColorConfig>
         m_colorconfig;  ///< OIIO/OCIO color configuration
 
+    std::shared_ptr<SharedDictionary>
+        m_shared_dictionary;  ///< Parsed dict_find documents and queries
+
     // Thread safety
     mutable mutex m_mutex;
 
+    // Table of shader groups, keyed on their serialization, used to find
+    // identical groups that can share compiled code.
+    std::unordered_map<std::string, std::weak_ptr<ShaderGroup>>
+        m_group_intern_table;
+    size_t m_group_intern_purge_size = 1024;  ///< Size to purge dead entries
+    spin_mutex m_group_intern_mutex;
+
     // Stats
     atomic_int m_stat_shaders_loaded;      ///< Stat: shaders loaded
     atomic_int m_stat_shaders_requested;   ///< Stat: shaders requested
@@ -980,6 +1086,7 @@ private:
     atomic_int m_stat_groupinstances;      ///< Stat: total inst in all groups
     atomic_int m_stat_instances_compiled;  ///< Stat: instances compiled
     atomic_int m_stat_groups_compiled;     ///< Stat: groups compiled
+    atomic_int m_stat_groups_shared;       ///< Stat: groups sharing code
     atomic_int m_stat_empty_instances;     ///< Stat: shaders empty after opt
     atomic_int m_stat_merged_inst;         ///< Stat: number of merged instances
     atomic_int m_stat_merged_inst_opt;     ///< Stat: merged insts after opt
@@ -997,6 +1104,9 @@ private:
     atomic_int m_stat_tex_calls_as_handles;  ///< Stat: texture calls with handles
     atomic_int m_stat_useparam_ops;  ///< Stat: pre-optimization useparam ops
     atomic_int m_stat_call_layers_inserted;  ///< Stat: post-opt layer calls
+    atomic_int m_stat_llvm_jit_cache_hits;    ///< Stat: JIT cache hits
+    atomic_int m_stat_llvm_jit_cache_misses;  ///< Stat: JIT cache misses
+    atomic_int m_stat_groups_async_jitted;    ///< Stat: groups JITed async
     double m_stat_master_load_time;          ///< Stat: time loading masters
     double m_stat_optimization_time;         ///< Stat: time spent optimizing
     double m_stat_opt_locking_time;          ///<   locking time
@@ -1043,6 +1153,9 @@ private:
     ClosureRegistry m_closure_registry;
     std::vector<std::weak_ptr<ShaderGroup>> m_all_shader_groups;
     mutable spin_mutex m_all_shader_groups_mutex;
+    // LLVM contexts (and the shadeops parsed into them) for the
+    // PerThreadInfos we hand out, kept from one PerThreadInfo to the next
+    LLVM_Util::ContextPool m_llvm_context_pool;
 
     // State for entering shader groups -- this is only for the
     // non-threadsafe calls to Parameter/etc that don't take a group
@@ -1051,6 +1164,20 @@ private:
 
     atomic_int m_groups_to_compile_count;
     atomic_int m_threads_currently_compiling;
+    struct CompileQueue;
+    ///< Compile passes in progress, by the kind of compile they do
+    std::map<std::string, std::shared_ptr<CompileQueue>> m_compile_queues;
+    spin_mutex m_compile_queue_mutex;
+    // Background compiles queued by compile_group_async and not yet
+    // finished, guarded by m_async_mutex; m_async_compiles_done is
+    // signaled when the count drops to zero.
+    int m_async_compiles_pending;
+    std::mutex m_async_mutex;
+    std::condition_variable m_async_compiles_done;
+    void async_compile_finished();
+    // Compile groups from the queue until it's empty or done() is true.
+    void drain_compile_queue(CompileQueue& queue,
+                             const std::function<bool()>& done = nullptr);
     mutable std::map<ustring, long long> m_group_profile_times;
     // N.B. group_profile_times is protected by m_stat_mutex.
 
@@ -1607,6 +1734,73 @@ private:
     size_t m_block_offset;   ///< Offset from the start of the current block
 };
 
+/// Hash table from message names to messages, so that getmessage and
+/// setmessage don't have to walk the list of all the messages set so far.
+/// Names are unique within a list of messages, so entries are keyed by
+/// the name's hash alone. It uses open addressing with linear probing,
+/// grows to stay at most half full, and keeps its size across clear() so
+/// that a context doesn't reallocate it for every shade.
+class MessageIndex {
+public:
+    /// Return the message with this name hash, or nullptr.
+    void* find(uint64_t name) const
+    {
+        if (m_slots.empty())
+            return nullptr;
+        const size_t mask = m_slots.size() - 1;
+        for (size_t i = size_t(name) & mask;; i = (i + 1) & mask) {
+            const Slot& slot = m_slots[i];
+            if (!slot.message || slot.name == name)
+                return slot.message;
+        }
+    }
+
+    /// Add a message, whose name must not be in the table yet.
+    void insert(uint64_t name, void* message)
+    {
+        if (2 * (m_count + 1) > m_slots.size())
+            grow();
+        place(name, message);
+        ++m_count;
+    }
+
+    void clear()
+    {
+        if (m_count)
+            std::fill(m_slots.begin(), m_slots.end(), Slot());
+        m_count = 0;
+    }
+
+private:
+    struct Slot {
+        uint64_t name = 0;
+        void* message = nullptr;
+    };
+
+    void place(uint64_t name, void* message)
+    {
+        const size_t mask = m_slots.size() - 1;
+        size_t i          = size_t(name) & mask;
+        while (m_slots[i].message)
+            i = (i + 1) & mask;
+        m_slots[i].name    = name;
+        m_slots[i].message = message;
+    }
+
+    void grow()
+    {
+        std::vector<Slot> old(std::max(size_t(16), 2 * m_slots.size()));
+        m_slots.swap(old);
+        for (const Slot& slot : old)
+            if (slot.message)
+                place(slot.name, slot.message);
+    }
+
+    std::vector<Slot> m_slots;  ///< Power of 2 size
+    size_t m_count = 0;         ///< Number of messages in the table
+};
+
+
 /// Represents a single message for use by getmessage and setmessage opcodes
 ///
 struct Message {
@@ -1645,15 +1839,13 @@ struct MessageList {
     void clear()
     {
         list_head = nullptr;
+        message_index.clear();
         message_data.clear();
     }
 
     const Message* find(ustringhash name) const
     {
-        for (const Message* m = list_head; m; m = m->next)
-            if (m->name == name)
-                return m;  // name matches
-        return nullptr;    // not found
+        return static_cast<const Message*>(message_index.find(name.hash()));
     }
 
     void add(ustringhash name, void* data, const TypeDesc& type, int layeridx,
@@ -1665,10 +1857,12 @@ struct MessageList {
             list_head->data = message_data.alloc(type.size());
             memcpy(list_head->data, data, type.size());
         }
+        message_index.insert(name.hash(), list_head);
     }
 
 private:
     Message* list_head;
+    MessageIndex message_index;
     SimplePool<1024> message_data;
 };
 
@@ -1683,23 +1877,62 @@ struct BatchedMessageBuffer {
     void clear()
     {
         list_head = NULL;
+        message_index.clear();
         message_data.clear();
     }
 
     void* list_head;
+    MessageIndex message_index;
     SimplePool<16 * 1024> message_data;
 };
 
 
 #endif
 
+
+
+/// Cycle counts of a group JITed with the "profile_layers" option. Each
+/// layer has a slot for the cycles spent in its own code and one for each
+/// class of expensive op it runs. The time of a layer doesn't include that
+/// of the layers it runs lazily, nor that of its timed ops, so the slots
+/// add up to the total.
+struct GroupProfile {
+    enum OpClass {
+        Layer = 0,  ///< The layer's own code
+        Texture,
+        Noise,
+        Getattribute,
+        Trace,
+        Pointcloud,
+        Spline,
+        NumOpClasses
+    };
+
+    explicit GroupProfile(int nlayers)
+        : cycles(nlayers * NumOpClasses), calls(nlayers * NumOpClasses)
+    {
+    }
+
+    int nlayers() const { return int(cycles.size()) / NumOpClasses; }
+    static int slot(int layer, int opclass)
+    {
+        return layer * NumOpClasses + opclass;
+    }
+    /// The class of ops timed under this name, or -1 if they aren't timed.
+    static int opclass(ustring opname);
+    static const char* opclass_name(int opclass);
+
+    std::vector<atomic_ll> cycles;  ///< Per slot, from all threads
+    std::vector<atomic_ll> calls;   ///< Per slot, from all threads
+};
+
 };  // namespace pvt
 
 
 
 /// A ShaderGroup consists of one or more layers (each of which is a
 /// ShaderInstance), and the connections among them.
-class ShaderGroup {
+class ShaderGroup : public std::enable_shared_from_this<ShaderGroup> {
 public:
     ShaderGroup(string_view name, ShadingSystemImpl& shadingsys);
     ~ShaderGroup();
@@ -1986,6 +2219,9 @@ private:
     RunLLVMGroupFuncWide m_llvm_compiled_wide_init    = nullptr;
     std::vector<RunLLVMGroupFuncWide> m_llvm_compiled_wide_layers;
 #endif
+    /// Memory of the code the compiled functions point to, freed along
+    /// with the last group that holds it (see LLVM_Util::jit_memory).
+    std::vector<std::shared_ptr<void>> m_llvm_jit_memory;
     std::vector<ShaderInstanceRef> m_layers;
     ustring m_name;
     int m_exec_repeat     = 1;   ///< How many times to execute group
@@ -2014,10 +2250,35 @@ private:
     bool m_unknown_attributes_needed;
     atomic_ll m_executions { 0 };  ///< Number of times the group executed
     atomic_ll m_stat_total_shading_time_ticks { 0 };  // Shading time (ticks)
+    std::unique_ptr<GroupProfile> m_profile;  // If JITed with profile_layers
+
+    // Compile stats of this group, for ShadingSystem::getstats
+    float m_stat_optimization_time = 0;  // Runtime optimization (seconds)
+    float m_stat_llvm_irgen_time   = 0;  // LLVM IR generation (seconds)
+    float m_stat_llvm_opt_time     = 0;  // LLVM optimization (seconds)
+    float m_stat_llvm_jit_time     = 0;  // LLVM JIT (seconds)
+    int m_stat_preopt_ops          = 0;  // Ops before runtime optimization
+    int m_stat_postopt_ops         = 0;  // Ops after runtime optimization
+    int m_stat_preopt_syms         = 0;  // Symbols before optimization
+    int m_stat_postopt_syms        = 0;  // Symbols after optimization
 
     // PTX assembly for compiled ShaderGroup
     std::string m_llvm_ptx_compiled_version;
 
+    // Group portion of the on-disk JIT cache key (empty if not caching)
+    std::string m_llvm_jit_cache_key;
+
+    // If this group is identical to one that was optimized before it, the
+    // group whose layers and compiled code it shares.
+    ShaderGroupRef m_shared_code_group;
+
+    // With "async_jit", the group to run in place of this one until its
+    // background JIT finishes, and which background compiles (AsyncScalar,
+    // AsyncBatched bits) have already been queued.
+    ShaderGroupRef m_async_fallback;
+    std::atomic<int> m_async_queued { 0 };
+    enum { AsyncScalar = 1, AsyncBatched = 2 };
+
     ParamValueList m_pending_params;          // Pending Parameter() values
     std::vector<ParamHints> m_pending_hints;  // ParamHints of pending params
     ustring m_group_use;                      // "Usage" of group
@@ -2094,6 +2355,10 @@ public:
             return context().m_shadingsys;
         }
         OSL_FORCEINLINE ShaderGroup* group() { return context().m_group; }
+        OSL_FORCEINLINE ShaderGroup* code_group()
+        {
+            return context().code_group();
+        }
         OSL_FORCEINLINE BatchedRendererServices<WidthT>* renderer()
         {
             // turn templated call to polymorphic virtual function call
@@ -2263,7 +2528,15 @@ public:
     ///
     ShaderGroup* group() { return m_group; }
     const ShaderGroup* group() const { return m_group; }
-    void group(ShaderGroup* grp) { m_group = grp; }
+    void group(ShaderGroup* grp)
+    {
+        m_group      = grp;
+        m_code_group = nullptr;
+    }
+
+    /// Return the group whose compiled code runs for group(): the group
+    /// itself, or its async fallback while it is being compiled.
+    ShaderGroup* code_group() { return m_code_group ? m_code_group : m_group; }
 
     /// Return a reference to the MessageList containing messages.
     ///
@@ -2334,6 +2607,26 @@ public:
 
     void incr_get_userdata_calls() { ++m_stat_get_userdata_calls; }
 
+    // Start timing a GroupProfile slot at this cycle count, pausing the
+    // one it's nested in.
+    void profile_enter(int slot, long long cycles)
+    {
+        if (m_prof_stack.size())
+            m_prof_cycles[m_prof_stack.back()] += cycles - m_prof_mark;
+        if (!m_prof_calls[slot]++)
+            m_prof_touched.push_back(slot);
+        m_prof_stack.push_back(slot);
+        m_prof_mark = cycles;
+    }
+
+    // Stop timing the innermost slot, resuming the one it's nested in.
+    void profile_exit(long long cycles)
+    {
+        m_prof_cycles[m_prof_stack.back()] += cycles - m_prof_mark;
+        m_prof_stack.pop_back();
+        m_prof_mark = cycles;
+    }
+
     // Clear the stats we record per-execution in this context (unlocked)
     void clear_runtime_stats()
     {
@@ -2349,6 +2642,9 @@ public:
         shadingsys().m_stat_layers_executed += m_stat_layers_executed;
     }
 
+    // Add this execution's GroupProfile counts to the group's.
+    void record_profile();
+
     bool allow_warnings()
     {
         if (m_max_warnings > 0) {
@@ -2417,6 +2713,7 @@ private:
     mutable TextureSystem::Perthread*
         m_texture_thread_info;  ///< Ptr to texture thread info
     ShaderGroup* m_group;       ///< Ptr to shader group
+    ShaderGroup* m_code_group = nullptr;  ///< Group whose code runs instead
     // Heap memory
     std::unique_ptr<char, decltype(&OIIO::aligned_free)> m_heap {
         nullptr, &OIIO::aligned_free
@@ -2434,6 +2731,16 @@ private:
     int m_stat_layers_executed;     ///< Number of layers executed
     long long m_ticks;              ///< Time executing the shader
 
+    // For "profile_layers": per-slot cycles and calls not yet added to the
+    // group's GroupProfile (only the slots in m_prof_touched are nonzero),
+    // the slots being timed, innermost last, and when the innermost one was
+    // last charged. Only this thread touches them, so no locking.
+    std::vector<long long> m_prof_cycles;
+    std::vector<long long> m_prof_calls;
+    std::vector<int> m_prof_touched;
+    std::vector<int> m_prof_stack;
+    long long m_prof_mark = 0;
+
     TextureOpt m_textureopt;                ///< texture call options
     RendererServices::NoiseOpt m_noiseopt;  ///< noise call options
     RendererServices::TraceOpt m_traceopt;  ///< trace call options
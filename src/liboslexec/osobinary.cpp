@@ -0,0 +1,508 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstring>
+#include <iterator>
+
+#include <OpenImageIO/fmath.h>
+
+#include "osobinary.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#    pragma GCC visibility push(hidden)
+#endif
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+namespace {
+
+static const char binary_magic[8] = { 'O', 'S', 'O', 'B', 'I', 'N', 0, 1 };
+static const uint32_t NoString    = ~uint32_t(0);
+
+// Words of the header, after the magic
+enum HeaderWord {
+    NStrings,
+    StringBytes,
+    NSymbols,
+    NValues,
+    NHints,
+    NOps,
+    NArgs,
+    NJumps,
+    NMarkers,
+    SpecID,
+    Major,
+    Minor,
+    ShaderType,
+    ShaderName,
+    ShaderFirstHint,
+    ShaderNHints,
+    HeaderWords
+};
+
+// Arrays that follow the header, in order, with the header word that
+// holds the number of their entries and the words in each entry
+enum Section { Offsets, Symbols, Values, Hints, Ops, Args, Jumps, Markers };
+static const int nsections = Markers + 1;
+static const HeaderWord section_count[] = { NStrings, NSymbols, NValues,
+                                            NHints,   NOps,     NArgs,
+                                            NJumps,   NMarkers };
+static const uint32_t section_words[]   = { 1, 9, 2, 1, 8, 1, 1, 2 };
+
+enum ValueKind { IntValue = 0, FloatValue = 1, StringValue = 2 };
+enum TypeKind { PlainType = 0, ClosureType = 1, StructType = 2 };
+
+
+
+inline void
+put(std::string& out, uint32_t word)
+{
+    if (OIIO::bigendian())
+        OIIO::swap_endian(&word);
+    out.append((const char*)&word, sizeof(word));
+}
+
+
+
+inline void
+put(std::string& out, const std::vector<uint32_t>& words)
+{
+    for (uint32_t w : words)
+        put(out, w);
+}
+
+
+
+// Read-only view of a binary .oso, checked on construction to have all
+// its arrays and strings within the data.
+class BinaryOSO {
+public:
+    explicit BinaryOSO(string_view data) : m_data(data.data())
+    {
+        const size_t headerbytes = sizeof(binary_magic) + 4 * HeaderWords;
+        if (data.size() < headerbytes
+            || memcmp(data.data(), binary_magic, sizeof(binary_magic)))
+            return;
+        size_t offset = headerbytes;
+        for (int s = 0; s < nsections; ++s) {
+            m_count[s]   = header(section_count[s]);
+            m_section[s] = offset;
+            offset += size_t(m_count[s]) * section_words[s] * 4;
+        }
+        m_strings = offset;
+        if (offset + header(StringBytes) != data.size()
+            || (header(StringBytes) && data.back() != 0))
+            return;
+        // Strings must start inside the data, which ends with a 0
+        for (uint32_t i = 0; i < m_count[Offsets]; ++i)
+            if (get(Offsets, i) >= header(StringBytes))
+                return;
+        m_valid = true;
+    }
+
+    bool valid() const { return m_valid; }
+
+    uint32_t header(HeaderWord w) const
+    {
+        return word(sizeof(binary_magic) + 4 * w);
+    }
+
+    uint32_t count(Section s) const { return m_count[s]; }
+
+    // Word of the i-th entry of a section
+    uint32_t get(Section s, uint32_t i, uint32_t field = 0) const
+    {
+        return word(m_section[s] + 4 * (size_t(i) * section_words[s] + field));
+    }
+
+    // Are entries [first,first+n) of the section all there?
+    bool in_range(Section s, uint32_t first, uint32_t n) const
+    {
+        return uint64_t(first) + n <= m_count[s];
+    }
+
+    // The string with this index, or nullptr if there is no such string
+    const char* string(uint32_t index) const
+    {
+        return index < m_count[Offsets]
+                   ? m_data + m_strings + get(Offsets, index)
+                   : nullptr;
+    }
+
+private:
+    uint32_t word(size_t offset) const
+    {
+        uint32_t w;
+        memcpy(&w, m_data + offset, sizeof(w));
+        if (OIIO::bigendian())
+            OIIO::swap_endian(&w);
+        return w;
+    }
+
+    const char* m_data;
+    size_t m_section[nsections] = {};
+    uint32_t m_count[nsections] = {};
+    size_t m_strings            = 0;
+    bool m_valid                = false;
+};
+
+}  // namespace
+
+
+
+bool
+OSOReader::is_binary(string_view data)
+{
+    return data.size() >= sizeof(binary_magic)
+           && !memcmp(data.data(), binary_magic, sizeof(binary_magic));
+}
+
+
+
+bool
+OSOReader::parse_binary(string_view data, string_view sourcename)
+{
+    BinaryOSO oso(data);
+    bool ok = oso.valid();
+
+    auto hints = [&](uint32_t first, uint32_t n) {
+        if (!oso.in_range(Hints, first, n))
+            return false;
+        for (uint32_t h = first; h < first + n; ++h) {
+            const char* s = oso.string(oso.get(Hints, h));
+            if (!s)
+                return false;
+            hint(s);
+        }
+        return true;
+    };
+
+    if (ok) {
+        const char* specid     = oso.string(oso.header(SpecID));
+        const char* shadertype = oso.string(oso.header(ShaderType));
+        const char* shadername = oso.string(oso.header(ShaderName));
+        ok                     = specid && shadertype && shadername;
+        if (ok) {
+            version(specid, int(oso.header(Major)), int(oso.header(Minor)));
+            shader(shadertype, shadername);
+            ok = hints(oso.header(ShaderFirstHint), oso.header(ShaderNHints));
+        }
+    }
+
+    for (uint32_t i = 0, n = oso.count(Symbols); ok && i < n; ++i) {
+        SymType symtype = SymType(oso.get(Symbols, i, 0));
+        if (symtype == SymTypeTemp && stop_parsing_at_temp_symbols())
+            return true;
+        const char* name    = oso.string(oso.get(Symbols, i, 1));
+        uint32_t type       = oso.get(Symbols, i, 2);
+        uint32_t firstvalue = oso.get(Symbols, i, 5);
+        uint32_t nvalues    = oso.get(Symbols, i, 6);
+        TypeDesc simple(TypeDesc::BASETYPE(type & 0xff),
+                        TypeDesc::AGGREGATE((type >> 8) & 0xff),
+                        TypeDesc::VECSEMANTICS((type >> 16) & 0xff));
+        TypeSpec typespec;
+        switch (type >> 24) {
+        case PlainType: typespec = TypeSpec(simple); break;
+        case ClosureType: typespec = TypeSpec(simple, true); break;
+        case StructType: {
+            const char* structname = oso.string(oso.get(Symbols, i, 3));
+            if (structname)
+                typespec = TypeSpec(structname, 0);
+            else
+                ok = false;
+            break;
+        }
+        default: ok = false;
+        }
+        if (int arraylen = int(oso.get(Symbols, i, 4)))
+            typespec.make_array(arraylen);
+        ok = ok && name && symtype < SymTypeLast
+             && oso.in_range(Values, firstvalue, nvalues);
+        if (!ok)
+            break;
+
+        symbol(symtype, typespec, name);
+        for (uint32_t v = firstvalue; ok && v < firstvalue + nvalues; ++v) {
+            uint32_t bits = oso.get(Values, v, 1);
+            switch (oso.get(Values, v, 0)) {
+            case IntValue: symdefault(int(bits)); break;
+            case FloatValue: {
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                symdefault(f);
+                break;
+            }
+            case StringValue:
+                if (const char* s = oso.string(bits))
+                    symdefault(s);
+                else
+                    ok = false;
+                break;
+            default: ok = false;
+            }
+        }
+        ok = ok && hints(oso.get(Symbols, i, 7), oso.get(Symbols, i, 8));
+        if (ok)
+            parameter_done();
+    }
+
+    if (ok && !parse_code_section())
+        return true;
+
+    // Code markers go before the op they are recorded with
+    uint32_t marker = 0;
+    auto markers    = [&](uint32_t op) {
+        for (; marker < oso.count(Markers) && oso.get(Markers, marker, 1) <= op;
+             ++marker) {
+            const char* name = oso.string(oso.get(Markers, marker, 0));
+            if (!name)
+                return false;
+            codemarker(name);
+        }
+        return true;
+    };
+
+    for (uint32_t i = 0, n = oso.count(Ops); ok && i < n; ++i) {
+        const char* opcode = oso.string(oso.get(Ops, i, 0));
+        uint32_t firstarg  = oso.get(Ops, i, 2);
+        uint32_t nargs     = oso.get(Ops, i, 3);
+        uint32_t firstjump = oso.get(Ops, i, 4);
+        uint32_t njumps    = oso.get(Ops, i, 5);
+        ok = markers(i) && opcode && oso.in_range(Args, firstarg, nargs)
+             && oso.in_range(Jumps, firstjump, njumps);
+        if (!ok)
+            break;
+
+        instruction(int(oso.get(Ops, i, 1)), opcode);
+        for (uint32_t a = firstarg; ok && a < firstarg + nargs; ++a) {
+            const char* arg = oso.string(oso.get(Args, a));
+            if (arg)
+                instruction_arg(arg);
+            else
+                ok = false;
+        }
+        for (uint32_t j = firstjump; ok && j < firstjump + njumps; ++j)
+            instruction_jump(int(oso.get(Jumps, j)));
+        ok = ok && hints(oso.get(Ops, i, 6), oso.get(Ops, i, 7));
+        if (ok)
+            instruction_end();
+    }
+
+    ok = ok && markers(oso.count(Ops));
+    if (ok)
+        codeend();
+    else
+        m_err.errorfmt("Failed parse of {} (corrupt binary oso)", sourcename);
+    return ok;
+}
+
+
+
+std::string
+OSOBinaryWriter::data() const
+{
+    std::string out(binary_magic, sizeof(binary_magic));
+    uint32_t stringbytes = 0;
+    for (const std::string& s : m_strings)
+        stringbytes += uint32_t(s.size() + 1);
+    put(out, uint32_t(m_strings.size()));
+    put(out, stringbytes);
+    put(out, uint32_t(m_symbols.size() / section_words[Symbols]));
+    put(out, uint32_t(m_values.size() / section_words[Values]));
+    put(out, uint32_t(m_hints.size()));
+    put(out, uint32_t(m_ops.size() / section_words[Ops]));
+    put(out, uint32_t(m_args.size()));
+    put(out, uint32_t(m_jumps.size()));
+    put(out, uint32_t(m_markers.size() / section_words[Markers]));
+    put(out, m_specid);
+    put(out, uint32_t(m_major));
+    put(out, uint32_t(m_minor));
+    put(out, m_shadertype);
+    put(out, m_shadername);
+    put(out, m_shader_firsthint);
+    put(out, m_shader_nhints);
+
+    uint32_t offset = 0;
+    for (const std::string& s : m_strings) {
+        put(out, offset);
+        offset += uint32_t(s.size() + 1);
+    }
+    put(out, m_symbols);
+    put(out, m_values);
+    put(out, m_hints);
+    put(out, m_ops);
+    put(out, m_args);
+    put(out, m_jumps);
+    put(out, m_markers);
+    for (const std::string& s : m_strings)
+        out.append(s.c_str(), s.size() + 1);
+    return out;
+}
+
+
+
+uint32_t
+OSOBinaryWriter::intern(string_view s)
+{
+    auto found = m_string_index.emplace(s, uint32_t(m_strings.size()));
+    if (found.second)
+        m_strings.emplace_back(s);
+    return found.first->second;
+}
+
+
+
+void
+OSOBinaryWriter::version(const char* specid, int major, int minor)
+{
+    m_specid = intern(specid);
+    m_major  = major;
+    m_minor  = minor;
+}
+
+
+
+void
+OSOBinaryWriter::shader(const char* shadertype, const char* name)
+{
+    m_shadertype       = intern(shadertype);
+    m_shadername       = intern(name);
+    m_shader_firsthint = uint32_t(m_hints.size());
+    m_hint_owner       = ShaderHints;
+}
+
+
+
+void
+OSOBinaryWriter::symbol(SymType symtype, TypeSpec typespec, const char* name)
+{
+    const TypeDesc& simple = typespec.simpletype();
+    uint32_t kind          = PlainType;
+    uint32_t structname    = NoString;
+    if (typespec.structure() > 0) {
+        kind = StructType;
+        if (StructSpec* structspec = typespec.structspec())
+            structname = intern(structspec->name());
+    } else if (typespec.is_closure() || typespec.is_closure_array()) {
+        kind = ClosureType;
+    }
+    uint32_t type = uint32_t(simple.basetype) | uint32_t(simple.aggregate) << 8
+                    | uint32_t(simple.vecsemantics) << 16 | kind << 24;
+    const uint32_t words[] = { uint32_t(symtype),
+                               intern(name),
+                               type,
+                               structname,
+                               uint32_t(simple.arraylen),
+                               uint32_t(m_values.size() / section_words[Values]),
+                               0,
+                               uint32_t(m_hints.size()),
+                               0 };
+    m_symbols.insert(m_symbols.end(), std::begin(words), std::end(words));
+    m_hint_owner = SymbolHints;
+}
+
+
+
+void
+OSOBinaryWriter::value(uint32_t kind, uint32_t bits)
+{
+    OSL_DASSERT(m_symbols.size());
+    m_values.push_back(kind);
+    m_values.push_back(bits);
+    m_symbols[m_symbols.size() - section_words[Symbols] + 6] += 1;
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(int def)
+{
+    value(IntValue, uint32_t(def));
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(float def)
+{
+    uint32_t bits;
+    memcpy(&bits, &def, sizeof(bits));
+    value(FloatValue, bits);
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(const char* def)
+{
+    value(StringValue, intern(def));
+}
+
+
+
+void
+OSOBinaryWriter::hint(string_view hintstring)
+{
+    m_hints.push_back(intern(hintstring));
+    switch (m_hint_owner) {
+    case ShaderHints: m_shader_nhints += 1; break;
+    case SymbolHints:
+        m_symbols[m_symbols.size() - section_words[Symbols] + 8] += 1;
+        break;
+    case OpHints: m_ops[m_ops.size() - section_words[Ops] + 7] += 1; break;
+    }
+}
+
+
+
+void
+OSOBinaryWriter::codemarker(const char* name)
+{
+    m_markers.push_back(intern(name));
+    m_markers.push_back(uint32_t(m_ops.size() / section_words[Ops]));
+}
+
+
+
+void
+OSOBinaryWriter::instruction(int label, const char* opcode)
+{
+    const uint32_t words[] = { intern(opcode),
+                               uint32_t(label),
+                               uint32_t(m_args.size()),
+                               0,
+                               uint32_t(m_jumps.size()),
+                               0,
+                               uint32_t(m_hints.size()),
+                               0 };
+    m_ops.insert(m_ops.end(), std::begin(words), std::end(words));
+    m_hint_owner = OpHints;
+}
+
+
+
+void
+OSOBinaryWriter::instruction_arg(const char* name)
+{
+    m_args.push_back(intern(name));
+    m_ops[m_ops.size() - section_words[Ops] + 3] += 1;
+}
+
+
+
+void
+OSOBinaryWriter::instruction_jump(int target)
+{
+    m_jumps.push_back(uint32_t(target));
+    m_ops[m_ops.size() - section_words[Ops] + 5] += 1;
+}
+
+
+};  // namespace pvt
+OSL_NAMESPACE_EXIT
+
+#if defined(__GNUC__) || defined(__clang__)
+#    pragma GCC visibility pop
+#endif
@@ -0,0 +1,100 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "osoreader.h"
+
+
+
+OSL_NAMESPACE_ENTER
+
+namespace pvt {
+
+// Binary .oso files hold the same information as the text ones, as the
+// sequence of OSOReader callbacks that parsing the text would make, but
+// packed into arrays that need no lexing or parsing and can be read
+// straight from a memory mapping of the file. Every string is stored
+// once, in a table at the end of the file.
+//
+// Layout, all 32 bit little endian words after the magic:
+//
+//     char magic[8]                "OSOBIN" 0 1
+//     nstrings, stringbytes, nsymbols, nvalues, nhints, nops, nargs,
+//     njumps, nmarkers             (sizes of the arrays below)
+//     specid, major, minor         (version)
+//     shadertype, shadername, firsthint, nhints
+//     nstrings x offset            (into the string data)
+//     nsymbols x { symtype, name, type, structname, arraylen,
+//                  firstvalue, nvalues, firsthint, nhints }
+//     nvalues x { kind, bits }     (kind: 0 int, 1 float, 2 string)
+//     nhints x string
+//     nops x { opcode, label, firstarg, nargs, firstjump, njumps,
+//              firsthint, nhints }
+//     nargs x string
+//     njumps x target
+//     nmarkers x { name, op }      (code marker placed before the op)
+//     char strings[stringbytes]    (each one followed by a 0)
+//
+// Strings are referred to by their index in the table, with ~0 meaning
+// none. A symbol's type packs the TypeDesc basetype, aggregate and
+// vecsemantics in its low three bytes, and in the top byte whether it
+// is a plain type (0), a closure (1) or a struct (2, named structname).
+// arraylen is as in TypeDesc (-1 for unsized arrays).
+
+
+
+/// OSOReader that records the callbacks it gets, when it parses a text
+/// .oso, and turns them into a binary .oso.
+class OSOBinaryWriter final : public OSOReader {
+public:
+    OSOBinaryWriter(ErrorHandler* errhandler = nullptr)
+        : OSOReader(errhandler)
+    {
+    }
+
+    /// The binary .oso of what was parsed.
+    std::string data() const;
+
+    void version(const char* specid, int major, int minor) override;
+    void shader(const char* shadertype, const char* name) override;
+    void symbol(SymType symtype, TypeSpec typespec, const char* name) override;
+    void symdefault(int def) override;
+    void symdefault(float def) override;
+    void symdefault(const char* def) override;
+    void hint(string_view hintstring) override;
+    void codemarker(const char* name) override;
+    void instruction(int label, const char* opcode) override;
+    void instruction_arg(const char* name) override;
+    void instruction_jump(int target) override;
+
+private:
+    uint32_t intern(string_view s);
+    void value(uint32_t kind, uint32_t bits);
+
+    enum HintOwner { ShaderHints, SymbolHints, OpHints };
+
+    std::vector<std::string> m_strings;
+    std::unordered_map<std::string, uint32_t> m_string_index;
+    uint32_t m_specid = ~uint32_t(0);
+    int m_major = 0, m_minor = 0;
+    uint32_t m_shadertype = ~uint32_t(0), m_shadername = ~uint32_t(0);
+    uint32_t m_shader_firsthint = 0, m_shader_nhints = 0;
+    HintOwner m_hint_owner = ShaderHints;
+    std::vector<uint32_t> m_symbols;  ///< 9 words per symbol
+    std::vector<uint32_t> m_values;   ///< 2 words per value
+    std::vector<uint32_t> m_hints;
+    std::vector<uint32_t> m_ops;  ///< 8 words per op
+    std::vector<uint32_t> m_args;
+    std::vector<uint32_t> m_jumps;
+    std::vector<uint32_t> m_markers;  ///< 2 words per marker
+};
+
+
+};  // namespace pvt
+OSL_NAMESPACE_EXIT
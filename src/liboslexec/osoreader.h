@@ -41,7 +41,20 @@ public:
     /// Read in OSO from memory, parse, call the various callbacks.
     /// Return true if the OSO code was correctly parsed, false if there was
     /// an unrecoverable error reading.
-    virtual bool parse_memory(const std::string& buffer);
+    virtual bool parse_memory(string_view buffer);
+
+    /// Parse .oso text held in memory, calling the callbacks. The
+    /// sourcename is only used for error messages.
+    bool parse_text(string_view text, string_view sourcename);
+
+    /// Parse a binary .oso (see osobinary.h) held in memory, calling the
+    /// same callbacks as parsing the text would. The strings passed to the
+    /// callbacks point into the data, so they are only valid during the
+    /// call. The sourcename is only used for error messages.
+    bool parse_binary(string_view data, string_view sourcename);
+
+    /// Does the data start like a binary .oso?
+    static bool is_binary(string_view data);
 
     /// Declare the shader version.
     ///
@@ -2,9 +2,23 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cstdarg>
+#include <cstring>
+#include <limits>
+#include <numeric>
 #include <sstream>
 
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/fmath.h>
+#include <OpenImageIO/parallel.h>
+#include <OpenImageIO/strutil.h>
+
+#ifdef USE_PARTIO
+#    include <Partio.h>
+#endif
+
+#include "mappedfile.h"
 #include "pointcloud.h"
 
 #include "oslexec_pvt.h"
@@ -12,62 +26,163 @@
 OSL_NAMESPACE_ENTER
 namespace pvt {
 
-#ifdef USE_PARTIO
+namespace {
+
 using PointCloudMap
     = std::unordered_map<ustringhash, std::unique_ptr<PointCloud>>;
 static PointCloudMap pointclouds;
+static std::unordered_map<ustringhash, std::string> pointcloud_errors;
 static OIIO::spin_mutex pointcloudmap_mutex;
+static OIIO::mutex pointcloud_load_mutex;
+
+// Layout of the native ".oslpc" format, all little endian:
+//
+//     char magic[8]                "OSLPC" 0 0 1
+//     uint64 npoints
+//     uint32 nattribs, nstrings
+//     nattribs x {
+//         uint32 basetype, aggregate, arraylen (TypeDesc fields)
+//         uint32 namelength, char name[namelength]
+//     }
+//     nstrings x { uint32 length, char string[length] }
+//
+// followed, for each attribute in turn and starting at a multiple of 16
+// bytes, by npoints values of its type. Attributes are FLOAT or INT based,
+// or a single STRING, stored as a 32 bit index into the string table.
+static const char native_magic[8] = { 'O', 'S', 'L', 'P', 'C', 0, 0, 1 };
+static const char* native_extension = ".oslpc";
+
+inline size_t
+align16(size_t offset)
+{
+    return (offset + 15) & ~size_t(15);
+}
+
+inline bool
+is_native(string_view filename)
+{
+    return Strutil::iequals(OIIO::Filesystem::extension(filename),
+                            native_extension);
+}
+
+
+
+// Reads the header of a native file, in the file's byte order
+class NativeReader {
+public:
+    NativeReader(const char* data, size_t size) : m_data(data), m_size(size)
+    {
+    }
+
+    bool read(void* out, size_t n)
+    {
+        if (m_pos + n > m_size)
+            return false;
+        memcpy(out, m_data + m_pos, n);
+        m_pos += n;
+        return true;
+    }
+    template<typename T> bool read(T& val)
+    {
+        if (!read(&val, sizeof(T)))
+            return false;
+        if (OIIO::bigendian())
+            OIIO::swap_endian(&val);
+        return true;
+    }
+    bool read(std::string& str)
+    {
+        uint32_t len;
+        if (!read(len) || m_pos + len > m_size)
+            return false;
+        str.assign(m_data + m_pos, len);
+        m_pos += len;
+        return true;
+    }
+    size_t pos() const { return m_pos; }
+    size_t remaining() const { return m_size - m_pos; }
+
+private:
+    const char* m_data;
+    size_t m_size;
+    size_t m_pos = 0;
+};
+
+
+
+// Accumulates the contents of a native file
+class NativeWriter {
+public:
+    void write(const void* data, size_t n)
+    {
+        m_bytes.insert(m_bytes.end(), (const char*)data, (const char*)data + n);
+    }
+    template<typename T> void write(T val)
+    {
+        if (OIIO::bigendian())
+            OIIO::swap_endian(&val);
+        write(&val, sizeof(T));
+    }
+    void write(string_view str)
+    {
+        write(uint32_t(str.size()));
+        write(str.data(), str.size());
+    }
+    void pad() { m_bytes.resize(align16(m_bytes.size()), 0); }
+    const std::vector<char>& bytes() const { return m_bytes; }
+
+private:
+    std::vector<char> m_bytes;
+};
+
+}  // namespace
+
+
 
 PointCloud*
 PointCloud::get(ustringhash filename, bool write)
 {
     if (filename.empty())
         return nullptr;
-    spin_lock lock(pointcloudmap_mutex);
+    {
+        spin_lock lock(pointcloudmap_mutex);
+        PointCloudMap::const_iterator found = pointclouds.find(filename);
+        if (found != pointclouds.end() && (found->second || !write))
+            return found->second.get();
+    }
+
+    // Not found. Read it outside of the map lock, so that other threads
+    // can keep using the clouds that are already loaded.
+    lock_guard load_lock(pointcloud_load_mutex);
     PointCloudMap::const_iterator found = pointclouds.find(filename);
-    if (found != pointclouds.end())
-        return found->second.get();
-    // Not found. Create a new one.
-    Partio::ParticlesDataMutable* partio_cloud = nullptr;
-    if (!write) {
-        // Mute Partio error prints: by default Partio::read sends errors directly
-        // to std::err, but in most cases we want errors to go via errorfmt so the
-        // renderer can recognize the message as an error, as we do in
-        // pointcloud_search and pointcloud_get.
-        std::stringstream m_errorStream;
-
-        partio_cloud = Partio::read(filename.c_str(), false, m_errorStream);
-        if (!partio_cloud)
-            return nullptr;
-    } else {
-        partio_cloud = Partio::create();
-    }
-    PointCloud* pc = new PointCloud(filename, partio_cloud, write);
-    pointclouds[filename].reset(pc);
-    return pc;
+    if (found != pointclouds.end() && (found->second || !write))
+        return found->second.get();  // another thread loaded it meanwhile
+    std::unique_ptr<PointCloud> pc(new PointCloud(filename, write));
+    std::string err;
+    if (!write && !pc->load(ustring_from(filename).string(), err))
+        pc.reset();  // remember the failure, rather than retrying
+    spin_lock lock(pointcloudmap_mutex);
+    if (!pc)
+        pointcloud_errors[filename] = err;
+    pointclouds[filename] = std::move(pc);
+    return pointclouds[filename].get();
 }
 
 
-PointCloud::PointCloud(ustringhash filename,
-                       Partio::ParticlesDataMutable* partio_cloud, bool write)
-    : m_filename(filename), m_partio_cloud(partio_cloud), m_write(write)
+
+std::string
+PointCloud::load_error(ustringhash filename)
+{
+    spin_lock lock(pointcloudmap_mutex);
+    auto found = pointcloud_errors.find(filename);
+    return found != pointcloud_errors.end() ? found->second : std::string();
+}
+
+
+
+PointCloud::PointCloud(ustringhash filename, bool write)
+    : m_filename(filename), m_write(write)
 {
-    if (!m_partio_cloud)
-        return;  // empty cloud
-
-    if (!m_write) {
-        // partio requires this for accelerated lookups
-        m_partio_cloud->sort();
-
-        // Create & stash a ParticleAttribute record for each attribute.
-        // These will be automatically freed by ~PointCloud when the map
-        // destructs.
-        for (int i = 0, e = m_partio_cloud->numAttributes(); i < e; ++i) {
-            Partio::ParticleAttribute* a = new Partio::ParticleAttribute();
-            m_partio_cloud->attributeInfo(i, *a);
-            m_attributes[ustringhash_from(ustring(a->name))].reset(a);
-        }
-    }
 }
 
 
@@ -75,13 +190,525 @@ PointCloud::PointCloud(ustringhash filename,
 PointCloud::~PointCloud()
 {
     // Save the file if we wrote to it
-    if (m_write && !m_filename.empty())
-        Partio::write(m_filename.c_str(), *m_partio_cloud);
-    if (m_partio_cloud)
-        m_partio_cloud->release();
+    if (m_write && m_npoints && !m_filename.empty()) {
+        std::string filename = ustring_from(m_filename).string();
+        if (is_native(filename))
+            save_native(filename);
+#ifdef USE_PARTIO
+        else
+            save_partio(filename);
+#endif
+    }
+}
+
+
+
+PointCloud::Attribute&
+PointCloud::add_attribute(ustring name, TypeDesc type)
+{
+    m_attribute_index[name.uhash()] = int(m_attributes.size());
+    m_attributes.emplace_back();
+    m_attributes.back().name = name;
+    m_attributes.back().type = type;
+    return m_attributes.back();
+}
+
+
+
+const PointCloud::Attribute*
+PointCloud::attribute(ustringhash name) const
+{
+    if (m_write)
+        return nullptr;
+    auto found = m_attribute_index.find(name);
+    return found != m_attribute_index.end() ? &m_attributes[found->second]
+                                            : nullptr;
+}
+
+
+
+TypeDesc
+PointCloud::storage_type(TypeDesc type)
+{
+    if (type == TypeFloat || type == TypeInt || type == TypeString)
+        return type;
+    if (type.basetype == TypeDesc::FLOAT && type.aggregate == TypeDesc::VEC3
+        && !type.arraylen)
+        return TypeDesc(TypeDesc::FLOAT, TypeDesc::VEC3, TypeDesc::NOSEMANTICS);
+    return TypeDesc::UNKNOWN;
+}
+
+
+
+bool
+PointCloud::load(const std::string& filename, std::string& err)
+{
+    bool ok = false;
+    if (is_native(filename))
+        ok = load_native(filename, err);
+#ifdef USE_PARTIO
+    else
+        ok = load_partio(filename, err);
+#else
+    else
+        err = "only .oslpc files are supported without Partio";
+#endif
+    // The kd-tree indexes points with int
+    if (ok && m_npoints > size_t(std::numeric_limits<int>::max())) {
+        err = fmtformat("{} points is more than the {} supported", m_npoints,
+                        std::numeric_limits<int>::max());
+        ok  = false;
+    }
+    if (ok)
+        build_index();
+    return ok;
+}
+
+
+
+bool
+PointCloud::load_native(const std::string& filename, std::string& err)
+{
+    m_mapped.reset(new MappedFile);
+    if (!m_mapped->open(filename)) {
+        err = "the file could not be opened";
+        return false;
+    }
+    NativeReader in(m_mapped->data(), m_mapped->size());
+    char magic[8];
+    uint64_t npoints;
+    uint32_t nattribs, nstrings;
+    if (!in.read(magic, 8) || memcmp(magic, native_magic, 8)
+        || !in.read(npoints) || !in.read(nattribs) || !in.read(nstrings)) {
+        err = "not an .oslpc file";
+        return false;
+    }
+    if (npoints > uint64_t(std::numeric_limits<size_t>::max())) {
+        err = fmtformat("{} points is too many", npoints);
+        return false;
+    }
+    m_npoints = size_t(npoints);
+    for (uint32_t i = 0; i < nattribs; ++i) {
+        uint32_t basetype, aggregate, arraylen;
+        std::string name;
+        if (!in.read(basetype) || !in.read(aggregate) || !in.read(arraylen)
+            || !in.read(name)) {
+            err = "truncated header";
+            return false;
+        }
+        TypeDesc type(TypeDesc::BASETYPE(basetype),
+                      TypeDesc::AGGREGATE(aggregate), int(arraylen));
+        if ((type.basetype != TypeDesc::FLOAT && type.basetype != TypeDesc::INT
+             && type != TypeString)
+            || !basevals(type)) {
+            err = fmtformat("attribute \"{}\" has unsupported type {}", name,
+                            type.c_str());
+            return false;
+        }
+        add_attribute(ustring(name), type);
+    }
+    // Every string takes at least its 4 byte length
+    if (nstrings > in.remaining() / 4) {
+        err = "truncated header";
+        return false;
+    }
+    std::vector<ustringhash> strings(nstrings);
+    for (auto& s : strings) {
+        std::string str;
+        if (!in.read(str)) {
+            err = "truncated header";
+            return false;
+        }
+        s = ustring(str).uhash();
+    }
+
+    // Point the attributes at their data in the file, except for strings,
+    // which are converted from string table indices. Check that the file
+    // holds all the points before working out their size, which could
+    // otherwise overflow.
+    size_t offset = align16(in.pos());
+    for (auto& a : m_attributes) {
+        size_t pointsize = size_t(basevals(a.type)) * 4;
+        size_t remaining = offset < m_mapped->size()
+                               ? m_mapped->size() - offset
+                               : 0;
+        if (m_npoints > remaining / pointsize) {
+            err = fmtformat("the file is too short for {} points of \"{}\"",
+                            m_npoints, a.name);
+            return false;
+        }
+        size_t bytes = m_npoints * pointsize;
+        const char* data = m_mapped->data() + offset;
+        offset           = align16(offset + bytes);
+        if (a.type == TypeString) {
+            a.storage.resize(m_npoints * sizeof(ustringhash));
+            ustringhash* out = (ustringhash*)a.storage.data();
+            for (size_t p = 0; p < m_npoints; ++p) {
+                uint32_t index;
+                memcpy(&index, data + 4 * p, 4);
+                if (OIIO::bigendian())
+                    OIIO::swap_endian(&index);
+                out[p] = index < nstrings ? strings[index] : ustringhash();
+            }
+        } else if (OIIO::bigendian()) {
+            a.storage.assign(data, data + bytes);
+            OIIO::swap_endian((uint32_t*)a.storage.data(), bytes / 4);
+        } else {
+            a.data = data;
+            continue;
+        }
+        a.data = a.storage.data();
+    }
+    return true;
+}
+
+
+
+bool
+PointCloud::save_native(const std::string& filename) const
+{
+    // Gather the string table
+    std::vector<ustringhash> strings;
+    std::unordered_map<ustringhash, uint32_t> string_index;
+    for (auto& a : m_attributes) {
+        if (a.type != TypeString)
+            continue;
+        const ustringhash* vals = (const ustringhash*)a.storage.data();
+        for (size_t p = 0; p < m_npoints; ++p) {
+            if (string_index.emplace(vals[p], uint32_t(strings.size())).second)
+                strings.push_back(vals[p]);
+        }
+    }
+
+    NativeWriter out;
+    out.write(native_magic, 8);
+    out.write(uint64_t(m_npoints));
+    out.write(uint32_t(m_attributes.size()));
+    out.write(uint32_t(strings.size()));
+    for (auto& a : m_attributes) {
+        out.write(uint32_t(a.type.basetype));
+        out.write(uint32_t(a.type.aggregate));
+        out.write(uint32_t(a.type.arraylen));
+        out.write(a.name.string());
+    }
+    for (auto s : strings)
+        out.write(ustring_from(s).string());
+    for (auto& a : m_attributes) {
+        out.pad();
+        if (a.type == TypeString) {
+            const ustringhash* vals = (const ustringhash*)a.storage.data();
+            for (size_t p = 0; p < m_npoints; ++p)
+                out.write(string_index[vals[p]]);
+        } else {
+            const uint32_t* vals = (const uint32_t*)a.storage.data();
+            for (size_t v = 0, n = m_npoints * basevals(a.type); v < n; ++v)
+                out.write(vals[v]);
+        }
+    }
+
+    OIIO::ofstream file;
+    OIIO::Filesystem::open(file, filename, std::ios::out | std::ios::binary);
+    file.write(out.bytes().data(), out.bytes().size());
+    return bool(file);
+}
+
+
+
+#ifdef USE_PARTIO
+namespace {
+
+inline Partio::ParticleAttributeType
+PartioType(TypeDesc t)
+{
+    if (t.basetype == TypeDesc::FLOAT && t.aggregate == TypeDesc::VEC3)
+        return Partio::VECTOR;
+    if (t.basetype == TypeDesc::FLOAT)
+        return Partio::FLOAT;
+    if (t.basetype == TypeDesc::INT)
+        return Partio::INT;
+    if (t == TypeString)
+        return Partio::INDEXEDSTR;
+    return Partio::NONE;
+}
+
+
+
+TypeDesc
+TypeDescOfPartioType(const Partio::ParticleAttribute* ptype)
+{
+    TypeDesc type;  // default to UNKNOWN
+    switch (ptype->type) {
+    case Partio::INT:
+        type = TypeDesc::INT;
+        if (ptype->count > 1)
+            type.arraylen = ptype->count;
+        break;
+    case Partio::FLOAT:
+        type = TypeDesc::FLOAT;
+        if (ptype->count > 1)
+            type.arraylen = ptype->count;
+        break;
+    case Partio::VECTOR:
+        type = TypeDesc(TypeDesc::FLOAT, TypeDesc::VEC3, TypeDesc::NOSEMANTICS);
+        if (ptype->count != 3)
+            type = TypeDesc::UNKNOWN;  // Must be 3: punt
+        break;
+    case Partio::INDEXEDSTR: type = TypeDesc::STRING; break;
+    default: break;  // Any other future types -- return UNKNOWN
+    }
+    return type;
+}
+
+}  // namespace
+
+
+
+bool
+PointCloud::load_partio(const std::string& filename, std::string& err)
+{
+    // Mute Partio error prints: by default Partio::read sends errors directly
+    // to std::err, but in most cases we want errors to go via errorfmt so the
+    // renderer can recognize the message as an error, as we do in
+    // pointcloud_search and pointcloud_get.
+    std::stringstream errors;
+    Partio::ParticlesDataMutable* cloud = Partio::read(filename.c_str(), false,
+                                                       errors);
+    if (!cloud) {
+        err = Strutil::strip(errors.str());
+        if (err.empty())
+            err = "the file could not be read";
+        return false;
+    }
+
+    // Copy each attribute out into its own array
+    m_npoints = size_t(cloud->numParticles());
+    for (int i = 0, e = cloud->numAttributes(); i < e; ++i) {
+        Partio::ParticleAttribute pa;
+        cloud->attributeInfo(i, pa);
+        TypeDesc type = TypeDescOfPartioType(&pa);
+        if (type == TypeDesc::UNKNOWN)
+            continue;
+        Attribute& a = add_attribute(ustring(pa.name), type);
+        size_t size  = type.size();
+        a.storage.resize(m_npoints * size);
+        if (pa.type == Partio::INDEXEDSTR) {
+            const auto& strs = cloud->indexedStrs(pa);
+            for (size_t p = 0; p < m_npoints; ++p) {
+                int ind = *cloud->data<int>(pa, p);
+                ustringhash s;
+                if (ind >= 0 && ind < int(strs.size()))
+                    s = ustring(strs[ind]).uhash();
+                memcpy(&a.storage[p * size], &s, size);
+            }
+        } else {
+            for (size_t p = 0; p < m_npoints; ++p)
+                memcpy(&a.storage[p * size], cloud->data<char>(pa, p), size);
+        }
+        a.data = a.storage.data();
+    }
+    cloud->release();
+    return true;
+}
+
+
+
+bool
+PointCloud::save_partio(const std::string& filename) const
+{
+    Partio::ParticlesDataMutable* cloud = Partio::create();
+    cloud->addParticles(int(m_npoints));
+    for (auto& a : m_attributes) {
+        Partio::ParticleAttributeType pt = PartioType(a.type);
+        Partio::ParticleAttribute pa
+            = cloud->addAttribute(a.name.c_str(), pt,
+                                  pt == Partio::VECTOR ? 3 : basevals(a.type));
+        size_t size = a.type.size();
+        for (size_t p = 0; p < m_npoints; ++p) {
+            const char* val = a.storage.data() + p * size;
+            if (pt == Partio::INDEXEDSTR) {
+                const char* s = ustring_from(*(const ustringhash*)val).c_str();
+                int index     = cloud->lookupIndexedStr(pa, s);
+                if (index == -1)
+                    index = cloud->registerIndexedStr(pa, s);
+                *cloud->dataWrite<int>(pa, p) = index;
+            } else {
+                memcpy(cloud->dataWrite<char>(pa, p), val, size);
+            }
+        }
+    }
+    Partio::write(filename.c_str(), *cloud);
+    cloud->release();
+    return true;
 }
 #endif
 
+
+
+void
+PointCloud::build_index()
+{
+    const Attribute* pos = attribute(u_position.uhash());
+    if (!pos || pos->type.basetype != TypeDesc::FLOAT
+        || basevals(pos->type) != 3)
+        return;  // no positions, so nothing to search
+    // load() refuses clouds with more points than an int can index
+    OSL_ASSERT(m_npoints <= size_t(std::numeric_limits<int>::max()));
+    const Vec3* P = (const Vec3*)pos->data;
+    int n         = int(m_npoints);
+
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    m_axis.resize(n);
+
+    // Split the first few levels serially until there are enough subtrees
+    // to keep all the threads busy, then build those in parallel.
+    std::vector<std::pair<int, int>> ranges { { 0, n } };
+    const size_t nsubtrees = 4 * OIIO::default_thread_pool()->size() + 1;
+    while (ranges.size() < nsubtrees && n > 65536) {
+        std::vector<std::pair<int, int>> next;
+        for (auto r : ranges) {
+            int begin = r.first, end = r.second;
+            if (end - begin <= LeafSize) {
+                next.push_back(r);
+                continue;
+            }
+            build_index(order.data(), P, begin, end);  // just this level
+            int mid = begin + (end - begin) / 2;
+            next.emplace_back(begin, mid);
+            next.emplace_back(mid + 1, end);
+        }
+        ranges.swap(next);
+    }
+    OIIO::parallel_for(int64_t(0), int64_t(ranges.size()), [&](int64_t i) {
+        int begin = ranges[i].first, end = ranges[i].second;
+        std::vector<std::pair<int, int>> stack { { begin, end } };
+        while (!stack.empty()) {
+            auto r = stack.back();
+            stack.pop_back();
+            if (r.second - r.first <= LeafSize)
+                continue;
+            build_index(order.data(), P, r.first, r.second);
+            int mid = r.first + (r.second - r.first) / 2;
+            stack.emplace_back(r.first, mid);
+            stack.emplace_back(mid + 1, r.second);
+        }
+    });
+
+    // Lay out the positions in tree order
+    for (int axis = 0; axis < 3; ++axis)
+        m_pos[axis].resize(n);
+    m_point.resize(n);
+    for (int i = 0; i < n; ++i) {
+        const Vec3& p = P[order[i]];
+        m_pos[0][i]   = p.x;
+        m_pos[1][i]   = p.y;
+        m_pos[2][i]   = p.z;
+        m_point[i]    = uint32_t(order[i]);
+    }
+}
+
+
+
+void
+PointCloud::build_index(int* order, const Vec3* P, int begin, int end)
+{
+    // Split the range at its middle point along its widest axis
+    Vec3 lo(P[order[begin]]), hi(lo);
+    for (int i = begin + 1; i < end; ++i) {
+        const Vec3& p = P[order[i]];
+        lo = Vec3(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+        hi = Vec3(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+    }
+    Vec3 extent = hi - lo;
+    int axis    = extent.x >= extent.y ? (extent.x >= extent.z ? 0 : 2)
+                                       : (extent.y >= extent.z ? 1 : 2);
+    int mid     = begin + (end - begin) / 2;
+    std::nth_element(order + begin, order + mid, order + end,
+                     [=](int a, int b) { return P[a][axis] < P[b][axis]; });
+    m_axis[mid] = uint8_t(axis);
+}
+
+
+
+int
+PointCloud::search(const Vec3& center, float radius, int max_points, bool sort,
+                   size_t* indices, float* dist2) const
+{
+    int count;
+    search<1>(&center.x, &center.y, &center.z, &radius, 1u, max_points, sort,
+              indices, dist2, &count);
+    return count;
+}
+
+
+
+void
+PointCloud::get(const Attribute& a, const size_t* indices, int count,
+                void* out) const
+{
+    size_t size = a.type.size();
+    char* dst   = (char*)out;
+    for (int i = 0; i < count; ++i, dst += size) {
+        if (indices[i] < m_npoints)
+            memcpy(dst, a.data + indices[i] * size, size);
+        else
+            memset(dst, 0, size);
+    }
+}
+
+
+
+bool
+PointCloud::write(const Vec3& pos, int nattribs, const ustringhash* names,
+                  const TypeDesc* types, const void** data, std::string* err)
+{
+    if (!m_write)
+        return false;
+    spin_lock lock(m_mutex);
+
+    // first time only -- add "position" attribute
+    if (m_attributes.empty())
+        add_attribute(u_position, storage_type(TypeVector));
+
+    // Make sure all the attributes mentioned have been added properly
+    bool ok = true;
+    for (int i = 0; i < nattribs; ++i) {
+        TypeDesc type = storage_type(types[i]);
+        auto found    = m_attribute_index.find(names[i]);
+        if (type == TypeDesc::UNKNOWN) {
+            ok = false;
+            if (err)
+                *err = fmtformat("attribute \"{}\" of type {} can't be "
+                                 "stored",
+                                 names[i], types[i].c_str());
+        } else if (found == m_attribute_index.end()) {
+            add_attribute(ustring_from(names[i]), type);
+        } else if (m_attributes[found->second].type != type) {
+            ok = false;
+            if (err)
+                *err = fmtformat("attribute \"{}\" was written as {}, not {}",
+                                 names[i],
+                                 m_attributes[found->second].type.c_str(),
+                                 types[i].c_str());
+        }
+    }
+
+    // Make a new point. Attributes it doesn't set are zero.
+    size_t p = m_npoints++;
+    for (auto& a : m_attributes)
+        a.storage.resize(m_npoints * a.type.size(), 0);
+    memcpy(&m_attributes[0].storage[p * sizeof(Vec3)], &pos, sizeof(Vec3));
+    for (int i = 0; i < nattribs; ++i) {
+        auto found = m_attribute_index.find(names[i]);
+        if (found == m_attribute_index.end())
+            continue;  // type couldn't be stored
+        Attribute& a(m_attributes[found->second]);
+        if (storage_type(types[i]) == a.type)
+            memcpy(&a.storage[p * a.type.size()], data[i], a.type.size());
+    }
+    return ok;
+}
+
 }  // namespace pvt
 
 
@@ -93,66 +720,37 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
                                     size_t* out_indices, float* out_distances,
                                     int derivs_offset)
 {
-#ifdef USE_PARTIO
     if (filename.empty())
         return 0;
     PointCloud* pc = PointCloud::get(filename);
     if (pc == NULL) {  // The file failed to load
-        sg->context->errorfmt("pointcloud_search: could not open \"{}\"",
-                              filename);
-        return 0;
-    }
-
-    const Partio::ParticlesData* cloud = pc->read_access();
-    if (cloud == NULL) {  // The file failed to load
-        sg->context->errorfmt("pointcloud_search: could not open \"{}\"",
-                              filename);
+        sg->context->errorfmt("pointcloud_search: could not open \"{}\": {}",
+                              filename, PointCloud::load_error(filename));
         return 0;
     }
 
     // Early exit if the pointcloud contains no particles.
-    if (cloud->numParticles() == 0)
+    if (pc->size() == 0)
         return 0;
 
     // If we need derivs of the distances, we'll need access to the
     // found point's positions.
-    Partio::ParticleAttribute* pos_attr = NULL;
+    const PointCloud::Attribute* pos_attr = NULL;
     if (derivs_offset) {
-        pos_attr = pc->m_attributes[u_position].get();
+        pos_attr = pc->attribute(u_position.uhash());
         if (!pos_attr)
             return 0;  // No "position" attribute -- fail
     }
 
-    static_assert(sizeof(size_t) == sizeof(Partio::ParticleIndex),
-                  "Partio ParticleIndex should be the size of a size_t");
-    // FIXME -- if anybody cares about an architecture in which that is not
-    // the case, we can easily allocate local space to retrieve the indices,
-    // then copy them back to the caller's indices.
-
-    Partio::ParticleIndex* indices = (Partio::ParticleIndex*)out_indices;
-    float* dist2                   = out_distances;
+    float* dist2 = out_distances;
     if (!dist2)  // If not supplied, allocate our own
         dist2 = (float*)sg->context->alloc_scratch(max_points * sizeof(float),
                                                    sizeof(float));
 
-    float finalRadius;
-    int count = cloud->findNPoints(&center[0], max_points, radius, indices,
-                                   dist2, &finalRadius);
-
-    // If sorting, allocate some temp space and sort the distances and
-    // indices at the same time.
-    if (sort && count > 1) {
-        SortedPointRecord* sorted
-            = (SortedPointRecord*)sg->context->alloc_scratch(
-                count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
-        for (int i = 0; i < count; ++i)
-            sorted[i] = SortedPointRecord(dist2[i], indices[i]);
-        std::sort(sorted, sorted + count, SortedPointCompare());
-        for (int i = 0; i < count; ++i) {
-            dist2[i]   = sorted[i].first;
-            indices[i] = sorted[i].second;
-        }
-    }
+    // The search leaves the results sorted if asked to, without needing
+    // another pass.
+    int count = pc->search(center, radius, max_points, sort, out_indices,
+                           dist2);
 
     if (out_distances) {
         // Convert the squared distances to straight distances
@@ -165,10 +763,7 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
             Vec3* positions = (Vec3*)sg->context->alloc_scratch(sizeof(Vec3)
                                                                     * count,
                                                                 sizeof(float));
-            // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
-            const_cast<Partio::ParticlesData*>(cloud)->data(*pos_attr, count,
-                                                            indices, true,
-                                                            (void*)positions);
+            pc->get(*pos_attr, out_indices, count, positions);
             const Vec3& dCdx     = (&center)[1];
             const Vec3& dCdy     = (&center)[2];
             float* d_distance_dx = out_distances + derivs_offset;
@@ -194,9 +789,6 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
         }
     }
     return count;
-#else
-    return 0;
-#endif
 }
 
 
@@ -207,26 +799,18 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
                                  ustringhash attr_name, TypeDesc attr_type,
                                  void* out_data)
 {
-#ifdef USE_PARTIO
     if (!count)
         return 1;  // always succeed if not asking for any data
 
     PointCloud* pc = PointCloud::get(filename);
     if (pc == NULL) {  // The file failed to load
-        sg->context->errorfmt("pointcloud_get: could not open \"{}\"",
-                              filename);
+        sg->context->errorfmt("pointcloud_get: could not open \"{}\": {}",
+                              filename, PointCloud::load_error(filename));
         return 0;
     }
 
-    const Partio::ParticlesData* cloud = pc->read_access();
-    if (cloud == NULL) {  // The file failed to load
-        sg->context->errorfmt("pointcloud_get: could not open \"{}\"",
-                              filename);
-        return 0;
-    }
-
-    // lookup the ParticleAttribute pointer needed for a query
-    Partio::ParticleAttribute* attr = pc->m_attributes[attr_name].get();
+    // lookup the attribute needed for a query
+    const PointCloud::Attribute* attr = pc->attribute(attr_name);
     if (!attr) {
         sg->context->errorfmt(
             "Accessing unexisting attribute {} in pointcloud \"{}\"", attr_name,
@@ -234,147 +818,54 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
         return 0;
     }
 
-    // Type the partio file contains:
-    TypeDesc partio_type = TypeDescOfPartioType(attr);
+    // Type the file contains:
+    TypeDesc cloud_type = attr->type;
     // Type the OSL shader has provided in destination array:
     TypeDesc element_type = attr_type.elementtype();
 
     // Finally check for some equivalent types like float3 and vector
-    if (!compatiblePartioType(partio_type, element_type)) {
+    if (!compatible_type(cloud_type, element_type)) {
         sg->context->errorfmt(
             "Type of attribute \"{}\" : {} not compatible with OSL's {} in \"{}\" pointcloud",
-            attr_name, partio_type, element_type, filename);
+            attr_name, cloud_type, element_type, filename);
         return 0;
     }
 
     // For safety, clamp the count to the most that will fit in the output
-    int maxn = basevals(attr_type) / basevals(partio_type);
+    int maxn = basevals(attr_type) / basevals(cloud_type);
     if (maxn < count) {
         sg->context->errorfmt(
-            "Point cloud attribute \"{}\" : {} with retrieval count {} will not fit in %s",
-            attr_name, partio_type, count, attr_type);
+            "Point cloud attribute \"{}\" : {} with retrieval count {} will not fit in {}",
+            attr_name, cloud_type, count, attr_type);
         count = maxn;
     }
 
-    static_assert(sizeof(size_t) == sizeof(Partio::ParticleIndex),
-                  "Partio ParticleIndex should be the size of a size_t");
-    // FIXME -- if anybody cares about an architecture in which that is not
-    // the case, we can easily allocate local space to retrieve the indices,
-    // then copy them back to the caller's indices.
-
-    // Actual data query
-    if (partio_type == TypeString) {
-        // strings are special cases because they are stored as int index
-        int* strindices = OSL_ALLOCA(int, count);
-        const_cast<Partio::ParticlesData*>(cloud)->data(
-            *attr, count, (const Partio::ParticleIndex*)indices,
-            /*sorted=*/false, (void*)strindices);
-        const auto& strings = cloud->indexedStrs(*attr);
-        int sicount         = int(strings.size());
-        for (int i = 0; i < count; ++i) {
-            int ind = strindices[i];
-            if (ind >= 0 && ind < sicount)
-                ((ustringhash*)out_data)[i] = ustringhash_from(
-                    ustring(strings[ind]));
-            else
-                ((ustringhash*)out_data)[i] = ustringhash {};
-        }
-    } else {
-        // All cases aside from strings are simple.
-        const_cast<Partio::ParticlesData*>(cloud)->data(
-            *attr, count, (const Partio::ParticleIndex*)indices,
-            /*sorted=*/false, out_data);
-        // FIXME: it is regrettable that we need this const_cast (and the
-        // one a few lines above). It's to work around a bug in partio where
-        // they fail to declare this method as const, even though it could
-        // be. We should submit a patch to partio to fix this.
-    }
+    // Actual data query. Strings are already stored as ustringhash.
+    pc->get(*attr, indices, count, out_data);
     return 1;
-#else
-    return 0;
-#endif
 }
 
 
 
 bool
-RendererServices::pointcloud_write(ShaderGlobals* /*sg*/, ustringhash filename,
+RendererServices::pointcloud_write(ShaderGlobals* sg, ustringhash filename,
                                    const Vec3& pos, int nattribs,
                                    const ustringhash* names,
                                    const TypeDesc* types, const void** data)
 {
-#ifdef USE_PARTIO
     if (filename.empty())
         return false;
     PointCloud* pc = PointCloud::get(filename, true /* create file to write */);
-    spin_lock lock(pc->m_mutex);
-    Partio::ParticlesDataMutable* cloud = pc->write_access();
-    if (cloud == NULL)  // The file failed to load
+    if (pc == NULL)
+        return false;
+    std::string err;
+    if (!pc->write(pos, nattribs, names, types, data, &err)) {
+        if (sg)
+            sg->context->errorfmt("pointcloud_write: \"{}\": {}", filename,
+                                  err);
         return false;
-
-    // Mark the pointcloud as written, so we will save it later
-    pc->m_write = true;
-
-    // first time only -- add "position" attribute
-    if (cloud->numParticles() == 0)
-        pc->m_position_attribute = cloud->addAttribute("position",
-                                                       Partio::VECTOR, 3);
-
-    // Make sure all the attributes mentioned have been added properly
-    bool ok = true;
-    std::vector<Partio::ParticleAttribute*> partattrs;
-    partattrs.reserve(nattribs);
-    for (int i = 0; i < nattribs; ++i) {
-        Partio::ParticleAttribute* a = pc->m_attributes[names[i]].get();
-        if (!a) {  // attribute needs to be added
-            Partio::ParticleAttributeType pt = PartioType(types[i]);
-            if (pt == Partio::NONE) {
-                ok = false;
-            } else {
-                a  = new Partio::ParticleAttribute();
-                *a = cloud->addAttribute(ustring_from(names[i]).c_str(), pt,
-                                         pt == Partio::VECTOR ? 3
-                                                              : 1 /*count*/);
-                pc->m_attributes[names[i]].reset(a);
-            }
-        }
-        partattrs.push_back(a);
-    }
-
-    // Make a new particle
-    Partio::ParticleIndex p = cloud->addParticle();
-    *(Vec3*)cloud->dataWrite<float>(pc->m_position_attribute, p) = pos;
-    for (int i = 0; i < nattribs; ++i) {
-        Partio::ParticleAttribute* a = partattrs[i];
-        if (a && PartioType(types[i]) == a->type) {
-            switch (a->type) {
-            case Partio::FLOAT:
-                *(float*)cloud->dataWrite<float>(*a, p) = *(float*)(data[i]);
-                break;
-            case Partio::VECTOR:
-                *(Vec3*)cloud->dataWrite<float>(*a, p) = *(Vec3*)(data[i]);
-                break;
-            case Partio::INT:
-                *(int*)cloud->dataWrite<int>(*a, p) = *(int*)(data[i]);
-                break;
-            case Partio::INDEXEDSTR: {
-                ustringhash s     = *(ustringhash*)(data[i]);
-                ustring s_ustring = ustring_from(s);
-                const char* sstr  = s_ustring.c_str();
-                int index         = cloud->lookupIndexedStr(*a, sstr);
-                if (index == -1)
-                    index = cloud->registerIndexedStr(*a, sstr);
-                *(int*)cloud->dataWrite<int>(*a, p) = index;
-            } break;
-            case Partio::NONE: break;
-            }
-        }
     }
-
-    return ok;
-#else
-    return false;
-#endif
+    return true;
 }
 
 namespace pvt {
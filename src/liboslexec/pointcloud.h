@@ -2,23 +2,48 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
-#ifdef USE_PARTIO
-#    include <Partio.h>
-#    include <memory>
-#    include <unordered_map>
-#endif
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <OpenImageIO/thread.h>
 
 #include <OSL/oslconfig.h>
 
 OSL_NAMESPACE_ENTER
 namespace pvt {
 
-#ifdef USE_PARTIO
+class MappedFile;
+
 
+/// Point cloud used by the default implementations of pointcloud_search,
+/// pointcloud_get and pointcloud_write.
+///
+/// Every attribute (including "position") is stored as its own contiguous
+/// array with one value per point. Clouds in OSL's own binary format
+/// (".oslpc") are memory mapped so their attributes are used in place;
+/// any other format is read with Partio, when OSL is built with it.
+///
+/// Searches use an implicit, balanced kd-tree: the positions are copied
+/// into separate x, y and z arrays in tree order, where the point splitting
+/// each range [begin,end) is the one at its middle. The tree is built once
+/// when the cloud is loaded, and is shared by the scalar and batched
+/// shadeops.
 class OSLEXECPUBLIC PointCloud {
 public:
-    PointCloud(ustringhash filename, Partio::ParticlesDataMutable* partio_cloud,
-               bool write);
+    struct Attribute {
+        ustring name;
+        TypeDesc type;  ///< Type of one point's value. Strings are ustringhash.
+        const char* data = nullptr;  ///< type.size() bytes per point
+        std::vector<char> storage;   ///< Holds data unless it's mapped
+    };
+
+    PointCloud(ustringhash filename, bool write);
     ~PointCloud();
 
     PointCloud(const PointCloud&)             = delete;
@@ -26,65 +51,243 @@ public:
     PointCloud& operator=(const PointCloud&)  = delete;
     PointCloud& operator=(const PointCloud&&) = delete;
 
+    /// Return the cloud for the named file, reading it the first time it
+    /// is asked for, or nullptr if it could not be read. With write=true,
+    /// create an empty cloud that will be saved to the file when the
+    /// program exits.
     static PointCloud* get(ustringhash filename, bool write = false);
 
-    typedef std::unordered_map<ustringhash,
-                               std::unique_ptr<Partio::ParticleAttribute>>
-        AttributeMap;
+    /// Why the named file could not be read, after get() returned nullptr
+    /// for it.
+    static std::string load_error(ustringhash filename);
+
+    /// Number of points.
+    size_t size() const { return m_npoints; }
+
+    /// Return the named attribute, or nullptr if there is none (or the
+    /// cloud is being written).
+    const Attribute* attribute(ustringhash name) const;
+
+    /// Find up to max_points points within `radius` of `center`, the
+    /// closest ones if there are more, storing their indices and squared
+    /// distances. Return the number of points found. If `sort` is true,
+    /// they are ordered by increasing distance.
+    int search(const Vec3& center, float radius, int max_points, bool sort,
+               size_t* indices, float* dist2) const;
+
+    /// Search around WidthT centers at once, for the lanes set in `lanes`,
+    /// walking the tree a single time for all of them. Lane l's center is
+    /// (cx[l],cy[l],cz[l]), its results go to indices and dist2 starting
+    /// at l*max_points, and their number to counts[l].
+    template<int WidthT>
+    void search(const float* cx, const float* cy, const float* cz,
+                const float* radius, unsigned int lanes, int max_points,
+                bool sort, size_t* indices, float* dist2, int* counts) const;
+
+    /// Copy the attribute values of the given points to `out`, one value
+    /// of a.type per point. Out of range indices give zeros.
+    void get(const Attribute& a, const size_t* indices, int count,
+             void* out) const;
 
-    const Partio::ParticlesData* read_access() const
+    /// Add a point at `pos` with the given attributes, each pointing at
+    /// one value of its type (ustringhash for strings). Return false,
+    /// and describe the problem in `err` if it's given, if any attribute
+    /// has a type that can't be stored or that differs from the type it
+    /// was first written with. Such attributes are left zero.
+    bool write(const Vec3& pos, int nattribs, const ustringhash* names,
+               const TypeDesc* types, const void** data,
+               std::string* err = nullptr);
+
+    /// Type an attribute of the given OSL type is stored as when written,
+    /// or UNKNOWN if it can't be written.
+    static TypeDesc storage_type(TypeDesc type);
+
+private:
+    bool load(const std::string& filename, std::string& err);
+    bool load_native(const std::string& filename, std::string& err);
+    bool save_native(const std::string& filename) const;
+#ifdef USE_PARTIO
+    bool load_partio(const std::string& filename, std::string& err);
+    bool save_partio(const std::string& filename) const;
+#endif
+    Attribute& add_attribute(ustring name, TypeDesc type);
+
+    // The results of a search are kept as a max-heap on distance, in the
+    // caller's arrays, so that the farthest one is the one to replace when
+    // a closer point turns up.
+    static void heap_sift_down(size_t* indices, float* dist2, int i, int count,
+                               size_t index, float d2)
     {
-        OSL_DASSERT(!m_write);
-        return m_partio_cloud;
+        for (int c = 2 * i + 1; c < count; i = c, c = 2 * i + 1) {
+            if (c + 1 < count && dist2[c + 1] > dist2[c])
+                ++c;
+            if (dist2[c] <= d2)
+                break;
+            indices[i] = indices[c];
+            dist2[i]   = dist2[c];
+        }
+        indices[i] = index;
+        dist2[i]   = d2;
     }
-    Partio::ParticlesDataMutable* write_access() const
+    static void heap_push(size_t* indices, float* dist2, int& count,
+                          size_t index, float d2)
     {
-        OSL_DASSERT(m_write);
-        return m_partio_cloud;
+        int c = count++;
+        for (int p = (c - 1) / 2; c > 0 && dist2[p] < d2; p = (c - 1) / 2) {
+            indices[c] = indices[p];
+            dist2[c]   = dist2[p];
+            c          = p;
+        }
+        indices[c] = index;
+        dist2[c]   = d2;
     }
+    // Sort the heap in place, leaving the closest point first
+    static void heap_sort(size_t* indices, float* dist2, int count)
+    {
+        for (int end = count - 1; end > 0; --end) {
+            size_t index = indices[end];
+            float d2     = dist2[end];
+            indices[end] = indices[0];
+            dist2[end]   = dist2[0];
+            heap_sift_down(indices, dist2, 0, end, index, d2);
+        }
+    }
+    void build_index();
+    void build_index(int* order, const Vec3* P, int begin, int end);
+
+    enum { LeafSize = 8 };
 
     ustringhash m_filename;
+    bool m_write;
+    size_t m_npoints = 0;
+    std::vector<Attribute> m_attributes;
+    std::unordered_map<ustringhash, int> m_attribute_index;
+    std::unique_ptr<MappedFile> m_mapped;
 
-private:
-    // hide just this field, because we want to control how it is accessed
-    Partio::ParticlesDataMutable* m_partio_cloud;
+    // kd-tree: positions in tree order, the index of each point in the
+    // file, and the split axis of each range at its middle point.
+    std::vector<float> m_pos[3];
+    std::vector<uint32_t> m_point;
+    std::vector<uint8_t> m_axis;
 
-public:
-    AttributeMap m_attributes;
-    bool m_write;
-    Partio::ParticleAttribute m_position_attribute;
-    OIIO::spin_mutex m_mutex;
+    OIIO::spin_mutex m_mutex;  // Protects writes
 };
 
-namespace {  // anon
 
-static ustring u_position("position");
 
-// some helper classes to make the sort easy
-typedef std::pair<float, Partio::ParticleIndex> SortedPointRecord;  // dist,index
-struct SortedPointCompare {
-    bool operator()(const SortedPointRecord& a, const SortedPointRecord& b)
-    {
-        return a.first < b.first;
+template<int WidthT>
+void
+PointCloud::search(const float* cx, const float* cy, const float* cz,
+                   const float* radius, unsigned int lanes, int max_points,
+                   bool sort, size_t* indices, float* dist2, int* counts) const
+{
+    const float* center[3] = { cx, cy, cz };
+    float r2[WidthT], limit[WidthT];
+    for (int l = 0; l < WidthT; ++l) {
+        counts[l] = 0;
+        r2[l]     = radius[l] * radius[l];
+        limit[l]  = r2[l];
     }
-};
+    int n = int(m_point.size());
+    if (!n || max_points <= 0)
+        return;
 
-inline Partio::ParticleAttributeType
-PartioType(TypeDesc t)
-{
-    if (t == TypeFloat)
-        return Partio::FLOAT;
-    if (t.basetype == TypeDesc::FLOAT && t.aggregate == TypeDesc::VEC3)
-        return Partio::VECTOR;
-    if (t == TypeInt)
-        return Partio::INT;
-    if (t == TypeString)
-        return Partio::INDEXEDSTR;
-    return Partio::NONE;
+    // Offer point i to the lanes in `mask`. Distances are computed for all
+    // the lanes at once, and once a lane's heap is full, its search limit
+    // shrinks to its farthest result.
+    auto visit = [&](int i, unsigned int mask) {
+        float d2[WidthT];
+        for (int l = 0; l < WidthT; ++l) {
+            float dx = m_pos[0][i] - cx[l];
+            float dy = m_pos[1][i] - cy[l];
+            float dz = m_pos[2][i] - cz[l];
+            d2[l]    = dx * dx + dy * dy + dz * dz;
+        }
+        for (int l = 0; l < WidthT; ++l) {
+            if (!(mask & (1u << l)) || d2[l] > limit[l])
+                continue;
+            size_t* lindices = indices + l * max_points;
+            float* ldist2    = dist2 + l * max_points;
+            if (counts[l] < max_points) {
+                heap_push(lindices, ldist2, counts[l], m_point[i], d2[l]);
+                if (counts[l] == max_points)
+                    limit[l] = ldist2[0];
+            } else if (d2[l] < ldist2[0]) {
+                heap_sift_down(lindices, ldist2, 0, max_points, m_point[i],
+                               d2[l]);
+                limit[l] = ldist2[0];
+            }
+        }
+    };
+
+    // A range of the tree, the lanes that still need to look at it, and
+    // for each of those a lower bound on its squared distance to them.
+    struct Range {
+        int begin, end;
+        unsigned int lanes;
+        float d2[WidthT];
+    };
+    Range stack[64];
+    int top = 0;
+    Range r { 0, n, lanes, {} };
+    stack[top++] = r;
+    while (top) {
+        r = stack[--top];
+        for (int l = 0; l < WidthT; ++l)
+            if (r.d2[l] > limit[l])
+                r.lanes &= ~(1u << l);
+        while (r.lanes && r.end - r.begin > LeafSize) {
+            int mid     = r.begin + (r.end - r.begin) / 2;
+            int axis    = m_axis[mid];
+            float split = m_pos[axis][mid];
+            visit(mid, r.lanes);
+            // Each lane goes to the side of the plane its center is on,
+            // and to the other side too if it's still close enough.
+            Range left { r.begin, mid, 0, {} }, right { mid + 1, r.end, 0, {} };
+            int nleft = 0, nright = 0;
+            for (int l = 0; l < WidthT; ++l) {
+                unsigned int bit = 1u << l;
+                if (!(r.lanes & bit))
+                    continue;
+                float diff  = center[axis][l] - split;
+                float dd    = std::max(r.d2[l], diff * diff);
+                Range& near = diff < 0 ? left : right;
+                Range& far  = diff < 0 ? right : left;
+                near.lanes |= bit;
+                near.d2[l] = r.d2[l];
+                ++(diff < 0 ? nleft : nright);
+                if (dd <= limit[l]) {
+                    far.lanes |= bit;
+                    far.d2[l] = dd;
+                }
+            }
+            // Carry on with the side most lanes are on, and come back to
+            // the other one later.
+            Range& far = nleft >= nright ? right : left;
+            if (far.lanes && top < 64)
+                stack[top++] = far;
+            r = nleft >= nright ? left : right;
+        }
+        if (r.lanes)
+            for (int i = r.begin; i < r.end; ++i)
+                visit(i, r.lanes);
+    }
+
+    if (sort)
+        for (int l = 0; l < WidthT; ++l)
+            if (lanes & (1u << l))
+                heap_sort(indices + l * max_points, dist2 + l * max_points,
+                          counts[l]);
 }
 
 
 
+namespace {  // anon
+
+static ustring u_position("position");
+
+
+
 // Helper: number of base values
 inline int
 basevals(TypeDesc t)
@@ -94,61 +297,33 @@ basevals(TypeDesc t)
 
 
 
-bool
-compatiblePartioType(TypeDesc partio_type, TypeDesc osl_element_type)
+// Can data of the cloud's type be retrieved into an OSL array whose
+// elements are osl_element_type?
+inline bool
+compatible_type(TypeDesc cloud_type, TypeDesc osl_element_type)
 {
     // Matching types (treating all VEC3 aggregates as equivalent)...
-    if (equivalent(partio_type, osl_element_type))
+    if (equivalent(cloud_type, osl_element_type))
         return true;
 
     // Consider arrays and aggregates as interchangeable, as long as the
     // totals are the same.
-    if (partio_type.basetype == osl_element_type.basetype
-        && basevals(partio_type) == basevals(osl_element_type))
+    if (cloud_type.basetype == osl_element_type.basetype
+        && basevals(cloud_type) == basevals(osl_element_type))
         return true;
 
-    // The Partio file may contain an array size that OSL can't exactly
-    // represent, for example the partio type may be float[4], and the
+    // The file may contain an array size that OSL can't exactly
+    // represent, for example the cloud type may be float[4], and the
     // OSL array will be float[] but the element type will be just float
     // because OSL doesn't permit multi-dimensional arrays.
     // Just allow it anyway and fill in the OSL array.
-    if (TypeDesc::BASETYPE(partio_type.basetype) == osl_element_type)
+    if (TypeDesc::BASETYPE(cloud_type.basetype) == osl_element_type)
         return true;
 
     return false;
 }
 
-
-
-TypeDesc
-TypeDescOfPartioType(const Partio::ParticleAttribute* ptype)
-{
-    TypeDesc type;  // default to UNKNOWN
-    switch (ptype->type) {
-    case Partio::INT:
-        type = TypeDesc::INT;
-        if (ptype->count > 1)
-            type.arraylen = ptype->count;
-        break;
-    case Partio::FLOAT:
-        type = TypeDesc::FLOAT;
-        if (ptype->count > 1)
-            type.arraylen = ptype->count;
-        break;
-    case Partio::VECTOR:
-        type = TypeDesc(TypeDesc::FLOAT, TypeDesc::VEC3, TypeDesc::NOSEMANTICS);
-        if (ptype->count != 3)
-            type = TypeDesc::UNKNOWN;  // Must be 3: punt
-        break;
-    case Partio::INDEXEDSTR: type = TypeDesc::STRING; break;
-    default: break;  // Any other future types -- return UNKNOWN
-    }
-    return type;
-}
-
 }  // namespace
 
-#endif
-
 }  // namespace pvt
 OSL_NAMESPACE_EXIT
@@ -3417,6 +3417,10 @@ RuntimeOptimizer::run()
         if (does_nothing)
             ss.m_stat_empty_groups += 1;
     }
+    group().m_stat_preopt_ops   = int(old_nops);
+    group().m_stat_postopt_ops  = int(new_nops);
+    group().m_stat_preopt_syms  = int(old_nsyms);
+    group().m_stat_postopt_syms = int(new_nsyms);
     if (shadingsys().m_compile_report) {
         shadingcontext()->infofmt("Optimized shader group {}:", group().name());
         shadingcontext()->infofmt(
@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <vector>
+
 #include <OSL/oslconfig.h>
 
 #include <OpenImageIO/imagebuf.h>
@@ -9,6 +11,12 @@
 #include <OpenImageIO/thread.h>
 
 #include <OSL/oslexec.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_rendererservices.h>
+#    include <OSL/batched_shaderglobals.h>
+#endif
+
+#include "oslexec_pvt.h"
 
 using namespace OSL;
 using namespace OSL::pvt;
@@ -20,6 +28,312 @@ using namespace OSL::pvt;
 
 OSL_NAMESPACE_ENTER
 
+namespace {
+
+// The shader outputs to save, gathered once rather than for each pixel
+struct ShadeImageOutputs {
+    std::vector<const ShaderSymbol*> sym;
+    std::vector<TypeDesc> type;
+    std::vector<int> nchans;
+
+    ShadeImageOutputs(ShadingSystem& shadingsys, ShaderGroup& group,
+                      cspan<ustring> outputs)
+    {
+        for (ustring name : outputs) {
+            sym.push_back(shadingsys.find_symbol(group, name));
+            type.push_back(shadingsys.symbol_typedesc(sym.back()));
+            nchans.push_back(type.back().numelements()
+                             * type.back().aggregate);
+        }
+    }
+    int size() const { return int(sym.size()); }
+};
+
+
+
+// Set up the shader globals that are the same for every point shaded.
+//
+// Note that because we are shading a single object that is a flat image
+// plane, a lot of this is simplified. In a real 3D render, most of these
+// fields would need to be reset for every shade.
+void
+setup_shaderglobals(ShaderGlobals& sg, const ShaderGlobals* defaultsg,
+                    const OIIO::ROI& roi_full,
+                    ShadeImageLocations shadelocations, Matrix44& Mshad,
+                    Matrix44& Mobj)
+{
+    int xres = roi_full.width();
+    int yres = roi_full.height();
+    int zres = roi_full.depth();
+    if (defaultsg) {
+        // If the caller passed a default SG template, use it to initialize
+        // the sg and in particular to set all the constant fields.
+        memcpy((char*)&sg, (const char*)defaultsg, sizeof(ShaderGlobals));
+    } else {
+        // No SG template was passed, so set up reasonable defaults.
+        memset((char*)&sg, 0, sizeof(ShaderGlobals));
+        // Set "shader" space to be Mshad.  In a real renderer, this may be
+        // different for each shader group.
+        sg.shader2common = OSL::TransformationPtr(&Mshad);
+        // Set "object" space to be Mobj.  In a real renderer, this may be
+        // different for each object.
+        sg.object2common = OSL::TransformationPtr(&Mobj);
+        // Just make it look like all shades are the result of 'raytype' rays.
+        sg.raytype = 0;  // default ray type
+        // Set the surface area of the patch to 1 (which it is).  This is
+        // only used for light shaders that call the surfacearea() function.
+        sg.surfacearea = 1;
+        // Derivs are constant across the image
+        if (shadelocations == ShadePixelCenters) {
+            sg.dudx = 1.0f / xres;  // sg.dudy is already 0
+            sg.dvdy = 1.0f / yres;  // sg.dvdx is already 0
+        } else {
+            sg.dudx = 1.0f / std::max(1, (xres - 1));
+            sg.dvdy = 1.0f / std::max(1, (yres - 1));
+        }
+        // Derivatives with respect to x,y
+        sg.dPdx = Vec3(1.0f, 0.0f, 0.0f);
+        sg.dPdy = Vec3(0.0f, 1.0f, 0.0f);
+        sg.dPdz = Vec3(0.0f, 0.0f, 1.0f);
+        // Tangents of P with respect to surface u,v
+        sg.dPdu = Vec3(xres, 0.0f, 0.0f);
+        sg.dPdv = Vec3(0.0f, yres, 0.0f);
+        sg.dPdz = Vec3(0.0f, 0.0f, zres);
+        // That also implies that our normal points to (0,0,1)
+        sg.N  = Vec3(0, 0, 1);
+        sg.Ng = Vec3(0, 0, 1);
+        // In our SimpleRenderer, the "renderstate" itself just a pointer to
+        // the ShaderGlobals.
+        // sg.renderstate = &sg;
+    }
+}
+
+
+
+// Compute the u,v of pixel (x,y)
+inline void
+pixel_uv(int x, int y, const OIIO::ROI& roi_full,
+         ShadeImageLocations shadelocations, float& u, float& v)
+{
+    int xres = roi_full.width();
+    int yres = roi_full.height();
+    if (shadelocations == ShadePixelCenters) {
+        u = float(x - roi_full.xbegin + 0.5f) / xres;
+        v = float(y - roi_full.ybegin + 0.5f) / yres;
+    } else {
+        u = (xres == 1) ? 0.5f : float(x - roi_full.xbegin) / (xres - 1);
+        v = (yres == 1) ? 0.5f : float(y - roi_full.ybegin) / (yres - 1);
+    }
+}
+
+
+
+// Shade the pixels of `roi` one at a time
+void
+shade_region(ShadingSystem& shadingsys, ShaderGroup& group,
+             ShadingContext* ctx, ShaderGlobals& sg, OIIO::ImageBuf& buf,
+             const ShadeImageOutputs& outputs,
+             ShadeImageLocations shadelocations, OIIO::ROI roi)
+{
+    // Ensure the group has already been optimized
+    shadingsys.optimize_group(&group, ctx);
+
+    OIIO::ROI roi_full = buf.roi_full();
+
+    // Loop over all pixels in the image (in x and y)...
+    for (OIIO::ImageBuf::Iterator<float> p(buf, roi); !p.done(); ++p) {
+        // Set the shader globals that vary from point to pixel to pixel
+        sg.P = Vec3(p.x(), p.y(), p.z());
+        pixel_uv(p.x(), p.y(), roi_full, shadelocations, sg.u, sg.v);
+
+        // Actually run the shader for this point
+        shadingsys.execute(*ctx, group, sg);
+
+        // Save all the designated outputs.
+        int chan = 0;
+        for (int i = 0; i < outputs.size(); ++i) {
+            const void* data = shadingsys.symbol_address(*ctx, outputs.sym[i]);
+            if (!data)
+                continue;  // Skip if symbol isn't found
+            TypeDesc t = outputs.type[i];
+            int tvals  = outputs.nchans[i];
+            if (chan + tvals > buf.nchannels())
+                break;
+            if (t.basetype == TypeDesc::FLOAT) {
+                for (int c = 0; c < tvals; ++c)
+                    p[chan++] = ((const float*)data)[c];
+            } else if (t.basetype == TypeDesc::INT) {
+                for (int c = 0; c < tvals; ++c)
+                    p[chan++] = ((const int*)data)[c];
+            }
+            // N.B. Drop any outputs that aren't float- or int-based
+        }
+    }
+}
+
+
+
+#if OSL_USE_BATCHED
+// Return the batch width (16, 8 or 4) shade_image should use, or 0 if the
+// shading system, renderer or hardware can't execute batches.
+int
+batch_width(ShadingSystem& shadingsys)
+{
+    int batched_analysis = 0;
+    shadingsys.getattribute("opt_batched_analysis", batched_analysis);
+    if (!batched_analysis)
+        return 0;
+    RendererServices* rs = shadingsys.renderer();
+    if (rs->batched(WidthOf<16>())
+        && shadingsys.configure_batch_execution_at(16))
+        return 16;
+    if (rs->batched(WidthOf<8>()) && shadingsys.configure_batch_execution_at(8))
+        return 8;
+    if (rs->batched(WidthOf<4>()) && shadingsys.configure_batch_execution_at(4))
+        return 4;
+    return 0;
+}
+
+
+
+// Shade the pixels of `roi` WidthT at a time. The varying shader globals
+// and the outputs of lane l of a batch belong to the l-th pixel of it, in
+// iteration order. Requires `buf` to have local pixels.
+template<int WidthT>
+void
+batched_shade_region(ShadingSystem& shadingsys, ShaderGroup& group,
+                     ShadingContext* ctx, const ShaderGlobals& sg,
+                     OIIO::ImageBuf& buf, const ShadeImageOutputs& outputs,
+                     ShadeImageLocations shadelocations, OIIO::ROI roi)
+{
+    // Ensure the group has already been compiled for this width
+    shadingsys.batched<WidthT>().jit_group(&group, ctx);
+
+    // Batched analysis decides how each output is laid out: a uniform
+    // symbol holds one value shared by all lanes, and an int it forced to
+    // an llvm bool holds a bool (uniform) or an ISA specific mask (varying).
+    std::vector<char> uniform(outputs.size(), 0);
+    std::vector<char> forced_bool(outputs.size(), 0);
+    for (int i = 0; i < outputs.size(); ++i) {
+        if (auto sym = (const Symbol*)outputs.sym[i]) {
+            uniform[i]     = sym->is_uniform();
+            forced_bool[i] = sym->forced_llvm_bool();
+        }
+    }
+
+    OIIO::ROI roi_full = buf.roi_full();
+    int xres           = roi_full.width();
+    int yres           = roi_full.height();
+
+    // Start every lane from the scalar template, so only P, u, v need to
+    // change per batch.
+    BatchedShaderGlobals<WidthT> bsg;
+    memset((char*)&bsg.uniform, 0, sizeof(bsg.uniform));
+    bsg.uniform.renderstate = sg.renderstate;
+    bsg.uniform.tracedata   = sg.tracedata;
+    bsg.uniform.objdata     = sg.objdata;
+    bsg.uniform.raytype     = sg.raytype;
+    auto& vsg               = bsg.varying;
+    assign_all(vsg.P, sg.P);
+    assign_all(vsg.dPdx, sg.dPdx);
+    assign_all(vsg.dPdy, sg.dPdy);
+    assign_all(vsg.dPdz, sg.dPdz);
+    assign_all(vsg.I, sg.I);
+    assign_all(vsg.dIdx, sg.dIdx);
+    assign_all(vsg.dIdy, sg.dIdy);
+    assign_all(vsg.N, sg.N);
+    assign_all(vsg.Ng, sg.Ng);
+    assign_all(vsg.u, sg.u);
+    assign_all(vsg.dudx, sg.dudx);
+    assign_all(vsg.dudy, sg.dudy);
+    assign_all(vsg.v, sg.v);
+    assign_all(vsg.dvdx, sg.dvdx);
+    assign_all(vsg.dvdy, sg.dvdy);
+    assign_all(vsg.dPdu, sg.dPdu);
+    assign_all(vsg.dPdv, sg.dPdv);
+    assign_all(vsg.time, sg.time);
+    assign_all(vsg.dtime, sg.dtime);
+    assign_all(vsg.dPdtime, sg.dPdtime);
+    assign_all(vsg.Ps, sg.Ps);
+    assign_all(vsg.dPsdx, sg.dPsdx);
+    assign_all(vsg.dPsdy, sg.dPsdy);
+    assign_all(vsg.object2common, sg.object2common);
+    assign_all(vsg.shader2common, sg.shader2common);
+    assign_all(vsg.Ci, (ClosureColor*)nullptr);
+    assign_all(vsg.surfacearea, sg.surfacearea);
+    assign_all(vsg.flipHandedness, sg.flipHandedness);
+    assign_all(vsg.backfacing, sg.backfacing);
+    Block<int, WidthT> wide_shadeindex;
+
+    float* pixels[WidthT];
+    auto run_batch = [&](int n) {
+        shadingsys.batched<WidthT>().execute(*ctx, group, n, wide_shadeindex,
+                                             bsg, nullptr, nullptr);
+
+        // Save all the designated outputs. Channel c of lane l of a wide
+        // symbol is at [c * WidthT + l], while a uniform symbol's channel c
+        // is at [c] for every lane.
+        int chan = 0;
+        for (int i = 0; i < outputs.size(); ++i) {
+            const void* data = shadingsys.symbol_address(*ctx, outputs.sym[i]);
+            if (!data)
+                continue;  // Skip if symbol isn't found
+            TypeDesc t = outputs.type[i];
+            int tvals  = outputs.nchans[i];
+            if (chan + tvals > buf.nchannels())
+                break;
+            // Index of channel c of lane l is c * stride + l * lane_step
+            int stride    = uniform[i] ? 1 : WidthT;
+            int lane_step = uniform[i] ? 0 : 1;
+            if (t.basetype == TypeDesc::FLOAT) {
+                for (int c = 0; c < tvals; ++c, ++chan)
+                    for (int l = 0; l < n; ++l)
+                        pixels[l][chan]
+                            = ((const float*)data)[c * stride + l * lane_step];
+            } else if (t.basetype == TypeDesc::INT && forced_bool[i]) {
+                if (uniform[i]) {
+                    for (int l = 0; l < n; ++l)
+                        pixels[l][chan] = *(const bool*)data;
+                }
+                chan += tvals;  // a varying mask isn't saved
+            } else if (t.basetype == TypeDesc::INT) {
+                for (int c = 0; c < tvals; ++c, ++chan)
+                    for (int l = 0; l < n; ++l)
+                        pixels[l][chan]
+                            = ((const int*)data)[c * stride + l * lane_step];
+            }
+            // N.B. Drop any outputs that aren't float- or int-based
+        }
+    };
+
+    int n = 0;
+    for (int z = roi.zbegin; z < roi.zend; ++z) {
+        for (int y = roi.ybegin; y < roi.yend; ++y) {
+            for (int x = roi.xbegin; x < roi.xend; ++x) {
+                float u, v;
+                pixel_uv(x, y, roi_full, shadelocations, u, v);
+                vsg.P.set(n, Vec3(x, y, z));
+                vsg.u.set(n, u);
+                vsg.v.set(n, v);
+                wide_shadeindex.set(n, ((z - roi_full.zbegin) * yres
+                                        + (y - roi_full.ybegin))
+                                               * xres
+                                           + (x - roi_full.xbegin));
+                pixels[n] = (float*)buf.pixeladdr(x, y, z);
+                if (++n == WidthT) {
+                    run_batch(n);
+                    n = 0;
+                }
+            }
+        }
+    }
+    if (n)
+        run_batch(n);
+}
+#endif
+
+}  // namespace
+
 
 
 bool
@@ -39,6 +353,19 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
         return false;
     }
 
+    // Gather some information about the outputs once, rather than for
+    // each pixel.
+    ShadeImageOutputs output_info(shadingsys, group, outputs);
+
+    // Shade whole batches of pixels at a time when the shading system and
+    // renderer support it. That writes straight into the pixel memory, so
+    // it needs a buffer that holds its pixels locally.
+    int batch_size = 0;
+#if OSL_USE_BATCHED
+    if (buf.localpixels())
+        batch_size = batch_width(shadingsys);
+#endif
+
     parallel_image(roi, popt, [&](OIIO::ROI roi) {
         // Request an OSL::PerThreadInfo for this thread.
         OSL::PerThreadInfo* thread_info = shadingsys.create_thread_info();
@@ -49,120 +376,25 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
         // within a thread.
         ShadingContext* ctx = shadingsys.get_context(thread_info);
 
-        // Ensure the group has already been optimized
-        shadingsys.optimize_group(&group, ctx);
-
         Matrix44 Mshad, Mobj;  // just let these be identity for now
-        OIIO::ROI roi_full = buf.roi_full();
-        int xres           = roi_full.width();
-        int yres           = roi_full.height();
-        int zres           = roi_full.depth();
-
-        // Gather some information about the outputs once, rather than for
-        // each pixel.
-        const ShaderSymbol** output_sym = OSL_ALLOCA(const ShaderSymbol*,
-                                                     outputs.size());
-        TypeDesc* output_type           = OSL_ALLOCA(TypeDesc, outputs.size());
-        int* output_nchans              = OSL_ALLOCA(int, outputs.size());
-        for (int i = 0; i < int(outputs.size()); ++i) {
-            output_sym[i]    = shadingsys.find_symbol(group, outputs[i]);
-            output_type[i]   = shadingsys.symbol_typedesc(output_sym[i]);
-            output_nchans[i] = output_type[i].numelements()
-                               * output_type[i].aggregate;
-        }
-
-        // Set up shader globals and a little test grid of points to shade.
-        // Note that some of the fields can be set up once and used for all of
-        // the shades. Others need to be changed for every point shaded.
-        //
-        // Note that because we are shading a single object that is a flat image
-        // plane, a lot of this is simplified. In a real 3D render, most of
-        // these fields would need to be reset for every shade.
         ShaderGlobals sg;
-        if (defaultsg) {
-            // If the caller passed a default SG template, use it to initialize
-            // the sg and in particular to set all the constant fields.
-            memcpy((char*)&sg, (const char*)defaultsg, sizeof(ShaderGlobals));
-        } else {
-            // No SG template was passed, so set up reasonable defaults.
-            memset((char*)&sg, 0, sizeof(ShaderGlobals));
-            // Set "shader" space to be Mshad.  In a real renderer, this may be
-            // different for each shader group.
-            sg.shader2common = OSL::TransformationPtr(&Mshad);
-            // Set "object" space to be Mobj.  In a real renderer, this may be
-            // different for each object.
-            sg.object2common = OSL::TransformationPtr(&Mobj);
-            // Just make it look like all shades are the result of 'raytype' rays.
-            sg.raytype = 0;  // default ray type
-            // Set the surface area of the patch to 1 (which it is).  This is
-            // only used for light shaders that call the surfacearea() function.
-            sg.surfacearea = 1;
-            // Derivs are constant across the image
-            if (shadelocations == ShadePixelCenters) {
-                sg.dudx = 1.0f / xres;  // sg.dudy is already 0
-                sg.dvdy = 1.0f / yres;  // sg.dvdx is already 0
-            } else {
-                sg.dudx = 1.0f / std::max(1, (xres - 1));
-                sg.dvdy = 1.0f / std::max(1, (yres - 1));
-            }
-            // Derivatives with respect to x,y
-            sg.dPdx = Vec3(1.0f, 0.0f, 0.0f);
-            sg.dPdy = Vec3(0.0f, 1.0f, 0.0f);
-            sg.dPdz = Vec3(0.0f, 0.0f, 1.0f);
-            // Tangents of P with respect to surface u,v
-            sg.dPdu = Vec3(xres, 0.0f, 0.0f);
-            sg.dPdv = Vec3(0.0f, yres, 0.0f);
-            sg.dPdz = Vec3(0.0f, 0.0f, zres);
-            // That also implies that our normal points to (0,0,1)
-            sg.N  = Vec3(0, 0, 1);
-            sg.Ng = Vec3(0, 0, 1);
-            // In our SimpleRenderer, the "renderstate" itself just a pointer to
-            // the ShaderGlobals.
-            // sg.renderstate = &sg;
-        }
-
-        // Loop over all pixels in the image (in x and y)...
-        for (OIIO::ImageBuf::Iterator<float> p(buf, roi); !p.done(); ++p) {
-            // Set the shader globals that vary from point to pixel to pixel
-            sg.P = Vec3(p.x(), p.y(), p.z());
-            if (shadelocations == ShadePixelCenters) {
-                sg.u = float(p.x() - roi_full.xbegin + 0.5f) / xres;
-                sg.v = float(p.y() - roi_full.ybegin + 0.5f) / yres;
-                // float w = float(p.z()-roi_full.zbegin+0.5f) / zres;
-            } else {
-                sg.u = (xres == 1)
-                           ? 0.5f
-                           : float(p.x() - roi_full.xbegin) / (xres - 1);
-                sg.v = (yres == 1)
-                           ? 0.5f
-                           : float(p.y() - roi_full.ybegin) / (yres - 1);
-                // float w = (zres == 1) ? 0.5f : float(p.z()-roi_full.zbegin) / (zres - 1);
-            }
+        setup_shaderglobals(sg, defaultsg, buf.roi_full(), shadelocations,
+                            Mshad, Mobj);
 
-            // Actually run the shader for this point
-            shadingsys.execute(*ctx, group, sg);
-
-            // Save all the designated outputs.
-            int chan = 0;
-            for (int i = 0; i < int(outputs.size()); ++i) {
-                const void* data = shadingsys.symbol_address(*ctx,
-                                                             output_sym[i]);
-                if (!data)
-                    continue;  // Skip if symbol isn't found
-                TypeDesc t = output_type[i];
-                int tvals  = output_nchans[i];
-                if (chan + tvals > buf.nchannels())
-                    break;
-                if (t.basetype == TypeDesc::FLOAT) {
-                    for (int c = 0; c < tvals; ++c)
-                        p[chan++] = ((const float*)data)[c];
-                } else if (t.basetype == TypeDesc::INT) {
-                    for (int c = 0; c < int(t.numelements()) * t.aggregate; ++c)
-                        p[chan++] = ((const int*)data)[c];
-                }
-                // N.B. Drop any outputs that aren't float- or int-based
-            }
-        }
+#if OSL_USE_BATCHED
+        if (batch_size == 16)
+            batched_shade_region<16>(shadingsys, group, ctx, sg, buf,
+                                     output_info, shadelocations, roi);
+        else if (batch_size == 8)
+            batched_shade_region<8>(shadingsys, group, ctx, sg, buf,
+                                    output_info, shadelocations, roi);
+        else if (batch_size == 4)
+            batched_shade_region<4>(shadingsys, group, ctx, sg, buf,
+                                    output_info, shadelocations, roi);
+        else
+#endif
+            shade_region(shadingsys, group, ctx, sg, buf, output_info,
+                         shadelocations, roi);
 
         // We're done shading with this context.
         shadingsys.release_context(ctx);
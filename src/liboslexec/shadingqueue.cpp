@@ -0,0 +1,229 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include <OSL/oslconfig.h>
+
+#include <OSL/rendererservices.h>
+#include <OSL/shadingqueue.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_rendererservices.h>
+#    include <OSL/batched_shaderglobals.h>
+#endif
+
+OSL_NAMESPACE_ENTER
+
+namespace {
+
+#if OSL_USE_BATCHED
+// Copy the scalar shader globals of one point into a lane of a batch
+template<int WidthT>
+void
+globals_to_lane(const ShaderGlobals& sg, BatchedShaderGlobals<WidthT>& bsg,
+                int lane)
+{
+    auto& vsg                = bsg.varying;
+    vsg.P[lane]              = sg.P;
+    vsg.dPdx[lane]           = sg.dPdx;
+    vsg.dPdy[lane]           = sg.dPdy;
+    vsg.dPdz[lane]           = sg.dPdz;
+    vsg.I[lane]              = sg.I;
+    vsg.dIdx[lane]           = sg.dIdx;
+    vsg.dIdy[lane]           = sg.dIdy;
+    vsg.N[lane]              = sg.N;
+    vsg.Ng[lane]             = sg.Ng;
+    vsg.u[lane]              = sg.u;
+    vsg.dudx[lane]           = sg.dudx;
+    vsg.dudy[lane]           = sg.dudy;
+    vsg.v[lane]              = sg.v;
+    vsg.dvdx[lane]           = sg.dvdx;
+    vsg.dvdy[lane]           = sg.dvdy;
+    vsg.dPdu[lane]           = sg.dPdu;
+    vsg.dPdv[lane]           = sg.dPdv;
+    vsg.time[lane]           = sg.time;
+    vsg.dtime[lane]          = sg.dtime;
+    vsg.dPdtime[lane]        = sg.dPdtime;
+    vsg.Ps[lane]             = sg.Ps;
+    vsg.dPsdx[lane]          = sg.dPsdx;
+    vsg.dPsdy[lane]          = sg.dPsdy;
+    vsg.object2common[lane]  = sg.object2common;
+    vsg.shader2common[lane]  = sg.shader2common;
+    vsg.surfacearea[lane]    = sg.surfacearea;
+    vsg.flipHandedness[lane] = sg.flipHandedness;
+    vsg.backfacing[lane]     = sg.backfacing;
+}
+
+// Copy the globals that the group may have written (SGBits of its
+// "globals_write") from a lane of a batch back to the scalar globals.
+template<int WidthT>
+void
+lane_to_globals(const BatchedShaderGlobals<WidthT>& bsg, int lane,
+                int written, ShaderGlobals& sg)
+{
+    auto& vsg = bsg.varying;
+    if (written & int(SGBits::P)) {
+        sg.P    = vsg.P[lane];
+        sg.dPdx = vsg.dPdx[lane];
+        sg.dPdy = vsg.dPdy[lane];
+        sg.dPdz = vsg.dPdz[lane];
+    }
+    if (written & int(SGBits::I)) {
+        sg.I    = vsg.I[lane];
+        sg.dIdx = vsg.dIdx[lane];
+        sg.dIdy = vsg.dIdy[lane];
+    }
+    if (written & int(SGBits::N))
+        sg.N = vsg.N[lane];
+    if (written & int(SGBits::Ng))
+        sg.Ng = vsg.Ng[lane];
+    if (written & int(SGBits::u)) {
+        sg.u    = vsg.u[lane];
+        sg.dudx = vsg.dudx[lane];
+        sg.dudy = vsg.dudy[lane];
+    }
+    if (written & int(SGBits::v)) {
+        sg.v    = vsg.v[lane];
+        sg.dvdx = vsg.dvdx[lane];
+        sg.dvdy = vsg.dvdy[lane];
+    }
+    if (written & int(SGBits::dPdu))
+        sg.dPdu = vsg.dPdu[lane];
+    if (written & int(SGBits::dPdv))
+        sg.dPdv = vsg.dPdv[lane];
+    if (written & int(SGBits::time))
+        sg.time = vsg.time[lane];
+    if (written & int(SGBits::dtime))
+        sg.dtime = vsg.dtime[lane];
+    if (written & int(SGBits::dPdtime))
+        sg.dPdtime = vsg.dPdtime[lane];
+    if (written & int(SGBits::Ps)) {
+        sg.Ps    = vsg.Ps[lane];
+        sg.dPsdx = vsg.dPsdx[lane];
+        sg.dPsdy = vsg.dPsdy[lane];
+    }
+    // The closures only live until the next execute, so always hand them
+    // over
+    sg.Ci = vsg.Ci[lane];
+}
+#endif
+
+}  // namespace
+
+
+
+ShadingQueue::ShadingQueue(ShadingSystem& shadingsys, int batch_width)
+    : m_shadingsys(shadingsys), m_batch_width(0)
+{
+#if OSL_USE_BATCHED
+    // Only batch if the renderer can answer batched queries at this width
+    RendererServices* rs = shadingsys.renderer();
+    if ((batch_width == 16 && rs->batched(WidthOf<16>()))
+        || (batch_width == 8 && rs->batched(WidthOf<8>()))
+        || (batch_width == 4 && rs->batched(WidthOf<4>())))
+        m_batch_width = batch_width;
+#endif
+}
+
+
+
+size_t
+ShadingQueue::push(ShaderGroup* group, const ShaderGlobals& sg)
+{
+    OSL_DASSERT(group);
+    auto rank = m_group_rank.emplace(group, int(m_group_rank.size())).first;
+    m_points.push_back(Point { group, rank->second, sg });
+    return m_points.size() - 1;
+}
+
+
+
+void
+ShadingQueue::sort()
+{
+    // Group by shader and then by ray type (which is uniform in a batch),
+    // keeping the points in the order they were pushed within each bin.
+    m_order.resize(m_points.size());
+    std::iota(m_order.begin(), m_order.end(), size_t(0));
+    std::stable_sort(m_order.begin(), m_order.end(), [&](size_t a, size_t b) {
+        const Point& pa = m_points[a];
+        const Point& pb = m_points[b];
+        return pa.rank < pb.rank
+               || (pa.rank == pb.rank && pa.sg.raytype < pb.sg.raytype);
+    });
+}
+
+
+
+void
+ShadingQueue::execute(ShadingContext& ctx, const Callback& done)
+{
+    if (m_points.empty())
+        return;
+    sort();
+#if OSL_USE_BATCHED
+    if (m_batch_width == 16)
+        return execute_batched<16>(ctx, done);
+    if (m_batch_width == 8)
+        return execute_batched<8>(ctx, done);
+    if (m_batch_width == 4)
+        return execute_batched<4>(ctx, done);
+#endif
+    for (size_t i : m_order) {
+        Point& point = m_points[i];
+        m_shadingsys.execute(ctx, *point.group, point.sg);
+        done(i, point.sg, -1);
+    }
+}
+
+
+
+#if OSL_USE_BATCHED
+template<int WidthT>
+void
+ShadingQueue::execute_batched(ShadingContext& ctx, const Callback& done)
+{
+    BatchedShaderGlobals<WidthT> bsg;
+    memset((char*)&bsg.uniform, 0, sizeof(bsg.uniform));
+    ShaderGlobals* lane_sg[WidthT] = {};
+    bsg.uniform.renderstate        = lane_sg;
+    Block<int, WidthT> shadeindex;
+
+    const size_t npoints = m_order.size();
+    for (size_t begin = 0, end = 0; begin < npoints; begin = end) {
+        const Point& first = m_points[m_order[begin]];
+        end                = begin + 1;
+        while (end < npoints && end - begin < size_t(WidthT)) {
+            const Point& p = m_points[m_order[end]];
+            if (p.group != first.group || p.sg.raytype != first.sg.raytype)
+                break;
+            ++end;
+        }
+        const int n = int(end - begin);
+        for (int lane = 0; lane < n; ++lane) {
+            Point& point     = m_points[m_order[begin + lane]];
+            lane_sg[lane]    = &point.sg;
+            shadeindex[lane] = int(m_order[begin + lane]);
+            globals_to_lane(point.sg, bsg, lane);
+        }
+        bsg.uniform.raytype = first.sg.raytype;
+        m_shadingsys.batched<WidthT>().execute(ctx, *first.group, n,
+                                               shadeindex, bsg, nullptr,
+                                               nullptr);
+        // Like the scalar execute, leave what the group wrote in each
+        // point's globals. The group is optimized by now, so it knows.
+        int written = 0;
+        m_shadingsys.getattribute(first.group, "globals_write", written);
+        for (int lane = 0; lane < n; ++lane) {
+            const size_t i = m_order[begin + lane];
+            lane_to_globals(bsg, lane, written, m_points[i].sg);
+            done(i, m_points[i].sg, lane);
+        }
+    }
+}
+#endif
+
+OSL_NAMESPACE_EXIT
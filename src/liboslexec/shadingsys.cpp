@@ -125,6 +125,14 @@ ShadingSystem::LoadMemoryCompiledShader(string_view shadername,
 
 
 
+int
+ShadingSystem::load_shaders(cspan<ustring> names)
+{
+    return m_impl->load_shaders(names);
+}
+
+
+
 ShaderGroupRef
 ShadingSystem::ShaderGroupBegin(string_view groupname)
 {
@@ -618,6 +626,29 @@ ShadingSystem::configure_batch_execution_at(int width)
                 m_impl->attribute("llvm_jit_fma", 0);
                 return true;
             }
+#    endif
+            if (target_requested) {
+                break;
+            }
+            // fallthrough
+        default: return false;
+        };
+        return false;
+    case 4:
+        switch (requestedISA) {
+        case TargetISA::UNKNOWN:
+            // fallthrough
+        case TargetISA::SSE4_2:
+#    ifdef __OSL_SUPPORTS_b4_SSE4_2
+            if (LLVM_Util::supports_isa(TargetISA::SSE4_2)) {
+                if (!target_requested)
+                    m_impl->attribute("llvm_jit_target",
+                                      LLVM_Util::target_isa_name(
+                                          TargetISA::SSE4_2));
+                // SSE4.2 doesn't support FMA
+                m_impl->attribute("llvm_jit_fma", 0);
+                return true;
+            }
 #    endif
             if (target_requested) {
                 break;
@@ -639,6 +670,22 @@ ShadingSystem::getstats(int level) const
 
 
 
+void
+ShadingSystem::getstats(OIIO::ParamValueList& stats, bool groups) const
+{
+    m_impl->getstats(stats, groups);
+}
+
+
+
+std::string
+ShadingSystem::getstats_json(bool groups) const
+{
+    return m_impl->getstats_json(groups);
+}
+
+
+
 void
 ShadingSystem::register_closure(string_view name, int id,
                                 const ClosureParam* params,
@@ -719,8 +766,7 @@ ShadingSystem::raytype_bit(ustring name)
 void
 ShadingSystem::optimize_all_groups(int nthreads, bool do_jit)
 {
-    return m_impl->optimize_all_groups(nthreads, 0 /*mythread*/,
-                                       1 /*totalthreads*/, do_jit);
+    return m_impl->optimize_all_groups(nthreads, do_jit);
 }
 
 
@@ -879,12 +925,13 @@ template<int WidthT>
 void
 ShadingSystem::BatchedExecutor<WidthT>::jit_all_groups(int nthreads)
 {
-    OSL_ASSERT(0 && "To Be Implemented");
+    m_shading_system.m_impl->batched<WidthT>().jit_all_groups(nthreads);
 }
 
 // Explicitly instantiate
 template class ShadingSystem::BatchedExecutor<16>;
 template class ShadingSystem::BatchedExecutor<8>;
+template class ShadingSystem::BatchedExecutor<4>;
 #endif
 
 
@@ -1000,7 +1047,10 @@ register_JIT_Global(const char* global_var_name, void* global_var_addr)
     LLVM_Util::add_global_mapping(global_var_name, global_var_addr);
 }
 
-PerThreadInfo::PerThreadInfo() {}
+PerThreadInfo::PerThreadInfo(LLVM_Util::ContextPool* llvm_pool)
+    : llvm_thread_info(llvm_pool)
+{
+}
 
 
 
@@ -1056,9 +1106,11 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_range_checking(true)
     , m_connection_error(true)
     , m_greedyjit(false)
+    , m_async_jit(false)
     , m_countlayerexecs(false)
     , m_relaxed_param_typecheck(false)
     , m_profile(0)
+    , m_profile_layers(0)
     , m_optimize(2)
     , m_opt_simplify_param(true)
     , m_opt_constant_fold(true)
@@ -1079,12 +1131,15 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_opt_groupdata(true)
 #if OSL_USE_BATCHED
     , m_opt_batched_analysis((renderer->batched(WidthOf<16>()) != nullptr)
-                             || (renderer->batched(WidthOf<8>()) != nullptr))
+                             || (renderer->batched(WidthOf<8>()) != nullptr)
+                             || (renderer->batched(WidthOf<4>()) != nullptr))
 #else
     , m_opt_batched_analysis(false)
 #endif
+    , m_opt_merge_groups(true)
     , m_llvm_jit_fma(false)
     , m_llvm_jit_aggressive(false)
+    , m_llvm_fuse_layers(false)
     , m_optimize_nondebug(false)
     , m_vector_width(4)
     , m_opt_passes(10)
@@ -1140,6 +1195,8 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_stat_groupinstances                    = 0;
     m_stat_instances_compiled                = 0;
     m_stat_groups_compiled                   = 0;
+    m_stat_groups_shared                     = 0;
+    m_stat_groups_async_jitted               = 0;
     m_stat_empty_instances                   = 0;
     m_stat_merged_inst                       = 0;
     m_stat_merged_inst_opt                   = 0;
@@ -1157,6 +1214,8 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_stat_tex_calls_as_handles              = 0;
     m_stat_useparam_ops                      = 0;
     m_stat_call_layers_inserted              = 0;
+    m_stat_llvm_jit_cache_hits               = 0;
+    m_stat_llvm_jit_cache_misses             = 0;
     m_stat_master_load_time                  = 0;
     m_stat_optimization_time                 = 0;
     m_stat_getattribute_time                 = 0;
@@ -1179,6 +1238,7 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
 
     m_groups_to_compile_count     = 0;
     m_threads_currently_compiling = 0;
+    m_async_compiles_pending      = 0;
 
     // If client didn't supply an error handler, just use the default
     // one that echoes to the terminal.
@@ -1491,6 +1551,13 @@ ShadingSystemImpl::query_closure(const char** name, int* id,
 
 ShadingSystemImpl::~ShadingSystemImpl()
 {
+    // Background compiles refer to us, so let any in flight finish.
+    {
+        std::unique_lock<std::mutex> lock(m_async_mutex);
+        m_async_compiles_done.wait(lock,
+                                   [&]() { return !m_async_compiles_pending; });
+    }
+
     size_t ngroups = m_all_shader_groups.size();
     for (size_t i = 0; i < ngroups; ++i) {
         if (ShaderGroupRef g = m_all_shader_groups[i].lock()) {
@@ -1590,6 +1657,7 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("debug_uninit", int, m_debug_uninit);
     ATTR_SET("lockgeom", int, m_lockgeom_default);
     ATTR_SET("profile", int, m_profile);
+    ATTR_SET("profile_layers", int, m_profile_layers);
     ATTR_SET("optimize", int, m_optimize);
     ATTR_SET("opt_simplify_param", int, m_opt_simplify_param);
     ATTR_SET("opt_constant_fold", int, m_opt_constant_fold);
@@ -1611,9 +1679,12 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("opt_useparam", int, m_opt_useparam);
     ATTR_SET("opt_groupdata", int, m_opt_groupdata);
     ATTR_SET("opt_batched_analysis", int, m_opt_batched_analysis);
+    ATTR_SET("opt_merge_groups", int, m_opt_merge_groups);
     ATTR_SET("llvm_jit_fma", int, m_llvm_jit_fma);
     ATTR_SET("llvm_jit_aggressive", int, m_llvm_jit_aggressive);
+    ATTR_SET("llvm_fuse_layers", int, m_llvm_fuse_layers);
     ATTR_SET_STRING("llvm_jit_target", m_llvm_jit_target);
+    ATTR_SET_STRING("llvm_jit_cache_dir", m_llvm_jit_cache_dir);
     ATTR_SET("vector_width", int, m_vector_width);
     ATTR_SET("opt_passes", int, m_opt_passes);
     ATTR_SET("optimize_nondebug", int, m_optimize_nondebug);
@@ -1637,6 +1708,7 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
              m_shading_state_uniform.m_unknown_coordsys_error);
     ATTR_SET("connection_error", int, m_connection_error);
     ATTR_SET("greedyjit", int, m_greedyjit);
+    ATTR_SET("async_jit", int, m_async_jit);
     ATTR_SET("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_SET("countlayerexecs", int, m_countlayerexecs);
     ATTR_SET("max_warnings_per_thread", int,
@@ -1780,6 +1852,7 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("debug_uninit", int, m_debug_uninit);
     ATTR_DECODE("lockgeom", int, m_lockgeom_default);
     ATTR_DECODE("profile", int, m_profile);
+    ATTR_DECODE("profile_layers", int, m_profile_layers);
     ATTR_DECODE("optimize", int, m_optimize);
     ATTR_DECODE("opt_simplify_param", int, m_opt_simplify_param);
     ATTR_DECODE("opt_constant_fold", int, m_opt_constant_fold);
@@ -1801,9 +1874,12 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("opt_useparam", int, m_opt_useparam);
     ATTR_DECODE("opt_groupdata", int, m_opt_groupdata);
     ATTR_DECODE("opt_batched_analysis", int, m_opt_batched_analysis);
+    ATTR_DECODE("opt_merge_groups", int, m_opt_merge_groups);
     ATTR_DECODE("llvm_jit_fma", int, m_llvm_jit_fma);
     ATTR_DECODE("llvm_jit_aggressive", int, m_llvm_jit_aggressive);
+    ATTR_DECODE("llvm_fuse_layers", int, m_llvm_fuse_layers);
     ATTR_DECODE_STRING("llvm_jit_target", m_llvm_jit_target);
+    ATTR_DECODE_STRING("llvm_jit_cache_dir", m_llvm_jit_cache_dir);
     ATTR_DECODE("vector_width", int, m_vector_width);
     ATTR_DECODE("opt_passes", int, m_opt_passes);
     ATTR_DECODE("optimize_nondebug", int, m_optimize_nondebug);
@@ -1828,6 +1904,7 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
                 m_shading_state_uniform.m_unknown_coordsys_error);
     ATTR_DECODE("connection_error", int, m_connection_error);
     ATTR_DECODE("greedyjit", int, m_greedyjit);
+    ATTR_DECODE("async_jit", int, m_async_jit);
     ATTR_DECODE("countlayerexecs", int, m_countlayerexecs);
     ATTR_DECODE("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_DECODE("max_warnings_per_thread", int,
@@ -1864,6 +1941,8 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("stat:groups", int, m_stat_groups);
     ATTR_DECODE("stat:instances_compiled", int, m_stat_instances_compiled);
     ATTR_DECODE("stat:groups_compiled", int, m_stat_groups_compiled);
+    ATTR_DECODE("stat:groups_shared", int, m_stat_groups_shared);
+    ATTR_DECODE("stat:groups_async_jitted", int, m_stat_groups_async_jitted);
     ATTR_DECODE("stat:empty_instances", int, m_stat_empty_instances);
     ATTR_DECODE("stat:merged_inst", int, m_stat_merged_inst);
     ATTR_DECODE("stat:merged_inst_opt", int, m_stat_merged_inst_opt);
@@ -1882,6 +1961,9 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("stat:tex_calls_as_handles", int, m_stat_tex_calls_as_handles);
     ATTR_DECODE("stat:useparam_ops", int, m_stat_useparam_ops);
     ATTR_DECODE("stat:call_layers_inserted", int, m_stat_call_layers_inserted);
+    ATTR_DECODE("stat:llvm_jit_cache_hits", int, m_stat_llvm_jit_cache_hits);
+    ATTR_DECODE("stat:llvm_jit_cache_misses", int,
+                m_stat_llvm_jit_cache_misses);
     ATTR_DECODE("stat:master_load_time", float, m_stat_master_load_time);
     ATTR_DECODE("stat:optimization_time", float, m_stat_optimization_time);
     ATTR_DECODE("stat:opt_locking_time", float, m_stat_opt_locking_time);
@@ -1953,6 +2035,11 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
                 m_stat_mem_inst_connections.current());
     ATTR_DECODE("stat:mem_inst_connections_peak", long long,
                 m_stat_mem_inst_connections.peak());
+    ATTR_DECODE("stat:layers_executed", long long, m_stat_layers_executed);
+    ATTR_DECODE("stat:shading_time", float,
+                OIIO::Timer::seconds(m_stat_total_shading_time_ticks));
+    ATTR_DECODE("stat:llvm_jit_memory", long long,
+                LLVM_Util::total_jit_memory_held());
 
     if (name == "colorsystem" && type.basetype == TypeDesc::PTR) {
         *(void**)val = &colorsystem();
@@ -2004,6 +2091,10 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
         *(const char**)val = ustring(deps).c_str();
         return true;
     }
+    if (name == "profile_report" && type == TypeDesc::STRING) {
+        *(const char**)val = ustring(profile_report()).c_str();
+        return true;
+    }
 #ifdef OSL_LLVM_CUDA_BITCODE
     if (name == "shadeops_cuda_ptx" && type.basetype == TypeDesc::PTR) {
         *(const char**)val = reinterpret_cast<const char*>(
@@ -2051,6 +2142,14 @@ ShadingSystemImpl::attribute(ShaderGroup* group, string_view name,
         group->name(ustring(((const char**)val)[0]));
         return true;
     }
+    if (name == "async_fallback" && type.basetype == TypeDesc::PTR) {
+        ShaderGroup* fallback = *(ShaderGroup* const*)val;
+        if (fallback == group)
+            return false;
+        group->m_async_fallback = fallback ? fallback->shared_from_this()
+                                           : ShaderGroupRef();
+        return true;
+    }
     return false;
 }
 
@@ -2135,10 +2234,26 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         *(ustring*)val = ustring(group->serialize());
         return true;
     }
+    if (name == "profile_report" && type == TypeDesc::STRING) {
+        *(ustring*)val = ustring(profile_report(group));
+        return true;
+    }
     if (name == "exec_repeat" && type == TypeInt) {
         *(int*)val = group->m_exec_repeat;
         return true;
     }
+    if (name == "jitted" && type == TypeInt) {
+        *(int*)val = group->jitted();
+        return true;
+    }
+    if (name == "batch_jitted" && type == TypeInt) {
+        *(int*)val = group->batch_jitted();
+        return true;
+    }
+    if (name == "async_fallback" && type.basetype == TypeDesc::PTR) {
+        *(ShaderGroup**)val = group->m_async_fallback.get();
+        return true;
+    }
     if (name == "ptx_compiled_version" && type.basetype == TypeDesc::PTR) {
         bool exists        = !group->m_llvm_ptx_compiled_version.empty();
         *(std::string*)val = exists ? group->m_llvm_ptx_compiled_version : "";
@@ -2361,10 +2476,96 @@ struct group_time_compare {  // So looking forward to C++11 lambdas!
         return a.second > b.second;
     }
 };
+
+
+
+// Escape a string for use inside a JSON string literal
+std::string
+json_escape(string_view str)
+{
+    std::string out;
+    out.reserve(str.size());
+    for (char c : str) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20)
+                out += fmtformat("\\u{:04x}", (unsigned int)c);
+            else
+                out += c;
+        }
+    }
+    return out;
+}
+
+
+
+// Append the JSON object for the layer profile of a group
+void
+append_profile_json(std::string& out, const ShaderGroup& group)
+{
+    const GroupProfile& prof = *group.m_profile;
+    out += fmtformat("{{\"name\": \"{}\", \"executions\": {}, \"layers\": [",
+                     json_escape(group.name()),
+                     (long long)group.m_executions);
+    for (int layer = 0, nl = prof.nlayers(); layer < nl; ++layer) {
+        const ShaderInstance* inst = group[layer];
+        out += fmtformat("{}{{\"name\": \"{}\", \"shader\": \"{}\"",
+                         layer ? ", " : "",
+                         json_escape(inst->layername()),
+                         json_escape(inst->shadername()));
+        auto append_counts = [&](const char* what,
+                                 const std::vector<atomic_ll>& counts) {
+            out += fmtformat(", \"{}\": {{", what);
+            for (int c = 0; c < GroupProfile::NumOpClasses; ++c)
+                out += fmtformat("{}\"{}\": {}", c ? ", " : "",
+                                 GroupProfile::opclass_name(c),
+                                 (long long)counts[GroupProfile::slot(layer,
+                                                                      c)]);
+            out += "}";
+        };
+        append_counts("cycles", prof.cycles);
+        append_counts("calls", prof.calls);
+        out += "}";
+    }
+    out += "]}";
+}
 }  // namespace
 
 
 
+std::string
+ShadingSystemImpl::profile_report(ShaderGroup* group) const
+{
+    std::string out = "{\"groups\": [";
+    if (group) {
+        if (group->m_profile)
+            append_profile_json(out, *group);
+    } else {
+        spin_lock lock(m_all_shader_groups_mutex);
+        bool first = true;
+        for (auto&& grp : m_all_shader_groups) {
+            ShaderGroupRef g = grp.lock();
+            if (g && g->m_profile) {
+                if (!first)
+                    out += ", ";
+                append_profile_json(out, *g);
+                first = false;
+            }
+        }
+    }
+    out += "]}";
+    return out;
+}
+
+
+
 std::string
 ShadingSystemImpl::getstats(int level) const
 {
@@ -2395,6 +2596,7 @@ ShadingSystemImpl::getstats(int level) const
     INTOPT(llvm_optimize);
     INTOPT(debug);
     INTOPT(profile);
+    INTOPT(profile_layers);
     INTOPT(llvm_debug);
     BOOLOPT(llvm_debug_layers);
     BOOLOPT(llvm_debug_ops);
@@ -2417,6 +2619,7 @@ ShadingSystemImpl::getstats(int level) const
     BOOLOPT(error_repeats);
     BOOLOPT(range_checking);
     BOOLOPT(greedyjit);
+    BOOLOPT(async_jit);
     BOOLOPT(countlayerexecs);
     BOOLOPT(opt_simplify_param);
     BOOLOPT(opt_constant_fold);
@@ -2434,10 +2637,13 @@ ShadingSystemImpl::getstats(int level) const
     BOOLOPT(opt_texture_handle);
     BOOLOPT(opt_seed_bblock_aliases);
     BOOLOPT(opt_batched_analysis);
+    BOOLOPT(opt_merge_groups);
     BOOLOPT(llvm_jit_fma);
     BOOLOPT(llvm_jit_aggressive);
+    BOOLOPT(llvm_fuse_layers);
     INTOPT(vector_width);
     STROPT(llvm_jit_target);
+    STROPT(llvm_jit_cache_dir);
     INTOPT(opt_passes);
     INTOPT(no_noise);
     INTOPT(no_pointcloud);
@@ -2528,6 +2734,12 @@ ShadingSystemImpl::getstats(int level) const
 
     out << "  Compiled " << m_stat_groups_compiled << " groups, "
         << m_stat_instances_compiled << " instances\n";
+    if (m_stat_groups_shared)
+        out << "  Shared compiled code with identical groups: "
+            << m_stat_groups_shared << " groups\n";
+    if (m_stat_groups_async_jitted)
+        out << "  Compiled in the background: " << m_stat_groups_async_jitted
+            << " groups\n";
     out << "  Merged " << (m_stat_merged_inst + m_stat_merged_inst_opt)
         << " instances (" << m_stat_merged_inst << " initial, "
         << m_stat_merged_inst_opt << " after opt) in "
@@ -2585,6 +2797,10 @@ ShadingSystemImpl::getstats(int level) const
         out << "    LLVM JIT:                  "
             << Strutil::timeintervalformat(m_stat_llvm_jit_time, 2) << "\n";
     }
+    if (m_llvm_jit_cache_dir.size())
+        print(out, "  LLVM JIT object cache: {} hits, {} misses\n",
+              (int)m_stat_llvm_jit_cache_hits,
+              (int)m_stat_llvm_jit_cache_misses);
 
     out << "  Texture calls compiled: " << (int)m_stat_tex_calls_codegened
         << " (" << (int)m_stat_tex_calls_as_handles << " used handles)\n";
@@ -2697,11 +2913,269 @@ ShadingSystemImpl::getstats(int level) const
         }
     }
 
+    if (m_profile_layers) {
+        // Cycles of the live groups that were JITed with profile_layers,
+        // by op class and by layer (including the ops it ran).
+        typedef std::pair<std::string, long long> LayerCycles;
+        std::vector<LayerCycles> layercycles;
+        long long classcycles[GroupProfile::NumOpClasses] = {};
+        long long classcalls[GroupProfile::NumOpClasses]  = {};
+        long long total                                   = 0;
+        {
+            spin_lock lock(m_all_shader_groups_mutex);
+            for (auto&& grp : m_all_shader_groups) {
+                ShaderGroupRef g = grp.lock();
+                if (!g || !g->m_profile)
+                    continue;
+                const GroupProfile& prof = *g->m_profile;
+                for (int layer = 0, nl = prof.nlayers(); layer < nl; ++layer) {
+                    long long layertotal = 0;
+                    for (int c = 0; c < GroupProfile::NumOpClasses; ++c) {
+                        int slot = GroupProfile::slot(layer, c);
+                        classcycles[c] += prof.cycles[slot];
+                        classcalls[c] += prof.calls[slot];
+                        layertotal += prof.cycles[slot];
+                    }
+                    total += layertotal;
+                    layercycles.emplace_back(
+                        fmtformat("{}/{}",
+                                  g->name().size() ? g->name().c_str()
+                                                   : "<unnamed group>",
+                                  (*g)[layer]->layername()),
+                        layertotal);
+                }
+            }
+        }
+        out << "  Layer profile (cycles, sum of all threads):\n";
+        out << "    Total: " << Strutil::fmt::format("{:.4g}", double(total))
+            << '\n';
+        for (int c = 0; c < GroupProfile::NumOpClasses; ++c) {
+            if (!classcalls[c])
+                continue;
+            out << Strutil::fmt::format(
+                "      {:<14} {:>10.4g} ({:4.1f}%) in {} calls\n",
+                GroupProfile::opclass_name(c), double(classcycles[c]),
+                total ? 100.0 * classcycles[c] / total : 0.0, classcalls[c]);
+        }
+        std::sort(layercycles.begin(), layercycles.end(),
+                  [](const LayerCycles& a, const LayerCycles& b) {
+                      return a.second > b.second;
+                  });
+        if (layercycles.size() > 10)
+            layercycles.resize(10);
+        if (layercycles.size())
+            out << "    Most expensive layers:\n";
+        for (auto&& l : layercycles)
+            out << Strutil::fmt::format("      {:>10.4g} ({:4.1f}%) {}\n",
+                                        double(l.second),
+                                        total ? 100.0 * l.second / total : 0.0,
+                                        l.first);
+    }
+
     return out.str();
 }
 
 
 
+namespace {
+// The "stat:" attributes, in the order they are snapshot
+const std::pair<const char*, TypeDesc> stat_attributes[] = {
+    { "stat:masters", TypeInt },
+    { "stat:groups", TypeInt },
+    { "stat:instances", TypeInt },
+    { "stat:instances_compiled", TypeInt },
+    { "stat:groups_compiled", TypeInt },
+    { "stat:groups_shared", TypeInt },
+    { "stat:groups_async_jitted", TypeInt },
+    { "stat:empty_instances", TypeInt },
+    { "stat:empty_groups", TypeInt },
+    { "stat:merged_inst", TypeInt },
+    { "stat:merged_inst_opt", TypeInt },
+    { "stat:regexes", TypeInt },
+    { "stat:preopt_syms", TypeInt },
+    { "stat:postopt_syms", TypeInt },
+    { "stat:syms_with_derivs", TypeInt },
+    { "stat:preopt_ops", TypeInt },
+    { "stat:postopt_ops", TypeInt },
+    { "stat:middlemen_eliminated", TypeInt },
+    { "stat:const_connections", TypeInt },
+    { "stat:global_connections", TypeInt },
+    { "stat:tex_calls_codegened", TypeInt },
+    { "stat:tex_calls_as_handles", TypeInt },
+    { "stat:useparam_ops", TypeInt },
+    { "stat:call_layers_inserted", TypeInt },
+    { "stat:llvm_jit_cache_hits", TypeInt },
+    { "stat:llvm_jit_cache_misses", TypeInt },
+    { "stat:master_load_time", TypeFloat },
+    { "stat:optimization_time", TypeFloat },
+    { "stat:opt_locking_time", TypeFloat },
+    { "stat:specialization_time", TypeFloat },
+    { "stat:total_llvm_time", TypeFloat },
+    { "stat:llvm_setup_time", TypeFloat },
+    { "stat:llvm_irgen_time", TypeFloat },
+    { "stat:llvm_opt_time", TypeFloat },
+    { "stat:llvm_jit_time", TypeFloat },
+    { "stat:inst_merge_time", TypeFloat },
+    { "stat:shading_time", TypeFloat },
+    { "stat:layers_executed", TypeDesc::INT64 },
+    { "stat:getattribute_calls", TypeDesc::INT64 },
+    { "stat:get_userdata_calls", TypeDesc::INT64 },
+    { "stat:noise_calls", TypeDesc::INT64 },
+    { "stat:pointcloud_searches", TypeDesc::INT64 },
+    { "stat:pointcloud_searches_total_results", TypeDesc::INT64 },
+    { "stat:pointcloud_max_results", TypeInt },
+    { "stat:pointcloud_failures", TypeInt },
+    { "stat:pointcloud_gets", TypeDesc::INT64 },
+    { "stat:pointcloud_writes", TypeDesc::INT64 },
+    { "stat:reparam_calls_total", TypeDesc::INT64 },
+    { "stat:reparam_bytes_total", TypeDesc::INT64 },
+    { "stat:reparam_calls_changed", TypeDesc::INT64 },
+    { "stat:reparam_bytes_changed", TypeDesc::INT64 },
+    { "stat:memory_current", TypeDesc::INT64 },
+    { "stat:memory_peak", TypeDesc::INT64 },
+    { "stat:mem_master_current", TypeDesc::INT64 },
+    { "stat:mem_master_peak", TypeDesc::INT64 },
+    { "stat:mem_inst_current", TypeDesc::INT64 },
+    { "stat:mem_inst_peak", TypeDesc::INT64 },
+    { "stat:llvm_jit_memory", TypeDesc::INT64 },
+};
+
+
+
+// Append a stat value as JSON. JSON has no inf or nan, so non-finite
+// floats are written as null.
+void
+append_json_value(std::string& out, const ParamValue& p)
+{
+    if (p.type() == TypeDesc::STRING)
+        out += fmtformat("\"{}\"", json_escape(p.get_ustring()));
+    else if (p.type() == TypeDesc::INT64)
+        out += fmtformat("{}", *(const long long*)p.data());
+    else if (p.type() == TypeFloat) {
+        float f = p.get_float();
+        out += OIIO::isfinite(f) ? fmtformat("{}", f) : std::string("null");
+    } else
+        out += fmtformat("{}", p.get_int());
+}
+}  // namespace
+
+
+
+void
+ShadingSystemImpl::getstats(ParamValueList& stats, bool groups) const
+{
+    auto self = const_cast<ShadingSystemImpl*>(this);
+    for (auto&& s : stat_attributes) {
+        long long val = 0;  // Big enough for any of them
+        if (self->getattribute(s.first, s.second, &val)) {
+            stats.remove(s.first);
+            stats.emplace_back(s.first, s.second, 1, &val);
+        }
+    }
+    if (!groups)
+        return;
+
+    std::vector<ShaderGroupRef> live;
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
+        for (auto&& grp : m_all_shader_groups)
+            if (ShaderGroupRef g = grp.lock())
+                live.push_back(g);
+    }
+    for (auto&& g : live) {
+        auto add = [&](string_view name, TypeDesc type, const void* val) {
+            std::string fullname = fmtformat("group:{}:{}", g->id(), name);
+            stats.remove(fullname);
+            stats.emplace_back(fullname, type, 1, val);
+        };
+        ustring name         = g->name();
+        int layers           = g->nlayers();
+        int optimized        = g->optimized();
+        int jitted           = g->jitted();
+        int shared_code      = g->m_shared_code_group != nullptr;
+        long long executions = g->m_executions;
+        long long groupdata  = (long long)g->llvm_groupdata_size();
+        // The compile stats are written while optimizing under the group's
+        // lock, so copy them out under it too.
+        float opt_time, irgen_time, llvmopt_time, jit_time;
+        int preopt_ops, postopt_ops, preopt_syms, postopt_syms;
+        {
+            lock_guard lock(g->m_mutex);
+            opt_time     = g->m_stat_optimization_time;
+            irgen_time   = g->m_stat_llvm_irgen_time;
+            llvmopt_time = g->m_stat_llvm_opt_time;
+            jit_time     = g->m_stat_llvm_jit_time;
+            preopt_ops   = g->m_stat_preopt_ops;
+            postopt_ops  = g->m_stat_postopt_ops;
+            preopt_syms  = g->m_stat_preopt_syms;
+            postopt_syms = g->m_stat_postopt_syms;
+        }
+        add("name", TypeDesc::STRING, &name);
+        add("layers", TypeInt, &layers);
+        add("optimized", TypeInt, &optimized);
+        add("jitted", TypeInt, &jitted);
+        add("shared_code", TypeInt, &shared_code);
+        add("executions", TypeDesc::INT64, &executions);
+        add("optimization_time", TypeFloat, &opt_time);
+        add("llvm_irgen_time", TypeFloat, &irgen_time);
+        add("llvm_opt_time", TypeFloat, &llvmopt_time);
+        add("llvm_jit_time", TypeFloat, &jit_time);
+        add("preopt_ops", TypeInt, &preopt_ops);
+        add("postopt_ops", TypeInt, &postopt_ops);
+        add("preopt_syms", TypeInt, &preopt_syms);
+        add("postopt_syms", TypeInt, &postopt_syms);
+        add("groupdata_size", TypeDesc::INT64, &groupdata);
+    }
+}
+
+
+
+std::string
+ShadingSystemImpl::getstats_json(bool groups) const
+{
+    ParamValueList stats;
+    getstats(stats, groups);
+
+    // The group entries are named "group:<id>:<stat>", and each group's
+    // entries are together.
+    std::string out = fmtformat("{{\"osl_version\": \"{}\", \"stats\": {{",
+                                OSL_LIBRARY_VERSION_STRING);
+    std::string groupsout;
+    string_view curgroup;
+    bool first = true;
+    for (auto&& p : stats) {
+        string_view name = p.name();
+        if (Strutil::parse_prefix(name, "stat:")) {
+            out += fmtformat("{}\"{}\": ", first ? "" : ", ",
+                             json_escape(name));
+            append_json_value(out, p);
+            first = false;
+        } else if (Strutil::parse_prefix(name, "group:")) {
+            size_t colon = name.find(':');
+            if (colon == string_view::npos)
+                continue;
+            string_view id = name.substr(0, colon);
+            if (id != curgroup) {
+                groupsout += fmtformat("{}{{\"id\": {}",
+                                       curgroup.size() ? "}, " : "", id);
+                curgroup = id;
+            }
+            groupsout += fmtformat(", \"{}\": ",
+                                   json_escape(name.substr(colon + 1)));
+            append_json_value(groupsout, p);
+        }
+    }
+    if (curgroup.size())
+        groupsout += "}";
+    out += "}";
+    if (groups)
+        out += fmtformat(", \"groups\": [{}]", groupsout);
+    out += "}";
+    return out;
+}
+
+
+
 void
 ShadingSystemImpl::printstats() const
 {
@@ -3415,7 +3889,7 @@ ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
 PerThreadInfo*
 ShadingSystemImpl::create_thread_info()
 {
-    return new PerThreadInfo;
+    return new PerThreadInfo(&m_llvm_context_pool);
 }
 
 
@@ -3696,8 +4170,48 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
     if (group.optimized() && (!do_jit || group.jitted()))
         return;  // already optimized and optionally jitted
 
+    // If an identical group has been seen before, optimize and JIT that
+    // one (if it isn't already) and share its layers and code, rather than
+    // compiling the same thing twice.
+    ShaderGroupRef shared;
+    {
+        lock_guard lock(group.m_mutex);
+        shared = group.m_shared_code_group;
+    }
+    if (!shared && m_opt_merge_groups && !group.optimized())
+        shared = intern_group(group);
+    if (shared) {
+        optimize_group(*shared, ctx, do_jit);
+        if (ctx)
+            ctx->group(&group);
+        lock_guard lock(group.m_mutex);
+        bool first_time = !group.optimized();
+        share_group_code(group, shared);
+        if (first_time) {
+            m_stat_groups_shared += 1;
+            m_groups_to_compile_count -= 1;
+        }
+        return;
+    }
+
     OIIO::Timer timer;
-    lock_guard lock(group.m_mutex);
+
+    // The JIT cache key needs the group serialization, which takes the
+    // group lock itself, so compute it before we lock.
+    std::string jit_cache_key;
+    if (do_jit && m_llvm_jit_cache_dir.size() && !use_optix()
+        && !group.optimized())
+        jit_cache_key = llvm_jit_cache_key(group);
+
+    std::unique_lock<mutex> lock(group.m_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        // Another thread is compiling this group. Rather than just wait,
+        // help with any pass over all groups that is under way.
+        help_compile_all_groups([&]() {
+            return group.optimized() && (!do_jit || group.jitted());
+        });
+        lock.lock();
+    }
     bool need_jit = do_jit && !group.jitted();
     if (group.optimized() && !need_jit) {
         // The group was somehow optimized by another thread between the
@@ -3734,6 +4248,29 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
         ctx           = get_context(thread_info);
         ctx_allocated = true;
     }
+    if (need_jit && !group.optimized() && jit_cache_key.size()) {
+        // If the on-disk JIT cache has the group's code, there's no need
+        // to optimize it or generate any IR.
+        group.m_llvm_jit_cache_key = jit_cache_key;
+        BackendLLVM lljitter(*this, group, ctx);
+        if (lljitter.load_from_jit_cache()) {
+            m_stat_llvm_jit_cache_hits += 1;
+            group_post_jit_cleanup(group);
+            group.m_optimized = true;
+            group.m_jitted    = true;
+            need_jit          = false;
+            spin_lock stat_lock(m_stat_mutex);
+            m_stat_opt_locking_time += locking_time;
+            m_stat_optimization_time += timer();
+            m_stat_total_llvm_time += lljitter.m_stat_total_llvm_time;
+            m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+            group.m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+            if (group.does_nothing())
+                m_stat_empty_groups += 1;
+        } else {
+            m_stat_llvm_jit_cache_misses += 1;
+        }
+    }
     if (!group.optimized()) {
         RuntimeOptimizer rop(*this, group, ctx);
         rop.run();
@@ -3780,6 +4317,7 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
         m_stat_opt_locking_time += rop.m_stat_opt_locking_time;
         m_stat_opt_locking_time += locking_time + rop.m_stat_opt_locking_time;
         m_stat_specialization_time += rop.m_stat_specialization_time;
+        group.m_stat_optimization_time = rop.m_stat_specialization_time;
     }
 
     if (need_jit) {
@@ -3794,7 +4332,8 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
         // the batch jit has already happened,
         // as it requires the ops so we can't delete them yet!
         if (((renderer()->batched(WidthOf<16>()) == nullptr)
-             && (renderer()->batched(WidthOf<8>()) == nullptr))
+             && (renderer()->batched(WidthOf<8>()) == nullptr)
+             && (renderer()->batched(WidthOf<4>()) == nullptr))
             || group.batch_jitted()) {
             group_post_jit_cleanup(group);
         }
@@ -3810,6 +4349,9 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
         m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
         m_stat_max_llvm_local_mem = std::max(m_stat_max_llvm_local_mem,
                                              lljitter.m_llvm_local_mem);
+        group.m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+        group.m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+        group.m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
     }
 
     if (ctx_allocated) {
@@ -3822,6 +4364,214 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
     m_groups_to_compile_count -= 1;
 }
 
+ShaderGroupRef
+ShadingSystemImpl::intern_group(ShaderGroup& group)
+{
+    // Groups whose compiled code is tied to their name can't share it.
+    if (use_optix() || m_only_groupname.size() || m_debug_groupname.size()
+        || m_archive_groupname.size())
+        return ShaderGroupRef();
+
+    std::string key = group_code_key(group);
+    // Interactive parameters may be changed per group after optimization,
+    // so groups that have them never share.
+    if (Strutil::contains(key, "[[int interactive=1]]"))
+        return ShaderGroupRef();
+
+    spin_lock lock(m_group_intern_mutex);
+    if (m_group_intern_table.size() >= m_group_intern_purge_size) {
+        // Drop the entries of groups that no longer exist.
+        for (auto i = m_group_intern_table.begin();
+             i != m_group_intern_table.end();) {
+            if (i->second.expired())
+                i = m_group_intern_table.erase(i);
+            else
+                ++i;
+        }
+        m_group_intern_purge_size = std::max(size_t(1024),
+                                             2 * m_group_intern_table.size());
+    }
+    std::weak_ptr<ShaderGroup>& entry = m_group_intern_table[key];
+    ShaderGroupRef found              = entry.lock();
+    if (found && found.get() != &group)
+        return found;
+    entry = group.shared_from_this();
+    return ShaderGroupRef();
+}
+
+
+
+void
+ShadingSystemImpl::share_group_code(ShaderGroup& group,
+                                    const ShaderGroupRef& srcref)
+{
+    // Caller holds group's lock. The source group is already optimized
+    // (and JITed as needed), but another thread may still be batch JITing
+    // it, so hold its lock while copying. A source group never shares
+    // another's code, so this can't deadlock.
+    const ShaderGroup& src = *srcref;
+    lock_guard src_lock(src.m_mutex);
+    group.m_shared_code_group = srcref;
+    group.m_layers            = src.m_layers;
+    group.m_does_nothing      = src.m_does_nothing;
+
+    group.m_llvm_groupdata_size      = src.m_llvm_groupdata_size;
+    group.m_llvm_groupdata_wide_size = src.m_llvm_groupdata_wide_size;
+    group.m_llvm_compiled_version    = src.m_llvm_compiled_version;
+    group.m_llvm_compiled_init       = src.m_llvm_compiled_init;
+    group.m_llvm_compiled_layers     = src.m_llvm_compiled_layers;
+    group.m_llvm_jit_memory          = src.m_llvm_jit_memory;
+
+#if OSL_USE_BATCHED
+    group.m_llvm_compiled_wide_version = src.m_llvm_compiled_wide_version;
+    group.m_llvm_compiled_wide_init    = src.m_llvm_compiled_wide_init;
+    group.m_llvm_compiled_wide_layers  = src.m_llvm_compiled_wide_layers;
+#endif
+
+    group.m_globals_read              = src.m_globals_read;
+    group.m_globals_write             = src.m_globals_write;
+    group.m_textures_needed           = src.m_textures_needed;
+    group.m_closures_needed           = src.m_closures_needed;
+    group.m_globals_needed            = src.m_globals_needed;
+    group.m_userdata_names            = src.m_userdata_names;
+    group.m_userdata_types            = src.m_userdata_types;
+    group.m_userdata_offsets          = src.m_userdata_offsets;
+    group.m_userdata_derivs           = src.m_userdata_derivs;
+    group.m_userdata_layers           = src.m_userdata_layers;
+    group.m_userdata_init_vals        = src.m_userdata_init_vals;
+    group.m_attributes_needed         = src.m_attributes_needed;
+    group.m_attribute_scopes          = src.m_attribute_scopes;
+    group.m_attribute_types           = src.m_attribute_types;
+    group.m_unknown_textures_needed   = src.m_unknown_textures_needed;
+    group.m_unknown_closures_needed   = src.m_unknown_closures_needed;
+    group.m_unknown_attributes_needed = src.m_unknown_attributes_needed;
+    group.m_optimized                 = src.m_optimized;
+    group.m_jitted                    = src.m_jitted;
+    group.m_batch_jitted              = src.m_batch_jitted;
+
+    // The code adds its cycles to whichever group is executing. Keep the
+    // counts of a group that is shared again (e.g., for the batched code).
+    if (src.m_profile && !group.m_profile)
+        group.m_profile.reset(new GroupProfile(src.m_profile->nlayers()));
+}
+
+
+
+std::string
+ShadingSystemImpl::group_code_key(const ShaderGroup& group) const
+{
+    std::string key = group.serialize();
+    // Add the group properties that influence optimization but are set
+    // outside of the layers and connections that serialize() describes.
+    key += fmtformat("raytypes {} {} ;\n", group.raytypes_on(),
+                     group.raytypes_off());
+    for (int layer = 0, nl = group.nlayers(); layer < nl; ++layer)
+        if (group.num_entry_layers() && group[layer]->entry_layer())
+            key += fmtformat("entry {} ;\n", layer);
+    // serialize() names each layer's shader, but with
+    // allow_shader_replacement the same name may stand for different code
+    // over time. Identify the master by the hash of its .oso, or by its
+    // address if it wasn't read from one we could hash.
+    for (int layer = 0, nl = group.nlayers(); layer < nl; ++layer) {
+        const ShaderMaster* master = group[layer]->master();
+        if (master->oso_hash())
+            key += fmtformat("master {} {:016x} ;\n", master->shadername(),
+                             master->oso_hash());
+        else
+            key += fmtformat("master {} @{} ;\n", master->shadername(),
+                             (const void*)master);
+    }
+    for (auto&& s : group.m_symlocs)
+        key += fmtformat("symloc {} {} {} {} {} {} ;\n", s.name,
+                         s.type.c_str(), s.derivs, int(s.arena), s.offset,
+                         s.stride);
+    for (auto&& name : group.m_renderer_outputs)
+        key += fmtformat("output {} ;\n", name);
+    // Range checking and the nan/uninitialized checks report errors that
+    // name the group, so groups compiled with them are only identical to
+    // groups with the same name.
+    bool names_group = m_debugnan || m_debug_uninit;
+    for (int layer = 0, nl = group.nlayers(); layer < nl; ++layer)
+        names_group |= group[layer]->master()->range_checking();
+    if (names_group)
+        key += fmtformat("group {} ;\n", group.name());
+    return key;
+}
+
+
+
+std::string
+ShadingSystemImpl::llvm_jit_cache_key(const ShaderGroup& group) const
+{
+    // The cached code can't follow a renderer that changes over the life
+    // of the group, or code that reports to a debugger or profiler, and
+    // it must not depend on the name of the group.
+    if (use_optix() || m_llvm_debugging_symbols || m_llvm_profiling_events
+        || m_llvm_debug || m_llvm_output_bitcode || m_llvm_dumpasm
+        || !m_rs_bitcode.empty() || m_only_groupname.size()
+        || m_debug_groupname.size() || m_archive_groupname.size()
+        || renderer()->batched(WidthOf<16>())
+        || renderer()->batched(WidthOf<8>())
+        || renderer()->batched(WidthOf<4>()))
+        return std::string();
+
+    // A master that wasn't hashed is identified by its address in this
+    // process, which can't be part of a key shared between runs.
+    for (int layer = 0, nl = group.nlayers(); layer < nl; ++layer)
+        if (!group[layer]->master()->oso_hash())
+            return std::string();
+
+    // The group's code key names the shaders and the hashes of their .oso
+    // contents (the shader may have been recompiled since the cache entry
+    // was made), their parameter values and connections. Add the closures
+    // the renderer registered, and every option that changes what code we
+    // generate for the group. None of it depends on addresses in this
+    // process, so the key is the same from run to run.
+    std::string desc = group_code_key(group);
+    if (Strutil::contains(desc, "[[int interactive=1]]"))
+        return std::string();
+    for (int id = 0, n = m_closure_registry.size(); id < n; ++id) {
+        const ClosureRegistry::ClosureEntry* clentry
+            = m_closure_registry.get_entry(id);
+        desc += fmtformat("closure {} {} {} {} {} {} {}", id, clentry->name,
+                          clentry->nformal, clentry->nkeyword,
+                          clentry->struct_size, clentry->prepare != nullptr,
+                          clentry->setup != nullptr);
+        for (auto&& p : clentry->params)
+            desc += fmtformat(" {} {} {} {}", p.type.c_str(), p.offset,
+                              p.key ? p.key : "", p.field_size);
+        desc += "\n";
+    }
+    desc += fmtformat(
+        "osl {} llvm {} optimize {} opt_passes {} llvm_optimize {} "
+        "jit_fma {} jit_aggressive {} fuse_layers {} target_host {} "
+        "prune {} lazylayers {} lazyglobals {} lazyunconnected {} "
+        "lazyerror {} lazy_userdata {} lazy_trace {} userdata_isconnected {} "
+        "debugnan {} debug_uninit {} range_checking {} countlayerexecs {} "
+        "profile {} profile_layers {} debug_layers {} debug_ops {} "
+        "strict_messages {}\n",
+        OSL_LIBRARY_VERSION_CODE, OSL_LLVM_VERSION, m_optimize, m_opt_passes,
+        m_llvm_optimize, m_llvm_jit_fma, m_llvm_jit_aggressive,
+        m_llvm_fuse_layers, m_llvm_target_host, m_llvm_prune_ir_strategy,
+        m_lazylayers, m_lazyglobals, m_lazyunconnected, m_lazyerror,
+        m_lazy_userdata, m_lazy_trace, m_userdata_isconnected, m_debugnan,
+        m_debug_uninit, m_range_checking, m_countlayerexecs, m_profile,
+        m_profile_layers, m_llvm_debug_layers, m_llvm_debug_ops,
+        m_strict_messages);
+    desc += fmtformat(
+        "opt {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {}\n",
+        m_opt_simplify_param, m_opt_constant_fold, m_opt_stale_assign,
+        m_opt_elide_useless_ops, m_opt_elide_unconnected_outputs,
+        m_opt_peephole, m_opt_coalesce_temps, m_opt_assign, m_opt_mix,
+        int(m_opt_merge_instances), m_opt_merge_instances_with_userdata,
+        m_opt_fold_getattribute, m_opt_middleman, m_opt_texture_handle,
+        m_opt_seed_bblock_aliases, m_opt_useparam, m_opt_groupdata,
+        m_opt_batched_analysis, m_clearmemory);
+    return fmtformat("{:016x}", Strutil::strhash(desc));
+}
+
+
+
 #if OSL_USE_BATCHED
 template<int WidthT>
 void
@@ -3842,10 +4592,32 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     if (!group.optimized())
         m_ssi.optimize_group(group, ctx, false /*do_jit*/);
 
+    ShaderGroupRef shared;
+    {
+        lock_guard lock(group.m_mutex);
+        shared = group.m_shared_code_group;
+    }
+    if (shared) {
+        // Identical to another group: batch JIT that one and share it.
+        jit_group(*shared, ctx);
+        lock_guard lock(group.m_mutex);
+        m_ssi.share_group_code(group, shared);
+        if (ctx_allocated) {
+            m_ssi.release_context(ctx);
+            m_ssi.destroy_thread_info(thread_info);
+        }
+        return;
+    }
+
     OIIO::Timer timer;
     // TODO: we could have separate mutexes for jit vs. batched_jit
     // choose to keep it simple to start with
-    lock_guard lock(group.m_mutex);
+    std::unique_lock<mutex> lock(group.m_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        m_ssi.help_compile_all_groups(
+            [&]() { return group.batch_jitted() != 0; });
+        lock.lock();
+    }
     if (group.batch_jitted()) {
         if (ctx_allocated) {
             // TODO: scope object to manage temporary context&threadinfo
@@ -3890,6 +4662,9 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     m_ssi.m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
     m_ssi.m_stat_max_llvm_local_mem = std::max(m_ssi.m_stat_max_llvm_local_mem,
                                                lljitter.m_llvm_local_mem);
+    group.m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+    group.m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+    group.m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
 
     // TODO: not sure how to count these given batched vs. not
     m_ssi.m_stat_groups_compiled += 1;
@@ -3898,123 +4673,285 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
 }
 #endif
 
-static void
-optimize_all_groups_wrapper(ShadingSystemImpl* ss, int mythread,
-                            int totalthreads, bool do_jit)
+/// Shared state of a pass compiling all groups: the groups to do, most
+/// expensive first, the index of the next one to hand out, and what to do
+/// with each one.
+struct ShadingSystemImpl::CompileQueue {
+    std::vector<ShaderGroupRef> groups;
+    std::atomic<size_t> next { 0 };
+    std::function<bool(const ShaderGroup&)> needs_compile;
+    std::function<void(ShaderGroup&, ShadingContext*)> compile;
+
+    /// Hand out the next group, or an empty ref if there are none left.
+    ShaderGroupRef take()
+    {
+        size_t i = next++;
+        return i < groups.size() ? groups[i] : ShaderGroupRef();
+    }
+};
+
+
+
+// Rough estimate of the cost of optimizing and JITing a group, used to
+// start the most expensive groups first so that no thread is left with a
+// big one at the end while the others sit idle.
+static size_t
+estimated_compile_cost(const ShaderGroup& group)
 {
-    ss->optimize_all_groups(1, mythread, totalthreads, do_jit);
+    // Count the ops, plus some fixed overhead for each layer.
+    size_t cost = 0;
+    for (int layer = 0, nl = group.nlayers(); layer < nl; ++layer)
+        cost += 16 + group[layer]->master()->num_ops();
+    return cost;
 }
 
 
-#if OSL_USE_BATCHED
-template<int WidthT>
-static void
-batched_jit_all_groups_wrapper(ShadingSystemImpl* ss, int mythread,
-                               int totalthreads)
+
+void
+ShadingSystemImpl::drain_compile_queue(CompileQueue& queue,
+                                       const std::function<bool()>& done)
+{
+    // A thread that is already working on the queue may get here again
+    // if it waits for a group another thread is compiling; don't recurse.
+    static thread_local bool draining = false;
+    if (draining)
+        return;
+    draining = true;
+
+    PerThreadInfo* threadinfo = nullptr;
+    ShadingContext* ctx       = nullptr;
+    while (!done || !done()) {
+        ShaderGroupRef group = queue.take();
+        if (!group)
+            break;
+        if (!queue.needs_compile(*group))
+            continue;  // done by someone else since the queue was made
+        if (!ctx) {
+            threadinfo = create_thread_info();
+            ctx        = get_context(threadinfo);
+        }
+        queue.compile(*group, ctx);
+    }
+    if (ctx) {
+        release_context(ctx);
+        destroy_thread_info(threadinfo);
+    }
+    draining = false;
+}
+
+
+
+void
+ShadingSystemImpl::help_compile_all_groups(const std::function<bool()>& done)
 {
-    ss->batched<WidthT>().jit_all_groups(1, mythread, totalthreads);
+    std::vector<std::shared_ptr<CompileQueue>> queues;
+    {
+        spin_lock lock(m_compile_queue_mutex);
+        for (auto&& q : m_compile_queues)
+            queues.push_back(q.second);
+    }
+    for (auto&& queue : queues)
+        drain_compile_queue(*queue, done);
 }
-#endif
+
+
 
 void
-ShadingSystemImpl::optimize_all_groups(int nthreads, int mythread,
-                                       int totalthreads, bool do_jit)
-{
-    // Spawn a bunch of threads to do this in parallel -- just call this
-    // routine again (with threads=1) for each thread.
-    if (nthreads < 1)  // threads <= 0 means use all hardware available
-        nthreads = std::min((int)std::thread::hardware_concurrency(),
-                            (int)m_groups_to_compile_count);
-    if (nthreads > 1) {
-        if (m_threads_currently_compiling)
-            return;  // never mind, somebody else spawned the JIT threads
-        OIIO::thread_group threads;
-        m_threads_currently_compiling += nthreads;
-        for (int t = 0; t < nthreads; ++t)
-            threads.add_thread(new std::thread(optimize_all_groups_wrapper,
-                                               this, t, nthreads, do_jit));
-        threads.join_all();
-        m_threads_currently_compiling -= nthreads;
+ShadingSystemImpl::compile_all_groups(
+    string_view kind, int nthreads,
+    std::function<bool(const ShaderGroup&)> needs_compile,
+    std::function<void(ShaderGroup&, ShadingContext*)> compile)
+{
+    // If another thread is already running a pass of this kind, help it
+    // along rather than starting a second one. A pass of another kind
+    // (say, scalar JIT while we want batched) won't compile what we need,
+    // so then we go ahead with our own.
+    std::string key(kind);
+    std::shared_ptr<CompileQueue> current;
+    {
+        spin_lock lock(m_compile_queue_mutex);
+        auto found = m_compile_queues.find(key);
+        if (found != m_compile_queues.end())
+            current = found->second;
+    }
+    if (current) {
+        drain_compile_queue(*current);
         return;
     }
 
-    // And here's the single thread case
-    size_t ngroups = 0;
+    auto queue           = std::make_shared<CompileQueue>();
+    queue->needs_compile = std::move(needs_compile);
+    queue->compile       = std::move(compile);
+    std::vector<std::pair<size_t, ShaderGroupRef>> costs;
     {
         spin_lock lock(m_all_shader_groups_mutex);
-        ngroups = m_all_shader_groups.size();
-    }
-    PerThreadInfo* threadinfo = create_thread_info();
-    ShadingContext* ctx       = get_context(threadinfo);
-    for (size_t i = 0; i < ngroups; ++i) {
-        // Assign to threads based on mod of totalthreads
-        if ((i % totalthreads) == (unsigned)mythread) {
-            ShaderGroupRef group;
-            {
-                spin_lock lock(m_all_shader_groups_mutex);
-                group = m_all_shader_groups[i].lock();
-            }
-            if (group && group->m_complete)
-                optimize_group(*group, ctx, do_jit);
+        for (auto&& g : m_all_shader_groups) {
+            ShaderGroupRef group = g.lock();
+            if (group && group->m_complete && queue->needs_compile(*group))
+                costs.emplace_back(0, std::move(group));
         }
     }
-    release_context(ctx);
-    destroy_thread_info(threadinfo);
-}
+    if (costs.empty())
+        return;
+    for (auto&& c : costs)
+        c.first = estimated_compile_cost(*c.second);
+    std::stable_sort(costs.begin(), costs.end(),
+                     [](const std::pair<size_t, ShaderGroupRef>& a,
+                        const std::pair<size_t, ShaderGroupRef>& b) {
+                         return a.first > b.first;
+                     });
+    queue->groups.reserve(costs.size());
+    for (auto&& c : costs)
+        queue->groups.push_back(std::move(c.second));
 
-#if OSL_USE_BATCHED
-template<int WidthT>
-void
-ShadingSystemImpl::Batched<WidthT>::jit_all_groups(int nthreads, int mythread,
-                                                   int totalthreads)
-{
-    // Spawn a bunch of threads to do this in parallel -- just call this
-    // routine again (with threads=1) for each thread.
-    if (nthreads < 1)  // threads <= 0 means use all hardware available
-        nthreads = std::min((int)std::thread::hardware_concurrency(),
-                            (int)m_ssi.m_groups_to_compile_count);
-    if (nthreads > 1) {
-        if (m_ssi.m_threads_currently_compiling)
-            return;  // never mind, somebody else spawned the JIT threads
-        OIIO::thread_group threads;
-        m_ssi.m_threads_currently_compiling += nthreads;
-        for (int t = 0; t < nthreads; ++t)
-            threads.add_thread(
-                new std::thread(batched_jit_all_groups_wrapper<WidthT>, &m_ssi,
-                                t, nthreads));
-        threads.join_all();
-        m_ssi.m_threads_currently_compiling -= nthreads;
+    {
+        spin_lock lock(m_compile_queue_mutex);
+        std::shared_ptr<CompileQueue>& entry = m_compile_queues[key];
+        current                              = entry;
+        if (!current)
+            entry = queue;
+    }
+    if (current) {
+        // Somebody else started a pass while we were making ours
+        drain_compile_queue(*current);
         return;
     }
 
-    // And here's the single thread case
-    size_t ngroups = 0;
+    // threads <= 0 means use all hardware available
+    if (nthreads < 1)
+        nthreads = (int)std::thread::hardware_concurrency();
+    nthreads = std::max(1, std::min(nthreads, (int)queue->groups.size()));
+
+    // The calling thread works on the queue too, plus nthreads-1 tasks on
+    // the persistent OIIO thread pool. Waiting on the task set lets this
+    // thread pick up other pool work rather than block.
+    m_threads_currently_compiling += nthreads;
+    OIIO::thread_pool* pool = OIIO::default_thread_pool();
+    OIIO::task_set tasks(pool);
+    for (int t = 1; t < nthreads; ++t)
+        tasks.push(pool->push(
+            [this, queue](int /*id*/) { drain_compile_queue(*queue); }));
+    drain_compile_queue(*queue);
+    tasks.wait();
+    m_threads_currently_compiling -= nthreads;
+
+    spin_lock lock(m_compile_queue_mutex);
+    m_compile_queues.erase(key);
+}
+
+
+
+namespace {
+
+// Calls a function when it goes out of scope, however the scope is left
+template<typename F> class ScopeExit {
+public:
+    explicit ScopeExit(F f) : m_f(std::move(f)) {}
+    ScopeExit(ScopeExit&& other) : m_f(std::move(other.m_f))
     {
-        spin_lock lock(m_ssi.m_all_shader_groups_mutex);
-        ngroups = m_ssi.m_all_shader_groups.size();
+        other.m_active = false;
     }
-    PerThreadInfo* threadinfo = m_ssi.create_thread_info();
-    ShadingContext* ctx       = m_ssi.get_context(threadinfo);
-    for (size_t i = 0; i < ngroups; ++i) {
-        // Assign to threads based on mod of totalthreads
-        if ((i % totalthreads) == (unsigned)mythread) {
-            ShaderGroupRef group;
-            {
-                spin_lock lock(m_ssi.m_all_shader_groups_mutex);
-                group = m_ssi.m_all_shader_groups[i].lock();
-            }
-            if (group)
-                jit_group(*group, ctx);
-        }
+    ~ScopeExit()
+    {
+        if (m_active)
+            m_f();
     }
-    m_ssi.release_context(ctx);
-    m_ssi.destroy_thread_info(threadinfo);
+
+private:
+    F m_f;
+    bool m_active = true;
+};
+
+template<typename F>
+ScopeExit<F>
+scope_exit(F f)
+{
+    return ScopeExit<F>(std::move(f));
+}
+
+}  // namespace
+
+
+
+void
+ShadingSystemImpl::compile_group_async(
+    ShaderGroup& group, int which,
+    std::function<void(ShaderGroup&, ShadingContext*)> compile)
+{
+    if (group.m_async_queued.fetch_or(which) & which)
+        return;  // already queued
+    {
+        std::lock_guard<std::mutex> lock(m_async_mutex);
+        m_async_compiles_pending += 1;
+    }
+    ShaderGroupRef ref = group.shared_from_this();
+    OIIO::default_thread_pool()->push(
+        [this, ref, which, compile](int /*id*/) mutable {
+            // Even if compile() throws, let the group be queued again and
+            // count this compile as finished. That comes last, since the
+            // destructor may be waiting to tear everything down.
+            auto finished = scope_exit([&]() {
+                ref->m_async_queued &= ~which;
+                ref.reset();
+                async_compile_finished();
+            });
+            PerThreadInfo* threadinfo = create_thread_info();
+            ShadingContext* ctx       = get_context(threadinfo);
+            auto release              = scope_exit([&]() {
+                release_context(ctx);
+                destroy_thread_info(threadinfo);
+            });
+            compile(*ref, ctx);
+            if (which == ShaderGroup::AsyncScalar ? ref->jitted()
+                                                  : ref->batch_jitted())
+                m_stat_groups_async_jitted += 1;
+        });
+}
+
+
+
+void
+ShadingSystemImpl::async_compile_finished()
+{
+    std::lock_guard<std::mutex> lock(m_async_mutex);
+    if (--m_async_compiles_pending == 0)
+        m_async_compiles_done.notify_all();
+}
+
+
+
+void
+ShadingSystemImpl::optimize_all_groups(int nthreads, bool do_jit)
+{
+    compile_all_groups(
+        do_jit ? "jit" : "optimize", nthreads,
+        [do_jit](const ShaderGroup& group) {
+            return !group.optimized() || (do_jit && !group.jitted());
+        },
+        [this, do_jit](ShaderGroup& group, ShadingContext* ctx) {
+            optimize_group(group, ctx, do_jit);
+        });
+}
+
+#if OSL_USE_BATCHED
+template<int WidthT>
+void
+ShadingSystemImpl::Batched<WidthT>::jit_all_groups(int nthreads)
+{
+    ShadingSystemImpl& ssi(m_ssi);
+    m_ssi.compile_all_groups(
+        fmtformat("batched{}", WidthT), nthreads,
+        [](const ShaderGroup& group) { return !group.batch_jitted(); },
+        [&ssi](ShaderGroup& group, ShadingContext* ctx) {
+            ssi.batched<WidthT>().jit_group(group, ctx);
+        });
 }
 
 // Explicitly instantiate, although might need to specialize on target
 // machine as well, start with just the batch size
 template class pvt::ShadingSystemImpl::Batched<16>;
 template class pvt::ShadingSystemImpl::Batched<8>;
+template class pvt::ShadingSystemImpl::Batched<4>;
 #endif
 
 int
@@ -109,10 +109,8 @@ public:
 
     MessageBlock* find(ustring name) const
     {
-        for (MessageBlock* m = list_head(); m != nullptr; m = m->next)
-            if (m->name == name)
-                return m;  // name matches
-        return nullptr;    // not found
+        return reinterpret_cast<MessageBlock*>(
+            m_buffer.message_index.find(name.hash()));
     }
 
 
@@ -129,6 +127,7 @@ public:
                                           alignment);
         list_head()->import_data(wsrcval, lanes_to_populate, layeridx,
                                  sourcefile, sourceline);
+        m_buffer.message_index.insert(name.hash(), list_head());
     }
 };
 
@@ -40,7 +40,6 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
                           int max_points, bool sort,
                           PointCloudSearchResults& results)
 {
-#ifdef USE_PARTIO
     ShadingContext* ctx = bsg->uniform.context;
 
     if (filename.empty()) {
@@ -50,32 +49,23 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
     PointCloud* pc = PointCloud::get(filename);
     if (pc == NULL) {  // The file failed to load
         ctx->batched<__OSL_WIDTH>().errorfmt(
-            results.mask(), "pointcloud_search: could not open \"{}\"",
-            filename);
-        assign_all(results.wnum_points(), 0);
-        return;
-    }
-
-    const Partio::ParticlesData* cloud = pc->read_access();
-    if (cloud == NULL) {  // The file failed to load
-        ctx->batched<__OSL_WIDTH>().errorfmt(
-            results.mask(), "pointcloud_search: could not open \"{}\"",
-            filename);
+            results.mask(), "pointcloud_search: could not open \"{}\": {}",
+            filename, PointCloud::load_error(filename));
         assign_all(results.wnum_points(), 0);
         return;
     }
 
     // Early exit if the pointcloud contains no particles.
-    if (cloud->numParticles() == 0) {
+    if (pc->size() == 0) {
         assign_all(results.wnum_points(), 0);
         return;
     }
 
     // If we need derivs of the distances, we'll need access to the
     // found point's positions.
-    Partio::ParticleAttribute* pos_attr = NULL;
+    const PointCloud::Attribute* pos_attr = NULL;
     if (results.distances_have_derivs()) {
-        pos_attr = pc->m_attributes[u_position].get();
+        pos_attr = pc->attribute(u_position.uhash());
         if (!pos_attr) {
             // No "position" attribute -- fail
             assign_all(results.wnum_points(), 0);
@@ -83,55 +73,43 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
         }
     }
 
-    static_assert(sizeof(size_t) == sizeof(Partio::ParticleIndex),
-                  "Partio ParticleIndex should be the size of a size_t");
-    // FIXME -- if anybody cares about an architecture in which that is not
-    // the case, we can easily allocate local space to retrieve the indices,
-    // then copy them back to the caller's indices.
-
-    // Partio needs size_t indices, and our batched representation is
-    // structure of arrays (wide) so we need a scalar temporary
-    // indices array
-    // TODO: evaluate if sg->context->alloc_scratch should be used instead?
-    Partio::ParticleIndex* indices
-        = (Partio::ParticleIndex*)OSL_ALLOCA(size_t, max_points);
-
+    // Search around every active lane's center at once, walking the tree
+    // a single time for the whole batch. The results of lane l are at
+    // [l*max_points] in these scalar arrays, and are then copied to the
+    // wide (structure of arrays) results.
+    size_t* indices = (size_t*)ctx->alloc_scratch(
+        __OSL_WIDTH * max_points * sizeof(size_t), alignof(size_t));
+    float* dist2 = (float*)ctx->alloc_scratch(__OSL_WIDTH * max_points
+                                                  * sizeof(float),
+                                              alignof(float));
+    int counts[__OSL_WIDTH];
+    float cx[__OSL_WIDTH], cy[__OSL_WIDTH], cz[__OSL_WIDTH];
+    float radius[__OSL_WIDTH];
     Wide<const OSL::Vec3> wcenter(wcenter_);
-
-    // Partio uses array of structure data layout for distances,
-    // and our batched representation is
-    // structure of arrays (wide) so we need a scalar temporary
-    // distances array
-    float* dist2              = OSL_ALLOCA(float, max_points);
-    SortedPointRecord* sorted = OSL_ALLOCA(SortedPointRecord, max_points);
-    auto windices             = results.windices();
-    auto wnum_points          = results.wnum_points();
-    results.mask().foreach ([=](ActiveLane lane) -> void {
+    OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+    for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
         const OSL::Vec3 center = wcenter[lane];
+        cx[lane]               = center.x;
+        cy[lane]               = center.y;
+        cz[lane]               = center.z;
+        radius[lane]           = wradius[lane];
+    }
+    pc->search<__OSL_WIDTH>(cx, cy, cz, radius, results.mask().value(),
+                            max_points, sort, indices, dist2, counts);
 
-        const float radius = wradius[lane];
-        float finalRadius;
-        int count = cloud->findNPoints(&center[0], max_points, radius, indices,
-                                       dist2, &finalRadius);
-
-        // If sorting, allocate some temp space and sort the distances and
-        // indices at the same time.
-        if (sort && count > 1) {
-            //SortedPointRecord *sorted = (SortedPointRecord *) sg->context->alloc_scratch (count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
-            //SortedPointRecord *sorted = OSL_ALLOCA(SortedPointRecord, count);
-            for (int i = 0; i < count; ++i)
-                sorted[i] = SortedPointRecord(dist2[i], indices[i]);
-            std::sort(sorted, sorted + count, SortedPointCompare());
-            for (int i = 0; i < count; ++i) {
-                dist2[i]   = sorted[i].first;
-                indices[i] = sorted[i].second;
-            }
-        }
+    OSL::Vec3* positions = pos_attr ? OSL_ALLOCA(OSL::Vec3, max_points)
+                                    : nullptr;
+    auto windices        = results.windices();
+    auto wnum_points     = results.wnum_points();
+    results.mask().foreach ([=](ActiveLane lane) -> void {
+        int count              = counts[lane];
+        const size_t* lindices = indices + lane * max_points;
+        const float* ldist2    = dist2 + lane * max_points;
 
         // copy scalar indices out to wide results
         auto out_indices = windices[lane];
         for (int i = 0; i < count; ++i) {
-            int indice     = static_cast<int>(indices[i]);
+            int indice     = static_cast<int>(lindices[i]);
             out_indices[i] = indice;
         }
 
@@ -146,18 +124,14 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
 
             // Convert the squared distances to straight distances
             for (int i = 0; i < count; ++i) {
-                float dist       = sqrtf(dist2[i]);
+                float dist       = sqrtf(ldist2[i]);
                 out_distances[i] = dist;
             }
 
             if (results.distances_have_derivs()) {
                 // We are going to need the positions if we need to compute
                 // distance derivs
-                //OSL::Vec3 *positions = (OSL::Vec3 *) sg->context->alloc_scratch (sizeof(OSL::Vec3) * count, sizeof(float));
-                OSL::Vec3* positions = OSL_ALLOCA(OSL::Vec3, count);
-                // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
-                const_cast<Partio::ParticlesData*>(cloud)->data(
-                    *pos_attr, count, indices, true, (void*)positions);
+                pc->get(*pos_attr, lindices, count, positions);
 
                 Wide<const Dual2<OSL::Vec3>> wdcenter(wcenter_);
                 const Dual2<OSL::Vec3> dcenter = wdcenter[lane];
@@ -191,9 +165,6 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
         }
         wnum_points[lane] = count;
     });
-#else
-    assign_all(results.wnum_points(), 0);
-#endif
 }
 
 
@@ -221,48 +192,36 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
                        Wide<const int[]> windices, Wide<const int> wnum_points,
                        ustringhash attr_name, MaskedData wout_data)
 {
-#ifdef USE_PARTIO
     Mask success { false };
     ShadingContext* ctx = bsg->uniform.context;
 
     PointCloud* pc = PointCloud::get(filename);
     // defer reporting errors as only lanes with non zero num_points
     // should report errors
-    const Partio::ParticlesData* cloud = nullptr;
+    const PointCloud::Attribute* attr = nullptr;
     if (pc != nullptr) {
-        cloud = pc->read_access();
-    }
-    Partio::ParticleAttribute* attr = nullptr;
-    if (cloud != nullptr) {
-        attr = pc->m_attributes[attr_name].get();
+        attr = pc->attribute(attr_name);
     }
 
     TypeDesc attr_type = wout_data.type();
     // Type the OSL shader has provided in destination array:
     TypeDesc element_type = attr_type.elementtype();
 
-    // Type the partio file contains:
-    TypeDesc partio_type;
-    int* strindices                = nullptr;
-    void* aos_buffer               = nullptr;
-    bool is_compatible_with_partio = false;
-    int maxn                       = 0;
+    // Type the file contains:
+    TypeDesc cloud_type;
+    void* aos_buffer   = nullptr;
+    bool is_compatible = false;
+    int maxn           = 0;
     if (attr != nullptr) {
-        partio_type               = TypeDescOfPartioType(attr);
-        is_compatible_with_partio = compatiblePartioType(partio_type,
-                                                         element_type);
-        maxn                      = basevals(attr_type) / basevals(partio_type);
-        if (partio_type == OIIO::TypeString) {
-            // strings are special cases because they are stored as int index
-            // Ensure alloca's happen outside loops
-            strindices = OSL_ALLOCA(int, attr_type.numelements());
-        } else {
-            aos_buffer = OSL_ALLOCA(char, attr_type.size());
-        }
+        cloud_type    = attr->type;
+        is_compatible = compatible_type(cloud_type, element_type);
+        maxn          = basevals(attr_type) / basevals(cloud_type);
+        // Ensure alloca's happen outside loops
+        aos_buffer = OSL_ALLOCA(char, std::max(attr_type.size(),
+                                               maxn * cloud_type.size()));
     }
 
-    Partio::ParticleIndex* indices
-        = (Partio::ParticleIndex*)OSL_ALLOCA(size_t, windices.length());
+    size_t* indices = OSL_ALLOCA(size_t, windices.length());
 
     wout_data.mask().foreach ([=, &success](ActiveLane lane) -> void {
         int count = wnum_points[lane];
@@ -273,19 +232,12 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
 
         if (pc == nullptr) {  // The file failed to load
             ctx->batched<__OSL_WIDTH>().errorfmt(
-                Mask { lane }, "pointcloud_get: could not open \"{}\"",
-                filename);
-            return;
-        }
-
-        if (cloud == nullptr) {  // The file failed to load
-            ctx->batched<__OSL_WIDTH>().errorfmt(
-                Mask { lane }, "pointcloud_get: could not open \"{}\"",
-                filename);
+                Mask { lane }, "pointcloud_get: could not open \"{}\": {}",
+                filename, PointCloud::load_error(filename));
             return;
         }
 
-        // lookup the ParticleAttribute pointer needed for a query
+        // lookup the attribute needed for a query
         if (attr == nullptr) {
             ctx->batched<__OSL_WIDTH>().errorfmt(
                 Mask { lane },
@@ -296,11 +248,11 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
 
 
         // Finally check for some equivalent types like float3 and vector
-        if (!is_compatible_with_partio) {
+        if (!is_compatible) {
             ctx->batched<__OSL_WIDTH>().errorfmt(
                 Mask { lane },
                 "Type of attribute \"{}\" : {} not compatible with OSL's {} in \"{}\" pointcloud",
-                attr_name, partio_type, element_type, filename);
+                attr_name, cloud_type, element_type, filename);
             return;
         }
 
@@ -309,7 +261,7 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
             ctx->batched<__OSL_WIDTH>().errorfmt(
                 Mask { lane },
                 "Point cloud attribute \"{}\" : {} with retrieval count {} will not fit in {}",
-                attr_name, partio_type, count, attr_type);
+                attr_name, cloud_type, count, attr_type);
             count = maxn;
         }
         // Copy int indices out of SOA wide format into local AOS size_t
@@ -318,47 +270,22 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
             indices[i] = int_indices[i];
         }
 
-        static_assert(sizeof(size_t) == sizeof(Partio::ParticleIndex),
-                      "Partio ParticleIndex should be the size of a size_t");
-        // FIXME -- if anybody cares about an architecture in which that is not
-        // the case, we can easily allocate local space to retrieve the indices,
-        // then copy them back to the caller's indices.
-
         // Actual data query
-        if (partio_type == OIIO::TypeString) {
-            // strings are special cases because they are stored as int index
-            const_cast<Partio::ParticlesData*>(cloud)->data(
-                *attr, count, (const Partio::ParticleIndex*)indices,
-                /*sorted*/ /*true*/ false, (void*)strindices);
-            const auto& strings = cloud->indexedStrs(*attr);
-            int sicount         = int(strings.size());
+        pc->get(*attr, indices, count, aos_buffer);
+        if (cloud_type == OIIO::TypeString) {
+            // strings are special cases because they are stored as hashes
             OSL_DASSERT(Masked<ustring[]>::is(wout_data));
             Masked<ustring[]> wout_strings(wout_data);
             auto out_strings = wout_strings[lane];
-            for (int i = 0; i < count; ++i) {
-                int ind = strindices[i];
-                if (ind >= 0 && ind < sicount)
-                    out_strings[i] = ustring(strings[ind]);
-                else
-                    out_strings[i] = ustring();
-            }
+            for (int i = 0; i < count; ++i)
+                out_strings[i] = ustring_from(((ustringhash*)aos_buffer)[i]);
         } else {
             // All cases aside from strings are simple.
-            const_cast<Partio::ParticlesData*>(cloud)->data(
-                *attr, count, (const Partio::ParticleIndex*)indices,
-                /*sorted*/ /*true*/ false, aos_buffer);
-            // FIXME: it is regrettable that we need this const_cast (and the
-            // one a few lines above). It's to work around a bug in partio where
-            // they fail to declare this method as const, even though it could
-            // be. We should submit a patch to partio to fix this.
             wout_data.assign_val_lane_from_scalar(lane, aos_buffer);
         }
         success.set_on(lane);
     });
     return success;
-#else
-    return Mask { false };
-#endif
 }
 
 
@@ -386,87 +313,55 @@ default_pointcloud_write(BatchedShaderGlobals* bsg, ustringhash filename,
                          const ustring* attr_names, const TypeDesc* attr_types,
                          const void** ptrs_to_wide_attr_value, Mask mask)
 {
-#ifdef USE_PARTIO
     if (filename.empty())
         return Mask { false };
 
     PointCloud* pc = PointCloud::get(filename, true /* create file to write */);
-    spin_lock lock(pc->m_mutex);
-    Partio::ParticlesDataMutable* cloud = pc->write_access();
-    if (cloud == NULL)  // The file failed to load
+    if (pc == NULL)  // The file failed to load
         return Mask { false };
 
-    // Mark the pointcloud as written, so we will save it later
-    pc->m_write = true;
-
-    // first time only -- add "position" attribute
-    if (cloud->numParticles() == 0)
-        pc->m_position_attribute = cloud->addAttribute("position",
-                                                       Partio::VECTOR, 3);
-
-    // Make sure all the attributes mentioned have been added properly
-    bool ok = true;
-    std::vector<Partio::ParticleAttribute*> partattrs;
-    partattrs.reserve(nattribs);
+    // Gather each lane's values into scalar temporaries to write. Strings
+    // are written as ustringhash, like the scalar case.
+    ustringhash* names = OSL_ALLOCA(ustringhash, nattribs);
+    char* values       = OSL_ALLOCA(char, nattribs * sizeof(OSL::Vec3));
+    const void** data  = OSL_ALLOCA(const void*, nattribs);
     for (int i = 0; i < nattribs; ++i) {
-        const ustring attr_name      = attr_names[i];
-        Partio::ParticleAttribute* a = pc->m_attributes[attr_name].get();
-        if (!a) {  // attribute needs to be added
-            Partio::ParticleAttributeType pt = PartioType(attr_types[i]);
-            if (pt == Partio::NONE) {
-                ok = false;
-            } else {
-                a  = new Partio::ParticleAttribute();
-                *a = cloud->addAttribute(attr_name.c_str(), pt,
-                                         pt == Partio::VECTOR ? 3
-                                                              : 1 /*count*/);
-                pc->m_attributes[attr_name].reset(a);
-            }
-        }
-        partattrs.push_back(a);
+        names[i] = attr_names[i].uhash();
+        data[i]  = values + i * sizeof(OSL::Vec3);
     }
 
-    mask.foreach ([=](ActiveLane lane) -> void {
-        // Make a new particle
-        Partio::ParticleIndex p = cloud->addParticle();
-        const Vec3 pos          = wpos[lane];
-        *(Vec3*)cloud->dataWrite<float>(pc->m_position_attribute, p) = pos;
+    Mask failed { false };
+    std::string err;
+    mask.foreach ([=, &failed, &err](ActiveLane lane) -> void {
         for (int i = 0; i < nattribs; ++i) {
-            Partio::ParticleAttribute* a       = partattrs[i];
             const void* ptr_to_wide_attr_value = ptrs_to_wide_attr_value[i];
-            if (a && PartioType(attr_types[i]) == a->type) {
-                switch (a->type) {
-                case Partio::FLOAT: {
-                    Wide<const float> wdata(ptr_to_wide_attr_value);
-                    *(float*)cloud->dataWrite<float>(*a, p) = wdata[lane];
-                } break;
-                case Partio::VECTOR: {
-                    Wide<const Vec3> wdata(ptr_to_wide_attr_value);
-                    *(Vec3*)cloud->dataWrite<float>(*a, p) = wdata[lane];
-                } break;
-                case Partio::INT: {
-                    Wide<const int> wdata(ptr_to_wide_attr_value);
-                    *(int*)cloud->dataWrite<int>(*a, p) = wdata[lane];
-                } break;
-                case Partio::INDEXEDSTR: {
-                    Wide<const ustring> wdata(ptr_to_wide_attr_value);
-                    ustring ustr  = wdata[lane];
-                    const char* s = ustr.c_str();
-                    int index     = cloud->lookupIndexedStr(*a, s);
-                    if (index == -1)
-                        index = cloud->registerIndexedStr(*a, s);
-                    *(int*)cloud->dataWrite<int>(*a, p) = index;
-                } break;
-                case Partio::NONE: break;
-                }
+            void* val                          = (void*)data[i];
+            TypeDesc type = PointCloud::storage_type(attr_types[i]);
+            if (type == OIIO::TypeFloat) {
+                Wide<const float> wdata(ptr_to_wide_attr_value);
+                *(float*)val = wdata[lane];
+            } else if (type == OIIO::TypeInt) {
+                Wide<const int> wdata(ptr_to_wide_attr_value);
+                *(int*)val = wdata[lane];
+            } else if (type == OIIO::TypeString) {
+                Wide<const ustring> wdata(ptr_to_wide_attr_value);
+                *(ustringhash*)val = ustring(wdata[lane]).uhash();
+            } else if (type != TypeDesc::UNKNOWN) {
+                Wide<const Vec3> wdata(ptr_to_wide_attr_value);
+                *(Vec3*)val = wdata[lane];
             }
         }
+        // Make a new particle
+        if (!pc->write(wpos[lane], nattribs, names, attr_types, data, &err))
+            failed.set_on(lane);
     });
 
-    return ok ? mask : Mask { false };
-#else
-    return Mask { false };
-#endif
+    if (failed.any_on()) {
+        bsg->uniform.context->batched<__OSL_WIDTH>().errorfmt(
+            failed, "pointcloud_write: \"{}\": {}", filename, err);
+        return Mask { false };
+    }
+    return mask;
 }
 
 
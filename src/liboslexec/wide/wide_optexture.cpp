@@ -31,163 +31,249 @@ using WidthTag                = OSL::WidthOf<__OSL_WIDTH>;
 
 namespace {
 
+// The default texture, texture3d and environment make one call to OIIO's
+// batched TextureSystem interface for all the active lanes. OIIO's batches
+// are Tex::BatchWidth wide, so our lanes are the first __OSL_WIDTH of them,
+// and their results come back with channel c of lane l at
+// [c * Tex::BatchWidth + l].
+static constexpr int TexBatchWidth = OIIO::Tex::BatchWidth;
+static_assert(__OSL_WIDTH <= TexBatchWidth,
+              "OSL batches must fit in an OIIO texture batch");
 
-Mask
-default_texture(BatchedRendererServices* bsr, ustring filename,
-                TextureSystem::TextureHandle* texture_handle,
-                TextureSystem::Perthread* texture_thread_info,
-                const BatchedTextureOptions& options, BatchedShaderGlobals* bsg,
-                Wide<const float> ws, Wide<const float> wt,
-                Wide<const float> wdsdx, Wide<const float> wdtdx,
-                Wide<const float> wdsdy, Wide<const float> wdtdy,
-                BatchedTextureOutputs& outputs)
-{
-    Mask status(false);
-    OSL_ASSERT(nullptr != bsg);
-    ShadingContext* context = bsg->uniform.context;
-    if (!texture_thread_info)
-        texture_thread_info = context->texture_thread_info();
-    if (!texture_handle)
-        texture_handle
-            = bsr->texturesys()->get_texture_handle(filename,
-                                                    texture_thread_info);
+typedef float TexBatchFloat[TexBatchWidth];
+typedef float TexBatchVec3[3 * TexBatchWidth];
+typedef float TexBatchResult[4 * TexBatchWidth];
 
-    Mask mask = outputs.mask();
-
-    MaskedData resultRef = outputs.result();
-    MaskedData alphaRef  = outputs.alpha();
-    bool has_derivs      = resultRef.has_derivs() || alphaRef.has_derivs();
 
-    OSL_ASSERT(resultRef.valid());
 
-    // Convert our BatchedTextureOptions to a single TextureOpt
-    // and submit them 1 at a time through existing non-batched interface
-    // Renderers could implement their own batched texturing,
-    // although expected a future version of OIIO will support
-    // this exact batched interface
+void
+to_texture_batch(const BatchedTextureOptions& options,
+                 OIIO::TextureOptBatch& opt)
+{
     const auto& uniform_opt = options.uniform;
-    TextureOpt opt;
-    // opt.time = ignoring (deprecated?)
-    // opt.bias = ignoring (deprecated?)
-    // opt.samples = ignoring (deprecated?)
-    opt.firstchannel = uniform_opt.firstchannel;
-    opt.subimage     = uniform_opt.subimage;
-    opt.subimagename = uniform_opt.subimagename;
-    opt.swrap        = (OIIO::TextureOpt::Wrap)uniform_opt.swrap;
-    opt.twrap        = (OIIO::TextureOpt::Wrap)uniform_opt.twrap;
-    opt.rwrap        = (OIIO::TextureOpt::Wrap)uniform_opt.rwrap;
-    opt.mipmode      = (OIIO::TextureOpt::MipMode)uniform_opt.mipmode;
-    opt.interpmode   = (OIIO::TextureOpt::InterpMode)uniform_opt.interpmode;
-    opt.anisotropic  = uniform_opt.anisotropic;
+    opt.firstchannel        = uniform_opt.firstchannel;
+    opt.subimage            = uniform_opt.subimage;
+    opt.subimagename        = uniform_opt.subimagename;
+    opt.swrap               = uniform_opt.swrap;
+    opt.twrap               = uniform_opt.twrap;
+    opt.rwrap               = uniform_opt.rwrap;
+    opt.mipmode             = uniform_opt.mipmode;
+    opt.interpmode          = uniform_opt.interpmode;
+    opt.anisotropic         = uniform_opt.anisotropic;
     opt.conservative_filter = uniform_opt.conservative_filter;
     opt.fill                = uniform_opt.fill;
     opt.missingcolor        = uniform_opt.missingcolor;
 
     const auto& vary_opt = options.varying;
+    for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+        opt.sblur[lane]  = vary_opt.sblur[lane];
+        opt.tblur[lane]  = vary_opt.tblur[lane];
+        opt.rblur[lane]  = vary_opt.rblur[lane];
+        opt.swidth[lane] = vary_opt.swidth[lane];
+        opt.twidth[lane] = vary_opt.twidth[lane];
+        opt.rwidth[lane] = vary_opt.rwidth[lane];
+        opt.rnd[lane]    = vary_opt.rnd[lane];
+    }
+}
 
-    mask.foreach ([=, &opt, &vary_opt, &outputs, &status](ActiveLane lane) {
-        opt.sblur  = vary_opt.sblur[lane];
-        opt.tblur  = vary_opt.tblur[lane];
-        opt.swidth = vary_opt.swidth[lane];
-        opt.twidth = vary_opt.twidth[lane];
-        opt.rnd    = vary_opt.rnd[lane];
-
-        // For 3D volume texture lookups only:
-        //opt.rblur = vary_opt.rblur[lane];
-        //opt.rwidth = vary_opt.rwidth[lane];
-
-        // For debugging
-        //std::cout << "BatchedRendererServices::texture[lane=" << lane << "opt = " << opt << std::endl;
-
-        // It's actually faster to ask for 4 channels (even if we need fewer)
-        // and ensure that they're being put in aligned memory.
-        // TODO:  investigate if the above statement is true when nchannels==1
-        // NOTE: using simd::vfloat4 to speedup texture transformation below
-        OIIO::simd::vfloat4 result_simd, dresultds_simd, dresultdt_simd;
-
-        bool retVal = false;
-
-        float dsdx = wdsdx[lane];
-        float dtdx = wdtdx[lane];
-        float dsdy = wdsdy[lane];
-        float dtdy = wdtdy[lane];
-        retVal     = bsr->texturesys()->texture(
-            texture_handle, texture_thread_info, opt, ws[lane], wt[lane], dsdx,
-            dtdx, dsdy, dtdy, 4, (float*)&result_simd,
-            has_derivs ? (float*)&dresultds_simd : NULL,
-            has_derivs ? (float*)&dresultdt_simd : NULL);
-
-        OIIO::simd::vfloat4 dresultdx_simd;
-        OIIO::simd::vfloat4 dresultdy_simd;
-        if (has_derivs) {
-            // Correct our st texture space gradients into xy-space gradients
-            dresultdx_simd = dresultds_simd * dsdx + dresultdt_simd * dtdx;
-            dresultdy_simd = dresultds_simd * dsdy + dresultdt_simd * dtdy;
-        }
 
-        // NOTE: regardless of the value of "retVal" we will always copy over the texture system's results.
-        // We are relying on the texture system properly filling in missing or fill colors
 
-        // Per the OSL language specification
-        // "The alpha channel (presumed to be the next channel following the channels returned by the texture() call)"
-        // so despite the fact the alpha channel really is
-        // we will always use +1 the final channel requested
-        int alphaChannelIndex = 0;
-        if (Masked<Color3>::is(resultRef)) {
-            alphaChannelIndex = 3;
-            Masked<Color3> result(resultRef);
-            result[lane] = Color3(result_simd[0], result_simd[1],
-                                  result_simd[2]);
-            if (resultRef.has_derivs()) {
-                MaskedDx<Color3> resultDx(resultRef);
-                MaskedDy<Color3> resultDy(resultRef);
-
-                resultDx[lane] = Color3(dresultdx_simd[0], dresultdx_simd[1],
-                                        dresultdx_simd[2]);
-                resultDy[lane] = Color3(dresultdy_simd[0], dresultdy_simd[1],
-                                        dresultdy_simd[2]);
-            }
-        } else if (Masked<float>::is(resultRef)) {
-            alphaChannelIndex = 1;
-            Masked<float> result(resultRef);
+OSL_FORCEINLINE void
+to_texture_batch(Wide<const float> wval, float* val)
+{
+    OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+    for (int lane = 0; lane < __OSL_WIDTH; ++lane)
+        val[lane] = wval[lane];
+}
+
+
+
+OSL_FORCEINLINE void
+to_texture_batch(Wide<const Vec3> wval, float* val)
+{
+    OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+    for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+        const Vec3 v                  = wval[lane];
+        val[lane]                     = v.x;
+        val[TexBatchWidth + lane]     = v.y;
+        val[2 * TexBatchWidth + lane] = v.z;
+    }
+}
+
+
+
+// Number of channels to look up: those of the result, and alpha after
+// them if it's wanted.
+int
+texture_channels(BatchedTextureOutputs& outputs)
+{
+    int nchannels = Masked<Color3>::is(outputs.result()) ? 3 : 1;
+    return outputs.alpha().valid() ? nchannels + 1 : nchannels;
+}
+
+
+
+// Copy the looked up values (and their x and y derivatives, if given) of
+// the lanes of `outputs` out of the texture batch.
+void
+store_texture_results(BatchedTextureOutputs& outputs, const float* result,
+                      const float* dresultdx, const float* dresultdy)
+{
+    MaskedData resultRef = outputs.result();
+    MaskedData alphaRef  = outputs.alpha();
+    auto channel = [](const float* r, int c, int lane) {
+        return r[c * TexBatchWidth + lane];
+    };
+
+    // Per the OSL language specification
+    // "The alpha channel (presumed to be the next channel following the
+    // channels returned by the texture() call)"
+    int alphaChannelIndex = 0;
+    if (Masked<Color3>::is(resultRef)) {
+        alphaChannelIndex = 3;
+        Masked<Color3> wresult(resultRef);
+        outputs.mask().foreach ([&](ActiveLane lane) {
+            wresult[lane] = Color3(channel(result, 0, lane),
+                                   channel(result, 1, lane),
+                                   channel(result, 2, lane));
+        });
+        if (resultRef.has_derivs() && dresultdx) {
+            MaskedDx<Color3> resultDx(resultRef);
+            MaskedDy<Color3> resultDy(resultRef);
+            outputs.mask().foreach ([&](ActiveLane lane) {
+                resultDx[lane] = Color3(channel(dresultdx, 0, lane),
+                                        channel(dresultdx, 1, lane),
+                                        channel(dresultdx, 2, lane));
+                resultDy[lane] = Color3(channel(dresultdy, 0, lane),
+                                        channel(dresultdy, 1, lane),
+                                        channel(dresultdy, 2, lane));
+            });
+        }
+    } else if (Masked<float>::is(resultRef)) {
+        alphaChannelIndex = 1;
+        Masked<float> wresult(resultRef);
+        outputs.mask().foreach ([&](ActiveLane lane) {
+            wresult[lane] = channel(result, 0, lane);
+        });
+        if (resultRef.has_derivs() && dresultdx) {
             MaskedDx<float> resultDx(resultRef);
             MaskedDy<float> resultDy(resultRef);
-            result[lane] = result_simd[0];
-            if (resultRef.has_derivs()) {
-                resultDx[lane] = dresultdx_simd[0];
-                resultDy[lane] = dresultdy_simd[0];
-            }
+            outputs.mask().foreach ([&](ActiveLane lane) {
+                resultDx[lane] = channel(dresultdx, 0, lane);
+                resultDy[lane] = channel(dresultdy, 0, lane);
+            });
         }
+    }
 
-        if (alphaRef.valid()) {
-            Masked<float> alpha(alphaRef);
-            alpha[lane] = result_simd[alphaChannelIndex];
-            if (alphaRef.has_derivs()) {
-                MaskedDx<float> alphaDx(alphaRef);
-                MaskedDy<float> alphaDy(alphaRef);
-                alphaDx[lane] = dresultdx_simd[alphaChannelIndex];
-                alphaDy[lane] = dresultdy_simd[alphaChannelIndex];
-            }
+    if (alphaRef.valid()) {
+        Masked<float> alpha(alphaRef);
+        outputs.mask().foreach ([&](ActiveLane lane) {
+            alpha[lane] = channel(result, alphaChannelIndex, lane);
+        });
+        if (alphaRef.has_derivs() && dresultdx) {
+            MaskedDx<float> alphaDx(alphaRef);
+            MaskedDy<float> alphaDy(alphaRef);
+            outputs.mask().foreach ([&](ActiveLane lane) {
+                alphaDx[lane] = channel(dresultdx, alphaChannelIndex, lane);
+                alphaDy[lane] = channel(dresultdy, alphaChannelIndex, lane);
+            });
         }
-        //std::cout << "s: " << s.get(i) << " t: " << t.get(i) << " color: " << resultColor << " " << wideResult.get(i) << std::endl;
-        if (retVal) {
-            status.set_on(lane);
-        } else {
-            std::string err = bsr->texturesys()->geterror();
-            bool errMsgSize = err.size() > 0;
-            if (outputs.errormessage().valid()) {
-                Masked<ustring> errormessage(outputs.errormessage());
-                if (errMsgSize) {
-                    errormessage[lane] = ustring(err);
-                } else {
-                    errormessage[lane] = Strings::unknown;
-                }
-            } else if (errMsgSize) {
-                context->batched<__OSL_WIDTH>().errorfmt(
-                    Mask(Lane(lane)), "[RendererServices::texture] {}", err);
-            }
+    }
+}
+
+
+
+// Run `lookup` (a call to the batched TextureSystem) for the lanes of
+// `outputs` and return the lanes that succeeded. OIIO only tells whether
+// the whole batch succeeded, so on failure all of its lanes are failed
+// with the one error message the texture system has for the call.
+// Regardless of success, the texture system fills in the results (with
+// the fill or missing color where it must).
+template<typename F>
+Mask
+texture_batch_lookup(F&& lookup, TextureSystem* texturesys,
+                     ShadingContext* context, BatchedTextureOutputs& outputs,
+                     const char* opname)
+{
+    Mask mask = outputs.mask();
+    if (lookup(mask))
+        return mask;
+
+    std::string err = texturesys->geterror();
+    if (outputs.errormessage().valid()) {
+        Masked<ustring> errormessage(outputs.errormessage());
+        ustring msg = err.size() ? ustring(err) : Strings::unknown;
+        mask.foreach ([&](ActiveLane lane) { errormessage[lane] = msg; });
+    } else if (err.size()) {
+        context->batched<__OSL_WIDTH>().errorfmt(
+            mask, "[RendererServices::{}] {}", opname, err);
+    }
+    return Mask(false);
+}
+
+
+
+Mask
+default_texture(BatchedRendererServices* bsr, ustring filename,
+                TextureSystem::TextureHandle* texture_handle,
+                TextureSystem::Perthread* texture_thread_info,
+                const BatchedTextureOptions& options, BatchedShaderGlobals* bsg,
+                Wide<const float> ws, Wide<const float> wt,
+                Wide<const float> wdsdx, Wide<const float> wdtdx,
+                Wide<const float> wdsdy, Wide<const float> wdtdy,
+                BatchedTextureOutputs& outputs)
+{
+    OSL_ASSERT(nullptr != bsg);
+    ShadingContext* context   = bsg->uniform.context;
+    TextureSystem* texturesys = bsr->texturesys();
+    if (!texture_thread_info)
+        texture_thread_info = context->texture_thread_info();
+    if (!texture_handle)
+        texture_handle = texturesys->get_texture_handle(filename,
+                                                        texture_thread_info);
+
+    OSL_ASSERT(outputs.result().valid());
+    bool has_derivs = outputs.result().has_derivs()
+                      || outputs.alpha().has_derivs();
+    int nchannels   = texture_channels(outputs);
+
+    OIIO::TextureOptBatch opt;
+    to_texture_batch(options, opt);
+    TexBatchFloat s = {}, t = {}, dsdx = {}, dtdx = {}, dsdy = {}, dtdy = {};
+    to_texture_batch(ws, s);
+    to_texture_batch(wt, t);
+    to_texture_batch(wdsdx, dsdx);
+    to_texture_batch(wdtdx, dtdx);
+    to_texture_batch(wdsdy, dsdy);
+    to_texture_batch(wdtdy, dtdy);
+
+    TexBatchResult result, dresultds, dresultdt;
+    Mask status = texture_batch_lookup(
+        [&](Mask lanes) {
+            return texturesys->texture(texture_handle, texture_thread_info, opt,
+                                       OIIO::Tex::RunMask(lanes.value()), s, t,
+                                       dsdx, dtdx, dsdy, dtdy, nchannels,
+                                       result, has_derivs ? dresultds : nullptr,
+                                       has_derivs ? dresultdt : nullptr);
+        },
+        texturesys, context, outputs, "texture");
+
+    if (!has_derivs) {
+        store_texture_results(outputs, result, nullptr, nullptr);
+        return status;
+    }
+    // Correct our st texture space gradients into xy-space gradients
+    TexBatchResult dresultdx, dresultdy;
+    for (int c = 0; c < nchannels; ++c) {
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+            int i        = c * TexBatchWidth + lane;
+            dresultdx[i] = dresultds[i] * dsdx[lane]
+                           + dresultdt[i] * dtdx[lane];
+            dresultdy[i] = dresultds[i] * dsdy[lane]
+                           + dresultdt[i] * dtdy[lane];
         }
-    });
+    }
+    store_texture_results(outputs, result, dresultdx, dresultdy);
     return status;
 }
 
@@ -225,166 +311,59 @@ default_texture3d(BatchedRendererServices* bsr, ustring filename,
                   Wide<const Vec3> wdPdx, Wide<const Vec3> wdPdy,
                   Wide<const Vec3> wdPdz, BatchedTextureOutputs& outputs)
 {
-    Mask status(false);
     ASSERT(nullptr != bsg);
-    ShadingContext* context = bsg->uniform.context;
+    ShadingContext* context   = bsg->uniform.context;
+    TextureSystem* texturesys = bsr->texturesys();
     if (!texture_thread_info)
         texture_thread_info = context->texture_thread_info();
     if (!texture_handle)
-        texture_handle
-            = bsr->texturesys()->get_texture_handle(filename,
-                                                    texture_thread_info);
-
-    Mask mask = outputs.mask();
-
-    MaskedData resultRef = outputs.result();
-    MaskedData alphaRef  = outputs.alpha();
-    bool has_derivs      = resultRef.has_derivs() | alphaRef.has_derivs();
-
-    ASSERT(resultRef.valid());
-
-    // Convert our BatchedTextureOptions to a single TextureOpt
-    // and submit them 1 at a time through existing non-batched interface
-    // Renderers could implement their own batched texturing,
-    // although expected a future version of OIIO will support
-    // this exact batched interface
-    const auto& uniform_opt = options.uniform;
-    TextureOpt opt;
-    // opt.time = ignoring (deprecated?)
-    // opt.bias = ignoring (deprecated?)
-    // opt.samples = ignoring (deprecated?)
-    opt.firstchannel = uniform_opt.firstchannel;
-    opt.subimage     = uniform_opt.subimage;
-    opt.subimagename = uniform_opt.subimagename;
-    opt.swrap        = (OIIO::TextureOpt::Wrap)uniform_opt.swrap;
-    opt.twrap        = (OIIO::TextureOpt::Wrap)uniform_opt.twrap;
-    opt.rwrap        = (OIIO::TextureOpt::Wrap)uniform_opt.rwrap;
-    opt.mipmode      = (OIIO::TextureOpt::MipMode)uniform_opt.mipmode;
-    opt.interpmode   = (OIIO::TextureOpt::InterpMode)uniform_opt.interpmode;
-    opt.anisotropic  = uniform_opt.anisotropic;
-    opt.conservative_filter = uniform_opt.conservative_filter;
-    opt.fill                = uniform_opt.fill;
-    opt.missingcolor        = uniform_opt.missingcolor;
-
-    const auto& vary_opt = options.varying;
-
-    mask.foreach ([=, &opt, &vary_opt, &outputs, &status](ActiveLane lane) {
-        opt.sblur = vary_opt.sblur[lane];
-        opt.tblur = vary_opt.tblur[lane];
-        // For 3D volume texture lookups only:
-        opt.rblur = vary_opt.rblur[lane];
-
-        opt.swidth = vary_opt.swidth[lane];
-        opt.twidth = vary_opt.twidth[lane];
-        // For 3D volume texture lookups only:
-        opt.rwidth = vary_opt.rwidth[lane];
-
-#if 0
-        // For debugging
-
-        //std::cout << "BatchedRendererServices::texture[lane=" << lane << std::endl;
-        std::cout << "BatchedRendererServices::texture:" << std::endl;
-        std::cout << "P = " << (const Vec3)wP[lane] << std::endl;
-        std::cout << "dPdx = " << (const Vec3)wdPdx[lane] << std::endl;
-        std::cout << "dPdy = " << (const Vec3)wdPdy[lane] << std::endl;
-        std::cout << "opt.wrap(s,r,t)=" << opt.swrap << "," << opt.twrap << "," << opt.rwrap << ")" << std::endl;
-#endif
-
-        // It's actually faster to ask for 4 channels (even if we need fewer)
-        // and ensure that they're being put in aligned memory.
-        // TODO:  investigate if the above statement is true when nchannels==1
-
-        // NOTE: using simd::vfloat4 to speedup texture transformation below
-        OIIO::simd::vfloat4 result_simd, dresultds_simd, dresultdt_simd,
-            dresultdr_simd;
-
-        bool retVal = false;
-
-        const Vec3 dPdx = wdPdx[lane];
-        const Vec3 dPdy = wdPdy[lane];
-        const Vec3 dPdz = wdPdz[lane];
-
-        retVal = bsr->texturesys()->texture3d(
-            texture_handle, texture_thread_info, opt, Vec3(wP[lane]),
-            Vec3(dPdx), Vec3(dPdy), dPdz, 4, (float*)&result_simd,
-            has_derivs ? (float*)&dresultds_simd : nullptr,
-            has_derivs ? (float*)&dresultdt_simd : nullptr,
-            has_derivs ? (float*)&dresultdr_simd : nullptr);
-
-        OIIO::simd::vfloat4 dresultdx_simd;
-        OIIO::simd::vfloat4 dresultdy_simd;
-        if (has_derivs) {
-            // Correct our str texture space gradients into xyz-space gradients
-            dresultdx_simd = dresultds_simd * dPdx.x + dresultdt_simd * dPdx.y
-                             + dresultdr_simd * dPdx.z;
-            dresultdy_simd = dresultds_simd * dPdy.x + dresultdt_simd * dPdy.y
-                             + dresultdr_simd * dPdy.z;
-        }
-
-        // NOTE: regardless of the value of "retVal" we will always copy over the texture system's results.
-        // We are relying on the texture system properly filling in missing or fill colors
-
-        // Per the OSL language specification
-        // "The alpha channel (presumed to be the next channel following the channels returned by the texture() call)"
-        // so despite the fact the alpha channel really is
-        // we will always use +1 the final channel requested
-        int alphaChannelIndex = 0;
-        if (Masked<Color3>::is(resultRef)) {
-            alphaChannelIndex = 3;
-            Masked<Color3> result(resultRef);
-            result[lane] = Color3(result_simd[0], result_simd[1],
-                                  result_simd[2]);
-            if (resultRef.has_derivs()) {
-                MaskedDx<Color3> resultDx(resultRef);
-                MaskedDy<Color3> resultDy(resultRef);
-                resultDx[lane] = Color3(dresultdx_simd[0], dresultdx_simd[1],
-                                        dresultdx_simd[2]);
-                resultDy[lane] = Color3(dresultdy_simd[0], dresultdy_simd[1],
-                                        dresultdy_simd[2]);
-            }
-        } else if (Masked<float>::is(resultRef)) {
-            alphaChannelIndex = 1;
-            Masked<float> result(resultRef);
-            result[lane] = result_simd[0];
-            if (resultRef.has_derivs()) {
-                MaskedDx<float> resultDx(resultRef);
-                MaskedDy<float> resultDy(resultRef);
-                resultDx[lane] = dresultdx_simd[0];
-                resultDy[lane] = dresultdy_simd[0];
-            }
-        }
-
-
-        if (alphaRef.valid()) {
-            Masked<float> alpha(alphaRef);
-            alpha[lane] = result_simd[alphaChannelIndex];
-            if (alphaRef.has_derivs()) {
-                MaskedDx<float> alphaDx(alphaRef);
-                MaskedDy<float> alphaDy(alphaRef);
-                alphaDx[lane] = dresultdx_simd[alphaChannelIndex];
-                alphaDy[lane] = dresultdy_simd[alphaChannelIndex];
-            }
-        }
-
-        //std::cout << "s: " << s.get(i) << " t: " << t.get(i) << " color: " << resultColor << " " << wideResult.get(i) << std::endl;
-        if (retVal) {
-            status.set_on(lane);
-        } else {
-            std::string err = bsr->texturesys()->geterror();
-            bool errMsgSize = err.size() > 0;
-            if (outputs.errormessage().valid()) {
-                Masked<ustring> errormessage(outputs.errormessage());
-                if (errMsgSize) {
-                    errormessage[lane] = ustring(err);
-                } else {
-                    errormessage[lane] = Strings::unknown;
-                }
-            } else if (errMsgSize) {
-                context->batched<__OSL_WIDTH>().errorfmt(
-                    Mask(Lane(lane)), "[RendererServices::texture3d] {}", err);
-            }
+        texture_handle = texturesys->get_texture_handle(filename,
+                                                        texture_thread_info);
+
+    ASSERT(outputs.result().valid());
+    bool has_derivs = outputs.result().has_derivs()
+                      || outputs.alpha().has_derivs();
+    int nchannels   = texture_channels(outputs);
+
+    OIIO::TextureOptBatch opt;
+    to_texture_batch(options, opt);
+    TexBatchVec3 P = {}, dPdx = {}, dPdy = {}, dPdz = {};
+    to_texture_batch(wP, P);
+    to_texture_batch(wdPdx, dPdx);
+    to_texture_batch(wdPdy, dPdy);
+    to_texture_batch(wdPdz, dPdz);
+
+    TexBatchResult result, dresultds, dresultdt, dresultdr;
+    Mask status = texture_batch_lookup(
+        [&](Mask lanes) {
+            return texturesys->texture3d(
+                texture_handle, texture_thread_info, opt,
+                OIIO::Tex::RunMask(lanes.value()), P, dPdx, dPdy, dPdz,
+                nchannels, result, has_derivs ? dresultds : nullptr,
+                has_derivs ? dresultdt : nullptr,
+                has_derivs ? dresultdr : nullptr);
+        },
+        texturesys, context, outputs, "texture3d");
+
+    if (!has_derivs) {
+        store_texture_results(outputs, result, nullptr, nullptr);
+        return status;
+    }
+    // Correct our str texture space gradients into xyz-space gradients
+    TexBatchResult dresultdx, dresultdy;
+    for (int c = 0; c < nchannels; ++c) {
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+            int i        = c * TexBatchWidth + lane;
+            int x        = lane;
+            int y        = TexBatchWidth + lane;
+            int z        = 2 * TexBatchWidth + lane;
+            dresultdx[i] = dresultds[i] * dPdx[x] + dresultdt[i] * dPdx[y]
+                           + dresultdr[i] * dPdx[z];
+            dresultdy[i] = dresultds[i] * dPdy[x] + dresultdt[i] * dPdy[y]
+                           + dresultdr[i] * dPdy[z];
         }
-    });
+    }
+    store_texture_results(outputs, result, dresultdx, dresultdy);
     return status;
 }
 
@@ -420,119 +399,37 @@ default_environment(BatchedRendererServices* bsr, ustring filename,
                     Wide<const Vec3> wdRdx, Wide<const Vec3> wdRdy,
                     BatchedTextureOutputs& outputs)
 {
-    Mask status(false);
     ASSERT(nullptr != bsg);
-    ShadingContext* context = bsg->uniform.context;
+    ShadingContext* context   = bsg->uniform.context;
+    TextureSystem* texturesys = bsr->texturesys();
     if (!texture_thread_info)
         texture_thread_info = context->texture_thread_info();
     if (!texture_handle)
-        texture_handle
-            = bsr->texturesys()->get_texture_handle(filename,
-                                                    texture_thread_info);
-
-    Mask mask = outputs.mask();
-
-    MaskedData resultRef = outputs.result();
-    MaskedData alphaRef  = outputs.alpha();
-
-    ASSERT(resultRef.valid());
-
-    // Convert our BatchedTextureOptions to a single TextureOpt
-    // and submit them 1 at a time through existing non-batched interface
-    // Renderers could implement their own batched environment,
-    // although expected a future version of OIIO will support
-    // this exact batched interface
-    const auto& uniform_opt = options.uniform;
-    TextureOpt opt;
-    // opt.time = ignoring (deprecated?)
-    // opt.bias = ignoring (deprecated?)
-    // opt.samples = ignoring (deprecated?)
-    opt.firstchannel = uniform_opt.firstchannel;
-    opt.subimage     = uniform_opt.subimage;
-    opt.subimagename = uniform_opt.subimagename;
-    opt.swrap        = (OIIO::TextureOpt::Wrap)uniform_opt.swrap;
-    opt.twrap        = (OIIO::TextureOpt::Wrap)uniform_opt.twrap;
-    opt.rwrap        = (OIIO::TextureOpt::Wrap)uniform_opt.rwrap;
-    opt.mipmode      = (OIIO::TextureOpt::MipMode)uniform_opt.mipmode;
-    opt.interpmode   = (OIIO::TextureOpt::InterpMode)uniform_opt.interpmode;
-    opt.anisotropic  = uniform_opt.anisotropic;
-    opt.conservative_filter = uniform_opt.conservative_filter;
-    opt.fill                = uniform_opt.fill;
-    opt.missingcolor        = uniform_opt.missingcolor;
-
-    const auto& vary_opt = options.varying;
-
-    mask.foreach ([=, &opt, &vary_opt, &outputs, &status](ActiveLane lane) {
-        opt.sblur = vary_opt.sblur[lane];
-        opt.tblur = vary_opt.tblur[lane];
-        // For 3D volume texture lookups only:
-        // opt.rblur = vary_opt.rblur[lane];
-
-        opt.swidth = vary_opt.swidth[lane];
-        opt.twidth = vary_opt.twidth[lane];
-        // For 3D volume texture lookups only:
-        // opt.rwidth = vary_opt.rwidth[lane];
-
-        // It's actually faster to ask for 4 channels (even if we need fewer)
-        // and ensure that they're being put in aligned memory.
-        // TODO:  investigate if the above statement is true when nchannels==1
-
-        // NOTE: using simd::vfloat4 to speedup texture transformation below
-        OIIO::simd::vfloat4 result_simd;
-
-        bool retVal = false;
-
-        const Vec3 dPdx = wdRdx[lane];
-        const Vec3 dPdy = wdRdy[lane];
-
-        retVal = bsr->texturesys()->environment(
-            texture_handle, texture_thread_info, opt, Vec3(wR[lane]),
-            Vec3(dPdx), Vec3(dPdy), 4, (float*)&result_simd, nullptr, nullptr);
-
-        // NOTE: regardless of the value of "retVal" we will always copy over the texture system's results.
-        // We are relying on the texture system properly filling in missing or fill colors
-
-        // Per the OSL language specification
-        // "The alpha channel (presumed to be the next channel following the channels returned by the texture() call)"
-        // so despite the fact the alpha channel really is
-        // we will always use +1 the final channel requested
-        int alphaChannelIndex = 0;
-        if (Masked<Color3>::is(resultRef)) {
-            alphaChannelIndex = 3;
-            Masked<Color3> result(resultRef);
-            result[lane] = Color3(result_simd[0], result_simd[1],
-                                  result_simd[2]);
-        } else if (Masked<float>::is(resultRef)) {
-            alphaChannelIndex = 1;
-            Masked<float> result(resultRef);
-            result[lane] = result_simd[0];
-        }
-
-        if (alphaRef.valid()) {
-            Masked<float> alpha(alphaRef);
-            alpha[lane] = result_simd[alphaChannelIndex];
-        }
-
-        //std::cout << "s: " << s.get(i) << " t: " << t.get(i) << " color: " << resultColor << " " << wideResult.get(i) << std::endl;
-        if (retVal) {
-            status.set_on(lane);
-        } else {
-            std::string err = bsr->texturesys()->geterror();
-            bool errMsgSize = err.size() > 0;
-            if (outputs.errormessage().valid()) {
-                Masked<ustring> errormessage(outputs.errormessage());
-                if (errMsgSize) {
-                    errormessage[lane] = ustring(err);
-                } else {
-                    errormessage[lane] = Strings::unknown;
-                }
-            } else if (errMsgSize) {
-                context->batched<__OSL_WIDTH>().errorfmt(
-                    Mask(Lane(lane)), "[RendererServices::environment] {}",
-                    err);
-            }
-        }
-    });
+        texture_handle = texturesys->get_texture_handle(filename,
+                                                        texture_thread_info);
+
+    ASSERT(outputs.result().valid());
+    int nchannels = texture_channels(outputs);
+
+    OIIO::TextureOptBatch opt;
+    to_texture_batch(options, opt);
+    TexBatchVec3 R = {}, dRdx = {}, dRdy = {};
+    to_texture_batch(wR, R);
+    to_texture_batch(wdRdx, dRdx);
+    to_texture_batch(wdRdy, dRdy);
+
+    // Derivatives of environment lookups are not computed
+    TexBatchResult result;
+    Mask status = texture_batch_lookup(
+        [&](Mask lanes) {
+            return texturesys->environment(texture_handle, texture_thread_info,
+                                           opt,
+                                           OIIO::Tex::RunMask(lanes.value()),
+                                           R, dRdx, dRdy, nchannels, result,
+                                           nullptr, nullptr);
+        },
+        texturesys, context, outputs, "environment");
+    store_texture_results(outputs, result, nullptr, nullptr);
     return status;
 }
 
@@ -17,6 +17,9 @@
 #include <OSL/oslcomp.h>
 #include <OSL/oslexec.h>
 #include <OSL/rendererservices.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_rendererservices.h>
+#endif
 
 using namespace OIIO;
 
@@ -130,16 +133,74 @@ OIIO_PLUGIN_EXPORTS_END
 namespace pvt {
 
 
+#if OSL_USE_BATCHED
+// Batched counterpart of OIIO_RendererServices, which lets shade_image()
+// run the shaders a batch of pixels at a time. Like the scalar one it has
+// no transforms, attributes or userdata, so it relies on the defaults of
+// BatchedRendererServices for everything.
+template<int WidthT>
+class OIIO_BatchedRendererServices final
+    : public BatchedRendererServices<WidthT> {
+public:
+    OIIO_BatchedRendererServices(TextureSystem* texsys = NULL)
+        : BatchedRendererServices<WidthT>(texsys)
+    {
+    }
+
+    bool is_overridden_get_inverse_matrix_WmWxWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_matrix_WmWsWf() const override { return false; }
+    bool is_overridden_get_inverse_matrix_WmsWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_inverse_matrix_WmWsWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_texture() const override { return false; }
+    bool is_overridden_texture3d() const override { return false; }
+    bool is_overridden_environment() const override { return false; }
+    bool is_overridden_pointcloud_search() const override { return false; }
+    bool is_overridden_pointcloud_get() const override { return false; }
+    bool is_overridden_pointcloud_write() const override { return false; }
+};
+#endif
+
+
+
 class OIIO_RendererServices final : public RendererServices {
 public:
     OIIO_RendererServices(TextureSystem* texsys = NULL)
         : RendererServices(texsys)
+#if OSL_USE_BATCHED
+        , m_batch16(texsys)
+        , m_batch8(texsys)
+        , m_batch4(texsys)
+#endif
     {
     }
     ~OIIO_RendererServices() {}
 
     int supports(string_view /*feature*/) const override { return false; }
 
+#if OSL_USE_BATCHED
+    BatchedRendererServices<16>* batched(WidthOf<16>) override
+    {
+        return &m_batch16;
+    }
+    BatchedRendererServices<8>* batched(WidthOf<8>) override
+    {
+        return &m_batch8;
+    }
+    BatchedRendererServices<4>* batched(WidthOf<4>) override
+    {
+        return &m_batch4;
+    }
+#endif
+
     bool get_matrix(ShaderGlobals* /*sg*/, Matrix44& /*result*/,
                     TransformationPtr /*xform*/, float /*time*/) override
     {
@@ -181,6 +242,13 @@ public:
     {
         return false;  // FIXME?
     }
+
+#if OSL_USE_BATCHED
+private:
+    OIIO_BatchedRendererServices<16> m_batch16;
+    OIIO_BatchedRendererServices<8> m_batch8;
+    OIIO_BatchedRendererServices<4> m_batch4;
+#endif
 };
 
 
@@ -228,6 +296,14 @@ setup_shadingsys()
     if (!shadingsys) {
         renderer   = new OIIO_RendererServices(TextureSystem::create(true));
         shadingsys = new ShadingSystem(renderer, NULL, &errhandler);
+#if OSL_USE_BATCHED
+        // Batched analysis is on by default because the renderer supports
+        // batches, but it only pays off if this machine can run them.
+        if (!shadingsys->configure_batch_execution_at(16)
+            && !shadingsys->configure_batch_execution_at(8)
+            && !shadingsys->configure_batch_execution_at(4))
+            shadingsys->attribute("opt_batched_analysis", 0);
+#endif
     }
 }
 
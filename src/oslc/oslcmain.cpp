@@ -39,6 +39,7 @@ usage()
            "\t-E             Only preprocess the input and output to stdout\n"
            "\t-Werror        Treat all warnings as errors\n"
            "\t-embed-source  Embed preprocessed source in the oso file\n"
+           "\t-binary        Write the oso file in binary, for faster loading\n"
            "\t-buffer        (debugging) Force compile from buffer\n"
            "\t-MD, -MMD      Write a depfile containing headers used, to a file\n"
            "\t-M, -MM        Like -MD, but write depfile to stdout\n"
@@ -132,6 +133,8 @@ main(int argc, const char* argv[])
                    || !strcmp(argv[a], "-Werror")
                    || !strcmp(argv[a], "-embed-source")
                    || !strcmp(argv[a], "--embed-source")
+                   || !strcmp(argv[a], "-binary")
+                   || !strcmp(argv[a], "--binary")
                    || !strcmp(argv[a], "-MD")
                    || !strcmp(argv[a], "--write-dependencies")
                    || !strcmp(argv[a], "-MMD")
@@ -0,0 +1,157 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include "batched_raytracer.h"
+#include "simpleraytracer.h"
+
+OSL_NAMESPACE_ENTER
+
+
+
+template<int WidthT>
+BatchedRaytracer<WidthT>::BatchedRaytracer(SimpleRaytracer& rend)
+    : BatchedRendererServices<WidthT>(rend.texturesys()), m_rend(rend)
+{
+}
+
+
+
+template<int WidthT>
+typename BatchedRaytracer<WidthT>::Mask
+BatchedRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                     Masked<Matrix44> result,
+                                     Wide<const TransformationPtr> xform,
+                                     Wide<const float> time)
+{
+    Mask success(false);
+    result.mask().foreach ([&](ActiveLane lane) -> void {
+        Matrix44 M;
+        if (m_rend.get_matrix(nullptr, M, xform[lane], time[lane])) {
+            result[lane] = M;
+            success.set_on(lane);
+        }
+    });
+    return success;
+}
+
+
+
+template<int WidthT>
+typename BatchedRaytracer<WidthT>::Mask
+BatchedRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                     Masked<Matrix44> result, ustringhash from,
+                                     Wide<const float> /*time*/)
+{
+    // Named transforms don't move, so one lookup serves every lane
+    Matrix44 M;
+    if (!m_rend.get_matrix(nullptr, M, from))
+        return Mask(false);
+    assign_all(result, M);
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedRaytracer<WidthT>::Mask
+BatchedRaytracer<WidthT>::get_inverse_matrix(BatchedShaderGlobals* /*bsg*/,
+                                             Masked<Matrix44> result,
+                                             ustringhash to,
+                                             Wide<const float> time)
+{
+    Mask success(false);
+    result.mask().foreach ([&](ActiveLane lane) -> void {
+        Matrix44 M;
+        if (m_rend.get_inverse_matrix(nullptr, M, to, time[lane])) {
+            result[lane] = M;
+            success.set_on(lane);
+        }
+    });
+    return success;
+}
+
+
+
+template<int WidthT>
+template<typename F>
+typename BatchedRaytracer<WidthT>::Mask
+BatchedRaytracer<WidthT>::lane_by_lane(BatchedShaderGlobals* bsg,
+                                       MaskedData val, F&& query)
+{
+    if (!bsg || !bsg->uniform.renderstate)
+        return Mask(false);
+    auto lane_sg = static_cast<ShaderGlobals* const*>(bsg->uniform.renderstate);
+
+    const TypeDesc type = val.type();
+    const size_t size   = type.size();
+    const int nvals     = val.has_derivs() ? 3 : 1;
+    char* scalar        = OSL_ALLOCA(char, 3 * size);
+    Mask success(false);
+    val.mask().foreach ([&](ActiveLane lane) -> void {
+        memset(scalar, 0, 3 * size);
+        if (!query(lane_sg[lane], scalar))
+            return;
+        // The scalar interface returns strings as hashes
+        if (type.basetype == TypeDesc::STRING)
+            for (size_t i = 0, n = type.numelements(); i < n; ++i)
+                ((ustring*)scalar)[i] = ustring_from(((ustringhash*)scalar)[i]);
+        // The value is followed by its derivatives, in both layouts
+        for (int d = 0; d < nvals; ++d) {
+            MaskedData dst(type, false, Mask(lane),
+                           (char*)val.ptr() + d * val.val_size_in_bytes());
+            dst.assign_val_lane_from_scalar(lane, scalar + d * size);
+        }
+        success.set_on(lane);
+    });
+    return success;
+}
+
+
+
+template<int WidthT>
+typename BatchedRaytracer<WidthT>::Mask
+BatchedRaytracer<WidthT>::get_array_attribute(BatchedShaderGlobals* bsg,
+                                              ustringhash object,
+                                              ustringhash name, int index,
+                                              MaskedData val)
+{
+    return lane_by_lane(bsg, val, [&](ShaderGlobals* sg, void* scalar) {
+        return m_rend.get_array_attribute(sg, val.has_derivs(), object,
+                                          val.type(), name, index, scalar);
+    });
+}
+
+
+
+template<int WidthT>
+typename BatchedRaytracer<WidthT>::Mask
+BatchedRaytracer<WidthT>::get_attribute(BatchedShaderGlobals* bsg,
+                                        ustringhash object, ustringhash name,
+                                        MaskedData val)
+{
+    return get_array_attribute(bsg, object, name, -1, val);
+}
+
+
+
+template<int WidthT>
+typename BatchedRaytracer<WidthT>::Mask
+BatchedRaytracer<WidthT>::get_userdata(ustringhash name,
+                                       BatchedShaderGlobals* bsg,
+                                       MaskedData val)
+{
+    return lane_by_lane(bsg, val, [&](ShaderGlobals* sg, void* scalar) {
+        return m_rend.get_userdata(val.has_derivs(), name, val.type(), sg,
+                                   scalar);
+    });
+}
+
+
+
+// Explicitly instantiate BatchedRaytracer template
+template class BatchedRaytracer<16>;
+template class BatchedRaytracer<8>;
+template class BatchedRaytracer<4>;
+
+OSL_NAMESPACE_EXIT
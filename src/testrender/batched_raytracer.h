@@ -0,0 +1,77 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/oslconfig.h>
+
+#include <OSL/batched_rendererservices.h>
+
+OSL_NAMESPACE_ENTER
+
+class SimpleRaytracer;
+
+// Batched renderer services for the wavefront integrator of SimpleRaytracer.
+//
+// The integrator sets up a scalar ShaderGlobals for every point it shades,
+// and its ShadingQueue copies them into the lanes of a batch. The batch's
+// renderstate is an array of WidthT pointers to those ShaderGlobals, so
+// attribute and userdata queries are answered one lane at a time by the
+// scalar SimpleRaytracer methods, exactly as they would be in scalar mode.
+template<int WidthT>
+class BatchedRaytracer : public BatchedRendererServices<WidthT> {
+public:
+    explicit BatchedRaytracer(SimpleRaytracer& rend);
+
+    OSL_USING_DATA_WIDTH(WidthT);
+
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    Wide<const TransformationPtr> xform,
+                    Wide<const float> time) override;
+    bool is_overridden_get_inverse_matrix_WmWxWf() const override
+    {
+        return false;
+    }
+
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    ustringhash from, Wide<const float> time) override;
+    bool is_overridden_get_matrix_WmWsWf() const override { return false; }
+
+    Mask get_inverse_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                            ustringhash to, Wide<const float> time) override;
+    bool is_overridden_get_inverse_matrix_WmsWf() const override
+    {
+        return true;
+    }
+    bool is_overridden_get_inverse_matrix_WmWsWf() const override
+    {
+        return false;
+    }
+
+    Mask get_array_attribute(BatchedShaderGlobals* bsg, ustringhash object,
+                             ustringhash name, int index,
+                             MaskedData val) override;
+    Mask get_attribute(BatchedShaderGlobals* bsg, ustringhash object,
+                       ustringhash name, MaskedData val) override;
+    Mask get_userdata(ustringhash name, BatchedShaderGlobals* bsg,
+                      MaskedData val) override;
+
+    bool is_overridden_texture() const override { return false; }
+    bool is_overridden_texture3d() const override { return false; }
+    bool is_overridden_environment() const override { return false; }
+    bool is_overridden_pointcloud_search() const override { return false; }
+    bool is_overridden_pointcloud_get() const override { return false; }
+    bool is_overridden_pointcloud_write() const override { return false; }
+
+private:
+    // Run a scalar query for each active lane of `val`, passing it the
+    // ShaderGlobals of the lane and a buffer for one value (and its
+    // derivatives), and copy what it returns into the lane.
+    template<typename F>
+    Mask lane_by_lane(BatchedShaderGlobals* bsg, MaskedData val, F&& query);
+
+    SimpleRaytracer& m_rend;
+};
+
+OSL_NAMESPACE_EXIT
@@ -0,0 +1,232 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include "bvh.h"
+
+
+OSL_NAMESPACE_ENTER
+
+// Node of the binary tree made by the SAH build, before it is collapsed
+struct BVH::BuildNode {
+    BBox box;
+    int left  = -1;  // inner node: indices of the children
+    int right = -1;
+    int begin = 0;  // leaf: range of m_prims
+    int end   = 0;
+    bool leaf() const { return left < 0; }
+};
+
+
+
+void
+BVH::build(const std::vector<BBox>& bounds)
+{
+    m_nodes.clear();
+    m_prims.clear();
+    m_depth = 0;
+    if (bounds.empty())
+        return;
+
+    std::vector<Vec3> centroids(bounds.size());
+    for (size_t i = 0; i < bounds.size(); ++i) {
+        centroids[i] = bounds[i].center();
+        m_prims.push_back(int(i));
+    }
+
+    std::vector<BuildNode> bnodes;
+    bnodes.reserve(2 * bounds.size());
+    int root = build_recursive(bnodes, bounds, centroids, 0,
+                               int(bounds.size()), 0);
+    m_nodes.reserve(bnodes.size() / 2 + 1);
+    collapse(bnodes, root, 1);
+    // intersect() keeps its stack on the C++ stack, so it must never need
+    // more entries than that holds
+    OSL_ASSERT(3 * m_depth + 1 <= StackSize);
+}
+
+
+
+int
+BVH::build_recursive(std::vector<BuildNode>& bnodes,
+                     const std::vector<BBox>& bounds,
+                     const std::vector<Vec3>& centroids, int begin, int end,
+                     int depth)
+{
+    BBox box, cbox;
+    for (int i = begin; i < end; ++i) {
+        box.extend(bounds[m_prims[i]]);
+        cbox.extend(centroids[m_prims[i]]);
+    }
+    // Pad a little so that flat primitives (and rounding in the ray/box
+    // test) don't make rays miss boxes around things they hit.
+    const float pad = 1e-5f
+                      * std::max(std::max(box.max.x - box.min.x,
+                                          box.max.y - box.min.y),
+                                 std::max(box.max.z - box.min.z, 1.0f));
+    box.min -= Vec3(pad);
+    box.max += Vec3(pad);
+
+    int index = int(bnodes.size());
+    bnodes.emplace_back();
+    bnodes[index].box   = box;
+    bnodes[index].begin = begin;
+    bnodes[index].end   = end;
+    const int n         = end - begin;
+    if (n == 1 || depth >= MaxDepth)
+        return index;
+
+    // Binned SAH: find the best split plane among a fixed number of
+    // candidates per axis, placed uniformly over the centroid bounds.
+    const int NumBins = 16;
+    int best_axis     = -1;
+    int best_bin      = 0;
+    float best_cost   = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; ++axis) {
+        const float lo = cbox.min[axis], hi = cbox.max[axis];
+        if (!(hi > lo))
+            continue;
+        const float scale = NumBins / (hi - lo);
+        auto bin_of       = [&](int prim) {
+            return std::min(NumBins - 1,
+                            int((centroids[prim][axis] - lo) * scale));
+        };
+        BBox bin_box[NumBins];
+        int bin_count[NumBins] = {};
+        for (int i = begin; i < end; ++i) {
+            int b = bin_of(m_prims[i]);
+            bin_box[b].extend(bounds[m_prims[i]]);
+            bin_count[b] += 1;
+        }
+        // Sweep from the right to get the area and count of everything
+        // past each split, then from the left to evaluate the splits.
+        float right_area[NumBins];
+        int right_count[NumBins];
+        BBox acc;
+        int count = 0;
+        for (int b = NumBins - 1; b > 0; --b) {
+            acc.extend(bin_box[b]);
+            count += bin_count[b];
+            right_area[b]  = acc.area();
+            right_count[b] = count;
+        }
+        acc   = BBox();
+        count = 0;
+        for (int b = 1; b < NumBins; ++b) {
+            acc.extend(bin_box[b - 1]);
+            count += bin_count[b - 1];
+            if (!count || !right_count[b])
+                continue;
+            float cost = acc.area() * count + right_area[b] * right_count[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin  = b;
+            }
+        }
+    }
+
+    // Traversal is taken to cost about as much as one primitive test
+    const float area = box.area();
+    int mid;
+    if (best_axis >= 0) {
+        if (n <= MaxLeafSize && n * area <= area + best_cost)
+            return index;
+        const int axis    = best_axis;
+        const float lo    = cbox.min[axis];
+        const float scale = NumBins / (cbox.max[axis] - lo);
+        mid = int(std::partition(m_prims.begin() + begin, m_prims.begin() + end,
+                                 [&](int prim) {
+                                     return std::min(NumBins - 1,
+                                                     int((centroids[prim][axis]
+                                                          - lo)
+                                                         * scale))
+                                            < best_bin;
+                                 })
+                  - m_prims.begin());
+    } else {
+        // All the centroids coincide: only split if the leaf is too big
+        if (n <= MaxLeafSize)
+            return index;
+        mid = begin + n / 2;
+    }
+
+    int left  = build_recursive(bnodes, bounds, centroids, begin, mid,
+                                depth + 1);
+    int right = build_recursive(bnodes, bounds, centroids, mid, end,
+                                depth + 1);
+    bnodes[index].left  = left;
+    bnodes[index].right = right;
+    return index;
+}
+
+
+
+int
+BVH::collapse(const std::vector<BuildNode>& bnodes, int b, int depth)
+{
+    m_depth = std::max(m_depth, depth);
+
+    // Gather up to four children by repeatedly opening the largest inner
+    // node among them.
+    int children[4];
+    int n = 0;
+    if (bnodes[b].leaf()) {
+        children[n++] = b;  // single leaf root
+    } else {
+        children[n++] = bnodes[b].left;
+        children[n++] = bnodes[b].right;
+    }
+    while (n < 4) {
+        int open        = -1;
+        float open_area = -1;
+        for (int i = 0; i < n; ++i) {
+            const BuildNode& c = bnodes[children[i]];
+            if (!c.leaf() && c.box.area() > open_area) {
+                open      = i;
+                open_area = c.box.area();
+            }
+        }
+        if (open < 0)
+            break;
+        int opened     = children[open];
+        children[open] = bnodes[opened].left;
+        children[n++]  = bnodes[opened].right;
+    }
+
+    const int index = int(m_nodes.size());
+    m_nodes.emplace_back();
+    float minx[4] = {}, miny[4] = {}, minz[4] = {};
+    float maxx[4] = {}, maxy[4] = {}, maxz[4] = {};
+    for (int i = 0; i < n; ++i) {
+        const BuildNode& c = bnodes[children[i]];
+        minx[i]            = c.box.min.x;
+        miny[i]            = c.box.min.y;
+        minz[i]            = c.box.min.z;
+        maxx[i]            = c.box.max.x;
+        maxy[i]            = c.box.max.y;
+        maxz[i]            = c.box.max.z;
+        int child, count;
+        if (c.leaf()) {
+            child = c.begin;
+            count = c.end - c.begin;
+        } else {
+            // may grow m_nodes
+            child = collapse(bnodes, children[i], depth + 1);
+            count = 0;
+        }
+        m_nodes[index].child[i] = child;
+        m_nodes[index].count[i] = count;
+    }
+    Node& node = m_nodes[index];
+    node.minx.load(minx);
+    node.miny.load(miny);
+    node.minz.load(minz);
+    node.maxx.load(maxx);
+    node.maxy.load(maxy);
+    node.maxz.load(maxz);
+    node.nchildren = n;
+    return index;
+}
+
+OSL_NAMESPACE_EXIT
@@ -0,0 +1,170 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <OpenImageIO/simd.h>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_ENTER
+
+// Axis aligned bounding box
+struct BBox {
+    Vec3 min { std::numeric_limits<float>::max(),
+               std::numeric_limits<float>::max(),
+               std::numeric_limits<float>::max() };
+    Vec3 max { -std::numeric_limits<float>::max(),
+               -std::numeric_limits<float>::max(),
+               -std::numeric_limits<float>::max() };
+
+    BBox() {}
+    BBox(const Vec3& min, const Vec3& max) : min(min), max(max) {}
+
+    void extend(const Vec3& p)
+    {
+        min = Vec3(std::min(min.x, p.x), std::min(min.y, p.y),
+                   std::min(min.z, p.z));
+        max = Vec3(std::max(max.x, p.x), std::max(max.y, p.y),
+                   std::max(max.z, p.z));
+    }
+    void extend(const BBox& b)
+    {
+        extend(b.min);
+        extend(b.max);
+    }
+
+    bool empty() const { return min.x > max.x; }
+    Vec3 center() const { return (min + max) * 0.5f; }
+    float area() const
+    {
+        if (empty())
+            return 0;
+        Vec3 d = max - min;
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+
+
+
+// Bounding volume hierarchy used by the CPU renderer to find the
+// primitives a ray may hit.
+//
+// The tree is built top down with binned SAH splits, then collapsed so that
+// every node holds the boxes of up to four children, stored so that the ray
+// can be tested against all of them at once with 4-wide SIMD. Nodes are laid
+// out in one array in depth first order.
+class BVH {
+public:
+    // Build over the given primitive bounds; primitive IDs are the indices
+    // into `bounds`.
+    void build(const std::vector<BBox>& bounds);
+
+    bool empty() const { return m_nodes.empty(); }
+
+    // Visit the primitives in every leaf the ray from `org` along `dir`
+    // reaches in [0,tmax], roughly front to back, by calling
+    // hit(primID, tmax). The callback may shorten `tmax` when it finds a
+    // hit, which prunes the rest of the traversal.
+    template<typename F>
+    void intersect(const Vec3& org, const Vec3& dir, float tmax, F&& hit) const
+    {
+        using OIIO::simd::vfloat4;
+        if (m_nodes.empty())
+            return;
+
+        // Avoid 0 * inf when the ray is parallel to a slab
+        auto safe_inv = [](float d) {
+            const float eps = 1e-20f;
+            return 1.0f / (fabsf(d) > eps ? d : (d < 0 ? -eps : eps));
+        };
+        const vfloat4 ox(org.x), oy(org.y), oz(org.z);
+        const vfloat4 ix(safe_inv(dir.x)), iy(safe_inv(dir.y)),
+            iz(safe_inv(dir.z));
+
+        struct Entry {
+            int node;
+            float tnear;
+        };
+        Entry stack[StackSize];
+        int top      = 0;
+        stack[top++] = { 0, 0.0f };
+        while (top) {
+            const Entry e = stack[--top];
+            if (e.tnear > tmax)
+                continue;  // a closer hit was found since it was pushed
+            const Node& node = m_nodes[e.node];
+
+            vfloat4 tx0 = (node.minx - ox) * ix, tx1 = (node.maxx - ox) * ix;
+            vfloat4 ty0 = (node.miny - oy) * iy, ty1 = (node.maxy - oy) * iy;
+            vfloat4 tz0 = (node.minz - oz) * iz, tz1 = (node.maxz - oz) * iz;
+            vfloat4 tnear = max(max(min(tx0, tx1), min(ty0, ty1)),
+                                max(min(tz0, tz1), vfloat4::Zero()));
+            vfloat4 tfar  = min(min(max(tx0, tx1), max(ty0, ty1)),
+                                min(max(tz0, tz1), vfloat4(tmax)));
+            int mask = (tnear <= tfar).bitmask() & ((1 << node.nchildren) - 1);
+            if (!mask)
+                continue;
+
+            // Leaves are intersected right away, inner nodes are pushed so
+            // that the nearest gets popped first.
+            Entry inner[4];
+            int ninner = 0;
+            for (int i = 0; i < node.nchildren; ++i) {
+                if (!(mask & (1 << i)))
+                    continue;
+                if (node.count[i]) {
+                    for (int p = 0; p < node.count[i]; ++p)
+                        hit(m_prims[node.child[i] + p], tmax);
+                } else {
+                    Entry c { node.child[i], tnear[i] };
+                    int j = ninner++;
+                    for (; j > 0 && inner[j - 1].tnear < c.tnear; --j)
+                        inner[j] = inner[j - 1];
+                    inner[j] = c;
+                }
+            }
+            OSL_DASSERT(top + ninner <= StackSize);
+            for (int i = 0; i < ninner; ++i)
+                stack[top++] = inner[i];
+        }
+    }
+
+private:
+    // Every node popped during traversal pushes at most 4 children, so a
+    // tree of depth d never needs more than 3 * d + 1 stack entries. The
+    // build stops splitting at MaxDepth, so the binary tree has at most
+    // MaxDepth + 1 levels and the collapsed one no more; build() checks
+    // the actual depth against StackSize.
+    enum {
+        MaxLeafSize = 4,
+        MaxDepth    = 64,
+        StackSize   = 3 * (MaxDepth + 1) + 1
+    };
+
+    struct Node {
+        // Bounds of the children, one per SIMD lane
+        OIIO::simd::vfloat4 minx, miny, minz, maxx, maxy, maxz;
+        int child[4];  // Inner child: node index. Leaf: first of m_prims.
+        int count[4];  // Leaf: number of primitives. Inner child: 0.
+        int nchildren;
+    };
+
+    struct BuildNode;
+    int build_recursive(std::vector<BuildNode>& bnodes,
+                        const std::vector<BBox>& bounds,
+                        const std::vector<Vec3>& centroids, int begin,
+                        int end, int depth);
+    int collapse(const std::vector<BuildNode>& bnodes, int b, int depth);
+
+    std::vector<Node> m_nodes;
+    int m_depth = 0;  // Levels of m_nodes, which bound the traversal stack
+    std::vector<int> m_prims;  // Primitive IDs, grouped by leaf
+};
+
+OSL_NAMESPACE_EXIT
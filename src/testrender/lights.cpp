@@ -0,0 +1,250 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include "lights.h"
+
+
+OSL_NAMESPACE_ENTER
+
+// Largest float below 1, to keep remapped random numbers in [0,1)
+static const float OneMinusEpsilon = 0.99999994f;
+
+
+
+void
+LightSampler::build(Mode mode, int nprims, const std::vector<int>& prims,
+                    const std::vector<BBox>& bounds, std::vector<float> power)
+{
+    m_mode  = mode;
+    m_prims = prims;
+    m_light.assign(nprims, -1);
+    for (int i = 0, n = size(); i < n; ++i)
+        m_light[prims[i]] = i;
+    m_power.clear();
+    m_alias_q.clear();
+    m_alias.clear();
+    m_nodes.clear();
+    m_leaf.clear();
+    if (mode == ALL || prims.empty())
+        return;
+
+    // Lights whose power couldn't be estimated get the average of the
+    // others, so that they still get sampled.
+    double total = 0;
+    int known    = 0;
+    for (float p : power) {
+        if (p > 0) {
+            total += p;
+            known++;
+        }
+    }
+    const float average = known ? float(total / known) : 1.0f;
+    for (float& p : power) {
+        if (!(p > 0)) {
+            p = average;
+            total += p;
+        }
+    }
+    for (float& p : power)
+        p = float(p / total);
+    m_power = std::move(power);
+
+    const int n = size();
+    if (mode == POWER) {
+        // Vose's alias method: every entry keeps its own light with
+        // probability q, and otherwise gives way to its alias, which is
+        // one of the lights that have more than their share.
+        m_alias_q.resize(n);
+        m_alias.resize(n);
+        std::vector<float> scaled(n);
+        std::vector<int> small, large;
+        for (int i = 0; i < n; ++i) {
+            scaled[i] = m_power[i] * n;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back();
+            int l = large.back();
+            small.pop_back();
+            m_alias_q[s] = scaled[s];
+            m_alias[s]   = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // Whatever is left is only off by rounding
+        for (int i : large) {
+            m_alias_q[i] = 1;
+            m_alias[i]   = i;
+        }
+        for (int i : small) {
+            m_alias_q[i] = 1;
+            m_alias[i]   = i;
+        }
+    } else {
+        std::vector<Vec3> centroids(n);
+        std::vector<int> order(n);
+        for (int i = 0; i < n; ++i) {
+            centroids[i] = bounds[i].center();
+            order[i]     = i;
+        }
+        m_leaf.resize(n);
+        m_nodes.reserve(2 * n - 1);
+        build_tree(order, bounds, centroids, 0, n, -1);
+    }
+}
+
+
+
+int
+LightSampler::build_tree(std::vector<int>& order,
+                         const std::vector<BBox>& bounds,
+                         const std::vector<Vec3>& centroids, int begin, int end,
+                         int parent)
+{
+    const int index = int(m_nodes.size());
+    m_nodes.emplace_back();
+    Node node;
+    node.power    = 0;
+    node.child[0] = node.child[1] = -1;
+    node.parent   = parent;
+    BBox cbox;
+    for (int i = begin; i < end; ++i) {
+        node.bounds.extend(bounds[order[i]]);
+        node.power += m_power[order[i]];
+        cbox.extend(centroids[order[i]]);
+    }
+    if (end - begin == 1) {
+        node.child[0]        = order[begin];
+        m_leaf[order[begin]] = index;
+        m_nodes[index]       = node;
+        return index;
+    }
+
+    // Split at the median along the longest axis of the centroids, which
+    // keeps the tree balanced.
+    Vec3 extent = cbox.max - cbox.min;
+    int axis    = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                      : (extent.y > extent.z ? 1 : 2);
+    int mid     = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid,
+                     order.begin() + end, [&](int a, int b) {
+                         return centroids[a][axis] < centroids[b][axis];
+                     });
+    node.child[0]  = build_tree(order, bounds, centroids, begin, mid, index);
+    node.child[1]  = build_tree(order, bounds, centroids, mid, end, index);
+    m_nodes[index] = node;
+    return index;
+}
+
+
+
+float
+LightSampler::Node::importance(const Vec3& x) const
+{
+    // Power over the squared distance to the center of the node, which
+    // can't get closer than the radius of the sphere around its bounds.
+    float r2 = 0.25f * (bounds.max - bounds.min).length2();
+    float d2 = (x - bounds.center()).length2();
+    return power / std::max(std::max(d2, r2), 1e-20f);
+}
+
+
+
+float
+LightSampler::left_probability(const Node& node, const Vec3& x) const
+{
+    float l = m_nodes[node.child[0]].importance(x);
+    float r = m_nodes[node.child[1]].importance(x);
+    float p = l / (l + r);
+    return p >= 0 && p <= 1 ? p : 0.5f;  // both negligible, or infinite
+}
+
+
+
+int
+LightSampler::pick_power(float& u, float& pdf) const
+{
+    const int n   = size();
+    float f       = u * n;
+    int i         = std::min(int(f), n - 1);
+    f             = std::min(f - i, OneMinusEpsilon);
+    const float q = m_alias_q[i];
+    if (f < q) {
+        u = f / q;
+    } else {
+        u = (f - q) / (1 - q);
+        i = m_alias[i];
+    }
+    u   = std::min(u, OneMinusEpsilon);
+    pdf = m_power[i];
+    return m_prims[i];
+}
+
+
+
+int
+LightSampler::pick_tree(const Vec3& x, float& u, float& pdf) const
+{
+    pdf   = 1;
+    int n = 0;
+    while (!m_nodes[n].leaf()) {
+        const Node& node = m_nodes[n];
+        float p          = left_probability(node, x);
+        if (u < p) {
+            u = u / p;
+            n = node.child[0];
+        } else {
+            u = (u - p) / (1 - p);
+            p = 1 - p;
+            n = node.child[1];
+        }
+        u = std::min(u, OneMinusEpsilon);
+        pdf *= p;
+    }
+    return m_prims[m_nodes[n].child[0]];
+}
+
+
+
+int
+LightSampler::pick(int i, const Vec3& x, float& u, float& pdf) const
+{
+    switch (m_mode) {
+    case POWER: return pick_power(u, pdf);
+    case TREE: return pick_tree(x, u, pdf);
+    default:
+        pdf = 1;
+        return m_prims[i];
+    }
+}
+
+
+
+float
+LightSampler::pdf(const Vec3& x, int primID) const
+{
+    const int light = index(primID);
+    if (light < 0)
+        return 0;
+    switch (m_mode) {
+    case POWER: return m_power[light];
+    case TREE: {
+        // The product of the choices on the way from the root to the leaf
+        float prob = 1;
+        for (int n = m_leaf[light]; m_nodes[n].parent >= 0;) {
+            const Node& parent = m_nodes[m_nodes[n].parent];
+            float p            = left_probability(parent, x);
+            prob *= parent.child[0] == n ? p : 1 - p;
+            n = m_nodes[n].parent;
+        }
+        return prob;
+    }
+    default: return 1;
+    }
+}
+
+OSL_NAMESPACE_EXIT
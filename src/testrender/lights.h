@@ -0,0 +1,91 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+#include "bvh.h"
+
+OSL_NAMESPACE_ENTER
+
+// The lights of a scene, and how the CPU renderer picks the ones to sample
+// at a shading point.
+//
+// In ALL mode every light gets a shadow ray at every shading point. The
+// other modes pick a single light, with a probability that is returned
+// along with it so the sample can be weighted by it:
+//   - POWER picks lights in proportion to their estimated power, in
+//     constant time, with an alias table.
+//   - TREE walks a binary tree of the lights from the root, choosing a
+//     child by how much light it may send to the shading point (its power
+//     over its squared distance), so that nearby bright lights are favored
+//     at a cost logarithmic in the number of lights.
+class LightSampler {
+public:
+    enum Mode { ALL = 0, POWER = 1, TREE = 2 };
+
+    // Build over the lights on the given primitives, with their bounds and
+    // power. Primitive IDs must be below `nprims`.
+    void build(Mode mode, int nprims, const std::vector<int>& prims,
+               const std::vector<BBox>& bounds, std::vector<float> power);
+
+    Mode mode() const { return m_mode; }
+    int size() const { return int(m_prims.size()); }
+
+    // Index of the light on a primitive, or -1 if it isn't one
+    int index(int primID) const
+    {
+        return primID >= 0 && primID < int(m_light.size()) ? m_light[primID]
+                                                             : -1;
+    }
+
+    // Number of lights to sample at each shading point
+    int samples() const
+    {
+        return m_mode == ALL ? size() : std::min(size(), 1);
+    }
+
+    // Primitive ID of the i-th of the samples() lights to take at `x`. The
+    // random number `u` picks it (when a choice is made) and is then
+    // remapped to [0,1), so it can be used again to sample the light.
+    // `pdf` is the probability the light was picked with.
+    int pick(int i, const Vec3& x, float& u, float& pdf) const;
+
+    // Probability that pick() chooses the light on this primitive at `x`
+    // (0 if the primitive isn't a light).
+    float pdf(const Vec3& x, int primID) const;
+
+private:
+    int pick_power(float& u, float& pdf) const;
+    int pick_tree(const Vec3& x, float& u, float& pdf) const;
+
+    struct Node {
+        BBox bounds;
+        float power;
+        int child[2];  // Inner node: children. Leaf: child[0] is the light.
+        int parent;
+        bool leaf() const { return child[1] < 0; }
+        // How much light the node may send to x
+        float importance(const Vec3& x) const;
+    };
+    int build_tree(std::vector<int>& order, const std::vector<BBox>& bounds,
+                   const std::vector<Vec3>& centroids, int begin, int end,
+                   int parent);
+    // Probability of going to the first child of an inner node from x
+    float left_probability(const Node& node, const Vec3& x) const;
+
+    Mode m_mode = ALL;
+    std::vector<int> m_prims;      // Primitive of each light
+    std::vector<int> m_light;      // Light index of each primitive, or -1
+    std::vector<float> m_power;    // Normalized to sum to 1 (POWER)
+    std::vector<float> m_alias_q;  // Alias table: keep probability
+    std::vector<int> m_alias;      // Alias table: the other light
+    std::vector<Node> m_nodes;     // TREE: root first
+    std::vector<int> m_leaf;       // TREE: leaf node of each light
+};
+
+OSL_NAMESPACE_EXIT
@@ -0,0 +1,565 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/fmath.h>
+#include <OpenImageIO/strutil.h>
+
+#include <OSL/fmt_util.h>
+
+#include "mesh.h"
+
+using OIIO::Strutil::parse_float;
+using OIIO::Strutil::parse_int;
+
+
+OSL_NAMESPACE_ENTER
+
+namespace {
+
+// Split off the next line of `text` (without its line ending)
+string_view
+next_line(string_view& text)
+{
+    size_t eol       = text.find('\n');
+    string_view line = text.substr(0, eol);
+    text = eol == string_view::npos ? string_view() : text.substr(eol + 1);
+    if (line.size() && line.back() == '\r')
+        line.remove_suffix(1);
+    return line;
+}
+
+
+
+// Parse one OBJ face corner "v", "v/vt", "v//vn" or "v/vt/vn". Missing
+// indices are set to 0. Indices are 1-based, negative ones are relative to
+// the end of the list so far.
+bool
+parse_obj_corner(string_view& line, int c[3])
+{
+    c[0] = c[1] = c[2] = 0;
+    if (!parse_int(line, c[0]))
+        return false;
+    for (int i = 1; i < 3 && line.size() && line[0] == '/'; ++i) {
+        line.remove_prefix(1);
+        if (line.size() && line[0] != '/' && !parse_int(line, c[i]))
+            return false;
+    }
+    return true;
+}
+
+
+
+// Convert an OBJ index to a 0-based one, or -1 if it is out of range
+int
+obj_index(int i, size_t n)
+{
+    if (i < 0)
+        i += int(n);
+    else
+        i -= 1;
+    return (i >= 0 && i < int(n)) ? i : -1;
+}
+
+}  // namespace
+
+
+
+bool
+TriangleMesh::load(const std::string& filename, std::string& err)
+{
+    std::string ext = OIIO::Strutil::lower(
+        OIIO::Filesystem::extension(filename));
+    bool ok;
+    if (ext == ".obj")
+        ok = load_obj(filename, err);
+    else if (ext == ".ply")
+        ok = load_ply(filename, err);
+    else {
+        err = fmtformat("Unknown mesh file format \"{}\"", filename);
+        return false;
+    }
+    return ok && validate(err);
+}
+
+
+
+bool
+TriangleMesh::load_obj(const std::string& filename, std::string& err)
+{
+    std::string contents;
+    if (!OIIO::Filesystem::read_text_file(filename, contents)) {
+        err = fmtformat("Could not read \"{}\"", filename);
+        return false;
+    }
+
+    std::vector<Vec3> colors;  // nonstandard "v x y z r g b"
+    int has_uv = -1, has_N = -1;
+    string_view text(contents);
+    for (int lineno = 1; text.size(); ++lineno) {
+        string_view line = next_line(text);
+        OIIO::Strutil::skip_whitespace(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+        string_view cmd = OIIO::Strutil::parse_until(line, " \t");
+        if (cmd == "v") {
+            Vec3 p, c;
+            if (!parse_float(line, p.x) || !parse_float(line, p.y)
+                || !parse_float(line, p.z)) {
+                err = fmtformat("{}:{}: malformed vertex", filename, lineno);
+                return false;
+            }
+            P.push_back(p);
+            if (parse_float(line, c.x) && parse_float(line, c.y)
+                && parse_float(line, c.z))
+                colors.push_back(c);
+        } else if (cmd == "vn") {
+            Vec3 n;
+            if (!parse_float(line, n.x) || !parse_float(line, n.y)
+                || !parse_float(line, n.z)) {
+                err = fmtformat("{}:{}: malformed normal", filename, lineno);
+                return false;
+            }
+            N.push_back(n);
+        } else if (cmd == "vt") {
+            Vec2 t(0.0f, 0.0f);
+            if (!parse_float(line, t.x)) {
+                err = fmtformat("{}:{}: malformed uv", filename, lineno);
+                return false;
+            }
+            parse_float(line, t.y);
+            uv.push_back(t);
+        } else if (cmd == "f") {
+            // Triangulate polygons as fans around their first corner
+            int first[3], prev[3], c[3], n = 0;
+            while (parse_obj_corner(line, c)) {
+                int v  = obj_index(c[0], P.size());
+                int vt = c[1] ? obj_index(c[1], uv.size()) : -2;
+                int vn = c[2] ? obj_index(c[2], N.size()) : -2;
+                if (v < 0 || vt == -1 || vn == -1) {
+                    err = fmtformat("{}:{}: face index out of range",
+                                    filename, lineno);
+                    return false;
+                }
+                if (has_uv < 0) {
+                    has_uv = vt >= 0;
+                    has_N  = vn >= 0;
+                }
+                if (has_uv != (vt >= 0) || has_N != (vn >= 0)) {
+                    err = fmtformat("{}:{}: faces must all have uvs and "
+                                    "normals, or not",
+                                    filename, lineno);
+                    return false;
+                }
+                int corner[3] = { v, vt, vn };
+                if (n == 0)
+                    std::copy(corner, corner + 3, first);
+                if (n >= 2) {
+                    for (const int* t : { first, prev, corner }) {
+                        P_index.push_back(t[0]);
+                        if (has_uv)
+                            uv_index.push_back(t[1]);
+                        if (has_N)
+                            N_index.push_back(t[2]);
+                    }
+                }
+                std::copy(corner, corner + 3, prev);
+                ++n;
+            }
+            if (n < 3) {
+                err = fmtformat("{}:{}: malformed face", filename, lineno);
+                return false;
+            }
+        }
+        // Anything else (groups, materials, ...) is ignored
+    }
+
+    if (!colors.empty() && colors.size() == P.size()) {
+        Attribute Cs { ustring("Cs"), TypeColor, {} };
+        Cs.data.reserve(3 * colors.size());
+        for (auto& c : colors)
+            Cs.data.insert(Cs.data.end(), { c.x, c.y, c.z });
+        attributes.push_back(std::move(Cs));
+    }
+    return true;
+}
+
+
+
+namespace {
+
+// Size in bytes of a binary value of the named PLY type, or 0 if the type
+// is unknown
+size_t
+ply_type_size(string_view type)
+{
+    if (type == "char" || type == "int8" || type == "uchar" || type == "uint8")
+        return 1;
+    if (type == "short" || type == "int16" || type == "ushort"
+        || type == "uint16")
+        return 2;
+    if (type == "int" || type == "int32" || type == "uint" || type == "uint32"
+        || type == "float" || type == "float32")
+        return 4;
+    if (type == "double" || type == "float64")
+        return 8;
+    return 0;
+}
+
+
+
+// Reads the values of a PLY file body, in any of its three encodings
+class PlyReader {
+public:
+    enum Format { Ascii, BinaryLE, BinaryBE };
+
+    PlyReader(string_view body, Format format) : m_body(body), m_format(format)
+    {
+    }
+
+    // The fewest bytes a value of the named type takes in the body (in
+    // ascii, a digit and a separator)
+    size_t min_size(string_view type) const
+    {
+        return m_format == Ascii ? 2 : ply_type_size(type);
+    }
+
+    // Could the rest of the body hold `count` values of `size` bytes?
+    bool can_hold(size_t count, size_t size) const
+    {
+        // Allow for a missing separator after the last ascii value
+        size_t avail = m_body.size() + (m_format == Ascii ? 1 : 0);
+        return size == 0 || count <= avail / size;
+    }
+
+    // Read one value of the named PLY type as a double
+    bool read(string_view type, double& val)
+    {
+        if (m_format == Ascii) {
+            OIIO::Strutil::skip_whitespace(m_body);
+            string_view word = OIIO::Strutil::parse_until(m_body, " \t\r\n");
+            if (word.empty())
+                return false;
+            val = OIIO::Strutil::stod(word);
+            return true;
+        }
+        if (type == "char" || type == "int8")
+            return read_binary<int8_t>(val);
+        if (type == "uchar" || type == "uint8")
+            return read_binary<uint8_t>(val);
+        if (type == "short" || type == "int16")
+            return read_binary<int16_t>(val);
+        if (type == "ushort" || type == "uint16")
+            return read_binary<uint16_t>(val);
+        if (type == "int" || type == "int32")
+            return read_binary<int32_t>(val);
+        if (type == "uint" || type == "uint32")
+            return read_binary<uint32_t>(val);
+        if (type == "float" || type == "float32")
+            return read_binary<float>(val);
+        if (type == "double" || type == "float64")
+            return read_binary<double>(val);
+        return false;
+    }
+
+private:
+    template<typename T> bool read_binary(double& val)
+    {
+        if (m_body.size() < sizeof(T))
+            return false;
+        char bytes[sizeof(T)];
+        memcpy(bytes, m_body.data(), sizeof(T));
+        m_body.remove_prefix(sizeof(T));
+        if ((m_format == BinaryBE) == OIIO::littleendian())
+            std::reverse(bytes, bytes + sizeof(T));
+        T v;
+        memcpy(&v, bytes, sizeof(T));
+        val = double(v);
+        return true;
+    }
+
+    string_view m_body;
+    Format m_format;
+};
+
+
+
+struct PlyProperty {
+    std::string name;
+    std::string type;        // value type
+    std::string count_type;  // nonempty for lists: type of the length
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+};
+
+// Whether a PLY value (read as a double, so it may be anything, NaN
+// included) can be converted to an int index or count
+bool
+ply_int_ok(double v)
+{
+    return v >= 0.0 && v <= double(std::numeric_limits<int>::max());
+}
+
+}  // namespace
+
+
+
+bool
+TriangleMesh::load_ply(const std::string& filename, std::string& err)
+{
+    std::string contents;
+    {
+        OIIO::ifstream in;
+        OIIO::Filesystem::open(in, filename, std::ios::in | std::ios::binary);
+        if (!in) {
+            err = fmtformat("Could not read \"{}\"", filename);
+            return false;
+        }
+        contents.assign(std::istreambuf_iterator<char>(in),
+                        std::istreambuf_iterator<char>());
+    }
+
+    // Header
+    string_view text(contents);
+    if (next_line(text) != "ply") {
+        err = fmtformat("\"{}\" is not a PLY file", filename);
+        return false;
+    }
+    PlyReader::Format format = PlyReader::Ascii;
+    std::vector<PlyElement> elements;
+    for (;;) {
+        if (text.empty()) {
+            err = fmtformat("{}: missing end_header", filename);
+            return false;
+        }
+        string_view line = next_line(text);
+        auto words       = OIIO::Strutil::splitsv(line);
+        if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+            continue;
+        if (words[0] == "end_header")
+            break;
+        if (words[0] == "format" && words.size() >= 2) {
+            if (words[1] == "ascii")
+                format = PlyReader::Ascii;
+            else if (words[1] == "binary_little_endian")
+                format = PlyReader::BinaryLE;
+            else if (words[1] == "binary_big_endian")
+                format = PlyReader::BinaryBE;
+            else {
+                err = fmtformat("{}: unknown format \"{}\"", filename,
+                                words[1]);
+                return false;
+            }
+        } else if (words[0] == "element" && words.size() == 3) {
+            PlyElement e;
+            e.name  = words[1];
+            e.count = size_t(
+                std::strtoull(std::string(words[2]).c_str(), nullptr, 10));
+            elements.push_back(e);
+        } else if (words[0] == "property" && !elements.empty()) {
+            PlyProperty p;
+            if (words.size() == 5 && words[1] == "list") {
+                p.count_type = words[2];
+                p.type       = words[3];
+                p.name       = words[4];
+            } else if (words.size() == 3) {
+                p.type = words[1];
+                p.name = words[2];
+            } else {
+                err = fmtformat("{}: malformed property \"{}\"", filename,
+                                line);
+                return false;
+            }
+            if (!ply_type_size(p.type)
+                || (p.count_type.size() && !ply_type_size(p.count_type))) {
+                err = fmtformat("{}: unknown property type in \"{}\"",
+                                filename, line);
+                return false;
+            }
+            elements.back().properties.push_back(p);
+        } else {
+            err = fmtformat("{}: unexpected header line \"{}\"", filename,
+                            line);
+            return false;
+        }
+    }
+
+    // Body
+    PlyReader reader(text, format);
+    std::vector<double> vals;
+    for (auto& e : elements) {
+        bool is_vertex = e.name == "vertex";
+        bool is_face   = e.name == "face";
+
+        // Refuse counts that the rest of the file can't possibly hold,
+        // before reserving any memory for them
+        size_t item_size = 0;
+        for (auto& prop : e.properties)
+            item_size += reader.min_size(prop.count_type.size()
+                                             ? prop.count_type
+                                             : prop.type);
+        if (!reader.can_hold(e.count, item_size)) {
+            err = fmtformat("{}: {} count {} exceeds the size of the file",
+                            filename, e.name, e.count);
+            return false;
+        }
+
+        // Where each vertex property goes: P/N/uv components, colors, or
+        // a float attribute of its own.
+        enum { Skip, Px, Py, Pz, Nx, Ny, Nz, U, V, R, G, B, Attr };
+        std::vector<int> dest(e.properties.size(), Skip);
+        std::vector<int> attr_of(e.properties.size(), -1);
+        std::vector<float> color_scale(e.properties.size(), 1.0f);
+        bool has_N = false, has_uv = false, has_color = false;
+        if (is_vertex) {
+            P.reserve(e.count);
+            for (size_t i = 0; i < e.properties.size(); ++i) {
+                const PlyProperty& p = e.properties[i];
+                const std::string& n = p.name;
+                if (!p.count_type.empty())
+                    continue;
+                if (n == "x" || n == "y" || n == "z")
+                    dest[i] = Px + (n[0] - 'x');
+                else if (n == "nx" || n == "ny" || n == "nz")
+                    dest[i] = Nx + (n[1] - 'x');
+                else if (n == "u" || n == "s" || n == "texture_u")
+                    dest[i] = U;
+                else if (n == "v" || n == "t" || n == "texture_v")
+                    dest[i] = V;
+                else if (n == "red" || n == "green" || n == "blue") {
+                    dest[i] = n == "red" ? R : (n == "green" ? G : B);
+                    if (p.type == "uchar" || p.type == "uint8")
+                        color_scale[i] = 1.0f / 255.0f;
+                } else {
+                    dest[i]    = Attr;
+                    attr_of[i] = int(attributes.size());
+                    attributes.push_back({ ustring(n), TypeFloat, {} });
+                }
+                has_N |= (dest[i] >= Nx && dest[i] <= Nz);
+                has_uv |= (dest[i] == U || dest[i] == V);
+                has_color |= (dest[i] >= R && dest[i] <= B);
+            }
+            if (has_color)
+                attributes.push_back({ ustring("Cs"), TypeColor, {} });
+        }
+        const int color_attr = has_color ? int(attributes.size()) - 1 : -1;
+
+        for (size_t item = 0; item < e.count; ++item) {
+            Vec3 p(0.0f), n(0.0f), c(0.0f);
+            Vec2 t(0.0f, 0.0f);
+            for (size_t i = 0; i < e.properties.size(); ++i) {
+                const PlyProperty& prop = e.properties[i];
+                size_t count            = 1;
+                if (!prop.count_type.empty()) {
+                    double len;
+                    if (!reader.read(prop.count_type, len) || !ply_int_ok(len)
+                        || !reader.can_hold(size_t(len),
+                                            reader.min_size(prop.type))) {
+                        err = fmtformat("{}: truncated or malformed data",
+                                        filename);
+                        return false;
+                    }
+                    count = size_t(len);
+                }
+                vals.resize(count);
+                for (size_t k = 0; k < count; ++k) {
+                    if (!reader.read(prop.type, vals[k])) {
+                        err = fmtformat("{}: truncated or malformed data",
+                                        filename);
+                        return false;
+                    }
+                }
+                if (is_face && !prop.count_type.empty()
+                    && (prop.name == "vertex_indices"
+                        || prop.name == "vertex_index")) {
+                    for (size_t k = 0; k < count; ++k) {
+                        if (!ply_int_ok(vals[k])) {
+                            err = fmtformat("{}: face index out of range",
+                                            filename);
+                            return false;
+                        }
+                    }
+                    for (size_t k = 2; k < count; ++k)
+                        P_index.insert(P_index.end(),
+                                       { int(vals[0]), int(vals[k - 1]),
+                                         int(vals[k]) });
+                    continue;
+                }
+                if (!is_vertex || !prop.count_type.empty())
+                    continue;
+                // Out of range doubles don't convert to float, so clamp
+                const double fmax = std::numeric_limits<float>::max();
+                float v           = float(OIIO::clamp(vals[0], -fmax, fmax));
+                switch (dest[i]) {
+                case Px: p.x = v; break;
+                case Py: p.y = v; break;
+                case Pz: p.z = v; break;
+                case Nx: n.x = v; break;
+                case Ny: n.y = v; break;
+                case Nz: n.z = v; break;
+                case U: t.x = v; break;
+                case V: t.y = v; break;
+                case R: c.x = v * color_scale[i]; break;
+                case G: c.y = v * color_scale[i]; break;
+                case B: c.z = v * color_scale[i]; break;
+                case Attr: attributes[attr_of[i]].data.push_back(v); break;
+                default: break;
+                }
+            }
+            if (is_vertex) {
+                P.push_back(p);
+                if (has_N)
+                    N.push_back(n);
+                if (has_uv)
+                    uv.push_back(t);
+                if (has_color)
+                    attributes[color_attr].data.insert(
+                        attributes[color_attr].data.end(), { c.x, c.y, c.z });
+            }
+        }
+    }
+
+    // PLY attributes are all per vertex
+    if (!N.empty())
+        N_index = P_index;
+    if (!uv.empty())
+        uv_index = P_index;
+    return true;
+}
+
+
+
+bool
+TriangleMesh::validate(std::string& err) const
+{
+    if (P_index.empty()) {
+        err = "mesh has no triangles";
+        return false;
+    }
+    for (int i : P_index)
+        if (i < 0 || i >= int(P.size())) {
+            err = "mesh has out of range vertex indices";
+            return false;
+        }
+    for (auto& a : attributes)
+        if (a.data.size() != P.size() * a.nfloats()) {
+            err = fmtformat("mesh attribute \"{}\" has the wrong size",
+                            a.name.c_str());
+            return false;
+        }
+    return true;
+}
+
+OSL_NAMESPACE_EXIT
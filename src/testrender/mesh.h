@@ -0,0 +1,58 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+
+OSL_NAMESPACE_ENTER
+
+// Triangle mesh geometry, as read from an OBJ or PLY file.
+//
+// Positions, normals and uvs each have their own index lists (three per
+// triangle) as in OBJ. Normals and uvs are optional: their index lists are
+// empty if the file didn't have them. Any other per-vertex data (vertex
+// colors, or extra PLY vertex properties) is kept as named attributes,
+// indexed like the positions, and is available to shaders as userdata.
+struct TriangleMesh {
+    struct Attribute {
+        ustring name;
+        TypeDesc type;  // TypeFloat or TypeColor
+        std::vector<float> data;
+        int nfloats() const { return int(type.aggregate); }
+    };
+
+    std::vector<Vec3> P;
+    std::vector<Vec3> N;
+    std::vector<Vec2> uv;
+    std::vector<int> P_index;
+    std::vector<int> N_index;
+    std::vector<int> uv_index;
+    std::vector<Attribute> attributes;
+
+    int num_triangles() const { return int(P_index.size() / 3); }
+
+    const Attribute* find_attribute(ustringhash name) const
+    {
+        for (auto& a : attributes)
+            if (a.name.hash() == name.hash())
+                return &a;
+        return nullptr;
+    }
+
+    // Read an .obj or .ply file (chosen by the file extension). Return
+    // false and set `err` if the file could not be read or is malformed.
+    bool load(const std::string& filename, std::string& err);
+
+private:
+    bool load_obj(const std::string& filename, std::string& err);
+    bool load_ply(const std::string& filename, std::string& err);
+    bool validate(std::string& err) const;
+};
+
+OSL_NAMESPACE_EXIT
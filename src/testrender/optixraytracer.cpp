@@ -795,6 +795,11 @@ OptixRaytracer::make_optix_materials()
 bool
 OptixRaytracer::finalize_scene()
 {
+    if (!scene.triangles.empty())
+        errhandler().warningfmt("Meshes are not supported with OptiX yet, "
+                                "ignoring {} triangles",
+                                scene.triangles.size());
+
     // Build acceleration structures
     OptixAccelBuildOptions accelOptions;
     OptixBuildInput buildInputs[2];
@@ -5,10 +5,13 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include <OpenImageIO/fmath.h>
 
+#include "bvh.h"
+#include "mesh.h"
 #include "optix_compat.h"
 #include "render_params.h"
 #include <OSL/dual_vec.h>
@@ -399,96 +402,337 @@ private:
 
 
 
+struct Triangle final : public Primitive {
+    Triangle(const TriangleMesh* mesh, int face, int shaderID, bool isLight)
+        : Primitive(shaderID, isLight), mesh(mesh), face(face)
+    {
+        p0  = vertex(0);
+        e1  = vertex(1) - p0;
+        e2  = vertex(2) - p0;
+        n   = e1.cross(e2);
+        a   = 0.5f * n.length();
+        n   = n.normalize();
+        d00 = e1.dot(e1);
+        d01 = e1.dot(e2);
+        d11 = e2.dot(e2);
+        float denom = d00 * d11 - d01 * d01;
+        invdenom    = denom != 0 ? 1 / denom : 0;
+    }
+
+    void getBounds(float& minx, float& miny, float& minz, float& maxx,
+                   float& maxy, float& maxz) const
+    {
+        const Vec3 p1 = p0 + e1;
+        const Vec3 p2 = p0 + e2;
+        minx          = std::min(p0.x, std::min(p1.x, p2.x));
+        miny          = std::min(p0.y, std::min(p1.y, p2.y));
+        minz          = std::min(p0.z, std::min(p1.z, p2.z));
+        maxx          = std::max(p0.x, std::max(p1.x, p2.x));
+        maxy          = std::max(p0.y, std::max(p1.y, p2.y));
+        maxz          = std::max(p0.z, std::max(p1.z, p2.z));
+    }
+
+    // returns distance to nearest hit or 0
+    Dual2<float> intersect(const Ray& r, bool self) const
+    {
+        if (self)
+            return 0;
+        // Moller-Trumbore
+        Vec3 pv   = r.direction.cross(e2);
+        float det = e1.dot(pv);
+        if (det == 0)
+            return 0;  // parallel
+        float invdet = 1 / det;
+        Vec3 tv      = r.origin - p0;
+        float u      = tv.dot(pv) * invdet;
+        if (u < 0 || u > 1)
+            return 0;
+        Vec3 qv = tv.cross(e1);
+        float v = r.direction.dot(qv) * invdet;
+        if (v < 0 || u + v > 1)
+            return 0;
+        float t = e2.dot(qv) * invdet;
+        return t > 0 ? t : 0;
+    }
+
+    float surfacearea() const { return a; }
+
+    Vec3 geometric_normal() const { return n; }
+
+    // Barycentric coordinates (of vertices 1 and 2) of a point on the plane
+    Dual2<Vec2> barycentrics(const Dual2<Vec3>& p) const
+    {
+        Dual2<Vec3> h    = p - p0;
+        Dual2<float> d20 = dot(h, e1);
+        Dual2<float> d21 = dot(h, e2);
+        Dual2<float> b1  = (d11 * d20 - d01 * d21) * invdenom;
+        Dual2<float> b2  = (d00 * d21 - d01 * d20) * invdenom;
+        return make_Vec2(b1, b2);
+    }
+
+    // Interpolate per-vertex values with barycentrics
+    template<typename T>
+    Dual2<T> interpolate(const Dual2<Vec2>& b, const T& v0, const T& v1,
+                         const T& v2) const
+    {
+        Dual2<float> b1(b.val().x, b.dx().x, b.dy().x);
+        Dual2<float> b2(b.val().y, b.dx().y, b.dy().y);
+        return (1.0f - b1 - b2) * v0 + b1 * v1 + b2 * v2;
+    }
+
+    Dual2<Vec3> normal(const Dual2<Vec3>& p) const
+    {
+        if (mesh->N_index.empty())
+            return Dual2<Vec3>(n, Vec3(0, 0, 0), Vec3(0, 0, 0));
+        const int* i = &mesh->N_index[3 * face];
+        return normalize(interpolate(barycentrics(p), mesh->N[i[0]],
+                                     mesh->N[i[1]], mesh->N[i[2]]));
+    }
+
+    Dual2<Vec2> uv(const Dual2<Vec3>& p, const Dual2<Vec3>& /*n*/, Vec3& dPdu,
+                   Vec3& dPdv) const
+    {
+        Dual2<Vec2> b = barycentrics(p);
+        if (mesh->uv_index.empty()) {
+            dPdu = e1;
+            dPdv = e2;
+            return b;
+        }
+        const int* i    = &mesh->uv_index[3 * face];
+        const Vec2& uv0 = mesh->uv[i[0]];
+        Vec2 duv1       = mesh->uv[i[1]] - uv0;
+        Vec2 duv2       = mesh->uv[i[2]] - uv0;
+        float det       = duv1.x * duv2.y - duv1.y * duv2.x;
+        if (det != 0) {
+            float invdet = 1 / det;
+            dPdu         = (e1 * duv2.y - e2 * duv1.y) * invdet;
+            dPdv         = (e2 * duv1.x - e1 * duv2.x) * invdet;
+        } else {
+            // degenerate uvs, any frame will do
+            ortho(n, dPdu, dPdv);
+        }
+        return interpolate(b, uv0, mesh->uv[i[1]], mesh->uv[i[2]]);
+    }
+
+    // Look up a per-vertex mesh attribute, interpolated at p, as userdata
+    bool attribute(ustringhash name, TypeDesc type, bool derivs,
+                   const Dual2<Vec3>& p, void* val) const
+    {
+        const TriangleMesh::Attribute* attr = mesh->find_attribute(name);
+        if (!attr)
+            return false;
+        const int nf = attr->nfloats();
+        if (type.basetype != TypeDesc::FLOAT || type.arraylen
+            || int(type.aggregate) != nf)
+            return false;
+        Dual2<Vec2> b  = barycentrics(p);
+        const int* i   = &mesh->P_index[3 * face];
+        float* out     = (float*)val;
+        for (int c = 0; c < nf; ++c) {
+            Dual2<float> v = interpolate(b, attr->data[i[0] * nf + c],
+                                         attr->data[i[1] * nf + c],
+                                         attr->data[i[2] * nf + c]);
+            out[c] = v.val();
+            if (derivs) {
+                out[nf + c]     = v.dx();
+                out[2 * nf + c] = v.dy();
+            }
+        }
+        return true;
+    }
+
+    // return a direction towards a point on the triangle
+    Vec3 sample(const Vec3& x, float xi, float yi, float& pdf) const
+    {
+        // uniform on the triangle area
+        float su = sqrtf(xi);
+        Vec3 l   = (p0 + e1 * (su * (1 - yi)) + e2 * (su * yi)) - x;
+        float d2 = l.length2();
+        Vec3 dir = l.normalize();
+        pdf      = d2 / (a * fabsf(dir.dot(n)));
+        return dir;
+    }
+
+    float shapepdf(const Vec3& x, const Vec3& p) const
+    {
+        Vec3 l   = p - x;
+        float d2 = l.length2();
+        Vec3 dir = l.normalize();
+        return d2 / (a * fabsf(dir.dot(n)));
+    }
+
+#if OSL_USE_OPTIX
+    virtual void setOptixVariables(void* /*data*/) const
+    {
+        // Meshes are only supported by the CPU renderer
+    }
+#endif
+
+private:
+    Vec3 vertex(int v) const { return mesh->P[mesh->P_index[3 * face + v]]; }
+
+    const TriangleMesh* mesh;
+    int face;
+    Vec3 p0, e1, e2, n;
+    float a, d00, d01, d11, invdenom;
+};
+
+
+
 struct Scene {
     void add_sphere(const Sphere& s) { spheres.push_back(s); }
 
     void add_quad(const Quad& q) { quads.push_back(q); }
 
-    int num_prims() const { return spheres.size() + quads.size(); }
+    // Add all the triangles of a mesh, which the scene takes over
+    void add_mesh(std::unique_ptr<TriangleMesh> mesh, int shaderID,
+                  bool isLight)
+    {
+        for (int f = 0, n = mesh->num_triangles(); f < n; f++)
+            triangles.emplace_back(mesh.get(), f, shaderID, isLight);
+        meshes.push_back(std::move(mesh));
+    }
+
+    int num_prims() const
+    {
+        return spheres.size() + quads.size() + triangles.size();
+    }
+
+    // Build the acceleration structure; call after all primitives are added.
+    void prepare()
+    {
+        std::vector<BBox> bounds(num_prims());
+        for (int i = 0, n = num_prims(); i < n; i++)
+            bounds[i] = this->bounds(i);
+        bvh.build(bounds);
+    }
+
+    BBox bounds(int primID) const
+    {
+        BBox b;
+        visit(primID, [&](const auto& prim) {
+            prim.getBounds(b.min.x, b.min.y, b.min.z, b.max.x, b.max.y,
+                           b.max.z);
+        });
+        return b;
+    }
 
     bool intersect(const Ray& r, Dual2<float>& t, int& primID) const
     {
-        const int ns   = spheres.size();
-        const int nq   = quads.size();
         const int self = primID;  // remember which object we started from
         t              = std::numeric_limits<float>::infinity();
         primID         = -1;  // reset ID
-        for (int i = 0; i < ns; i++) {
-            Dual2<float> d = spheres[i].intersect(r, self == i);
-            if (d.val() > 0 && d.val() < t.val()) {  // found valid hit?
-                t      = d;
-                primID = i;
-            }
+        // A ray leaving a triangle can hit its neighbors in the mesh right
+        // at its origin, from round off, so ignore hits that close (relative
+        // to the magnitude of the origin).
+        float tmin = 0;
+        if (self >= 0 && triangle(self)) {
+            const Vec3& o = r.origin;
+            tmin = 1e-5f
+                   * std::max(1.0f, std::max(fabsf(o.x),
+                                             std::max(fabsf(o.y),
+                                                      fabsf(o.z))));
         }
-        for (int i = 0; i < nq; i++) {
-            Dual2<float> d = quads[i].intersect(r, self == (i + ns));
-            if (d.val() > 0 && d.val() < t.val()) {  // found valid hit?
+        bvh.intersect(r.origin, r.direction, t.val(), [&](int i, float& tmax) {
+            Dual2<float> d = visit(i, [&](const auto& prim) {
+                return prim.intersect(r, self == i);
+            });
+            // found valid hit? (ties go to the lowest ID, so the result
+            // doesn't depend on the traversal order)
+            if (d.val() > tmin
+                && (d.val() < t.val() || (d.val() == t.val() && i < primID))) {
                 t      = d;
-                primID = i + ns;
+                primID = i;
+                tmax   = d.val();
             }
-        }
+        });
         return primID >= 0;
     }
 
+    // Distance along the ray to this one primitive, or 0 if it misses it
+    Dual2<float> intersect_prim(const Ray& r, int primID) const
+    {
+        return visit(primID, [&](const auto& prim) {
+            return prim.intersect(r, false);
+        });
+    }
+
     Vec3 sample(int primID, const Vec3& x, float xi, float yi, float& pdf) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].sample(x, xi, yi, pdf);
-        primID -= spheres.size();
-        return quads[primID].sample(x, xi, yi, pdf);
+        return visit(primID, [&](const auto& prim) {
+            return prim.sample(x, xi, yi, pdf);
+        });
     }
 
     float shapepdf(int primID, const Vec3& x, const Vec3& p) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].shapepdf(x, p);
-        primID -= spheres.size();
-        return quads[primID].shapepdf(x, p);
+        return visit(primID,
+                     [&](const auto& prim) { return prim.shapepdf(x, p); });
     }
 
     float surfacearea(int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].surfacearea();
-        primID -= spheres.size();
-        return quads[primID].surfacearea();
+        return visit(primID,
+                     [&](const auto& prim) { return prim.surfacearea(); });
     }
 
     Dual2<Vec3> normal(const Dual2<Vec3>& p, int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].normal(p);
-        primID -= spheres.size();
-        return quads[primID].normal(p);
+        return visit(primID, [&](const auto& prim) { return prim.normal(p); });
+    }
+
+    // The true surface normal, which differs from normal() for meshes with
+    // vertex normals.
+    Vec3 geometric_normal(const Dual2<Vec3>& p, int primID) const
+    {
+        if (const Triangle* tri = triangle(primID))
+            return tri->geometric_normal();
+        return normal(p, primID).val();
     }
 
     Dual2<Vec2> uv(const Dual2<Vec3>& p, const Dual2<Vec3>& n, Vec3& dPdu,
                    Vec3& dPdv, int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].uv(p, n, dPdu, dPdv);
-        primID -= spheres.size();
-        return quads[primID].uv(p, n, dPdu, dPdv);
+        return visit(primID, [&](const auto& prim) {
+            return prim.uv(p, n, dPdu, dPdv);
+        });
     }
 
     int shaderid(int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].shaderid();
-        primID -= spheres.size();
-        return quads[primID].shaderid();
+        return visit(primID, [&](const auto& prim) { return prim.shaderid(); });
     }
 
     bool islight(int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].islight();
-        primID -= spheres.size();
-        return quads[primID].islight();
+        return visit(primID, [&](const auto& prim) { return prim.islight(); });
+    }
+
+    // The triangle with this ID, or nullptr if it isn't one
+    const Triangle* triangle(int primID) const
+    {
+        primID -= int(spheres.size() + quads.size());
+        return primID >= 0 ? &triangles[primID] : nullptr;
     }
 
     std::vector<Sphere> spheres;
     std::vector<Quad> quads;
+    std::vector<Triangle> triangles;
+    std::vector<std::unique_ptr<TriangleMesh>> meshes;
+    BVH bvh;
+
+private:
+    // Call f with the primitive with this ID
+    template<typename F> auto visit(int primID, F&& f) const
+    {
+        if (primID < int(spheres.size()))
+            return f(spheres[primID]);
+        primID -= spheres.size();
+        if (primID < int(quads.size()))
+            return f(quads[primID]);
+        primID -= quads.size();
+        return f(triangles[primID]);
+    }
 };
 
 OSL_NAMESPACE_EXIT
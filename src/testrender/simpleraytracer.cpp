@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <numeric>
+
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/parallel.h>
 
@@ -69,6 +71,9 @@ private:
 
 
 SimpleRaytracer::SimpleRaytracer()
+#if OSL_USE_BATCHED
+    : m_batch16(*this), m_batch8(*this), m_batch4(*this)
+#endif
 {
     m_errhandler.reset(new SimpleRaytracer::ErrorHandler(*this));
 
@@ -351,6 +356,30 @@ SimpleRaytracer::parse_scene_xml(const std::string& scenefile)
                 scene.add_quad(
                     Quad(co, ex, ey, int(shaders().size()) - 1, is_light));
             }
+        } else if (strcmp(node.name(), "Mesh") == 0) {
+            // load triangle mesh from an .obj or .ply file, relative paths
+            // are relative to the scene file
+            pugi::xml_attribute file_attr = node.attribute("filename");
+            if (file_attr) {
+                std::string filename = file_attr.value();
+                if (!OIIO::Filesystem::exists(filename)
+                    && OIIO::Strutil::ends_with(scenefile, ".xml")) {
+                    std::string dir = OIIO::Filesystem::parent_path(scenefile);
+                    if (dir.size())
+                        filename = dir + "/" + filename;
+                }
+                pugi::xml_attribute light_attr = node.attribute("is_light");
+                bool is_light = light_attr ? strtobool(light_attr.value())
+                                           : false;
+                std::unique_ptr<TriangleMesh> mesh(new TriangleMesh);
+                std::string err;
+                if (mesh->load(filename, err))
+                    scene.add_mesh(std::move(mesh), int(shaders().size()) - 1,
+                                   is_light);
+                else
+                    errhandler().errorfmt("Error reading mesh {}: {}",
+                                          filename, err);
+            }
         } else if (strcmp(node.name(), "Background") == 0) {
             pugi::xml_attribute res_attr = node.attribute("resolution");
             if (res_attr)
@@ -621,6 +650,14 @@ SimpleRaytracer::get_userdata(bool derivatives, ustringhash name, TypeDesc type,
         return true;
     }
 
+    // Meshes provide their per-vertex attributes, interpolated at P
+    if (auto rs = static_cast<const RenderState*>(sg->renderstate)) {
+        if (const Triangle* tri = scene.triangle(rs->primID))
+            return tri->attribute(name, type, derivatives,
+                                  Dual2<Vec3>(sg->P, sg->dPdx, sg->dPdy),
+                                  val);
+    }
+
     return false;
 }
 
@@ -810,8 +847,8 @@ SimpleRaytracer::get_camera_screen_window(ShaderGlobals* /*sg*/, bool derivs,
 
 
 void
-SimpleRaytracer::globals_from_hit(ShaderGlobals& sg, const Ray& r,
-                                  const Dual2<float>& t, int id)
+SimpleRaytracer::globals_from_hit(ShaderGlobals& sg, RenderState& rs,
+                                  const Ray& r, const Dual2<float>& t, int id)
 {
     memset((char*)&sg, 0, sizeof(ShaderGlobals));
     Dual2<Vec3> P = r.point(t);
@@ -820,7 +857,8 @@ SimpleRaytracer::globals_from_hit(ShaderGlobals& sg, const Ray& r,
     sg.dPdx       = P.dx();
     sg.dPdy       = P.dy();
     Dual2<Vec3> N = scene.normal(P, id);
-    sg.Ng = sg.N          = N.val();
+    sg.N                  = N.val();
+    sg.Ng                 = scene.geometric_normal(P, id);
     Dual2<Vec2> uv        = scene.uv(P, N, sg.dPdu, sg.dPdv, id);
     sg.u                  = uv.val().x;
     sg.dudx               = uv.dx().x;
@@ -833,7 +871,7 @@ SimpleRaytracer::globals_from_hit(ShaderGlobals& sg, const Ray& r,
     sg.I                  = direction.val();
     sg.dIdx               = direction.dx();
     sg.dIdy               = direction.dy();
-    sg.backfacing         = sg.N.dot(sg.I) > 0;
+    sg.backfacing         = sg.Ng.dot(sg.I) > 0;
     if (sg.backfacing) {
         sg.N  = -sg.N;
         sg.Ng = -sg.Ng;
@@ -841,26 +879,102 @@ SimpleRaytracer::globals_from_hit(ShaderGlobals& sg, const Ray& r,
     sg.raytype        = r.raytype;
     sg.flipHandedness = sg.dPdx.cross(sg.dPdy).dot(sg.N) < 0;
 
-    // In our SimpleRaytracer, the "renderstate" itself just a pointer to
-    // the ShaderGlobals.
-    sg.renderstate = &sg;
+    // In our SimpleRaytracer, the "renderstate" records which primitive is
+    // being shaded, so that userdata can be looked up on it.
+    rs.primID      = id;
+    sg.renderstate = &rs;
 }
 
-Vec3
-SimpleRaytracer::eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx,
-                                 int bounce)
+void
+SimpleRaytracer::globals_from_background(ShaderGlobals& sg,
+                                         const Dual2<Vec3>& dir, int bounce)
 {
-    ShaderGlobals sg;
     memset((char*)&sg, 0, sizeof(ShaderGlobals));
     sg.I    = dir.val();
     sg.dIdx = dir.dx();
     sg.dIdy = dir.dy();
     if (bounce >= 0)
         sg.raytype = bounce > 0 ? Ray::DIFFUSE : Ray::CAMERA;
+}
+
+Vec3
+SimpleRaytracer::eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx,
+                                 int bounce)
+{
+    ShaderGlobals sg;
+    globals_from_background(sg, dir, bounce);
     shadingsys->execute(*ctx, *m_shaders[backgroundShaderID], sg);
     return process_background_closure(sg.Ci);
 }
 
+// Run the shader of a light (for emissive closures only) at one point of
+// it, seen along a shadow ray from outside its bounds, in front of it or
+// behind it. Return false if no such point was found.
+bool
+SimpleRaytracer::eval_light(int id, bool back, ShadingContext* ctx,
+                            ShaderGlobals& sg, Color3& Le)
+{
+    BBox bounds    = scene.bounds(id);
+    Vec3 center    = bounds.center();
+    float size     = (bounds.max - bounds.min).length();
+    Vec3 n         = scene.geometric_normal(center + Vec3(0, size, 0), id);
+    Vec3 origin    = center + n * (back ? -size : size);
+    float pdf      = 0;
+    Vec3 dir       = scene.sample(id, origin, 0.5f, 0.5f, pdf);
+    Ray r          = Ray(origin, dir, 0, 0, Ray::SHADOW);
+    Dual2<float> t = scene.intersect_prim(r, id);
+    if (!(t.val() > 0))
+        return false;
+    RenderState rs;
+    globals_from_hit(sg, rs, r, t, id);
+    shadingsys->execute(*ctx, *m_shaders[scene.shaderid(id)], sg);
+    ShadingResult result;
+    process_closure(sg, result, sg.Ci, true);
+    sg.renderstate = nullptr;  // rs is going away
+    Le             = result.Le;
+    return true;
+}
+
+// Is a light shader's emission the same wherever the light is hit? It may
+// not read the position, direction or parameterization of the point, nor
+// any userdata or attributes, which can be per primitive. What's left (the
+// surface area and the side the light is seen from) is the same for all
+// the points of a primitive, or is accounted for by caching both sides.
+bool
+SimpleRaytracer::uniform_emission(ShaderGroup* group)
+{
+    const int varying = int(SGBits::P) | int(SGBits::I) | int(SGBits::N)
+                        | int(SGBits::Ng) | int(SGBits::u) | int(SGBits::v)
+                        | int(SGBits::dPdu) | int(SGBits::dPdv)
+                        | int(SGBits::Ps);
+    int globals_read       = varying;
+    int num_userdata       = 1;
+    int num_attributes     = 1;
+    int unknown_attributes = 1;
+    shadingsys->getattribute(group, "globals_read", globals_read);
+    shadingsys->getattribute(group, "num_userdata", num_userdata);
+    shadingsys->getattribute(group, "num_attributes_needed", num_attributes);
+    shadingsys->getattribute(group, "unknown_attributes_needed",
+                             unknown_attributes);
+    return !(globals_read & varying) && !num_userdata && !num_attributes
+           && !unknown_attributes;
+}
+
+// The emission of the light `id` hit by the shadow ray `r` at `t`, if
+// prepare_render cached it, or nullptr if its shader needs to be run.
+const Color3*
+SimpleRaytracer::cached_emission(const Ray& r, const Dual2<float>& t,
+                                 int id) const
+{
+    int light = lights.index(id);
+    if (light < 0 || m_light_emission.empty())
+        return nullptr;
+    Vec3 Ng                = scene.geometric_normal(r.point(t), id);
+    bool backfacing        = Ng.dot(r.direction) > 0;
+    const LightEmission& e = m_light_emission[light];
+    return e.cached[backfacing] ? &e.Le[backfacing] : nullptr;
+}
+
 Color3
 SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
                                    ShadingContext* ctx)
@@ -896,7 +1010,8 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
 
         // construct a shader globals for the hit point
         ShaderGlobals sg;
-        globals_from_hit(sg, r, t, id);
+        RenderState rs;
+        globals_from_hit(sg, rs, r, t, id);
         const float radius = r.radius + r.spread * t.val();
         int shaderID       = scene.shaderid(id);
         if (shaderID < 0 || !m_shaders[shaderID])
@@ -912,7 +1027,8 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
         float k = 1;
         if (scene.islight(id)) {
             // figure out the probability of reaching this point
-            float light_pdf = scene.shapepdf(id, r.origin, sg.P);
+            float light_pdf = scene.shapepdf(id, r.origin, sg.P)
+                              * lights.pdf(r.origin, id);
             k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(bsdf_pdf, light_pdf);
         }
         path_radiance += path_weight * k * result.Le;
@@ -959,18 +1075,18 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
             }
         }
 
-        // trace one ray to each light
-        for (int lid = 0; lid < scene.num_prims(); lid++) {
+        // trace one ray to each light, or to one picked at random
+        for (int i = 0, n = lights.samples(); i < n; i++) {
+            float lxi = xi;
+            float pick_pdf;
+            int lid = lights.pick(i, sg.P, lxi, pick_pdf);
             if (lid == id)
                 continue;  // skip self
-            if (!scene.islight(lid))
-                continue;  // doesn't want to be sampled as a light
             int shaderID = scene.shaderid(lid);
-            if (shaderID < 0 || !m_shaders[shaderID])
-                continue;  // no shader attached to this light
             // sample a random direction towards the object
             float light_pdf;
-            Vec3 ldir      = scene.sample(lid, sg.P, xi, yi, light_pdf);
+            Vec3 ldir = scene.sample(lid, sg.P, lxi, yi, light_pdf);
+            light_pdf *= pick_pdf;
             BSDF::Sample b = result.bsdf.eval(-sg.I, ldir);
             Color3 contrib = path_weight * b.weight
                              * MIS::power_heuristic<MIS::EVAL_WEIGHT>(light_pdf,
@@ -983,9 +1099,17 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
                 Dual2<float> shadow_dist;
                 if (scene.intersect(shadow_ray, shadow_dist, shadow_id)
                     && shadow_id == lid) {
+                    // reuse the light's emission if it doesn't vary
+                    if (const Color3* Le = cached_emission(shadow_ray,
+                                                           shadow_dist, lid)) {
+                        path_radiance += contrib * *Le;
+                        continue;
+                    }
                     // setup a shader global for the point on the light
                     ShaderGlobals light_sg;
-                    globals_from_hit(light_sg, shadow_ray, shadow_dist, lid);
+                    RenderState light_rs;
+                    globals_from_hit(light_sg, light_rs, shadow_ray,
+                                     shadow_dist, lid);
                     // execute the light shader (for emissive closures only)
                     shadingsys->execute(*ctx, *m_shaders[shaderID], light_sg);
                     ShadingResult light_result;
@@ -1014,19 +1138,27 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
     return path_radiance;
 }
 
+// Random offset of a sample from the center of its pixel
+static Vec3
+pixel_jitter(Sampler& sampler)
+{
+    // jitter pixel coordinate [0,1)^2
+    Vec3 j = sampler.get();
+    // warp distribution to approximate a tent filter [-1,+1)^2
+    j.x *= 2;
+    j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
+    j.y *= 2;
+    j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+    return j;
+}
+
 Color3
 SimpleRaytracer::antialias_pixel(int x, int y, ShadingContext* ctx)
 {
     Color3 result(0, 0, 0);
     for (int si = 0, n = aa * aa; si < n; si++) {
         Sampler sampler(x, y, si);
-        // jitter pixel coordinate [0,1)^2
-        Vec3 j = sampler.get();
-        // warp distribution to approximate a tent filter [-1,+1)^2
-        j.x *= 2;
-        j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
-        j.y *= 2;
-        j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+        Vec3 j = pixel_jitter(sampler);
         // trace eye ray (apply jitter from center of the pixel)
         Color3 r = subpixel_radiance(x + 0.5f + j.x, y + 0.5f + j.y, sampler,
                                      ctx);
@@ -1037,6 +1169,297 @@ SimpleRaytracer::antialias_pixel(int x, int y, ShadingContext* ctx)
 }
 
 
+// A path of the wavefront integrator, between bounces
+struct SimpleRaytracer::WavefrontPath {
+    WavefrontPath(const Ray& ray, const Sampler& sampler)
+        : ray(ray), sampler(sampler)
+    {
+    }
+
+    Ray ray;
+    Sampler sampler;
+    Color3 weight   = Color3(1, 1, 1);
+    Color3 radiance = Color3(0, 0, 0);
+    // camera ray has only one possible direction
+    float bsdf_pdf = std::numeric_limits<float>::infinity();
+    int prev_id    = -1;
+};
+
+// A point waiting to be shaded for one of the paths
+struct SimpleRaytracer::ShadeItem {
+    ShaderGlobals sg;
+    RenderState rs;
+    int shaderID;
+    int path;
+};
+
+
+
+// Shade the points of `items` through the queue, one shader group at a
+// time, calling done(i, item) for each as soon as its closures are ready.
+template<typename F>
+void
+SimpleRaytracer::shade_queued(ShadingContext* ctx, ShadingQueue& queue,
+                              std::vector<ShadeItem>& items, F&& done)
+{
+    queue.clear();
+    for (ShadeItem& item : items) {
+        item.sg.renderstate = &item.rs;
+        queue.push(m_shaders[item.shaderID].get(), item.sg);
+    }
+    queue.execute(*ctx, [&](size_t i, ShaderGlobals& sg, int /*lane*/) {
+        items[i].sg.Ci = sg.Ci;
+        done(int(i), items[i]);
+    });
+}
+
+
+
+// Trace all the samples of pixels [pbegin,pend) together. This follows
+// the same steps as subpixel_radiance, but each step is taken for every
+// path before moving on to the next, so that the points to shade in
+// between can be sorted by shader (and batched).
+void
+SimpleRaytracer::render_tile(int pbegin, int pend, int xres,
+                             ShadingContext* ctx, ShadingQueue& queue)
+{
+    const int nsamples = aa * aa;
+    std::vector<WavefrontPath> paths;
+    paths.reserve((pend - pbegin) * nsamples);
+    for (int p = pbegin; p < pend; ++p) {
+        const int x = p % xres, y = p / xres;
+        for (int si = 0; si < nsamples; si++) {
+            Sampler sampler(x, y, si);
+            Vec3 j = pixel_jitter(sampler);
+            paths.emplace_back(camera.get(x + 0.5f + j.x, y + 0.5f + j.y),
+                               sampler);
+        }
+    }
+
+    std::vector<int> active(paths.size()), next;
+    std::iota(active.begin(), active.end(), 0);
+    std::vector<ShadeItem> surfaces, backgrounds, emitters;
+    std::vector<float> radii;
+    std::vector<Color3> light_weights;
+    for (int b = 0; b <= max_bounces && !active.empty(); b++) {
+        const bool last_bounce = b == max_bounces;
+
+        // trace the rays against the scene, queuing up the hits to shade
+        surfaces.clear();
+        backgrounds.clear();
+        radii.clear();
+        for (int pi : active) {
+            WavefrontPath& path = paths[pi];
+            Dual2<float> t;
+            int id = path.prev_id;
+            if (!scene.intersect(path.ray, t, id)) {
+                // we hit nothing? check background shader
+                if (backgroundShaderID < 0)
+                    continue;
+                if (b > 0 && backgroundResolution > 0) {
+                    float bg_pdf = 0;
+                    Vec3 bg      = background.eval(path.ray.direction, bg_pdf);
+                    path.radiance += path.weight * bg
+                                     * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(
+                                         path.bsdf_pdf, bg_pdf);
+                } else {
+                    backgrounds.emplace_back();
+                    ShadeItem& item = backgrounds.back();
+                    globals_from_background(item.sg, path.ray.direction, b);
+                    item.shaderID = backgroundShaderID;
+                    item.path     = pi;
+                }
+                continue;
+            }
+            int shaderID = scene.shaderid(id);
+            if (shaderID < 0 || !m_shaders[shaderID])
+                continue;  // no shader attached? done
+            surfaces.emplace_back();
+            ShadeItem& item = surfaces.back();
+            globals_from_hit(item.sg, item.rs, path.ray, t, id);
+            item.shaderID = shaderID;
+            item.path     = pi;
+            radii.push_back(path.ray.radius + path.ray.spread * t.val());
+        }
+
+        // execute the shaders and process the resulting closures
+        shade_queued(ctx, queue, backgrounds, [&](int, const ShadeItem& item) {
+            WavefrontPath& path = paths[item.path];
+            path.radiance += path.weight
+                             * process_background_closure(item.sg.Ci);
+        });
+        std::unique_ptr<ShadingResult[]> results(
+            new ShadingResult[surfaces.size()]);
+        shade_queued(ctx, queue, surfaces, [&](int i, const ShadeItem& item) {
+            process_closure(item.sg, results[i], item.sg.Ci, last_bounce);
+        });
+
+        // sample the lights and the next direction of every path
+        next.clear();
+        emitters.clear();
+        light_weights.clear();
+        for (size_t i = 0; i < surfaces.size(); i++) {
+            const ShaderGlobals& sg = surfaces[i].sg;
+            const int id            = surfaces[i].rs.primID;
+            const float radius      = radii[i];
+            ShadingResult& result   = results[i];
+            WavefrontPath& path     = paths[surfaces[i].path];
+
+            // add self-emission
+            float k = 1;
+            if (scene.islight(id)) {
+                // figure out the probability of reaching this point
+                float light_pdf = scene.shapepdf(id, path.ray.origin, sg.P)
+                                  * lights.pdf(path.ray.origin, id);
+                k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(path.bsdf_pdf,
+                                                           light_pdf);
+            }
+            path.radiance += path.weight * k * result.Le;
+
+            // last bounce? nothing left to do
+            if (last_bounce)
+                continue;
+
+            // build internal pdf for sampling between bsdf closures
+            result.bsdf.prepare(-sg.I, path.weight, b >= rr_depth);
+
+            if (show_albedo_scale > 0) {
+                // Instead of path tracing, just visualize the albedo
+                // of the bsdf.
+                path.radiance += path.weight * result.bsdf.get_albedo(-sg.I)
+                                 * show_albedo_scale;
+                continue;
+            }
+
+            // get three random numbers
+            Vec3 s   = path.sampler.get();
+            float xi = s.x;
+            float yi = s.y;
+            float zi = s.z;
+
+            // trace one ray to the background
+            if (backgroundResolution > 0) {
+                Dual2<Vec3> bg_dir;
+                float bg_pdf   = 0;
+                Vec3 bg        = background.sample(xi, yi, bg_dir, bg_pdf);
+                BSDF::Sample b = result.bsdf.eval(-sg.I, bg_dir.val());
+                Color3 contrib = path.weight * b.weight * bg
+                                 * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(
+                                     bg_pdf, b.pdf);
+                if ((contrib.x + contrib.y + contrib.z) > 0) {
+                    int shadow_id  = id;
+                    Ray shadow_ray = Ray(sg.P, bg_dir.val(), radius, 0,
+                                         Ray::SHADOW);
+                    Dual2<float> shadow_dist;
+                    if (!scene.intersect(shadow_ray, shadow_dist, shadow_id))
+                        path.radiance += contrib;
+                }
+            }
+
+            // trace one ray to each light (or to one picked at random),
+            // queuing up the light shaders
+            for (int l = 0, n = lights.samples(); l < n; l++) {
+                float lxi = xi;
+                float pick_pdf;
+                int lid = lights.pick(l, sg.P, lxi, pick_pdf);
+                if (lid == id)
+                    continue;
+                int shaderID = scene.shaderid(lid);
+                float light_pdf;
+                Vec3 ldir = scene.sample(lid, sg.P, lxi, yi, light_pdf);
+                light_pdf *= pick_pdf;
+                BSDF::Sample b = result.bsdf.eval(-sg.I, ldir);
+                Color3 contrib = path.weight * b.weight
+                                 * MIS::power_heuristic<MIS::EVAL_WEIGHT>(
+                                     light_pdf, b.pdf);
+                if ((contrib.x + contrib.y + contrib.z) > 0) {
+                    Ray shadow_ray = Ray(sg.P, ldir, radius, 0, Ray::SHADOW);
+                    int shadow_id  = id;  // ignore self hit
+                    Dual2<float> shadow_dist;
+                    if (scene.intersect(shadow_ray, shadow_dist, shadow_id)
+                        && shadow_id == lid) {
+                        if (const Color3* Le
+                            = cached_emission(shadow_ray, shadow_dist, lid)) {
+                            path.radiance += contrib * *Le;
+                            continue;
+                        }
+                        emitters.emplace_back();
+                        ShadeItem& item = emitters.back();
+                        globals_from_hit(item.sg, item.rs, shadow_ray,
+                                         shadow_dist, lid);
+                        item.shaderID = shaderID;
+                        item.path     = surfaces[i].path;
+                        light_weights.push_back(contrib);
+                    }
+                }
+            }
+
+            // continue with the indirect ray
+            BSDF::Sample p = result.bsdf.sample(-sg.I, xi, yi, zi);
+            path.weight *= p.weight;
+            path.bsdf_pdf      = p.pdf;
+            path.ray.raytype   = Ray::DIFFUSE;
+            path.ray.direction = p.wi;
+            path.ray.radius    = radius;
+            path.ray.spread    = std::max(path.ray.spread, p.roughness);
+            if (!(path.weight.x > 0) && !(path.weight.y > 0)
+                && !(path.weight.z > 0))
+                continue;  // filter out all 0's or NaNs
+            path.prev_id    = id;
+            path.ray.origin = sg.P;
+            next.push_back(surfaces[i].path);
+        }
+
+        // execute the light shaders (for emissive closures only)
+        shade_queued(ctx, queue, emitters, [&](int i, const ShadeItem& item) {
+            ShadingResult light_result;
+            process_closure(item.sg, light_result, item.sg.Ci, true);
+            paths[item.path].radiance += light_weights[i] * light_result.Le;
+        });
+        std::swap(active, next);
+    }
+
+    // Mix the samples of each pixel in the same order antialias_pixel does
+    for (int p = pbegin; p < pend; ++p) {
+        Color3 result(0, 0, 0);
+        for (int si = 0; si < nsamples; si++)
+            result = OIIO::lerp(result,
+                                paths[(p - pbegin) * nsamples + si].radiance,
+                                1.0f / (si + 1));
+        pixelbuf.setpixel(p % xres, p / xres, &result.x, 3);
+    }
+}
+
+
+
+void
+SimpleRaytracer::render_wavefront(int xres, int yres)
+{
+    // Tiles of about a thousand paths keep enough points to fill the
+    // batches, without needing much memory per thread.
+    const int tile_pixels = std::max(1, 1024 / (aa * aa));
+    const int npixels     = xres * yres;
+    const int ntiles      = (npixels + tile_pixels - 1) / tile_pixels;
+
+    ShadingSystem* shadingsys = this->shadingsys;
+    OIIO::parallel_for_chunked(
+        0, ntiles, 0, [&, this](int64_t tbegin, int64_t tend) {
+            // One context and queue per thread, reused for all of its tiles
+            OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
+
+            ShadingContext* ctx = shadingsys->get_context(thread_info);
+            ShadingQueue queue(*shadingsys, batch_size);
+
+            for (int64_t tile = tbegin; tile < tend; ++tile)
+                render_tile(int(tile * tile_pixels),
+                            std::min(npixels, int((tile + 1) * tile_pixels)),
+                            xres, ctx, queue);
+            shadingsys->release_context(ctx);
+            shadingsys->destroy_thread_info(thread_info);
+        });
+}
+
+
 void
 SimpleRaytracer::prepare_render()
 {
@@ -1045,6 +1468,64 @@ SimpleRaytracer::prepare_render()
     max_bounces       = options.get_int("max_bounces");
     rr_depth          = options.get_int("rr_depth");
     show_albedo_scale = options.get_float("show_albedo_scale");
+    batch_size        = options.get_int("batch_size");
+    deferred          = options.get_int("deferred");
+    light_sampling    = OIIO::clamp(options.get_int("light_sampling"), 0, 2);
+
+    // build the acceleration structure for ray intersection
+    scene.prepare();
+
+    // gather the lights (primitives that want to be sampled as lights and
+    // have a shader)
+    std::vector<int> light_prims;
+    std::vector<BBox> light_bounds;
+    std::vector<float> light_power;
+    for (int id = 0, n = scene.num_prims(); id < n; id++) {
+        int shaderID = scene.shaderid(id);
+        if (scene.islight(id) && shaderID >= 0 && m_shaders[shaderID]) {
+            light_prims.push_back(id);
+            light_bounds.push_back(scene.bounds(id));
+        }
+    }
+
+    // cache the emission of the lights that don't vary over their surface,
+    // and estimate the power of all of them if they are picked by it
+    m_light_emission.clear();
+    m_light_emission.resize(light_prims.size());
+    if (!light_prims.empty()) {
+        OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
+        ShadingContext* ctx             = shadingsys->get_context(thread_info);
+        std::vector<int> uniform(m_shaders.size(), -1);  // by shaderID
+        for (size_t i = 0; i < light_prims.size(); i++) {
+            const int id       = light_prims[i];
+            const int shaderID = scene.shaderid(id);
+            if (uniform[shaderID] < 0)
+                uniform[shaderID] = uniform_emission(m_shaders[shaderID].get());
+            float power = 0;
+            for (int back = 0; back < 2; back++) {
+                if (!uniform[shaderID]
+                    && (back || light_sampling == LightSampler::ALL))
+                    continue;
+                ShaderGlobals sg;
+                Color3 Le;
+                if (!eval_light(id, back, ctx, sg, Le))
+                    continue;
+                if (uniform[shaderID]) {
+                    m_light_emission[i].Le[sg.backfacing]     = Le;
+                    m_light_emission[i].cached[sg.backfacing] = true;
+                }
+                // radiance times area (the solid angle factor is about the
+                // same for all)
+                if (!back)
+                    power = (Le.x + Le.y + Le.z) * scene.surfacearea(id);
+            }
+            light_power.push_back(power);
+        }
+        shadingsys->release_context(ctx);
+        shadingsys->destroy_thread_info(thread_info);
+    }
+    lights.build(LightSampler::Mode(light_sampling), scene.num_prims(),
+                 light_prims, light_bounds, std::move(light_power));
 
     // prepare background importance table (if requested)
     if (backgroundResolution > 0 && backgroundShaderID >= 0) {
@@ -1072,6 +1553,8 @@ SimpleRaytracer::prepare_render()
 void
 SimpleRaytracer::render(int xres, int yres)
 {
+    if (deferred || batch_size)
+        return render_wavefront(xres, yres);
     ShadingSystem* shadingsys = this->shadingsys;
     OIIO::parallel_for_chunked(
         0, yres, 0, [&, this](int64_t ybegin, int64_t yend) {
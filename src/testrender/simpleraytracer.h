@@ -12,10 +12,16 @@
 
 #include <OSL/oslexec.h>
 #include <OSL/rendererservices.h>
+#include <OSL/shadingqueue.h>
 #include "background.h"
+#include "lights.h"
 #include "raytracer.h"
 #include "sampling.h"
 
+#if OSL_USE_BATCHED
+#    include "batched_raytracer.h"
+#endif
+
 
 OSL_NAMESPACE_ENTER
 
@@ -92,14 +98,36 @@ public:
 
     OIIO::ErrorHandler& errhandler() const { return *m_errhandler; }
 
+#if OSL_USE_BATCHED
+    BatchedRendererServices<16>* batched(WidthOf<16>) override
+    {
+        return &m_batch16;
+    }
+    BatchedRendererServices<8>* batched(WidthOf<8>) override
+    {
+        return &m_batch8;
+    }
+    BatchedRendererServices<4>* batched(WidthOf<4>) override
+    {
+        return &m_batch4;
+    }
+#endif
+
     Camera camera;
     Scene scene;
     Background background;
+    LightSampler lights;
     ShadingSystem* shadingsys = nullptr;
     OIIO::ParamValueList options;
     OIIO::ImageBuf pixelbuf;
 
 private:
+#if OSL_USE_BATCHED
+    BatchedRaytracer<16> m_batch16;
+    BatchedRaytracer<8> m_batch8;
+    BatchedRaytracer<4> m_batch4;
+#endif
+
     // Camera parameters
     Matrix44 m_world_to_camera;
     ustringhash m_projection;
@@ -113,8 +141,20 @@ private:
     int max_bounces          = 1000000;
     int rr_depth             = 5;
     float show_albedo_scale  = 0.0f;
+    int batch_size           = 0;      // 0: shade one point at a time
+    bool deferred            = false;  // use the wavefront integrator
+    int light_sampling       = 0;      // LightSampler::Mode
     std::vector<ShaderGroupRef> m_shaders;
 
+    // Emission of the lights seen from the front and from the back, for the
+    // lights whose emission is the same wherever they are hit. Indexed like
+    // the LightSampler.
+    struct LightEmission {
+        Color3 Le[2];
+        bool cached[2] = { false, false };
+    };
+    std::vector<LightEmission> m_light_emission;
+
     class ErrorHandler;  // subclass ErrorHandler for SimpleRaytracer
     std::unique_ptr<OIIO::ErrorHandler> m_errhandler;
     bool m_had_error = false;
@@ -168,15 +208,41 @@ private:
                                   ustringhash object, TypeDesc type,
                                   ustringhash name, void* val);
 
+    // What the CPU renderer knows about the point being shaded; the
+    // ShaderGlobals renderstate points to one of these.
+    struct RenderState {
+        int primID = -1;
+    };
+
     // CPU renderer helpers
-    void globals_from_hit(ShaderGlobals& sg, const Ray& r,
+    void globals_from_hit(ShaderGlobals& sg, RenderState& rs, const Ray& r,
                           const Dual2<float>& t, int id);
+    void globals_from_background(ShaderGlobals& sg, const Dual2<Vec3>& dir,
+                                 int bounce);
     Vec3 eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx,
                          int bounce = -1);
+    bool eval_light(int id, bool back, ShadingContext* ctx, ShaderGlobals& sg,
+                    Color3& Le);
+    bool uniform_emission(ShaderGroup* group);
+    const Color3* cached_emission(const Ray& r, const Dual2<float>& t,
+                                  int id) const;
     Color3 subpixel_radiance(float x, float y, Sampler& sampler,
                              ShadingContext* ctx);
     Color3 antialias_pixel(int x, int y, ShadingContext* ctx);
 
+    // Wavefront integrator: paths are traced a tile at a time, one bounce
+    // for all of them at once, and the points they hit are shaded through
+    // a ShadingQueue, one shader group at a time (in batches of batch_size
+    // if it is set).
+    struct WavefrontPath;
+    struct ShadeItem;
+    void render_wavefront(int xres, int yres);
+    void render_tile(int pbegin, int pend, int xres, ShadingContext* ctx,
+                     ShadingQueue& queue);
+    template<typename F>
+    void shade_queued(ShadingContext* ctx, ShadingQueue& queue,
+                      std::vector<ShadeItem>& items, F&& done);
+
     friend class ErrorHandler;
 };
 
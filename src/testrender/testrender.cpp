@@ -41,6 +41,8 @@ static bool runstats             = false;
 static bool saveptx              = false;
 static bool warmup               = false;
 static bool profile              = false;
+static bool batched              = false;
+static bool deferred             = false;
 static bool O0 = false, O1 = false, O2 = false;
 static int llvm_opt              = 1;  // LLVM optimization level
 static bool debugnan             = false;
@@ -52,9 +54,12 @@ static int xres = 640, yres = 480;
 static int aa = 1, max_bounces = 1000000, rr_depth = 5;
 static float show_albedo_scale = 0.0f;
 static int num_threads         = 0;
+static int batch_size          = 0;
+static int light_sampling      = -1;  // -1: as the scene says
 static int iters               = 1;
 static std::string scenefile, imagefile;
 static std::string shaderpath;
+static std::string lightmode;
 static bool shadingsys_options_set = false;
 static bool use_optix              = OIIO::Strutil::stoi(
     OIIO::Sysutil::getenv("TESTSHADE_OPTIX"));
@@ -176,6 +181,13 @@ getargs(int argc, const char* argv[])
       .help("Visualize the albedo of each pixel instead of path tracing");
     ap.arg("--iters %d:N", &iters)
       .help("Number of iterations");
+    ap.arg("--deferred", &deferred)
+      .help("Trace paths in tiles and shade their hits sorted by shader");
+    ap.arg("--batched", &batched)
+      .help("Trace paths in tiles and shade their hits in batches");
+    ap.arg("--lights %s:MODE", &lightmode)
+      .help("Lights to sample at each shading point: all (default), "
+            "power (one, picked by power), tree (one, picked with a light BVH)");
     ap.arg("-O0", &O0)
       .help("Do no runtime shader optimization");
     ap.arg("-O1", &O1)
@@ -228,6 +240,18 @@ getargs(int argc, const char* argv[])
         ap.usage();
         exit(EXIT_FAILURE);
     }
+    if (lightmode.size()) {
+        // in the order of LightSampler::Mode
+        static const char* modes[] = { "all", "power", "tree" };
+        auto mode = std::find(std::begin(modes), std::end(modes), lightmode);
+        if (mode == std::end(modes)) {
+            std::cerr << "testrender: Unknown light sampling mode \""
+                      << lightmode << "\"\n\n";
+            ap.usage();
+            exit(EXIT_FAILURE);
+        }
+        light_sampling = int(mode - std::begin(modes));
+    }
 }
 
 }  // anonymous namespace
@@ -265,6 +289,11 @@ main(int argc, const char* argv[])
         OIIO::Sysutil::getenv("TESTRENDER_AA"));
     if (aaoverride)
         aa = aaoverride;
+    // Likewise TESTSHADE_BATCHED, set by the testsuite's batched variants,
+    // turns on --batched, so that tests with a BATCHED marker file render
+    // their scene in batches against the same reference image.
+    if (OIIO::Strutil::stoi(OIIO::Sysutil::getenv("TESTSHADE_BATCHED")))
+        batched = true;
 
     SimpleRaytracer* rend = nullptr;
 #if OSL_USE_OPTIX
@@ -281,6 +310,9 @@ main(int argc, const char* argv[])
     rend->attribute("rr_depth", rr_depth);
     rend->attribute("aa", aa);
     rend->attribute("show_albedo_scale", show_albedo_scale);
+    rend->attribute("deferred", (int)deferred);
+    if (light_sampling >= 0)
+        rend->attribute("light_sampling", light_sampling);
     OIIO::attribute("threads", num_threads);
 
 #if OSL_USE_OPTIX
@@ -304,6 +336,30 @@ main(int argc, const char* argv[])
     // Setup common attributes
     set_shadingsys_options();
 
+    if (batched && !use_optix) {
+#if OSL_USE_BATCHED
+        if (shadingsys->configure_batch_execution_at(16))
+            batch_size = 16;
+        else if (shadingsys->configure_batch_execution_at(8))
+            batch_size = 8;
+        else if (shadingsys->configure_batch_execution_at(4))
+            batch_size = 4;
+        else
+            rend->errhandler().warningfmt(
+                "Hardware or library requirements to utilize batched "
+                "execution are not met, tracing paths one at a time");
+#else
+        rend->errhandler().warningfmt(
+            "OSL was built without batched execution, tracing paths one "
+            "at a time");
+#endif
+    }
+    if (!batch_size) {
+        // Batched analysis is only useful when shading in batches
+        shadingsys->attribute("opt_batched_analysis", 0);
+    }
+    rend->attribute("batch_size", batch_size);
+
 #if OSL_USE_OPTIX
     if (use_optix)
         reinterpret_cast<OptixRaytracer*>(rend)->synch_attributes();
@@ -78,6 +78,7 @@ static int llvm_opt              = 1;  // LLVM optimization level
 static bool pixelcenters         = false;
 static bool debugnan             = false;
 static bool debug_uninit         = false;
+static bool fuse_layers          = false;
 static bool use_group_outputs    = false;
 static bool do_oslquery          = false;
 static bool print_groupdata      = false;
@@ -118,6 +119,9 @@ static OSL::Matrix44 Mshad;  // "shader" space to "common" space matrix
 static OSL::Matrix44 Mobj;   // "object" space to "common" space matrix
 static ShaderGroupRef shadergroup;
 static std::string archivegroup;
+static std::string profile_report_file;
+static std::string stats_json_file;
+static std::string preload_shaders;
 static int exprcount               = 0;
 static bool shadingsys_options_set = false;
 static float uscale = 1, vscale = 1;
@@ -254,6 +258,9 @@ set_shadingsys_options()
     shadingsys->attribute("profile", int(profile));
     shadingsys->attribute("debug_nan", debugnan);
     shadingsys->attribute("debug_uninit", debug_uninit);
+    if (const char* fuse_env = getenv("TESTSHADE_FUSE_LAYERS"))
+        fuse_layers = atoi(fuse_env);
+    shadingsys->attribute("llvm_fuse_layers", int(fuse_layers));
     shadingsys->attribute("userdata_isconnected", userdata_isconnected);
 
     // build searchpath for ISA specific OSL shared libraries based on expected
@@ -306,6 +313,9 @@ set_shadingsys_options()
         } else if ((!batch_size_requested || batch_size == 8)
                    && shadingsys->configure_batch_execution_at(8)) {
             batch_size = 8;
+        } else if ((!batch_size_requested || batch_size == 4)
+                   && shadingsys->configure_batch_execution_at(4)) {
+            batch_size = 4;
         } else {
             OSL::print(
                 "WARNING:  Hardware or library requirements to utilize batched execution");
@@ -817,12 +827,20 @@ getargs(int argc, const char* argv[])
       .help("Turn on 'debug_nan' mode");
     ap.arg("--debuguninit", &debug_uninit)
       .help("Turn on 'debug_uninit' mode");
+    ap.arg("--fuse-layers", &fuse_layers)
+      .help("Fuse the group's layers into one function (llvm_fuse_layers)");
     ap.arg("--groupoutputs", &use_group_outputs)
       .help("Specify group outputs, not global outputs");
     ap.arg("--oslquery", &do_oslquery)
       .help("Test OSLQuery at runtime");
     ap.arg("--print-groupdata", &print_groupdata)
         .help("Print groupdata size to stdout");
+    ap.arg("--profile-report %s:FILENAME", &profile_report_file)
+      .help("Write the group's profile_layers report (JSON) to a file");
+    ap.arg("--stats-json %s:FILENAME", &stats_json_file)
+      .help("Write the shading system's statistics (JSON) to a file");
+    ap.arg("--load-shaders %s:NAMES", &preload_shaders)
+      .help("Load these shaders (comma-separated) in parallel first");
     ap.arg("--inbuffer", &inbuffer)
       .help("Compile osl source from and to jbuffer");
     ap.arg("--no-output-placement")
@@ -1194,9 +1212,11 @@ setup_output_images(SimpleRenderer* rend, ShadingSystem* shadingsys,
             // jit_group will optimize the group if necesssary
             if (batch_size == 16) {
                 shadingsys->batched<16>().jit_group(shadergroup.get(), ctx);
-            } else {
-                ASSERT((batch_size == 8) && "Unsupported batch size");
+            } else if (batch_size == 8) {
                 shadingsys->batched<8>().jit_group(shadergroup.get(), ctx);
+            } else {
+                ASSERT((batch_size == 4) && "Unsupported batch size");
+                shadingsys->batched<4>().jit_group(shadergroup.get(), ctx);
             }
         } else
 #endif
@@ -2008,6 +2028,17 @@ test_shade(int argc, const char* argv[])
     // line arguments, whereas the connections accumulate and have
     // to be processed at the end.  Bear with us.
 
+    // Load any shaders asked for up front, all at once.
+    if (preload_shaders.size()) {
+        set_shadingsys_options();
+        std::vector<ustring> names;
+        for (auto&& n : OIIO::Strutil::splitsv(preload_shaders, ","))
+            names.emplace_back(n);
+        int nloaded = shadingsys->load_shaders(names);
+        std::cout << "Loaded " << nloaded << " of " << names.size()
+                  << " shaders\n";
+    }
+
     // Start the shader group and grab a reference to it.
     shadergroup = shadingsys->ShaderGroupBegin(groupname);
 
@@ -2195,13 +2226,19 @@ test_shade(int argc, const char* argv[])
                             batched_shade_region<16>(rend, shadergroup.get(),
                                                      sub_roi, save);
                         });
-                } else {
-                    ASSERT((batch_size == 8) && "Unsupported batch size");
+                } else if (batch_size == 8) {
                     OIIO::ImageBufAlgo::parallel_image(
                         roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
                             batched_shade_region<8>(rend, shadergroup.get(),
                                                     sub_roi, save);
                         });
+                } else {
+                    ASSERT((batch_size == 4) && "Unsupported batch size");
+                    OIIO::ImageBufAlgo::parallel_image(
+                        roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
+                            batched_shade_region<4>(rend, shadergroup.get(),
+                                                    sub_roi, save);
+                        });
                 }
             } else
 #    endif
@@ -2310,6 +2347,19 @@ test_shade(int argc, const char* argv[])
         std::cout << "Groupdata size: " << groupdata_size << "\n";
     }
 
+    if (profile_report_file.size()) {
+        ustring report;
+        shadingsys->getattribute(shadergroup.get(), "profile_report",
+                                 TypeDesc::STRING, &report);
+        std::ofstream file(profile_report_file);
+        file << report << "\n";
+    }
+
+    if (stats_json_file.size()) {
+        std::ofstream file(stats_json_file);
+        file << shadingsys->getstats_json() << "\n";
+    }
+
 
     // Give the renderer a chance to do initial cleanup while everything is still alive
     rend->clear();
@@ -0,0 +1,46 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Given the output of a first and a second testshade run (with --runstats)
+# that share a JIT cache directory, check that the second run found the
+# group in the cache, and that both shaded the same. Print what the shader
+# printed, which is the same from run to run.
+
+from __future__ import print_function
+import re
+import sys
+
+def read_run(filename):
+    shaded, stats = [], ""
+    lines = open(filename).read().splitlines()
+    for i, line in enumerate(lines):
+        if line.startswith("Setup : "):
+            stats = "\n".join(lines[i:])
+            break
+        shaded.append(line)
+    while shaded and not shaded[-1]:
+        shaded.pop()
+    hits = re.search(r"LLVM JIT object cache: (\d+) hits, (\d+) misses", stats)
+    return shaded, hits
+
+ok = True
+first, first_hits = read_run(sys.argv[1])
+second, second_hits = read_run(sys.argv[2])
+if not first_hits or not second_hits:
+    print("No JIT cache statistics")
+    ok = False
+else:
+    if int(first_hits.group(1)) != 0 or int(first_hits.group(2)) == 0:
+        print("First run should have missed the cache:", first_hits.group(0))
+        ok = False
+    if int(second_hits.group(1)) == 0:
+        print("Second run should have hit the cache:", second_hits.group(0))
+        ok = False
+if first != second:
+    print("The cached code shaded differently")
+    ok = False
+print("\n".join(second))
+sys.exit(0 if ok else 1)
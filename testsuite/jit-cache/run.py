@@ -0,0 +1,16 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Shade the same group twice, in two processes sharing a JIT cache
+# directory: the first run fills the cache, the second must load the
+# group's code from it and shade just the same.
+import shutil
+shutil.rmtree("jitcache", ignore_errors=True)
+
+args = "-g 2 2 --runstats --options llvm_jit_cache_dir=jitcache test"
+command  = osl_app("testshade") + " " + args + " > run1.txt 2>&1 ;\n"
+command += osl_app("testshade") + " " + args + " > run2.txt 2>&1 ;\n"
+command += pythonbin + " data/check_jit_cache.py run1.txt run2.txt >> out.txt ;\n"
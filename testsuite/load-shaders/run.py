@@ -0,0 +1,16 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Load all the masters at once on the thread pool, some of them asked for
+# twice, then chain them: ((1 + 2) * 2 + 4) * 3 = 30
+command += testshade("-g 1 1 --load-shaders a,b,c,d,e,f,a,c,e "
+                     + "-layer la a -layer lb b -layer lc c "
+                     + "-layer ld d -layer le e -layer lf f "
+                     + "--connect la f_out lb f_in "
+                     + "--connect lb f_out lc f_in "
+                     + "--connect lc f_out ld f_in "
+                     + "--connect ld f_out le f_in "
+                     + "--connect le f_out lf f_in")
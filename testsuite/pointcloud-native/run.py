@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Write a 3x3 grid of points to a native .oslpc point cloud (saved when
+# testshade exits), then look them up from the corners of the grid. The
+# native format doesn't need Partio, so neither does this test.
+command  = testshade("-g 3 3 wrcloud")
+command += testshade("-g 2 2 rdcloud")
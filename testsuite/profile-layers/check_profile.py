@@ -0,0 +1,25 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Print the call counts of a profile_layers report, which are the same
+# from run to run, and check that every counted slot took some cycles.
+
+from __future__ import print_function
+import json
+import sys
+
+report = json.load(open(sys.argv[1]))
+for group in report["groups"]:
+    print("group", group["name"])
+    for layer in group["layers"]:
+        calls = layer["calls"]
+        cycles = layer["cycles"]
+        counted = [c for c in sorted(calls) if calls[c]]
+        print("  layer {} ({}): {}".format(layer["name"], layer["shader"],
+              ", ".join("{} {}".format(c, calls[c]) for c in counted)))
+        for c in counted:
+            if cycles[c] <= 0:
+                print("    no cycles counted for", c)
@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Each of the 4 points runs both layers, one noise and one texture call
+command += testshade("-g 2 2 --groupname profiled --options profile_layers=1 "
+                     + "--profile-report profile.json "
+                     + "-layer alayer a --layer blayer b "
+                     + "--connect alayer f_out blayer f_in")
+command += pythonbin + " data/check_profile.py profile.json >> out.txt ;\n"
@@ -0,0 +1,18 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Fail unless every .oso named on the command line is a binary one.
+
+from __future__ import print_function
+import sys
+
+ok = True
+for filename in sys.argv[1:]:
+    with open(filename, "rb") as f:
+        if f.read(8) != b"OSOBIN\x00\x01":
+            print(filename, "is not a binary .oso")
+            ok = False
+sys.exit(0 if ok else 1)
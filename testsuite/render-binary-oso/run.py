@@ -0,0 +1,18 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The render-uv scene, with its shaders compiled to binary .oso files. It
+# must render just like the text ones do.
+oslcargs = "-Wall -binary"
+
+failthresh = 0.013
+failpercent = 1
+allowfailures = 3
+idiff_program = "idiff"
+
+outputs = [ "out.exr" ]
+command = pythonbin + " data/check_binary.py emitter.oso matte.oso tex_matte.oso uv.oso >> out.txt ;\n"
+command += testrender("-r 320 240 -aa 8 scene.xml out.exr")
@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Same scene and reference as render-bumptest, but shading the hits sorted
+# by shader, through a ShadingQueue.
+failthresh = 0.01
+failpercent = 0.5
+hardfail = 0.035
+
+outputs = [ "out.exr" ]
+command = testrender("-r 256 256 -aa 4 --deferred bumptest.xml out.exr")
@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# A binary PLY quad with per-vertex colors (and an extra float property),
+# which the shader picks up as userdata
+outputs = [ "out.tif" ]
+# Render the scene from the source directory, where quad.ply is
+command = testrender("-r 16 16 -aa 1 data/scene.xml out.tif")
@@ -0,0 +1,19 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# render-veachmis's scene, sampling one light per shading point, picked by
+# power or with the light BVH, rather than all four. Both converge to the
+# same image as sampling all of them, so they are checked against the
+# render-veachmis reference, with more samples and more slack for the
+# extra noise of picking a single light.
+failthresh = 0.02
+failpercent = 2
+hardfail = 0.5
+allowfailures = 100
+
+outputs = [ "out-power.exr", "out-tree.exr" ]
+command  = testrender("-r 320 240 -aa 8 --lights power veach.xml out-power.exr")
+command += testrender("-r 320 240 -aa 8 --lights tree veach.xml out-tree.exr")
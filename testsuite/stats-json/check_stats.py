@@ -0,0 +1,45 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Parse the JSON written by getstats_json, check that it has the shading
+# system's stats and every per-group key, and print the values that are
+# the same from run to run.
+
+from __future__ import print_function
+import json
+import sys
+
+group_keys = [ "id", "name", "layers", "optimized", "jitted", "shared_code",
+               "executions", "optimization_time", "llvm_irgen_time",
+               "llvm_opt_time", "llvm_jit_time", "preopt_ops", "postopt_ops",
+               "preopt_syms", "postopt_syms", "groupdata_size" ]
+
+ok = True
+report = json.load(open(sys.argv[1]))
+print("osl_version is a string:",
+      isinstance(report["osl_version"], type(u"")))
+stats = report["stats"]
+for key in [ "shading_time", "layers_executed", "groups_compiled" ]:
+    if key not in stats:
+        print("missing stat", key)
+        ok = False
+for group in report["groups"]:
+    if group["name"] != sys.argv[2]:
+        continue
+    missing = [k for k in group_keys if k not in group]
+    extra = [k for k in group if k not in group_keys]
+    if missing or extra:
+        print("group keys missing:", missing, "unexpected:", extra)
+        ok = False
+    print("group", group["name"])
+    print("  layers", group["layers"])
+    print("  optimized", group["optimized"])
+    print("  ops before optimization", group["preopt_ops"] > 0)
+    break
+else:
+    print("no group named", sys.argv[2])
+    ok = False
+sys.exit(0 if ok else 1)
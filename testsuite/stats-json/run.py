@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Write the shading system's statistics as JSON (getstats_json) and check
+# its stats and the keys of the group's entry
+command += testshade("-g 2 2 --groupname statsgroup --stats-json stats.json "
+                     + "-layer alayer a --layer blayer b "
+                     + "--connect alayer f_out blayer f_in")
+command += pythonbin + " data/check_stats.py stats.json statsgroup >> out.txt ;\n"